@@ -146,6 +146,10 @@ struct
      for signing operations.  */
   int ignore_cache_for_signing;
 
+  /* If this global option is true, keys unprotected with a cached
+     passphrase are kept in the cache along with that passphrase.  */
+  int cache_unprotected_keys;
+
   /* If this global option is true, the user is allowed to
      interactively mark certificate in trustlist.txt as trusted. */
   int allow_mark_trusted;
@@ -391,6 +395,8 @@ void agent_exit (int rc)
 void agent_set_progress_cb (void (*cb)(ctrl_t ctrl, const char *what,
                                        int printchar, int current, int total),
                             ctrl_t ctrl);
+void agent_dispatch_progress (const char *what, int printchar,
+                              int current, int total);
 gpg_error_t agent_copy_startup_env (ctrl_t ctrl);
 const char *get_agent_socket_name (void);
 const char *get_agent_ssh_socket_name (void);
@@ -459,6 +465,8 @@ gpg_error_t agent_public_key_from_file (ctrl_t ctrl,
                                         const unsigned char *grip,
                                         gcry_sexp_t *result);
 int agent_pk_get_algo (gcry_sexp_t s_key);
+void agent_update_key_index (void);
+int agent_key_available_indexed (const unsigned char *grip);
 int agent_key_available (const unsigned char *grip);
 gpg_error_t agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
                                       int *r_keytype,
@@ -500,6 +508,12 @@ void agent_flush_cache (int pincache_only);
 int agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
                      const char *data, int ttl);
 char *agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode);
+void agent_put_cache_key (ctrl_t ctrl, const char *key,
+                          cache_mode_t cache_mode,
+                          const unsigned char *keybuf);
+unsigned char *agent_get_cache_key (ctrl_t ctrl, const char *key,
+                                    cache_mode_t cache_mode);
+void agent_forget_cache_key (const char *key);
 void agent_store_cache_hit (const char *key);
 
 
@@ -512,6 +526,11 @@ gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           const char *desc_text,
                           membuf_t *outbuf, cache_mode_t cache_mode);
+gpg_error_t agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                                const char *desc_text,
+                                const unsigned char *digests,
+                                size_t digestslen,
+                                membuf_t *outbuf, cache_mode_t cache_mode);
 
 /*-- pkdecrypt.c --*/
 int agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
@@ -672,4 +691,17 @@ gpg_error_t fixup_when_ecc_private_key (unsigned char *buf, size_t *buflen_p);
 gpg_error_t sexp_sscan_private_key (gcry_sexp_t *result, size_t *r_erroff,
                                     unsigned char *buf);
 
+/*-- worker.c --*/
+void initialize_module_worker (unsigned int nthreads);
+void agent_run_job (void (*fnc)(void *opaque), void *opaque);
+gpg_error_t worker_pk_sign (gcry_sexp_t *r_sig,
+                            gcry_sexp_t s_hash, gcry_sexp_t s_skey);
+gpg_error_t worker_pk_verify (gcry_sexp_t s_sig,
+                              gcry_sexp_t s_hash, gcry_sexp_t s_pkey);
+gpg_error_t worker_pk_decrypt (gcry_sexp_t *r_plain,
+                               gcry_sexp_t s_cipher, gcry_sexp_t s_skey);
+gpg_error_t worker_pk_genkey (gcry_sexp_t *r_key, gcry_sexp_t s_parms);
+void worker_store_progress (const char *what, int printchar,
+                            int current, int total);
+
 #endif /*AGENT_H*/
@@ -34,8 +34,21 @@
 /* The size of the encryption key in bytes.  */
 #define ENCRYPTION_KEYSIZE (128/8)
 
-/* A mutex used to serialize access to the cache.  */
-static npth_mutex_t cache_lock;
+/* The number of hash buckets and the number of locks protecting
+ * them.  Bucket N is protected by the lock of stripe N % CACHE_STRIPES
+ * so that CACHE_BUCKETS must be a multiple of CACHE_STRIPES.  */
+#define CACHE_BUCKETS 1024
+#define CACHE_STRIPES 16
+
+/* The number of slots in the timer wheel of a stripe.  Each slot
+ * covers one second.  */
+#define WHEEL_SLOTS 256
+
+/* Items without data are removed after this many seconds.  */
+#define UNUSED_ITEM_TTL (60*30)
+
+/* A mutex used to serialize access to the encryption context.  */
+static npth_mutex_t encryption_lock;
 /* The encryption context.  This is the only place where the
    encryption key for all cached entries is available.  It would be nice
    to keep this (or just the key) in some hardware device, for example
@@ -56,18 +69,46 @@ struct secret_data_s {
 /* The cache object.  */
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;     /* The next item in the same hash bucket.  */
+  ITEM wnext;    /* The next item in the same slot of the timer wheel.  */
+  ITEM *wprevp;  /* NULL or the pointer pointing to this item in the
+                  * timer wheel.  */
+  time_t due;    /* 0 or the time at which the item needs to be
+                  * checked for expiration.  */
+  unsigned int hash;  /* The hash value of KEY.  */
   time_t created;
   time_t accessed;  /* Not updated for CACHE_MODE_DATA */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
   struct secret_data_s *pw;
+  struct secret_data_s *skey;  /* NULL or the key unprotected with PW.  */
   cache_mode_t cache_mode;
   int restricted;  /* The value of ctrl->restricted is part of the key.  */
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
+/* A stripe of the cache.  */
+struct cache_stripe_s {
+  /* The lock protecting the stripe, its buckets and their items.  */
+  npth_mutex_t lock;
+
+  /* The time the timer wheel has last been advanced.  */
+  time_t wheel_time;
+
+  /* The values of the max-cache-ttl options used to compute the due
+   * times of the items.  */
+  unsigned long max_cache_ttl;
+  unsigned long max_cache_ttl_ssh;
+
+  /* The timer wheel.  An item is linked into the slot DUE %
+   * WHEEL_SLOTS or, if DUE has already passed, into the next slot to
+   * be processed.  */
+  ITEM wheel[WHEEL_SLOTS];
+};
+
+/* The cache himself.  Items are hashed by their KEY because that is
+ * the only property all lookup modes compare.  */
+static ITEM thecache[CACHE_BUCKETS];
+static struct cache_stripe_s stripes[CACHE_STRIPES];
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
@@ -78,9 +119,11 @@ static char *last_stored_cache_key;
 void
 initialize_module_cache (void)
 {
-  int err;
+  int err, i;
 
-  err = npth_mutex_init (&cache_lock, NULL);
+  err = npth_mutex_init (&encryption_lock, NULL);
+  for (i=0; !err && i < CACHE_STRIPES; i++)
+    err = npth_mutex_init (&stripes[i].lock, NULL);
 
   if (err)
     log_fatal ("error initializing cache module: %s\n", strerror (err));
@@ -136,6 +179,29 @@ init_encryption (void)
 }
 
 
+static void
+lock_encryption (void)
+{
+  int res;
+
+  res = npth_mutex_lock (&encryption_lock);
+  if (res)
+    log_fatal ("failed to acquire cache encryption mutex: %s\n",
+               strerror (res));
+}
+
+
+static void
+unlock_encryption (void)
+{
+  int res;
+
+  res = npth_mutex_unlock (&encryption_lock);
+  if (res)
+    log_fatal ("failed to release cache encryption mutex: %s\n",
+               strerror (res));
+}
+
 
 static void
 release_data (struct secret_data_s *data)
@@ -143,22 +209,28 @@ release_data (struct secret_data_s *data)
    xfree (data);
 }
 
+/* Release the passphrase of item R and the key unprotected with it.  */
+static void
+clear_item (ITEM r)
+{
+  release_data (r->pw);
+  r->pw = NULL;
+  release_data (r->skey);
+  r->skey = NULL;
+}
+
+
+/* Encrypt the LENGTH bytes at BUFFER and store them as a new data
+ * object at R_DATA.  */
 static gpg_error_t
-new_data (const char *string, struct secret_data_s **r_data)
+new_data (const void *buffer, size_t length, struct secret_data_s **r_data)
 {
   gpg_error_t err;
   struct secret_data_s *d, *d_enc;
-  size_t length;
   int total;
 
   *r_data = NULL;
 
-  err = init_encryption ();
-  if (err)
-    return err;
-
-  length = strlen (string) + 1;
-
   /* We pad the data to 32 bytes so that it get more complicated
      finding something out by watching allocation patterns.  This is
      usually not possible but we better assume nothing about our secure
@@ -169,7 +241,7 @@ new_data (const char *string, struct secret_data_s **r_data)
   d = xtrymalloc_secure (sizeof *d + total - 1);
   if (!d)
     return gpg_error_from_syserror ();
-  memcpy (d->data, string, length);
+  memcpy (d->data, buffer, length);
 
   d_enc = xtrymalloc (sizeof *d_enc + total - 1);
   if (!d_enc)
@@ -180,8 +252,12 @@ new_data (const char *string, struct secret_data_s **r_data)
     }
 
   d_enc->totallen = total;
-  err = gcry_cipher_encrypt (encryption_handle, d_enc->data, total,
-                             d->data, total - 8);
+  lock_encryption ();
+  err = init_encryption ();
+  if (!err)
+    err = gcry_cipher_encrypt (encryption_handle, d_enc->data, total,
+                               d->data, total - 8);
+  unlock_encryption ();
   xfree (d);
   if (err)
     {
@@ -194,132 +270,296 @@ new_data (const char *string, struct secret_data_s **r_data)
 
 
 
-/* Check whether there are items to expire.  */
+/* Return the maximum lifetime of items in CACHE_MODE at R_MAXTTL.
+ * Returns false if there is no such limit for this mode.  */
+static int
+get_max_ttl (struct cache_stripe_s *stripe, cache_mode_t cache_mode,
+             unsigned long *r_maxttl)
+{
+  switch (cache_mode)
+    {
+    case CACHE_MODE_DATA:
+    case CACHE_MODE_PIN:
+      return 0;  /* No MAX TTL here.  */
+    case CACHE_MODE_SSH: *r_maxttl = stripe->max_cache_ttl_ssh; break;
+    default: *r_maxttl = stripe->max_cache_ttl; break;
+    }
+  return 1;
+}
+
+
+/* Remove item R from the timer wheel.  */
 static void
-housekeeping (void)
+wheel_unlink (ITEM r)
 {
-  ITEM r, rprev;
-  time_t current = gnupg_get_time ();
+  if (r->wprevp)
+    {
+      *r->wprevp = r->wnext;
+      if (r->wnext)
+        r->wnext->wprevp = r->wprevp;
+      r->wnext = NULL;
+      r->wprevp = NULL;
+    }
+}
 
-  /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+
+/* Compute the due time of item R and put it into the timer wheel of
+ * STRIPE.  This needs to be called whenever a time stamp or the
+ * data of R changes.  */
+static void
+schedule_item (struct cache_stripe_s *stripe, ITEM r)
+{
+  unsigned long maxttl;
+  time_t due = 0;
+  ITEM *slot;
+
+  wheel_unlink (r);
+
+  if (r->pw)
     {
       if (r->cache_mode == CACHE_MODE_PIN)
         ; /* Don't let it expire - scdaemon explicitly flushes them.  */
-      else if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
+      else
         {
-          if (DBG_CACHE)
-            log_debug ("  expired '%s'.%d (%ds after last access)\n",
-                       r->key, r->restricted, r->ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
+          if (r->ttl >= 0)
+            due = r->accessed + r->ttl + 1;
+          if (get_max_ttl (stripe, r->cache_mode, &maxttl)
+              && (!due || r->created + maxttl + 1 < due))
+            due = r->created + maxttl + 1;
         }
     }
+  else if (r->ttl >= 0)
+    due = r->accessed + UNUSED_ITEM_TTL + 1;
+
+  r->due = due;
+  if (!due)
+    return;
+
+  if (due <= stripe->wheel_time)
+    due = stripe->wheel_time + 1;
+  slot = &stripe->wheel[due % WHEEL_SLOTS];
+  r->wnext = *slot;
+  if (r->wnext)
+    r->wnext->wprevp = &r->wnext;
+  r->wprevp = slot;
+  *slot = r;
+}
+
+
+/* Remove item R from the cache and release it.  */
+static void
+remove_item (ITEM r)
+{
+  ITEM *rp;
+
+  wheel_unlink (r);
+  for (rp = &thecache[r->hash % CACHE_BUCKETS]; *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  clear_item (r);
+  xfree (r);
+}
+
+
+/* Expire the data of item R or the entire item if its time has come.
+ * CURRENT is the current time.  */
+static void
+expire_item (struct cache_stripe_s *stripe, ITEM r, time_t current)
+{
+  unsigned long maxttl;
+
+  /* First expire the actual data */
+  if (r->cache_mode == CACHE_MODE_PIN)
+    ; /* Don't let it expire - scdaemon explicitly flushes them.  */
+  else if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
+    {
+      if (DBG_CACHE)
+        log_debug ("  expired '%s'.%d (%ds after last access)\n",
+                   r->key, r->restricted, r->ttl);
+      clear_item (r);
+      r->accessed = current;
+    }
 
   /* Second, make sure that we also remove them based on the created
    * stamp so that the user has to enter it from time to time.  We
    * don't do this for data items which are used to storage secrets in
    * meory and are not user entered passphrases etc.  */
-  for (r=thecache; r; r = r->next)
+  if (r->pw && get_max_ttl (stripe, r->cache_mode, &maxttl)
+      && r->created + maxttl < current)
     {
-      unsigned long maxttl;
-
-      switch (r->cache_mode)
-        {
-        case CACHE_MODE_DATA:
-        case CACHE_MODE_PIN:
-          continue;  /* No MAX TTL here.  */
-        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
-        default: maxttl = opt.max_cache_ttl; break;
-        }
-      if (r->pw && r->created + maxttl < current)
-        {
-          if (DBG_CACHE)
-            log_debug ("  expired '%s'.%d (%lus after creation)\n",
-                       r->key, r->restricted, opt.max_cache_ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
-        }
+      if (DBG_CACHE)
+        log_debug ("  expired '%s'.%d (%lus after creation)\n",
+                   r->key, r->restricted, maxttl);
+      clear_item (r);
+      r->accessed = current;
     }
 
   /* Third, make sure that we don't have too many items in the list.
    * Expire old and unused entries after 30 minutes.  */
-  for (rprev=NULL, r=thecache; r; )
+  if (!r->pw && r->ttl >= 0 && r->accessed + UNUSED_ITEM_TTL < current)
+    {
+      if (DBG_CACHE)
+        log_debug ("  removed '%s'.%d (mode %d) (slot not used for 30m)\n",
+                   r->key, r->restricted, r->cache_mode);
+      remove_item (r);
+      return;
+    }
+
+  schedule_item (stripe, r);
+}
+
+
+/* Check whether there are items of STRIPE to expire.  The caller
+ * must hold the lock of the stripe.  Only the slots of the timer
+ * wheel passed since the last call are inspected.  */
+static void
+housekeeping (struct cache_stripe_s *stripe)
+{
+  ITEM r, rnext;
+  time_t current = gnupg_get_time ();
+  time_t last, t;
+  ITEM *slot;
+  int i;
+
+  if (stripe->max_cache_ttl != opt.max_cache_ttl
+      || stripe->max_cache_ttl_ssh != opt.max_cache_ttl_ssh)
     {
-      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
+      /* The options have been changed - reschedule all items.  */
+      stripe->max_cache_ttl = opt.max_cache_ttl;
+      stripe->max_cache_ttl_ssh = opt.max_cache_ttl_ssh;
+      for (i = stripe - stripes; i < CACHE_BUCKETS; i += CACHE_STRIPES)
+        for (r = thecache[i]; r; r = r->next)
+          schedule_item (stripe, r);
+    }
+
+  if (current <= stripe->wheel_time)
+    return;
+  last = stripe->wheel_time;
+  if (current - last > WHEEL_SLOTS)
+    last = current - WHEEL_SLOTS;
+  /* Advance the wheel first so that rescheduled items are not put
+   * into a slot processed below.  */
+  stripe->wheel_time = current;
+
+  for (t = last + 1; t <= current; t++)
+    {
+      slot = &stripe->wheel[t % WHEEL_SLOTS];
+      r = *slot;
+      *slot = NULL;
+      for (; r; r = rnext)
         {
-          ITEM r2 = r->next;
-          if (DBG_CACHE)
-            log_debug ("  removed '%s'.%d (mode %d) (slot not used for 30m)\n",
-                       r->key, r->restricted, r->cache_mode);
-          xfree (r);
-          if (!rprev)
-            thecache = r2;
+          rnext = r->wnext;
+          r->wnext = NULL;
+          r->wprevp = NULL;
+          if (r->due <= current)
+            expire_item (stripe, r, current);
           else
-            rprev->next = r2;
-          r = r2;
-        }
-      else
-        {
-          rprev = r;
-          r = r->next;
+            {
+              /* Not yet due - keep it for the next round.  */
+              r->wnext = *slot;
+              if (r->wnext)
+                r->wnext->wprevp = &r->wnext;
+              r->wprevp = slot;
+              *slot = r;
+            }
         }
     }
 }
 
 
-void
-agent_cache_housekeeping (void)
+/* Return the stripe for the bucket of HASH.  */
+static struct cache_stripe_s *
+get_stripe (unsigned int hash)
 {
-  int res;
+  return &stripes[(hash % CACHE_BUCKETS) % CACHE_STRIPES];
+}
 
-  if (DBG_CACHE)
-    log_debug ("agent_cache_housekeeping\n");
 
-  res = npth_mutex_lock (&cache_lock);
+static void
+lock_stripe (struct cache_stripe_s *stripe)
+{
+  int res;
+
+  res = npth_mutex_lock (&stripe->lock);
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+}
 
-  housekeeping ();
 
-  res = npth_mutex_unlock (&cache_lock);
+static void
+unlock_stripe (struct cache_stripe_s *stripe)
+{
+  int res;
+
+  res = npth_mutex_unlock (&stripe->lock);
   if (res)
     log_fatal ("failed to release cache mutex: %s\n", strerror (res));
 }
 
 
+/* Return the hash value for the cache key KEY.  */
+static unsigned int
+cache_hash (const char *key)
+{
+  const unsigned char *s = (const unsigned char *)key;
+  unsigned int h = 2166136261u;  /* FNV-1a */
+
+  for (; *s; s++)
+    h = (h ^ *s) * 16777619u;
+  return h;
+}
+
+
+void
+agent_cache_housekeeping (void)
+{
+  int i;
+
+  if (DBG_CACHE)
+    log_debug ("agent_cache_housekeeping\n");
+
+  for (i=0; i < CACHE_STRIPES; i++)
+    {
+      lock_stripe (&stripes[i]);
+      housekeeping (&stripes[i]);
+      unlock_stripe (&stripes[i]);
+    }
+}
+
+
 void
 agent_flush_cache (int pincache_only)
 {
+  struct cache_stripe_s *stripe;
   ITEM r;
-  int res;
+  int i, j;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache%s\n", pincache_only?" (pincache only)":"");
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
-
-  for (r=thecache; r; r = r->next)
+  for (i=0; i < CACHE_STRIPES; i++)
     {
-      if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
-        continue;
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-        }
+      stripe = &stripes[i];
+      lock_stripe (stripe);
+      for (j=i; j < CACHE_BUCKETS; j += CACHE_STRIPES)
+        for (r=thecache[j]; r; r = r->next)
+          {
+            if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
+              continue;
+            if (r->pw)
+              {
+                if (DBG_CACHE)
+                  log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
+                clear_item (r);
+                r->accessed = 0;
+                schedule_item (stripe, r);
+              }
+          }
+      unlock_stripe (stripe);
     }
-
-  res = npth_mutex_unlock (&cache_lock);
-  if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
 }
 
 
@@ -348,17 +588,16 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
 {
   gpg_error_t err = 0;
   ITEM r;
-  int res;
   int restricted = ctrl? ctrl->restricted : -1;
+  unsigned int hash = cache_hash (key);
+  struct cache_stripe_s *stripe = get_stripe (hash);
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+  lock_stripe (stripe);
 
   if (DBG_CACHE)
     log_debug ("agent_put_cache '%s'.%d (mode %d) requested ttl=%d\n",
                key, restricted, cache_mode, ttl);
-  housekeeping ();
+  housekeeping (stripe);
 
   if (!ttl)
     {
@@ -373,8 +612,10 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
+  for (r=thecache[hash % CACHE_BUCKETS]; r; r = r->next)
     {
+      if (r->hash != hash)
+        continue;
       if (cache_mode == CACHE_MODE_PIN && data)
         {
           /* PIN mode is special because it is only used by scdaemon.  */
@@ -397,20 +638,17 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
     }
   if (r) /* Replace.  */
     {
-      if (r->pw)
-        {
-          release_data (r->pw);
-          r->pw = NULL;
-        }
+      clear_item (r);
       if (data)
         {
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = new_data (data, strlen (data) + 1, &r->pw);
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
         }
+      schedule_item (stripe, r);
     }
   else if (data) /* Insert.  */
     {
@@ -420,17 +658,19 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
       else
         {
           strcpy (r->key, key);
+          r->hash = hash;
           r->restricted = restricted;
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = new_data (data, strlen (data) + 1, &r->pw);
           if (err)
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              r->next = thecache[hash % CACHE_BUCKETS];
+              thecache[hash % CACHE_BUCKETS] = r;
+              schedule_item (stripe, r);
             }
         }
       if (err)
@@ -438,14 +678,70 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
     }
 
  out:
-  res = npth_mutex_unlock (&cache_lock);
-  if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+  unlock_stripe (stripe);
 
   return err;
 }
 
 
+/* Return the item for KEY with a passphrase matching CACHE_MODE and
+ * RESTRICTED or NULL if there is none.  HASH is the hash value of
+ * KEY.  The caller must hold the lock of the stripe.  */
+static ITEM
+find_item (const char *key, unsigned int hash, cache_mode_t cache_mode,
+           int restricted)
+{
+  ITEM r;
+
+  for (r=thecache[hash % CACHE_BUCKETS]; r; r = r->next)
+    {
+      if (r->hash != hash)
+        ;
+      else if (cache_mode == CACHE_MODE_PIN)
+        {
+          if (r->pw && !strcmp (r->key, key))
+            break;
+        }
+      else if (r->pw
+               && ((cache_mode != CACHE_MODE_USER
+                    && cache_mode != CACHE_MODE_NONCE)
+                   || cache_mode_equal (r->cache_mode, cache_mode))
+               && r->restricted == restricted
+               && !strcmp (r->key, key))
+        break;
+    }
+  return r;
+}
+
+
+/* Decrypt the data object D into a buffer allocated in secure
+ * memory and store it at R_VALUE.  */
+static gpg_error_t
+decrypt_data (struct secret_data_s *d, char **r_value)
+{
+  gpg_error_t err;
+  char *value;
+
+  *r_value = NULL;
+  if (d->totallen < 32)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+  if (!(value = xtrymalloc_secure (d->totallen - 8)))
+    return gpg_error_from_syserror ();
+
+  lock_encryption ();
+  err = init_encryption ();
+  if (!err)
+    err = gcry_cipher_decrypt (encryption_handle, value, d->totallen - 8,
+                               d->data, d->totallen);
+  unlock_encryption ();
+  if (err)
+    xfree (value);
+  else
+    *r_value = value;
+  return err;
+}
+
+
 /* Try to find an item in the cache.  Returns NULL if not found or an
  * malloced string with the value.  */
 char *
@@ -454,89 +750,175 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
   gpg_error_t err;
   ITEM r;
   char *value = NULL;
-  int res;
   int last_stored = 0;
   int restricted = ctrl? ctrl->restricted : -1;
-  int yes;
+  unsigned int hash;
+  struct cache_stripe_s *stripe;
 
   if (cache_mode == CACHE_MODE_IGNORE)
     return NULL;
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
-
-  if (!key)
+  if (key)
     {
-      key = last_stored_cache_key;
-      if (!key)
-        goto out;
+      hash = cache_hash (key);
+      stripe = get_stripe (hash);
+      lock_stripe (stripe);
+    }
+  else
+    {
+      /* The stored cache key may change while we are waiting for the
+       * lock; thus we need to check it again after taking the lock.  */
       last_stored = 1;
+      for (;;)
+        {
+          key = last_stored_cache_key;
+          if (!key)
+            return NULL;
+          hash = cache_hash (key);
+          stripe = get_stripe (hash);
+          lock_stripe (stripe);
+          key = last_stored_cache_key;
+          if (!key)
+            goto out;
+          if (cache_hash (key) == hash)
+            break;
+          unlock_stripe (stripe);
+        }
     }
 
   if (DBG_CACHE)
     log_debug ("agent_get_cache '%s'.%d (mode %d)%s ...\n",
                key, restricted, cache_mode,
                last_stored? " (stored cache key)":"");
-  housekeeping ();
+  housekeeping (stripe);
 
-  for (r=thecache; r; r = r->next)
+  r = find_item (key, hash, cache_mode, restricted);
+  if (r)
     {
-      if (cache_mode == CACHE_MODE_PIN)
-        yes = (r->pw && !strcmp (r->key, key));
-      else if (r->pw
-               && ((cache_mode != CACHE_MODE_USER
-                    && cache_mode != CACHE_MODE_NONCE)
-                   || cache_mode_equal (r->cache_mode, cache_mode))
-               && r->restricted == restricted
-               && !strcmp (r->key, key))
-        yes = 1;
-      else
-        yes = 0;
-
-      if (yes)
+      /* Note: To avoid races KEY may not be accessed anymore
+       * below.  Note also that we don't update the accessed time
+       * for data items.  */
+      if (r->cache_mode != CACHE_MODE_DATA)
         {
-          /* Note: To avoid races KEY may not be accessed anymore
-           * below.  Note also that we don't update the accessed time
-           * for data items.  */
-          if (r->cache_mode != CACHE_MODE_DATA)
-            r->accessed = gnupg_get_time ();
-          if (DBG_CACHE)
-            log_debug ("... hit\n");
-          if (r->pw->totallen < 32)
-            err = gpg_error (GPG_ERR_INV_LENGTH);
-          else if ((err = init_encryption ()))
-            ;
-          else if (!(value = xtrymalloc_secure (r->pw->totallen - 8)))
-            err = gpg_error_from_syserror ();
-          else
-            {
-              err = gcry_cipher_decrypt (encryption_handle,
-                                         value, r->pw->totallen - 8,
-                                         r->pw->data, r->pw->totallen);
-            }
-          if (err)
-            {
-              xfree (value);
-              value = NULL;
-              log_error ("retrieving cache entry '%s'.%d failed: %s\n",
-                         key, restricted, gpg_strerror (err));
-            }
-          break;
+          r->accessed = gnupg_get_time ();
+          schedule_item (stripe, r);
         }
+      if (DBG_CACHE)
+        log_debug ("... hit\n");
+      err = decrypt_data (r->pw, &value);
+      if (err)
+        log_error ("retrieving cache entry '%s'.%d failed: %s\n",
+                   key, restricted, gpg_strerror (err));
     }
   if (DBG_CACHE && value == NULL)
     log_debug ("... miss\n");
 
  out:
-  res = npth_mutex_unlock (&cache_lock);
-  if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+  unlock_stripe (stripe);
 
   return value;
 }
 
 
+/* Store the unprotected key KEYBUF, a canonical S-expression, along
+ * with the passphrase cached under KEY for CACHE_MODE.  The key is
+ * released together with that passphrase; thus it has the same
+ * lifetime.  Nothing is stored if no such passphrase is cached.  */
+void
+agent_put_cache_key (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
+                     const unsigned char *keybuf)
+{
+  gpg_error_t err;
+  ITEM r;
+  int restricted = ctrl? ctrl->restricted : -1;
+  unsigned int hash = cache_hash (key);
+  struct cache_stripe_s *stripe = get_stripe (hash);
+  size_t keylen;
+
+  if (cache_mode == CACHE_MODE_IGNORE)
+    return;
+  keylen = gcry_sexp_canon_len (keybuf, 0, NULL, NULL);
+  if (!keylen)
+    return;
+
+  lock_stripe (stripe);
+  r = find_item (key, hash, cache_mode, restricted);
+  if (r && r->cache_mode != CACHE_MODE_DATA && r->cache_mode != CACHE_MODE_PIN)
+    {
+      if (DBG_CACHE)
+        log_debug ("agent_put_cache_key '%s'.%d (mode %d)\n",
+                   key, restricted, cache_mode);
+      release_data (r->skey);
+      r->skey = NULL;
+      err = new_data (keybuf, keylen, &r->skey);
+      if (err)
+        log_error ("error caching the unprotected key: %s\n",
+                   gpg_strerror (err));
+    }
+  unlock_stripe (stripe);
+}
+
+
+/* Return the unprotected key stored with agent_put_cache_key for KEY
+ * and CACHE_MODE.  Returns NULL if there is no such key or a canonical
+ * S-expression allocated in secure memory.  Like a passphrase lookup
+ * this updates the access time of the cache item.  */
+unsigned char *
+agent_get_cache_key (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
+{
+  gpg_error_t err;
+  ITEM r;
+  char *value = NULL;
+  int restricted = ctrl? ctrl->restricted : -1;
+  unsigned int hash = cache_hash (key);
+  struct cache_stripe_s *stripe = get_stripe (hash);
+
+  if (cache_mode == CACHE_MODE_IGNORE)
+    return NULL;
+
+  lock_stripe (stripe);
+  housekeeping (stripe);
+  r = find_item (key, hash, cache_mode, restricted);
+  if (r && r->skey)
+    {
+      if (DBG_CACHE)
+        log_debug ("agent_get_cache_key '%s'.%d (mode %d) ... hit\n",
+                   key, restricted, cache_mode);
+      r->accessed = gnupg_get_time ();
+      schedule_item (stripe, r);
+      err = decrypt_data (r->skey, &value);
+      if (err)
+        log_error ("retrieving cached key '%s'.%d failed: %s\n",
+                   key, restricted, gpg_strerror (err));
+    }
+  unlock_stripe (stripe);
+
+  return (unsigned char *)value;
+}
+
+
+/* Release all unprotected keys stored under KEY regardless of the
+ * cache mode.  This is used when the key file changes.  */
+void
+agent_forget_cache_key (const char *key)
+{
+  ITEM r;
+  unsigned int hash = cache_hash (key);
+  struct cache_stripe_s *stripe = get_stripe (hash);
+
+  lock_stripe (stripe);
+  for (r=thecache[hash % CACHE_BUCKETS]; r; r = r->next)
+    if (r->skey && r->hash == hash && !strcmp (r->key, key))
+      {
+        if (DBG_CACHE)
+          log_debug ("agent_forget_cache_key '%s'.%d\n", r->key, r->restricted);
+        release_data (r->skey);
+        r->skey = NULL;
+      }
+  unlock_stripe (stripe);
+}
+
+
 /* Store the key for the last successful cache hit.  That value is
    used by agent_get_cache if the requested KEY is given as NULL.
    NULL may be used to remove that key. */
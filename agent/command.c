@@ -51,6 +51,8 @@
 #define MAXLEN_KEYDATA 8192
 /* Maximum length of a secret to store under one key.  */
 #define MAXLEN_PUT_SECRET 4096
+/* Maximum allowed size of the digest list for PKSIGN --batch.  */
+#define MAXLEN_DIGESTS (256*1024)
 /* The size of the import/export KEK key (in bytes).  */
 #define KEYWRAP_KEYSIZE (128/8)
 
@@ -610,6 +612,13 @@ cmd_havekey (assuan_context_t ctx, char *line)
 {
   gpg_error_t err;
   unsigned char buf[20];
+  int use_index;
+
+  /* With several keygrips we use the key index instead of probing
+     for each key file.  */
+  use_index = !!strpbrk (line, " \t");
+  if (use_index)
+    agent_update_key_index ();
 
   do
     {
@@ -617,7 +626,8 @@ cmd_havekey (assuan_context_t ctx, char *line)
       if (err)
         return err;
 
-      if (!agent_key_available (buf))
+      if (!(use_index? agent_key_available_indexed (buf)
+            /**/     : agent_key_available (buf)))
         return 0; /* Found.  */
 
       while (*line && *line != ' ' && *line != '\t')
@@ -837,10 +847,21 @@ cmd_sethash (assuan_context_t ctx, char *line)
 
 
 static const char hlp_pksign[] =
-  "PKSIGN [<options>] [<cache_nonce>]\n"
+  "PKSIGN [--batch] [<options>] [<cache_nonce>]\n"
   "\n"
   "Perform the actual sign operation.  Neither input nor output are\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.\n"
+  "\n"
+  "With option --batch the digests are not taken from SETHASH but\n"
+  "requested using\n"
+  "  INQUIRE DIGESTS\n"
+  "The response is a sequence of records each consisting of the\n"
+  "digest algorithm number as one byte, the length of the digest as\n"
+  "one byte and the digest.  All digests are signed with the key set\n"
+  "by SIGKEY which is unprotected only once.  The returned data is\n"
+  "a sequence of the signatures in the order of the digests, each\n"
+  "prefixed by its length as a 4 byte big endian integer.  If one\n"
+  "signature fails the entire command fails.";
 static gpg_error_t
 cmd_pksign (assuan_context_t ctx, char *line)
 {
@@ -850,7 +871,11 @@ cmd_pksign (assuan_context_t ctx, char *line)
   membuf_t outbuf;
   char *cache_nonce = NULL;
   char *p;
+  int opt_batch;
+  unsigned char *digests = NULL;
+  size_t digestslen;
 
+  opt_batch = has_option (line, "--batch");
   line = skip_options (line);
 
   for (p=line; *p && *p != ' ' && *p != '\t'; p++)
@@ -864,15 +889,31 @@ cmd_pksign (assuan_context_t ctx, char *line)
   else if (!ctrl->server_local->use_cache_for_signing)
     cache_mode = CACHE_MODE_IGNORE;
 
+  if (opt_batch)
+    {
+      err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_DIGESTS);
+      if (!err)
+        err = assuan_inquire (ctx, "DIGESTS",
+                              &digests, &digestslen, MAXLEN_DIGESTS);
+      if (err)
+        goto leave;
+    }
+
   init_membuf (&outbuf, 512);
 
-  err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
-                      &outbuf, cache_mode);
+  if (opt_batch)
+    err = agent_pksign_batch (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                              digests, digestslen, &outbuf, cache_mode);
+  else
+    err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                        &outbuf, cache_mode);
   if (err)
     clear_outbuf (&outbuf);
   else
     err = write_and_clear_outbuf (ctx, &outbuf);
 
+ leave:
+  xfree (digests);
   xfree (cache_nonce);
   xfree (ctrl->server_local->keydesc);
   ctrl->server_local->keydesc = NULL;
@@ -1165,12 +1206,16 @@ cmd_readkey (assuan_context_t ctx, char *line)
 
 static const char hlp_keyinfo[] =
   "KEYINFO [--[ssh-]list] [--data] [--ssh-fpr[=algo]] [--with-ssh] <keygrip>\n"
+  "KEYINFO --multi [--data] [--ssh-fpr[=algo]] [--with-ssh] <keygrips>\n"
   "\n"
   "Return information about the key specified by the KEYGRIP.  If the\n"
   "key is not available GPG_ERR_NOT_FOUND is returned.  If the option\n"
   "--list is given the keygrip is ignored and information about all\n"
   "available keys are returned.  If --ssh-list is given information\n"
-  "about all keys listed in the sshcontrol are returned.  With --with-ssh\n"
+  "about all keys listed in the sshcontrol are returned.  With --multi\n"
+  "a list of space separated keygrips is expected and information about\n"
+  "those of the keys which are available is returned; unavailable keys\n"
+  "are silently skipped.  With --with-ssh\n"
   "information from sshcontrol is always added to the info. Unless --data\n"
   "is given, the information is returned as a status line using the format:\n"
   "\n"
@@ -1372,7 +1417,7 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
   unsigned char grip[20];
   gnupg_dir_t dir = NULL;
   int list_mode;
-  int opt_data, opt_ssh_fpr, opt_with_ssh;
+  int opt_data, opt_ssh_fpr, opt_with_ssh, opt_multi;
   ssh_control_file_t cf = NULL;
   char hexgrip[41];
   int disabled, ttl, confirm, is_ssh;
@@ -1384,6 +1429,7 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
     list_mode = 2;
   else
     list_mode = has_option (line, "--list");
+  opt_multi = has_option (line, "--multi");
   opt_data = has_option (line, "--data");
 
   if (has_option_name (line, "--ssh-fpr"))
@@ -1509,6 +1555,50 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
         }
       err = 0;
     }
+  else if (opt_multi)
+    {
+      /* Use the key index so that unavailable keys can be skipped
+       * without touching the disk.  */
+      agent_update_key_index ();
+      while (*line)
+        {
+          err = parse_keygrip (ctx, line, grip);
+          if (err)
+            goto leave;
+          while (*line && !spacep (line))
+            line++;
+          while (spacep (line))
+            line++;
+
+          if (agent_key_available_indexed (grip))
+            continue;
+          bin2hex (grip, 20, hexgrip);
+
+          disabled = ttl = confirm = is_ssh = 0;
+          if (opt_with_ssh)
+            {
+              err = ssh_search_control_file (cf, hexgrip,
+                                             &disabled, &ttl, &confirm);
+              if (!err)
+                is_ssh = 1;
+              else if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+                goto leave;
+            }
+
+          on_card = 0;
+          for (l = keyinfo_on_cards; l; l = l->next)
+            if (!memcmp (l->keygrip, hexgrip, 40))
+              on_card = 1;
+
+          err = do_one_keyinfo (ctrl, grip, ctx, opt_data, opt_ssh_fpr, is_ssh,
+                                ttl, disabled, confirm, on_card);
+          if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+            err = 0;  /* Removed in the meantime.  */
+          if (err)
+            goto leave;
+        }
+      err = 0;
+    }
   else
     {
       err = parse_keygrip (ctx, line, grip);
@@ -3760,6 +3850,16 @@ command_has_option (const char *cmd, const char *cmdopt)
       if (!strcmp (cmdopt, "newsymkey"))
         return 1;
     }
+  else if (!strcmp (cmd, "PKSIGN"))
+    {
+      if (!strcmp (cmdopt, "batch"))
+        return 1;
+    }
+  else if (!strcmp (cmd, "KEYINFO"))
+    {
+      if (!strcmp (cmdopt, "multi"))
+        return 1;
+    }
 
   return 0;
 }
@@ -39,6 +39,28 @@
 #define O_BINARY 0
 #endif
 
+/* An index of the keygrips of all keys in the private key directory.
+ * It is used to quickly answer queries for many keys at once without
+ * probing for each key file.  */
+static struct
+{
+  int valid;             /* The index may be used.  */
+  time_t dir_mtime;      /* The mtime of the directory at the scan.  */
+  time_t scan_time;      /* The time the directory was scanned.  */
+  unsigned char *grips;  /* Sorted array of NGRIPS keygrips.  */
+  size_t ngrips;
+  size_t size;           /* Allocated number of keygrips.  */
+} key_index;
+
+
+/* Mark the index of available keys as outdated.  */
+static void
+invalidate_key_index (void)
+{
+  key_index.valid = 0;
+}
+
+
 /* Helper to pass data to the check callback of the unprotect function. */
 struct try_unprotect_arg_s
 {
@@ -228,6 +250,9 @@ agent_write_private_key (const unsigned char *grip,
   char hexgrip[40+4+1];
 
   bin2hex (grip, 20, hexgrip);
+  /* A cached unprotected key may not match the new key file.  */
+  agent_forget_cache_key (hexgrip);
+  invalidate_key_index ();
   strcpy (hexgrip+40, ".key");
 
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
@@ -655,6 +680,8 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
             {
               if (cache_mode == CACHE_MODE_NORMAL)
                 agent_store_cache_hit (hexgrip);
+              if (opt.cache_unprotected_keys)
+                agent_put_cache_key (ctrl, hexgrip, cache_mode, result);
               if (r_passphrase)
                 *r_passphrase = pw;
               else
@@ -794,6 +821,9 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
           agent_put_cache (ctrl, hexgrip, cache_mode, pi->pin,
                            lookup_ttl? lookup_ttl (hexgrip) : 0);
           agent_store_cache_hit (hexgrip);
+          if (opt.cache_unprotected_keys)
+            agent_put_cache_key (ctrl, hexgrip, cache_mode,
+                                 arg.unprotected_key);
           if (r_passphrase && *pi->pin)
             *r_passphrase = xtrystrdup (pi->pin);
         }
@@ -954,6 +984,7 @@ remove_key_file (const unsigned char *grip)
   strcpy (hexgrip+40, ".key");
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
+  invalidate_key_index ();
   if (gnupg_remove (fname))
     err = gpg_error_from_syserror ();
   xfree (fname);
@@ -996,6 +1027,29 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   if (r_passphrase)
     *r_passphrase = NULL;
 
+  /* If the key has already been unprotected with a cached passphrase
+   * we can skip reading the file and the costly unprotection.  */
+  if (opt.cache_unprotected_keys && !r_passphrase
+      && cache_mode != CACHE_MODE_IGNORE)
+    {
+      char hexgrip[40+1];
+
+      bin2hex (grip, 20, hexgrip);
+      buf = agent_get_cache_key (ctrl, hexgrip, cache_mode);
+      if (buf)
+        {
+          if (cache_mode == CACHE_MODE_NORMAL)
+            agent_store_cache_hit (hexgrip);
+          err = sexp_sscan_private_key (result, &erroff, buf);
+          xfree (buf);
+          if (!err)
+            return 0;
+          log_error ("failed to build S-Exp from cached key (off=%u): %s\n",
+                     (unsigned int)erroff, gpg_strerror (err));
+          agent_forget_cache_key (hexgrip);
+        }
+    }
+
   err = read_key_file (grip, &s_skey, &keymeta);
   if (err)
     {
@@ -1310,6 +1364,120 @@ agent_public_key_from_file (ctrl_t ctrl,
 
 
 
+/* Compare function for qsort and bsearch on the key index.  */
+static int
+cmp_key_index_grips (const void *a, const void *b)
+{
+  return memcmp (a, b, KEYGRIP_LEN);
+}
+
+
+/* Make sure that the index of available keys reflects the current
+ * content of the private key directory.  The directory is only
+ * scanned again if its modification time changed since the last
+ * scan, if it was modified in the same second as the last scan, or
+ * if we changed a key file ourselves.  On error the index is marked
+ * as invalid and agent_key_available_indexed falls back to checking
+ * the files.  */
+void
+agent_update_key_index (void)
+{
+  char *dirname;
+  struct stat st;
+  time_t scan_time;
+  gnupg_dir_t dir;
+  gnupg_dirent_t dir_entry;
+  char hexgrip[40+1];
+  unsigned char *p;
+  size_t n;
+
+  dirname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (!dirname)
+    {
+      invalidate_key_index ();
+      return;
+    }
+  if (gnupg_stat (dirname, &st))
+    {
+      invalidate_key_index ();
+      xfree (dirname);
+      return;
+    }
+  if (key_index.valid
+      && st.st_mtime == key_index.dir_mtime
+      && key_index.dir_mtime < key_index.scan_time)
+    {
+      xfree (dirname);
+      return;  /* Still up-to-date.  */
+    }
+
+  /* Take the time before reading the directory so that changes
+   * during the scan are detected by the next call.  */
+  scan_time = time (NULL);
+  key_index.valid = 0;
+  key_index.ngrips = 0;
+  dir = gnupg_opendir (dirname);
+  xfree (dirname);
+  if (!dir)
+    return;
+
+  while ((dir_entry = gnupg_readdir (dir)))
+    {
+      if (strlen (dir_entry->d_name) != 44
+          || strcmp (dir_entry->d_name + 40, ".key"))
+        continue;
+
+      if (key_index.ngrips == key_index.size)
+        {
+          n = key_index.size? 2 * key_index.size : 256;
+          p = xtryrealloc (key_index.grips, n * KEYGRIP_LEN);
+          if (!p)
+            {
+              gnupg_closedir (dir);
+              return;
+            }
+          key_index.grips = p;
+          key_index.size = n;
+        }
+
+      strncpy (hexgrip, dir_entry->d_name, 40);
+      hexgrip[40] = 0;
+      p = key_index.grips + key_index.ngrips * KEYGRIP_LEN;
+      if (hex2bin (hexgrip, p, KEYGRIP_LEN) < 0)
+        continue; /* Bad hex string.  */
+      key_index.ngrips++;
+    }
+  gnupg_closedir (dir);
+
+  if (key_index.ngrips)
+    qsort (key_index.grips, key_index.ngrips, KEYGRIP_LEN,
+           cmp_key_index_grips);
+  key_index.dir_mtime = st.st_mtime;
+  key_index.scan_time = scan_time;
+  key_index.valid = 1;
+}
+
+
+/* Check whether the secret key identified by GRIP is available.
+ * Returns 0 if the key is available.  In contrast to
+ * agent_key_available this function uses the index of the private
+ * key directory and does not need a system call per key.  It is
+ * meant for checking many keys at once; the caller must call
+ * agent_update_key_index before a batch of such checks.  */
+int
+agent_key_available_indexed (const unsigned char *grip)
+{
+  if (!key_index.valid)
+    return agent_key_available (grip);
+
+  if (!key_index.ngrips
+      || !bsearch (grip, key_index.grips, key_index.ngrips, KEYGRIP_LEN,
+                   cmp_key_index_grips))
+    return -1;
+  return 0;
+}
+
+
 /* Check whether the secret key identified by GRIP is available.
    Returns 0 is the key is available.  */
 int
@@ -1462,6 +1630,7 @@ agent_delete_key (ctrl_t ctrl, const char *desc_text,
     case PRIVATE_KEY_OPENPGP_NONE:
     case PRIVATE_KEY_PROTECTED:
       bin2hex (grip, 20, hexgrip);
+      agent_forget_cache_key (hexgrip);
       if (!force)
         {
           if (!desc_text)
@@ -60,6 +60,7 @@
 #include "../common/exechelp.h"
 #include "../common/asshelp.h"
 #include "../common/init.h"
+#include "../common/work-queue.h"
 
 
 enum cmd_and_opt_values
@@ -121,6 +122,7 @@ enum cmd_and_opt_values
   oFakedSystemTime,
 
   oIgnoreCacheForSigning,
+  oCacheUnprotectedKeys,
   oAllowMarkTrusted,
   oNoAllowMarkTrusted,
   oAllowPresetPassphrase,
@@ -139,6 +141,7 @@ enum cmd_and_opt_values
   oS2KCalibration,
   oAutoExpandSecmem,
   oListenBacklog,
+  oWorkerThreads,
 
   oWriteEnvFile,
 
@@ -222,6 +225,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDisableExtendedKeyFormat, "disable-extended-key-format", "@"),
   ARGPARSE_s_n (oEnableExtendedKeyFormat, "enable-extended-key-format", "@"),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
+  ARGPARSE_s_u (oWorkerThreads, "worker-threads", "@"),
   ARGPARSE_op_u (oAutoExpandSecmem, "auto-expand-secmem", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
 
@@ -238,6 +242,8 @@ static gpgrt_opt_t opts[] = {
                 /* */     N_("|N|set maximum SSH key lifetime to N seconds")),
   ARGPARSE_s_n (oIgnoreCacheForSigning, "ignore-cache-for-signing",
                 /* */    N_("do not use the PIN cache when signing")),
+  ARGPARSE_s_n (oCacheUnprotectedKeys, "cache-unprotected-keys",
+                /* */    N_("cache unprotected keys along with the PIN")),
   ARGPARSE_s_n (oNoAllowExternalCache,  "no-allow-external-cache",
                 /* */    N_("disallow the use of an external password cache")),
   ARGPARSE_s_n (oNoAllowMarkTrusted, "no-allow-mark-trusted",
@@ -408,6 +414,10 @@ static assuan_sock_nonce_t socket_nonce_ssh;
  * Let's try this as default.  Change at runtime with --listen-backlog.  */
 static int listen_backlog = 64;
 
+/* The number of threads used for CPU intensive crypto operations.
+ * Change at startup with --worker-threads; 0 disables them.  */
+static unsigned int worker_threads = 4;
+
 /* Default values for options passed to the pinentry. */
 static char *default_display;
 static char *default_ttyname;
@@ -858,6 +868,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.enable_passphrase_history = 0;
       opt.enable_extended_key_format = 1;
       opt.ignore_cache_for_signing = 0;
+      opt.cache_unprotected_keys = 0;
       opt.allow_mark_trusted = 1;
       opt.allow_external_cache = 1;
       opt.allow_loopback_pinentry = 1;
@@ -940,6 +951,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       break;
 
     case oIgnoreCacheForSigning: opt.ignore_cache_for_signing = 1; break;
+    case oCacheUnprotectedKeys: opt.cache_unprotected_keys = 1; break;
 
     case oAllowMarkTrusted: opt.allow_mark_trusted = 1; break;
     case oNoAllowMarkTrusted: opt.allow_mark_trusted = 0; break;
@@ -1001,7 +1013,10 @@ thread_init_once (void)
       npth_initialized++;
       npth_init ();
     }
-  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+  /* Jobs on the worker threads run without the nPth global lock and
+   * may call Libgcrypt functions using the clamp; thus we use the
+   * work queue's variants of npth_unprotect and npth_protect.  */
+  gpgrt_set_syscall_clamp (work_queue_pre_syscall, work_queue_post_syscall);
   /* Now that we have set the syscall clamp we need to tell Libgcrypt
    * that it should get them from libgpg-error.  Note that Libgcrypt
    * has already been initialized but at that point nPth was not
@@ -1022,6 +1037,7 @@ initialize_modules (void)
   initialize_module_call_pinentry ();
   initialize_module_daemon ();
   initialize_module_trustlist ();
+  initialize_module_worker (worker_threads);
 }
 
 
@@ -1275,6 +1291,10 @@ main (int argc, char **argv)
           listen_backlog = pargs.r.ret_int;
           break;
 
+        case oWorkerThreads:
+          worker_threads = pargs.r.ret_ulong;
+          break;
+
         case oDebugQuickRandom:
           /* Only used by the first stage command line parser.  */
           break;
@@ -1800,23 +1820,43 @@ agent_exit (int rc)
 }
 
 
-/* This is our callback function for gcrypt progress messages.  It is
-   set once at startup and dispatches progress messages to the
-   corresponding threads of the agent.  */
-static void
-agent_libgcrypt_progress_cb (void *data, const char *what, int printchar,
-                             int current, int total)
+/* Dispatch a progress message to the connection running in the
+ * calling thread.  */
+void
+agent_dispatch_progress (const char *what, int printchar,
+                         int current, int total)
 {
   struct progress_dispatch_s *dispatch;
   npth_t mytid = npth_self ();
 
-  (void)data;
-
   for (dispatch = progress_dispatch_list; dispatch; dispatch = dispatch->next)
     if (dispatch->ctrl && dispatch->tid == mytid)
       break;
   if (dispatch && dispatch->cb)
     dispatch->cb (dispatch->ctrl, what, printchar, current, total);
+}
+
+
+/* This is our callback function for gcrypt progress messages.  It is
+   set once at startup and dispatches progress messages to the
+   corresponding threads of the agent.  */
+static void
+agent_libgcrypt_progress_cb (void *data, const char *what, int printchar,
+                             int current, int total)
+{
+  (void)data;
+
+  /* Libgcrypt may also call us from a job on a worker thread.  Such a
+   * thread does not hold the nPth lock and is not associated with a
+   * connection; thus the message is stored with the job and
+   * dispatched later by the connection waiting for the job.  */
+  if (work_queue_in_job ())
+    {
+      worker_store_progress (what, printchar, current, total);
+      return;
+    }
+
+  agent_dispatch_progress (what, printchar, current, total);
 
   /* Libgcrypt < 1.8 does not know about nPth and thus when it reads
    * from /dev/random this will block the process.  To mitigate this
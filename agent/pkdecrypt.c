@@ -105,7 +105,7 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
 /*           gcry_sexp_dump (s_skey); */
 /*         } */
 
-      rc = gcry_pk_decrypt (&s_plain, s_cipher, s_skey);
+      rc = worker_pk_decrypt (&s_plain, s_cipher, s_skey);
       if (rc)
         {
           log_error ("decryption failed: %s\n", gpg_strerror (rc));
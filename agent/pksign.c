@@ -28,6 +28,7 @@
 
 #include "agent.h"
 #include "../common/i18n.h"
+#include "../common/host2net.h"
 
 
 static int
@@ -268,63 +269,22 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 
 
 
-/* SIGN whatever information we have accumulated in CTRL and return
- * the signature S-expression.  LOOKUP is an optional function to
- * provide a way for lower layers to ask for the caching TTL.  If a
- * CACHE_NONCE is given that cache item is first tried to get a
- * passphrase.  If OVERRIDEDATA is not NULL, OVERRIDEDATALEN bytes
- * from this buffer are used instead of the data in CTRL.  The
- * override feature is required to allow the use of Ed25519 with ssh
- * because Ed25519 does the hashing itself.  */
-gpg_error_t
-agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
-                 const char *desc_text,
-		 gcry_sexp_t *signature_sexp,
-                 cache_mode_t cache_mode, lookup_ttl_t lookup_ttl,
-                 const void *overridedata, size_t overridedatalen)
+/* Sign DATA of length DATALEN using the digest information from CTRL
+ * with the secret key S_SKEY and store the signature S-expression at
+ * R_SIG.  If SHADOW_INFO is not NULL or NO_SHADOW_INFO is set the
+ * operation is diverted to a smartcard.  */
+static gpg_error_t
+do_pksign (ctrl_t ctrl, const char *desc_text, gcry_sexp_t s_skey,
+           const unsigned char *shadow_info, int no_shadow_info,
+           const unsigned char *data, int datalen, gcry_sexp_t *r_sig)
 {
   gpg_error_t err = 0;
-  gcry_sexp_t s_skey = NULL;
   gcry_sexp_t s_sig  = NULL;
   gcry_sexp_t s_hash = NULL;
   gcry_sexp_t s_pkey = NULL;
-  unsigned char *shadow_info = NULL;
-  int no_shadow_info = 0;
-  const unsigned char *data;
-  int datalen;
   int check_signature = 0;
   int algo;
 
-  if (overridedata)
-    {
-      data = overridedata;
-      datalen = overridedatalen;
-    }
-  else if (ctrl->digest.data)
-    {
-      data = ctrl->digest.data;
-      datalen = ctrl->digest.valuelen;
-    }
-  else
-    {
-      data = ctrl->digest.value;
-      datalen = ctrl->digest.valuelen;
-    }
-
-  if (!ctrl->have_keygrip)
-    return gpg_error (GPG_ERR_NO_SECKEY);
-
-  err = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
-                             &shadow_info, cache_mode, lookup_ttl,
-                             &s_skey, NULL);
-  if (gpg_err_code (err) == GPG_ERR_NO_SECKEY)
-    no_shadow_info = 1;
-  else if (err)
-    {
-      log_error ("failed to read the secret key\n");
-      goto leave;
-    }
-
   algo = get_pk_algo_from_key (s_skey);
 
   if (shadow_info || no_shadow_info)
@@ -524,7 +484,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
         }
 
       /* sign */
-      err = gcry_pk_sign (&s_sig, s_hash, s_skey);
+      err = worker_pk_sign (&s_sig, s_hash, s_skey);
       if (err)
         {
           log_error ("signing failed: %s\n", gpg_strerror (err));
@@ -561,7 +521,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
         }
 
       if (!err)
-        err = gcry_pk_verify (s_sig, s_hash, sexp_key);
+        err = worker_pk_verify (s_sig, s_hash, sexp_key);
 
       if (err)
         {
@@ -574,11 +534,76 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 
  leave:
 
-  *signature_sexp = s_sig;
+  *r_sig = s_sig;
 
   gcry_sexp_release (s_pkey);
-  gcry_sexp_release (s_skey);
   gcry_sexp_release (s_hash);
+
+  return err;
+}
+
+
+/* SIGN whatever information we have accumulated in CTRL and return
+ * the signature S-expression.  LOOKUP is an optional function to
+ * provide a way for lower layers to ask for the caching TTL.  If a
+ * CACHE_NONCE is given that cache item is first tried to get a
+ * passphrase.  If OVERRIDEDATA is not NULL, OVERRIDEDATALEN bytes
+ * from this buffer are used instead of the data in CTRL.  The
+ * override feature is required to allow the use of Ed25519 with ssh
+ * because Ed25519 does the hashing itself.  */
+gpg_error_t
+agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
+                 const char *desc_text,
+		 gcry_sexp_t *signature_sexp,
+                 cache_mode_t cache_mode, lookup_ttl_t lookup_ttl,
+                 const void *overridedata, size_t overridedatalen)
+{
+  gpg_error_t err = 0;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_sig  = NULL;
+  unsigned char *shadow_info = NULL;
+  int no_shadow_info = 0;
+  const unsigned char *data;
+  int datalen;
+
+  if (overridedata)
+    {
+      data = overridedata;
+      datalen = overridedatalen;
+    }
+  else if (ctrl->digest.data)
+    {
+      data = ctrl->digest.data;
+      datalen = ctrl->digest.valuelen;
+    }
+  else
+    {
+      data = ctrl->digest.value;
+      datalen = ctrl->digest.valuelen;
+    }
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  err = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
+                             &shadow_info, cache_mode, lookup_ttl,
+                             &s_skey, NULL);
+  if (gpg_err_code (err) == GPG_ERR_NO_SECKEY)
+    no_shadow_info = 1;
+  else if (err)
+    {
+      log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+
+  err = do_pksign (ctrl, desc_text, s_skey, shadow_info, no_shadow_info,
+                   data, datalen, &s_sig);
+
+ leave:
+
+  *signature_sexp = s_sig;
+
+  gcry_sexp_release (s_skey);
   xfree (shadow_info);
 
   return err;
@@ -620,3 +645,118 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 
   return err;
 }
+
+
+/* Sign a batch of digests with the key set in CTRL and write the
+ * signatures to OUTBUF.  DIGESTS is a buffer of DIGESTSLEN bytes with
+ * a sequence of records each consisting of the digest algorithm
+ * number as one byte, the length of the digest as one byte and the
+ * digest itself.  For each record the signature is written as a 4
+ * byte big endian length followed by the canonical S-expression.
+ * The secret key is loaded and unprotected only once for the entire
+ * batch.  A CACHE_NONCE and CACHE_MODE are used as with agent_pksign.
+ * The digest set in CTRL is cleared.  On error the data written to
+ * OUTBUF is undefined.  */
+gpg_error_t
+agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text,
+                    const unsigned char *digests, size_t digestslen,
+                    membuf_t *outbuf, cache_mode_t cache_mode)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_sig = NULL;
+  unsigned char *shadow_info = NULL;
+  int no_shadow_info = 0;
+  char *buf = NULL;
+  size_t buflen = 0;
+  size_t len, off, n;
+  unsigned char lenbuf[4];
+  int algo;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  /* Check the records first so that we don't ask for a passphrase
+   * for a malformed or empty request.  */
+  if (!digestslen)
+    return gpg_error (GPG_ERR_NO_DATA);
+  for (off = 0; off < digestslen; off += n)
+    {
+      if (digestslen - off < 2)
+        return gpg_error (GPG_ERR_INV_LENGTH);
+      algo = digests[off];
+      n = digests[off+1];
+      off += 2;
+      if (n > digestslen - off)
+        return gpg_error (GPG_ERR_INV_LENGTH);
+      if (!algo || gcry_md_test_algo (algo))
+        return gpg_error (GPG_ERR_UNSUPPORTED_ALGORITHM);
+      if (n != 16 && n != 20 && n != 24
+          && n != 28 && n != 32 && n != 48 && n != 64)
+        return gpg_error (GPG_ERR_INV_LENGTH);
+    }
+
+  err = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
+                             &shadow_info, cache_mode, NULL,
+                             &s_skey, NULL);
+  if (gpg_err_code (err) == GPG_ERR_NO_SECKEY)
+    no_shadow_info = 1;
+  else if (err)
+    {
+      log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+
+  xfree (ctrl->digest.data);
+  ctrl->digest.data = NULL;
+  ctrl->digest.raw_value = 0;
+  ctrl->digest.is_pss = 0;
+  for (off = 0; off < digestslen; off += n)
+    {
+      ctrl->digest.algo = digests[off];
+      n = digests[off+1];
+      off += 2;
+      memcpy (ctrl->digest.value, digests + off, n);
+      ctrl->digest.valuelen = n;
+
+      err = do_pksign (ctrl, desc_text, s_skey, shadow_info, no_shadow_info,
+                       ctrl->digest.value, n, &s_sig);
+      if (err)
+        goto leave;
+
+      len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+      log_assert (len);
+      if (len > buflen)
+        {
+          xfree (buf);
+          buflen = len;
+          buf = xtrymalloc (buflen);
+          if (!buf)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+        }
+      len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, buflen);
+      log_assert (len);
+      gcry_sexp_release (s_sig);
+      s_sig = NULL;
+
+      ulongtobuf (lenbuf, len);
+      put_membuf (outbuf, lenbuf, 4);
+      put_membuf (outbuf, buf, len);
+    }
+
+ leave:
+  /* Do not leave the last digest of the batch for a following PKSIGN
+   * without a SETHASH.  */
+  ctrl->digest.valuelen = 0;
+  ctrl->digest.algo = 0;
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
+  xfree (buf);
+
+  return err;
+}
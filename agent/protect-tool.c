@@ -754,6 +754,13 @@ release_passphrase (char *pw)
 }
 
 
+/* Stub function.  We have no worker threads.  */
+void
+agent_run_job (void (*fnc)(void *opaque), void *opaque)
+{
+  fnc (opaque);
+}
+
 /* Stub function.  */
 int
 agent_key_available (const unsigned char *grip)
@@ -87,6 +87,11 @@ struct calibrate_time_s
 };
 
 
+static int
+do_hash_passphrase (const char *passphrase, int hashalgo,
+                    int s2kmode,
+                    const unsigned char *s2ksalt, unsigned long s2kcount,
+                    unsigned char *key, size_t keylen);
 static int
 hash_passphrase (const char *passphrase, int hashalgo,
                  int s2kmode,
@@ -158,9 +163,12 @@ calibrate_s2k_count_one (unsigned long count)
   char keybuf[PROT_CIPHER_KEYLEN];
   struct calibrate_time_s starttime;
 
+  /* Call do_hash_passphrase directly; the entire calibration is run
+   * as one job so that we do not measure the time waiting for a
+   * worker thread.  */
   calibrate_get_time (&starttime);
-  rc = hash_passphrase ("123456789abcdef0", GCRY_MD_SHA1,
-                        3, "saltsalt", count, keybuf, sizeof keybuf);
+  rc = do_hash_passphrase ("123456789abcdef0", GCRY_MD_SHA1,
+                           3, "saltsalt", count, keybuf, sizeof keybuf);
   if (rc)
     BUG ();
   return calibrate_elapsed_time (&starttime);
@@ -200,6 +208,16 @@ calibrate_s2k_count (void)
 }
 
 
+/* Run calibrate_s2k_count and store the result at OPAQUE.  */
+static void
+calibrate_s2k_count_job (void *opaque)
+{
+  unsigned long *r_count = opaque;
+
+  *r_count = calibrate_s2k_count ();
+}
+
+
 /* Set the calibration time.  This may be called early at startup or
  * at any time.  Thus it should one set variables.  */
 void
@@ -219,8 +237,15 @@ set_s2k_calibration_time (unsigned int milliseconds)
 unsigned long
 get_calibrated_s2k_count (void)
 {
+  unsigned long count;
+
   if (!s2k_calibrated_count)
-    s2k_calibrated_count = calibrate_s2k_count ();
+    {
+      /* The calibration takes a while; run it on a worker thread so
+       * that other connections are not blocked.  */
+      agent_run_job (calibrate_s2k_count_job, &count);
+      s2k_calibrated_count = count;
+    }
 
   /* Enforce a lower limit.  */
   return s2k_calibrated_count < 65536 ? 65536 : s2k_calibrated_count;
@@ -1445,11 +1470,11 @@ agent_private_key_type (const unsigned char *privatekey)
 
    Returns an error code on failure.  */
 static int
-hash_passphrase (const char *passphrase, int hashalgo,
-                 int s2kmode,
-                 const unsigned char *s2ksalt,
-                 unsigned long s2kcount,
-                 unsigned char *key, size_t keylen)
+do_hash_passphrase (const char *passphrase, int hashalgo,
+                    int s2kmode,
+                    const unsigned char *s2ksalt,
+                    unsigned long s2kcount,
+                    unsigned char *key, size_t keylen)
 {
   /* The key derive function does not support a zero length string for
      the passphrase in the S2K modes.  Return a better suited error
@@ -1465,6 +1490,53 @@ hash_passphrase (const char *passphrase, int hashalgo,
 }
 
 
+/* Parameters for hash_passphrase_job.  */
+struct hash_passphrase_parm_s
+{
+  const char *passphrase;
+  int hashalgo;
+  int s2kmode;
+  const unsigned char *s2ksalt;
+  unsigned long s2kcount;
+  unsigned char *key;
+  size_t keylen;
+  int rc;
+};
+
+static void
+hash_passphrase_job (void *opaque)
+{
+  struct hash_passphrase_parm_s *parm = opaque;
+
+  parm->rc = do_hash_passphrase (parm->passphrase, parm->hashalgo,
+                                 parm->s2kmode, parm->s2ksalt, parm->s2kcount,
+                                 parm->key, parm->keylen);
+}
+
+
+/* Same as do_hash_passphrase but run on a worker thread because the
+   iterated and salted S2K is designed to be slow.  */
+static int
+hash_passphrase (const char *passphrase, int hashalgo,
+                 int s2kmode,
+                 const unsigned char *s2ksalt,
+                 unsigned long s2kcount,
+                 unsigned char *key, size_t keylen)
+{
+  struct hash_passphrase_parm_s parm;
+
+  parm.passphrase = passphrase;
+  parm.hashalgo = hashalgo;
+  parm.s2kmode = s2kmode;
+  parm.s2ksalt = s2ksalt;
+  parm.s2kcount = s2kcount;
+  parm.key = key;
+  parm.keylen = keylen;
+  agent_run_job (hash_passphrase_job, &parm);
+  return parm.rc;
+}
+
+
 gpg_error_t
 s2k_hash_passphrase (const char *passphrase, int hashalgo,
                      int s2kmode,
@@ -0,0 +1,266 @@
+/* t-cache.c - Module tests for cache.c
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#define INCLUDED_BY_MAIN_MODULE 1
+#include "agent.h"
+
+
+#define pass()  do { ; } while(0)
+#define fail()  do { fprintf (stderr, "%s:%d: test failed\n",\
+                              __FILE__,__LINE__);            \
+                     exit (1);                               \
+                   } while(0)
+
+/* The faked time at the start of the tests.  */
+#define START_TIME 1600000000
+
+/* The number of items used to fill the cache; this is more than the
+ * number of hash buckets.  */
+#define NITEMS 3000
+
+
+/* Set the faked time to START_TIME plus SECONDS.  */
+static void
+set_time (int seconds)
+{
+  gnupg_set_time ((time_t)START_TIME + seconds, 1);
+}
+
+
+/* Return true if the passphrase VALUE is cached under KEY.  */
+static int
+is_cached (ctrl_t ctrl, const char *key, const char *value)
+{
+  char *pw;
+  int okay;
+
+  pw = agent_get_cache (ctrl, key, CACHE_MODE_NORMAL);
+  okay = pw && !strcmp (pw, value);
+  xfree (pw);
+  return okay;
+}
+
+
+/* Store many items so that the buckets and stripes are shared and
+ * check that all of them are found.  */
+static void
+test_many_items (ctrl_t ctrl)
+{
+  char key[40];
+  char value[40];
+  int i;
+
+  set_time (0);
+  for (i=0; i < NITEMS; i++)
+    {
+      snprintf (key, sizeof key, "KEY%04d", i);
+      snprintf (value, sizeof value, "secret-%d", i);
+      if (agent_put_cache (ctrl, key, CACHE_MODE_NORMAL, value, -1))
+        fail ();
+    }
+  for (i=0; i < NITEMS; i++)
+    {
+      snprintf (key, sizeof key, "KEY%04d", i);
+      snprintf (value, sizeof value, "secret-%d", i);
+      if (!is_cached (ctrl, key, value))
+        fail ();
+    }
+
+  /* The restricted flag is part of the key.  */
+  ctrl->restricted = 1;
+  if (is_cached (ctrl, "KEY0001", "secret-1"))
+    fail ();
+  ctrl->restricted = 0;
+
+  /* Replace and delete.  */
+  if (agent_put_cache (ctrl, "KEY0002", CACHE_MODE_NORMAL, "other", -1))
+    fail ();
+  if (!is_cached (ctrl, "KEY0002", "other"))
+    fail ();
+  if (agent_put_cache (ctrl, "KEY0003", CACHE_MODE_NORMAL, NULL, 0))
+    fail ();
+  if (is_cached (ctrl, "KEY0003", "secret-3"))
+    fail ();
+  if (!is_cached (ctrl, "KEY0004", "secret-4"))
+    fail ();
+
+  agent_flush_cache (0);
+  for (i=0; i < NITEMS; i++)
+    {
+      snprintf (key, sizeof key, "KEY%04d", i);
+      snprintf (value, sizeof value, "secret-%d", i);
+      if (is_cached (ctrl, key, value))
+        fail ();
+    }
+}
+
+
+/* Check the expiration after the last access.  */
+static void
+test_ttl (ctrl_t ctrl)
+{
+  set_time (1000);
+  if (agent_put_cache (ctrl, "TTL", CACHE_MODE_NORMAL, "ttl", 10))
+    fail ();
+  set_time (1005);
+  if (!is_cached (ctrl, "TTL", "ttl"))
+    fail ();
+  /* The access at 1005 extended the lifetime.  */
+  set_time (1014);
+  if (!is_cached (ctrl, "TTL", "ttl"))
+    fail ();
+  set_time (1025);
+  if (is_cached (ctrl, "TTL", "ttl"))
+    fail ();
+
+  /* A TTL longer than the timer wheel with a jump in time.  */
+  set_time (2000);
+  if (agent_put_cache (ctrl, "LONGTTL", CACHE_MODE_NORMAL, "long", 300))
+    fail ();
+  set_time (2299);
+  agent_cache_housekeeping ();
+  if (!is_cached (ctrl, "LONGTTL", "long"))
+    fail ();
+  set_time (2599);
+  agent_cache_housekeeping ();
+  if (!is_cached (ctrl, "LONGTTL", "long"))
+    fail ();
+  set_time (5000);
+  agent_cache_housekeeping ();
+  if (is_cached (ctrl, "LONGTTL", "long"))
+    fail ();
+}
+
+
+/* Check the expiration after the creation.  */
+static void
+test_max_ttl (ctrl_t ctrl)
+{
+  int t;
+
+  opt.max_cache_ttl = 100;
+  set_time (10000);
+  if (agent_put_cache (ctrl, "MAXTTL", CACHE_MODE_NORMAL, "max", 60))
+    fail ();
+  for (t = 10000; t <= 10100; t += 50)
+    {
+      set_time (t);
+      if (!is_cached (ctrl, "MAXTTL", "max"))
+        fail ();
+    }
+  set_time (10101);
+  if (is_cached (ctrl, "MAXTTL", "max"))
+    fail ();
+
+  /* Lowering the option applies to items already cached.  */
+  set_time (20000);
+  if (agent_put_cache (ctrl, "MAXTTL", CACHE_MODE_NORMAL, "max", -1))
+    fail ();
+  set_time (20030);
+  if (!is_cached (ctrl, "MAXTTL", "max"))
+    fail ();
+  opt.max_cache_ttl = 20;
+  set_time (20031);
+  if (is_cached (ctrl, "MAXTTL", "max"))
+    fail ();
+
+  /* Data items have no maximum lifetime.  */
+  set_time (30000);
+  if (agent_put_cache (ctrl, "DATA", CACHE_MODE_DATA, "data", 100))
+    fail ();
+  set_time (30090);
+  {
+    char *pw = agent_get_cache (ctrl, "DATA", CACHE_MODE_DATA);
+    if (!pw || strcmp (pw, "data"))
+      fail ();
+    xfree (pw);
+  }
+  opt.max_cache_ttl = 7200;
+}
+
+
+/* Check that an unprotected key shares the lifetime of the
+ * passphrase.  */
+static void
+test_cache_key (ctrl_t ctrl)
+{
+  static const unsigned char keybuf[] = "(3:foo3:bar)";
+  unsigned char *key;
+
+  set_time (40000);
+  /* Without a passphrase nothing is stored.  */
+  agent_put_cache_key (ctrl, "SKEY", CACHE_MODE_NORMAL, keybuf);
+  if (agent_get_cache_key (ctrl, "SKEY", CACHE_MODE_NORMAL))
+    fail ();
+
+  if (agent_put_cache (ctrl, "SKEY", CACHE_MODE_NORMAL, "pw", 10))
+    fail ();
+  agent_put_cache_key (ctrl, "SKEY", CACHE_MODE_NORMAL, keybuf);
+  key = agent_get_cache_key (ctrl, "SKEY", CACHE_MODE_NORMAL);
+  if (!key || memcmp (key, keybuf, sizeof keybuf - 1))
+    fail ();
+  xfree (key);
+
+  agent_forget_cache_key ("SKEY");
+  if (agent_get_cache_key (ctrl, "SKEY", CACHE_MODE_NORMAL))
+    fail ();
+  if (!is_cached (ctrl, "SKEY", "pw"))
+    fail ();
+
+  agent_put_cache_key (ctrl, "SKEY", CACHE_MODE_NORMAL, keybuf);
+  set_time (40011);
+  if (agent_get_cache_key (ctrl, "SKEY", CACHE_MODE_NORMAL))
+    fail ();
+}
+
+
+int
+main (int argc, char **argv)
+{
+  ctrl_t ctrl;
+
+  (void)argv;
+
+  opt.verbose = argc - 1;
+  opt.def_cache_ttl = 600;
+  opt.max_cache_ttl = 7200;
+  opt.max_cache_ttl_ssh = 7200;
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  npth_init ();
+  initialize_module_cache ();
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+
+  test_many_items (ctrl);
+  test_ttl (ctrl);
+  test_max_ttl (ctrl);
+  test_cache_key (ctrl);
+
+  agent_flush_cache (0);
+  deinitialize_module_cache ();
+  xfree (ctrl);
+  return 0;
+}
@@ -349,3 +349,10 @@ convert_from_openpgp_native (gcry_sexp_t s_pgp, const char *passphrase,
   (void)r_key;
   return gpg_error (GPG_ERR_BUG);
 }
+
+/* Stub function.  */
+void
+agent_run_job (void (*fnc)(void *opaque), void *opaque)
+{
+  fnc (opaque);
+}
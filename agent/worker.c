@@ -0,0 +1,283 @@
+/* worker.c - Worker threads for CPU intensive operations
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The connections of gpg-agent are handled by nPth threads which run
+ * one at a time.  A lengthy public key operation or a passphrase
+ * derivation thus blocks all other clients.  The functions here run
+ * such Libgcrypt operations on a pool of worker threads which do not
+ * hold the nPth global lock, so that they run in parallel to each
+ * other and to the connection threads.  The calling thread waits for
+ * the result while other nPth threads may run.
+ *
+ * Libgcrypt reports the progress of a key generation via a callback
+ * which is dispatched to the connection by means of the nPth thread
+ * id.  On a worker thread the events are thus stored with the job and
+ * emitted by the waiting connection thread at regular intervals.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "agent.h"
+#include "../common/work-queue.h"
+
+
+/* The number of progress events buffered by a job.  If more events
+ * arrive before they are dispatched the last one is replaced.  */
+#define MAX_PROGRESS_EVENTS 32
+
+/* The interval in milliseconds at which buffered progress events are
+ * dispatched.  */
+#define PROGRESS_INTERVAL 100
+
+
+/* The pool of worker threads or NULL if not used.  */
+static work_queue_t worker_queue;
+
+/* A thread specific key pointing to the progress buffer of the job
+ * running on a worker thread.  */
+static npth_key_t progress_key;
+
+
+/* Parameters for the public key jobs.  */
+struct pk_job_s
+{
+  gcry_sexp_t *r_result;
+  gcry_sexp_t arg1;
+  gcry_sexp_t arg2;
+  gcry_sexp_t arg3;
+  gpg_error_t err;
+};
+
+
+/* A progress event reported by Libgcrypt.  */
+struct progress_event_s
+{
+  char what[32];
+  int printchar;
+  int current;
+  int total;
+};
+
+/* The progress events of a job not yet dispatched.  The lock is a
+ * gpgrt lock because it is taken by a worker thread which does not
+ * hold the nPth lock.  */
+struct progress_buffer_s
+{
+  gpgrt_lock_t lock;
+  unsigned int nevents;
+  struct progress_event_s events[MAX_PROGRESS_EVENTS];
+};
+
+
+/* Parameters for the key generation job.  */
+struct genkey_job_s
+{
+  gcry_sexp_t *r_key;
+  gcry_sexp_t parms;
+  gpg_error_t err;
+  struct progress_buffer_s progress;
+};
+
+
+
+/* Start NTHREADS worker threads.  With NTHREADS 0 all operations are
+ * run by the calling thread.  */
+void
+initialize_module_worker (unsigned int nthreads)
+{
+  gpg_error_t err;
+  int rc;
+
+  if (!nthreads || worker_queue)
+    return;
+
+  rc = npth_key_create (&progress_key, NULL);
+  if (rc)
+    {
+      log_error ("error creating the progress key: %s\n", strerror (rc));
+      return;
+    }
+
+  err = work_queue_new (&worker_queue, nthreads);
+  if (err)
+    log_error ("error starting the worker threads: %s\n", gpg_strerror (err));
+}
+
+
+/* Run FNC with OPAQUE on a worker thread and wait for its completion.
+ * FNC must not call any nPth, Assuan or estream function.  If there
+ * are no worker threads FNC is called directly.  */
+void
+agent_run_job (void (*fnc)(void *opaque), void *opaque)
+{
+  if (!worker_queue || work_queue_run (worker_queue, fnc, opaque))
+    fnc (opaque);
+}
+
+
+static void
+pk_sign_job (void *opaque)
+{
+  struct pk_job_s *parm = opaque;
+
+  parm->err = gcry_pk_sign (parm->r_result, parm->arg1, parm->arg2);
+}
+
+
+/* Same as gcry_pk_sign but run on a worker thread.  */
+gpg_error_t
+worker_pk_sign (gcry_sexp_t *r_sig, gcry_sexp_t s_hash, gcry_sexp_t s_skey)
+{
+  struct pk_job_s parm = { r_sig, s_hash, s_skey };
+
+  agent_run_job (pk_sign_job, &parm);
+  return parm.err;
+}
+
+
+static void
+pk_verify_job (void *opaque)
+{
+  struct pk_job_s *parm = opaque;
+
+  parm->err = gcry_pk_verify (parm->arg1, parm->arg2, parm->arg3);
+}
+
+
+/* Same as gcry_pk_verify but run on a worker thread.  */
+gpg_error_t
+worker_pk_verify (gcry_sexp_t s_sig, gcry_sexp_t s_hash, gcry_sexp_t s_pkey)
+{
+  struct pk_job_s parm = { NULL, s_sig, s_hash, s_pkey };
+
+  agent_run_job (pk_verify_job, &parm);
+  return parm.err;
+}
+
+
+static void
+pk_decrypt_job (void *opaque)
+{
+  struct pk_job_s *parm = opaque;
+
+  parm->err = gcry_pk_decrypt (parm->r_result, parm->arg1, parm->arg2);
+}
+
+
+/* Same as gcry_pk_decrypt but run on a worker thread.  */
+gpg_error_t
+worker_pk_decrypt (gcry_sexp_t *r_plain, gcry_sexp_t s_cipher,
+                   gcry_sexp_t s_skey)
+{
+  struct pk_job_s parm = { r_plain, s_cipher, s_skey };
+
+  agent_run_job (pk_decrypt_job, &parm);
+  return parm.err;
+}
+
+
+/* Store a progress event reported by Libgcrypt while running a job.
+ * This is called on the worker thread; events of jobs without a
+ * progress buffer are ignored.  */
+void
+worker_store_progress (const char *what, int printchar,
+                       int current, int total)
+{
+  struct progress_buffer_s *pb;
+  struct progress_event_s *ev;
+
+  if (!worker_queue || !(pb = npth_getspecific (progress_key)))
+    return;
+
+  gpgrt_lock_lock (&pb->lock);
+  if (pb->nevents < MAX_PROGRESS_EVENTS)
+    pb->nevents++;
+  ev = pb->events + pb->nevents - 1;
+  if (what)
+    {
+      strncpy (ev->what, what, sizeof ev->what - 1);
+      ev->what[sizeof ev->what - 1] = 0;
+    }
+  else
+    *ev->what = 0;
+  ev->printchar = printchar;
+  ev->current = current;
+  ev->total = total;
+  gpgrt_lock_unlock (&pb->lock);
+}
+
+
+/* Dispatch the buffered progress events of the job's progress buffer
+ * OPAQUE to the connection of the calling thread.  */
+static void
+dispatch_progress (void *opaque)
+{
+  struct progress_buffer_s *pb = opaque;
+  struct progress_event_s events[MAX_PROGRESS_EVENTS];
+  unsigned int nevents, i;
+
+  gpgrt_lock_lock (&pb->lock);
+  nevents = pb->nevents;
+  memcpy (events, pb->events, nevents * sizeof *events);
+  pb->nevents = 0;
+  gpgrt_lock_unlock (&pb->lock);
+
+  for (i=0; i < nevents; i++)
+    agent_dispatch_progress (*events[i].what? events[i].what : NULL,
+                             events[i].printchar,
+                             events[i].current, events[i].total);
+}
+
+
+static void
+pk_genkey_job (void *opaque)
+{
+  struct genkey_job_s *parm = opaque;
+
+  if (worker_queue)
+    npth_setspecific (progress_key, &parm->progress);
+  parm->err = gcry_pk_genkey (parm->r_key, parm->parms);
+  if (worker_queue)
+    npth_setspecific (progress_key, NULL);
+}
+
+
+/* Same as gcry_pk_genkey but run on a worker thread.  The progress of
+ * the key generation is relayed to the connection.  */
+gpg_error_t
+worker_pk_genkey (gcry_sexp_t *r_key, gcry_sexp_t s_parms)
+{
+  struct genkey_job_s parm;
+
+  memset (&parm, 0, sizeof parm);
+  parm.r_key = r_key;
+  parm.parms = s_parms;
+  gpgrt_lock_init (&parm.progress.lock);
+  if (!worker_queue
+      || work_queue_run_poll (worker_queue, pk_genkey_job, &parm,
+                              PROGRESS_INTERVAL,
+                              dispatch_progress, &parm.progress))
+    pk_genkey_job (&parm);
+  gpgrt_lock_destroy (&parm.progress.lock);
+  return parm.err;
+}
@@ -106,6 +106,17 @@ b64dec_proc (struct b64state *state, void *buffer, size_t length,
 
   for (s=d=buffer; length && !state->stop_seen; length--, s++)
     {
+      if (ds == s_b64_0 && length >= 4)
+        {
+          /* Fast path for runs of complete groups.  */
+          size_t used;
+
+          d += radix64_decode (d, s, length, &used);
+          s += used;
+          length -= used;
+          if (!length)
+            break;
+        }
     again:
       switch (ds)
         {
@@ -197,6 +197,18 @@ my_fputs (const char *string, struct b64state *state)
 }
 
 
+/* Write the LENGTH bytes at BUFFER to the output of STATE.  Returns
+   true on error.  */
+static int
+my_fwrite (const void *buffer, size_t length, struct b64state *state)
+{
+  if (state->stream)
+    return es_fwrite (buffer, length, 1, state->stream) != 1;
+  else
+    return fwrite (buffer, length, 1, state->fp) != 1;
+}
+
+
 /* Write NBYTES from BUFFER to the Base 64 stream identified by
    STATE. With BUFFER and NBYTES being 0, merely do a fflush on the
    stream. */
@@ -204,8 +216,10 @@ gpg_error_t
 b64enc_write (struct b64state *state, const void *buffer, size_t nbytes)
 {
   unsigned char radbuf[4];
+  char line[64+1];
   int idx, quad_count;
   const unsigned char *p;
+  size_t n, ngroups;
 
   if (state->lasterr)
     return state->lasterr;
@@ -249,41 +263,38 @@ b64enc_write (struct b64state *state, const void *buffer, size_t nbytes)
       state->crc = (crc & 0x00ffffff);
     }
 
-  for (p=buffer; nbytes; p++, nbytes--)
+  for (p=buffer; nbytes; )
     {
-      radbuf[idx++] = *p;
-      if (idx > 2)
+      if (idx || nbytes < 3)
         {
-          char tmp[4];
-
-          tmp[0] = bintoasc[(*radbuf >> 2) & 077];
-          tmp[1] = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
-          tmp[2] = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-          tmp[3] = bintoasc[radbuf[2]&077];
-          if (state->stream)
-            {
-              for (idx=0; idx < 4; idx++)
-                es_putc (tmp[idx], state->stream);
-              idx = 0;
-              if (es_ferror (state->stream))
-                goto write_error;
-            }
-          else
-            {
-              for (idx=0; idx < 4; idx++)
-                putc (tmp[idx], state->fp);
-              idx = 0;
-              if (ferror (state->fp))
-                goto write_error;
-            }
-          if (++quad_count >= (64/4))
-            {
-              quad_count = 0;
-              if (!(state->flags & B64ENC_NO_LINEFEEDS)
-                  && my_fputs ("\n", state) == EOF)
-                goto write_error;
-            }
+          /* Collect the bytes of an incomplete group.  */
+          radbuf[idx++] = *p++;
+          nbytes--;
+          if (idx < 3)
+            continue;
+          n = radix64_encode (line, radbuf, 3);
+          idx = 0;
+          ngroups = 1;
         }
+      else
+        {
+          /* Encode as much as fits into the current line.  */
+          ngroups = (64/4) - quad_count;
+          if (ngroups > nbytes / 3)
+            ngroups = nbytes / 3;
+          n = radix64_encode (line, p, 3 * ngroups);
+          p += 3 * ngroups;
+          nbytes -= 3 * ngroups;
+        }
+      quad_count += ngroups;
+      if (quad_count >= (64/4))
+        {
+          quad_count = 0;
+          if (!(state->flags & B64ENC_NO_LINEFEEDS))
+            line[n++] = '\n';
+        }
+      if (my_fwrite (line, n, state))
+        goto write_error;
     }
   memcpy (state->radbuf, radbuf, idx);
   state->idx = idx;
@@ -310,7 +321,10 @@ b64enc_finish (struct b64state *state)
   char tmp[4];
 
   if (state->lasterr)
-    return state->lasterr;
+    {
+      err = state->lasterr;
+      goto cleanup;
+    }
 
   if (!(state->flags & B64ENC_DID_HEADER))
     goto cleanup;
@@ -40,6 +40,12 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -72,6 +78,11 @@
  * iobuf_set_buffer_size function.  */
 static unsigned int iobuf_buffer_size = DEFAULT_IOBUF_BUFFER_SIZE;
 
+/* Regular files of at least this size are mapped into memory instead
+ * of being read into the buffer.  0 disables the use of mmap.  This
+ * can be changed using the iobuf_set_mmap_threshold function.  */
+static off_t iobuf_mmap_threshold;
+
 
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_W32CE_SYSTEM
@@ -165,6 +176,7 @@ block_filter_ctx_t;
 static int underflow (iobuf_t a, int clear_pending_eof);
 static int underflow_target (iobuf_t a, int clear_pending_eof, size_t target);
 static int translate_file_handle (int fd, int for_write);
+static void unmap_buffer (iobuf_t a);
 
 /* Sends any pending data to the filter's FILTER function.  Note: this
    works on the filter and not on the whole pipeline.  That is,
@@ -1151,6 +1163,19 @@ iobuf_set_buffer_size (unsigned int kilobyte)
 }
 
 
+/* Change the minimum size of regular files which are read using a
+ * memory mapping to MEGABYTE MiB.  Using 0 disables mmap.  Returns
+ * the previous value.  */
+unsigned int
+iobuf_set_mmap_threshold (unsigned int megabyte)
+{
+  unsigned int old = (unsigned int)(iobuf_mmap_threshold / (1024*1024));
+
+  iobuf_mmap_threshold = (off_t)megabyte * 1024 * 1024;
+  return old;
+}
+
+
 #define MAX_IOBUF_DESC 32
 /*
  * Fill the buffer by the description of iobuf A.
@@ -1246,7 +1271,13 @@ iobuf_close (iobuf_t a)
 	rc = rc2;
 
       xfree (a->real_fname);
-      if (a->d.buf)
+      if (a->d.mapped)
+        {
+#ifdef HAVE_MMAP
+          munmap (a->d.buf, a->d.size);
+#endif
+        }
+      else if (a->d.buf)
 	{
 	  memset (a->d.buf, 0, a->d.size);	/* erase the buffer */
 	  xfree (a->d.buf);
@@ -1340,6 +1371,94 @@ iobuf_is_pipe_filename (const char *fname)
 }
 
 
+/* Try to replace the buffer of the file filter A, which reads the
+ * file described by FCX, by a read-only memory mapping of the entire
+ * file.  This is only done for regular files larger than the mmap
+ * threshold.  The file pointer is moved to the end of the mapped area
+ * so that the file filter returns EOF, or data appended to the file
+ * after it has been mapped, once the mapped image has been consumed.
+ * On any error A is not changed and the standard read path is used.  */
+static void
+map_file (iobuf_t a, file_filter_ctx_t *fcx)
+{
+#ifdef HAVE_MMAP
+  struct stat st;
+  size_t maplen;
+  void *map;
+
+  if (!iobuf_mmap_threshold)
+    return;
+
+  if (fstat (FD2INT (fcx->fp), &st) || !S_ISREG (st.st_mode)
+      || st.st_size < iobuf_mmap_threshold)
+    return;
+  maplen = (size_t)st.st_size;
+  if ((off_t)maplen != st.st_size)
+    return;  /* Does not fit into our address space.  */
+
+  /* The file pointer of a fresh or cached fd is at the start.  */
+  if (lseek (FD2INT (fcx->fp), 0, SEEK_CUR) != 0)
+    return;
+
+  map = mmap (NULL, maplen, PROT_READ, MAP_PRIVATE, FD2INT (fcx->fp), 0);
+  if (map == MAP_FAILED)
+    {
+      if (DBG_IOBUF)
+        log_debug ("%s: mmap failed: %s\n", fcx->fname, strerror (errno));
+      return;
+    }
+  if (lseek (FD2INT (fcx->fp), st.st_size, SEEK_SET) == (off_t)(-1))
+    {
+      log_error ("%s: can't lseek: %s\n", fcx->fname, strerror (errno));
+      munmap (map, maplen);
+      return;
+    }
+#ifdef MADV_SEQUENTIAL
+  madvise (map, maplen, MADV_SEQUENTIAL);
+#endif
+
+  xfree (a->d.buf);
+  a->d.buf = map;
+  a->d.size = maplen;
+  a->d.len = maplen;
+  a->d.start = 0;
+  a->d.mapped = 1;
+  if (DBG_IOBUF)
+    log_debug ("iobuf-%d.%d: mapped %lu bytes of '%s'\n",
+               a->no, a->subno, (ulong)maplen, fcx->fname);
+#else /*!HAVE_MMAP*/
+  (void)a;
+  (void)fcx;
+#endif /*!HAVE_MMAP*/
+}
+
+
+/* Replace the mapped buffer of A by a standard buffer.  Data which
+ * has not yet been consumed is copied to the new buffer.  */
+static void
+unmap_buffer (iobuf_t a)
+{
+  size_t rest = a->d.len - a->d.start;
+  size_t size = iobuf_buffer_size;
+  byte *buf;
+
+  log_assert (a->d.mapped);
+
+  if (size < rest)
+    size = rest;
+  buf = xmalloc (size);
+  memcpy (buf, a->d.buf + a->d.start, rest);
+#ifdef HAVE_MMAP
+  munmap (a->d.buf, a->d.size);
+#endif
+  a->d.buf = buf;
+  a->d.size = size;
+  a->d.start = 0;
+  a->d.len = rest;
+  a->d.mapped = 0;
+}
+
+
 static iobuf_t
 do_open (const char *fname, int special_filenames,
 	 int use, const char *opentype, int mode700)
@@ -1396,6 +1515,8 @@ do_open (const char *fname, int special_filenames,
   a->filter = file_filter;
   a->filter_ov = fcx;
   file_filter (fcx, IOBUFCTRL_INIT, NULL, NULL, &len);
+  if (use == IOBUF_INPUT && !print_only)
+    map_file (a, fcx);
   if (DBG_IOBUF)
     log_debug ("iobuf-%d.%d: open '%s' desc=%s fd=%d\n",
 	       a->no, a->subno, fname, iobuf_desc (a, desc), FD2INT (fcx->fp));
@@ -1708,6 +1829,12 @@ iobuf_push_filter2 (iobuf_t a,
       a->use = IOBUF_INPUT;
       a->d.size = iobuf_buffer_size;
     }
+  else if (a->d.mapped)
+    /* The mapping stays with the file filter (B).  */
+    {
+      a->d.mapped = 0;
+      a->d.size = iobuf_buffer_size;
+    }
 
   /* The new filter (A) gets a new buffer.
 
@@ -1875,6 +2002,12 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 
   assert (a->use == IOBUF_INPUT);
 
+  /* The mapped image of a file has been consumed (or we are asked to
+     peek beyond its end).  Switch to a standard buffer so that the
+     file filter can check for EOF or for appended data.  */
+  if (a->d.mapped)
+    unmap_buffer (a);
+
   /* If there is still some buffered data, then move it to the start
      of the buffer and try to fill the end of the buffer.  (This is
      useful if we are called from iobuf_peek().)  */
@@ -2171,8 +2304,8 @@ iobuf_peek (iobuf_t a, byte * buf, unsigned buflen)
     buflen = a->d.size;
 
   /* Try to fill the internal buffer with enough data to satisfy the
-     request.  */
-  while (buflen > a->d.len - a->d.start)
+     request.  A mapped buffer already holds the entire file.  */
+  while (!a->d.mapped && buflen > a->d.len - a->d.start)
     {
       if (underflow_target (a, 0, buflen) == -1)
 	/* EOF.  We can't read any more.  */
@@ -2537,6 +2670,11 @@ iobuf_seek (iobuf_t a, off_t newpos)
 	}
 #endif
       /* Discard the buffer it is not a temp stream.  */
+      if (a->d.mapped)
+        {
+          a->d.start = a->d.len;
+          unmap_buffer (a);
+        }
       a->d.len = 0;
     }
   a->d.start = 0;
@@ -200,6 +200,10 @@ struct iobuf_struct
     size_t len;
     /* The buffer itself.  */
     byte *buf;
+    /* If set, BUF is a read-only memory mapping of the entire file
+       read by the file filter (see iobuf_set_mmap_threshold).  Such a
+       buffer may only be released using munmap.  */
+    int mapped;
   } d;
 
   /* When FILTER is called to read some data, it may read some data
@@ -258,6 +262,14 @@ extern int iobuf_debug_mode;
  * returning the current value.  */
 unsigned int iobuf_set_buffer_size (unsigned int kilobyte);
 
+/* Read regular files opened by iobuf_open which are at least
+ * MEGABYTE MiB large via a read-only memory mapping instead of
+ * read(2).  The filters above such a file filter then directly read
+ * from the mapped image of the file.  Using 0 disables this, which is
+ * the default.  Pipes, sockets and other special files are never
+ * mapped.  Returns the previous value.  */
+unsigned int iobuf_set_mmap_threshold (unsigned int megabyte);
+
 /* Returns whether the specified filename corresponds to a pipe.  In
    particular, this function checks if FNAME is "-" and, if special
    filenames are enabled (see check_special_filename), whether
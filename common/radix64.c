@@ -0,0 +1,160 @@
+/* radix64.c - Bulk Radix-64 (Base64) conversion
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+/* The functions here convert complete groups of 3 binary bytes or 4
+ * Radix-64 characters and are used by the Base64 and armor code for
+ * the bulk of their data.  Line breaks, padding, and invalid
+ * characters are left to the callers' state machines.  */
+
+#include <config.h>
+#include <stdlib.h>
+
+#include "util.h"
+
+
+/* The Radix-64 character set.  */
+static const unsigned char bintoasc[64] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+  "abcdefghijklmnopqrstuvwxyz"
+  "0123456789+/";
+
+/* The reverse table.  All invalid characters map to 0xff so that a
+ * single test of the high bit of the ORed values of a group
+ * detects any invalid character.  */
+static const unsigned char asctobin[256] =
+  {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+    0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+    0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+  };
+
+
+/* Encode the NBYTES of binary data at IN to Radix-64 and store the
+ * result at OUT, which needs room for 4/3 of NBYTES characters.
+ * Only complete groups of 3 bytes are encoded; trailing bytes are
+ * ignored.  No line breaks, padding or Nul is written.  Returns the
+ * number of characters stored at OUT.  */
+size_t
+radix64_encode (char *out, const void *in, size_t nbytes)
+{
+  const unsigned char *s = in;
+  char *d = out;
+  u32 v, w;
+
+  /* Two groups at once to keep more loads in flight.  */
+  for (; nbytes >= 6; nbytes -= 6, s += 6, d += 8)
+    {
+      v = ((u32)s[0] << 16) | ((u32)s[1] << 8) | s[2];
+      w = ((u32)s[3] << 16) | ((u32)s[4] << 8) | s[5];
+      d[0] = bintoasc[(v >> 18) & 077];
+      d[1] = bintoasc[(v >> 12) & 077];
+      d[2] = bintoasc[(v >>  6) & 077];
+      d[3] = bintoasc[ v        & 077];
+      d[4] = bintoasc[(w >> 18) & 077];
+      d[5] = bintoasc[(w >> 12) & 077];
+      d[6] = bintoasc[(w >>  6) & 077];
+      d[7] = bintoasc[ w        & 077];
+    }
+  if (nbytes >= 3)
+    {
+      v = ((u32)s[0] << 16) | ((u32)s[1] << 8) | s[2];
+      d[0] = bintoasc[(v >> 18) & 077];
+      d[1] = bintoasc[(v >> 12) & 077];
+      d[2] = bintoasc[(v >>  6) & 077];
+      d[3] = bintoasc[ v        & 077];
+      d += 4;
+    }
+
+  return d - out;
+}
+
+
+/* Decode the Radix-64 characters at IN of length INLEN and store the
+ * binary result at OUT, which needs room for 3/4 of INLEN bytes.
+ * Decoding stops at the first group of 4 characters which contains a
+ * character not in the Radix-64 set (this includes white space and
+ * the pad character) or if less than 4 characters are left.  The
+ * number of consumed characters is stored at R_USED and the number
+ * of bytes stored at OUT is returned.  OUT may be the same as IN for
+ * in-place decoding.  */
+size_t
+radix64_decode (void *out, const void *in, size_t inlen, size_t *r_used)
+{
+  const unsigned char *s = in;
+  unsigned char *d = out;
+  u32 a, b, c, e;
+  u32 v;
+
+  for (; inlen >= 4; inlen -= 4, s += 4, d += 3)
+    {
+      a = asctobin[s[0]];
+      b = asctobin[s[1]];
+      c = asctobin[s[2]];
+      e = asctobin[s[3]];
+      if (((a | b | c | e) & 0x80))
+        break;
+      v = (a << 18) | (b << 12) | (c << 6) | e;
+      d[0] = v >> 16;
+      d[1] = v >> 8;
+      d[2] = v;
+    }
+
+  *r_used = s - (const unsigned char *)in;
+  return d - (unsigned char *)out;
+}
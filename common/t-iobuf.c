@@ -390,5 +390,62 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Read a file large enough to be memory mapped through a filter,
+     peek at it and seek in it.  */
+  {
+    const char *fname = "t-iobuf-mmap.tmp";
+    size_t size = 1024 * 1024 + 17;
+    unsigned char *content;
+    unsigned char buffer[16];
+    FILE *fp;
+    iobuf_t iobuf;
+    size_t i, n;
+    int c, rc;
+
+    content = malloc (size);
+    assert (content);
+    for (i = 0; i < size; i++)
+      content[i] = i % 251;
+    fp = fopen (fname, "wb");
+    assert (fp);
+    assert (fwrite (content, size, 1, fp) == 1);
+    fclose (fp);
+
+    iobuf_set_mmap_threshold (1);
+
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    n = iobuf_peek (iobuf, buffer, sizeof buffer);
+    assert (n == sizeof buffer);
+    assert (!memcmp (buffer, content, n));
+    rc = iobuf_seek (iobuf, size - 3);
+    assert (rc == 0);
+    n = iobuf_read (iobuf, buffer, sizeof buffer);
+    assert (n == 3);
+    assert (!memcmp (buffer, content + size - 3, 3));
+    iobuf_close (iobuf);
+
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    for (n = 0; (c = iobuf_get (iobuf)) != -1; n++)
+      assert (c == content[n]);
+    assert (n == size);
+    assert (iobuf_get (iobuf) == -1);
+    iobuf_close (iobuf);
+
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    rc = iobuf_push_filter (iobuf, every_other_filter, NULL);
+    assert (rc == 0);
+    for (n = 0; (c = iobuf_get (iobuf)) != -1; n++)
+      assert (c == content[2 * n + 1]);
+    assert (n == size / 2);
+    iobuf_close (iobuf);
+
+    iobuf_set_mmap_threshold (0);
+    remove (fname);
+    free (content);
+  }
+
   return 0;
 }
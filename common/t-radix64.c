@@ -0,0 +1,202 @@
+/* t-radix64.c - Module tests for radix64.c
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#define PGM "t-radix64"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (int)(a));     \
+                     errcount++;                                 \
+                   } while(0)
+
+static int verbose;
+static int errcount;
+
+
+static void
+test_radix64_encode (void)
+{
+  static struct {
+    size_t datalen;
+    const char *data;
+    const char *expected;
+  } tests[] = {
+    { 0, "", "" },
+    { 1, "f", "" },
+    { 2, "fo", "" },
+    { 3, "foo", "Zm9v" },
+    { 4, "foob", "Zm9v" },
+    { 5, "fooba", "Zm9v" },
+    { 6, "foobar", "Zm9vYmFy" },
+    { 7, "foobarx", "Zm9vYmFy" },
+    { 9, "\xff\xfe\xfd\x00\x01\x02\x3e\x3f\x40", "//79AAECPj9A" }
+  };
+  int tidx;
+  char out[64];
+  size_t n;
+
+  for (tidx = 0; tidx < DIM(tests); tidx++)
+    {
+      n = radix64_encode (out, tests[tidx].data, tests[tidx].datalen);
+      if (n != strlen (tests[tidx].expected)
+          || memcmp (out, tests[tidx].expected, n))
+        fail (tidx);
+    }
+}
+
+
+static void
+test_radix64_decode (void)
+{
+  static struct {
+    const char *data;
+    size_t used;
+    size_t len;
+    const char *expected;
+  } tests[] = {
+    { "",          0, 0, "" },
+    { "Zm9",       0, 0, "" },
+    { "Zm9v",      4, 3, "foo" },
+    { "Zm9vYmFy",  8, 6, "foobar" },
+    { "Zm9vYmE=",  4, 3, "foo" },
+    { "Zm9v\nYmFy", 4, 3, "foo" },
+    { "Zm9vYm-y",  4, 3, "foo" },
+    { "Zm9vYm\xc1y",  4, 3, "foo" },
+    { "Zm9vYmFyZ", 8, 6, "foobar" },
+    { "//79AAECPj9A", 12, 9, "\xff\xfe\xfd\x00\x01\x02\x3e\x3f\x40" }
+  };
+  int tidx;
+  char out[64];
+  size_t n, used;
+
+  for (tidx = 0; tidx < DIM(tests); tidx++)
+    {
+      n = radix64_decode (out, tests[tidx].data, strlen (tests[tidx].data),
+                          &used);
+      if (n != tests[tidx].len || used != tests[tidx].used
+          || memcmp (out, tests[tidx].expected, n))
+        fail (tidx);
+    }
+}
+
+
+/* Check that encoding and in-place decoding of random data of
+ * various lengths round trips.  */
+static void
+test_roundtrip (void)
+{
+  unsigned char data[3*100];
+  char enc[4*100];
+  size_t len, n, m, used;
+  int i;
+
+  for (i=0; i < sizeof data; i++)
+    data[i] = rand ();
+
+  for (len = 0; len <= sizeof data; len += 3)
+    {
+      n = radix64_encode (enc, data, len);
+      if (n != len / 3 * 4)
+        fail (len);
+      m = radix64_decode (enc, enc, n, &used);
+      if (m != len || used != n || memcmp (enc, data, len))
+        fail (len);
+    }
+}
+
+
+/* Check that an OpenPGP armor created with b64enc carries the
+ * correct CRC.  */
+static void
+test_b64enc_crc (void)
+{
+  static const char expected[] =
+    "-----BEGIN PGP MESSAGE-----\n"
+    "\n"
+    "SGVsbG8sIHdvcmxkIQo=\n"
+    "=nIBy\n"
+    "-----END PGP MESSAGE-----\n";
+  gpg_error_t err;
+  struct b64state state;
+  estream_t fp;
+  void *result;
+  size_t resultlen;
+
+  fp = es_fopenmem (0, "w+b");
+  if (!fp)
+    {
+      fprintf (stderr, PGM": es_fopenmem failed: %s\n",
+               gpg_strerror (gpg_error_from_syserror ()));
+      exit (1);
+    }
+  err = b64enc_start_es (&state, fp, "PGP MESSAGE");
+  if (!err)
+    err = b64enc_write (&state, "Hello, ", 7);
+  if (!err)
+    err = b64enc_write (&state, "world!\n", 7);
+  if (!err)
+    err = b64enc_finish (&state);
+  if (err)
+    fail (1);
+  else if (es_fclose_snatch (fp, &result, &resultlen))
+    fail (2);
+  else
+    {
+      if (verbose)
+        printf ("%.*s", (int)resultlen, (char *)result);
+      if (resultlen != strlen (expected)
+          || memcmp (result, expected, resultlen))
+        fail (3);
+      es_free (result);
+      fp = NULL;
+    }
+  es_fclose (fp);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  test_radix64_encode ();
+  test_radix64_decode ();
+  test_roundtrip ();
+  test_b64enc_crc ();
+
+  return !!errcount;
+}
@@ -0,0 +1,208 @@
+/* t-work-queue.c - Regression tests for work-queue.c
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute and/or modify this
+ * part of GnuPG under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * GnuPG is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copies of the GNU General Public License
+ * and the GNU Lesser General Public License along with this program;
+ * if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "work-queue.h"
+
+#include "t-support.h"
+
+
+struct job_s
+{
+  unsigned int n;
+  unsigned long result;
+};
+
+
+static void
+sum_job (void *opaque)
+{
+  struct job_s *job = opaque;
+  unsigned int i;
+
+  job->result = 0;
+  for (i=1; i <= job->n; i++)
+    job->result += i;
+}
+
+
+static void
+test_work_queue (unsigned int nthreads)
+{
+  gpg_error_t err;
+  work_queue_t wq;
+  struct job_s jobs[100];
+  int round, i;
+
+  err = work_queue_new (&wq, nthreads);
+  if (err)
+    fail (1);
+  if (work_queue_nthreads (wq) != nthreads)
+    fail (2);
+
+  /* Run several batches to check that the threads are reused.  */
+  for (round=0; round < 3; round++)
+    {
+      for (i=0; i < DIM (jobs); i++)
+        {
+          jobs[i].n = 1000 * (i + round);
+          jobs[i].result = 1;
+          err = work_queue_add (wq, sum_job, jobs + i);
+          if (err)
+            fail (3);
+        }
+      work_queue_wait (wq);
+      for (i=0; i < DIM (jobs); i++)
+        if (jobs[i].result
+            != (unsigned long)jobs[i].n * (jobs[i].n + 1) / 2)
+          fail (4);
+    }
+
+  /* Releasing waits for the pending jobs.  */
+  for (i=0; i < DIM (jobs); i++)
+    {
+      jobs[i].n = 100;
+      jobs[i].result = 0;
+      err = work_queue_add (wq, sum_job, jobs + i);
+      if (err)
+        fail (5);
+    }
+  work_queue_release (wq);
+  for (i=0; i < DIM (jobs); i++)
+    if (jobs[i].result != 5050)
+      fail (6);
+}
+
+
+/* The thread for test_work_queue_run.  */
+static void *
+run_thread (void *arg)
+{
+  work_queue_t wq = arg;
+  struct job_s job;
+  int i;
+
+  for (i=0; i < 20; i++)
+    {
+      job.n = 1000 + i;
+      job.result = 0;
+      if (work_queue_run (wq, sum_job, &job))
+        fail (10);
+      if (job.result != (unsigned long)job.n * (job.n + 1) / 2)
+        fail (11);
+    }
+  return NULL;
+}
+
+
+/* Check that several threads may run jobs at the same time.  */
+static void
+test_work_queue_run (unsigned int nthreads)
+{
+  gpg_error_t err;
+  work_queue_t wq;
+  npth_attr_t tattr;
+  npth_t threads[8];
+  int i;
+
+  err = work_queue_new (&wq, nthreads);
+  if (err)
+    fail (1);
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i=0; i < DIM (threads); i++)
+    if (npth_create (&threads[i], &tattr, run_thread, wq))
+      fail (2);
+  npth_attr_destroy (&tattr);
+  for (i=0; i < DIM (threads); i++)
+    npth_join (threads[i], NULL);
+
+  work_queue_release (wq);
+}
+
+
+static void
+count_poll (void *opaque)
+{
+  int *npolls = opaque;
+
+  (*npolls)++;
+}
+
+
+/* Check that the poll function is called while waiting and at the
+ * end.  */
+static void
+test_work_queue_run_poll (void)
+{
+  gpg_error_t err;
+  work_queue_t wq;
+  struct job_s job;
+  int npolls = 0;
+
+  err = work_queue_new (&wq, 2);
+  if (err)
+    fail (1);
+
+  job.n = 1000000;
+  job.result = 0;
+  err = work_queue_run_poll (wq, sum_job, &job, 1, count_poll, &npolls);
+  if (err)
+    fail (2);
+  if (job.result != (unsigned long)job.n * (job.n + 1) / 2)
+    fail (3);
+  if (npolls < 1)
+    fail (4);
+
+  work_queue_release (wq);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  npth_init ();
+
+  test_work_queue (1);
+  test_work_queue (4);
+  test_work_queue_run (1);
+  test_work_queue_run (3);
+  test_work_queue_run_poll ();
+
+  return 0;
+}
@@ -172,6 +172,11 @@ gpg_error_t b64dec_proc (struct b64state *state, void *buffer, size_t length,
                          size_t *r_nbytes);
 gpg_error_t b64dec_finish (struct b64state *state);
 
+/*-- radix64.c --*/
+size_t radix64_encode (char *out, const void *in, size_t nbytes);
+size_t radix64_decode (void *out, const void *in, size_t inlen,
+                       size_t *r_used);
+
 /*-- sexputil.c */
 char *canon_sexp_to_string (const unsigned char *canon, size_t canonlen);
 void log_printcanon (const char *text,
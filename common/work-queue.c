@@ -0,0 +1,405 @@
+/* work-queue.c - A pool of worker threads for CPU bound jobs
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <npth.h>
+
+#include "util.h"
+#include "work-queue.h"
+
+
+/* The hard limit for the number of worker threads.  */
+#define MAX_WORKER_THREADS 256
+
+
+/* A thread specific key which is set while a worker thread runs a
+ * job and thus does not hold the nPth global lock.  */
+static npth_key_t job_key;
+static int job_key_created;
+
+
+/* An item in the list of jobs.  */
+struct job_item_s
+{
+  struct job_item_s *next;
+  work_queue_job_t fnc;
+  void *opaque;
+  int *r_done;  /* If not NULL set to true when the job has finished.  */
+};
+typedef struct job_item_s *job_item_t;
+
+
+/* The object describing a work queue.  */
+struct work_queue_s
+{
+  /* This lock protects all fields below.  */
+  npth_mutex_t lock;
+
+  /* Signaled when a new job has been queued or the workers shall
+   * terminate.  */
+  npth_cond_t job_cond;
+
+  /* Signaled when the last pending job or a job started by
+   * work_queue_run has been finished.  */
+  npth_cond_t done_cond;
+
+  /* The queue of jobs not yet started.  */
+  job_item_t jobs;
+  job_item_t *jobs_tail;
+
+  /* Items of finished jobs ready for reuse.  */
+  job_item_t unused;
+
+  /* The number of queued or running jobs.  */
+  unsigned int pending;
+
+  /* Set to tell the worker threads to terminate.  */
+  int stop;
+
+  /* The number of started worker threads and their ids.  */
+  unsigned int nthreads;
+  npth_t *threads;
+};
+
+
+
+/* The worker thread.  */
+static void *
+worker_thread (void *arg)
+{
+  work_queue_t wq = arg;
+  job_item_t item;
+
+  npth_mutex_lock (&wq->lock);
+  for (;;)
+    {
+      while (!wq->jobs && !wq->stop)
+        npth_cond_wait (&wq->job_cond, &wq->lock);
+      if (!wq->jobs)
+        break; /* Stop requested and no more jobs.  */
+
+      item = wq->jobs;
+      wq->jobs = item->next;
+      if (!wq->jobs)
+        wq->jobs_tail = &wq->jobs;
+      npth_mutex_unlock (&wq->lock);
+
+      /* Run the job outside of the global lock so that it does not
+       * block the other threads.  */
+      npth_unprotect ();
+      npth_setspecific (job_key, wq);
+      item->fnc (item->opaque);
+      npth_setspecific (job_key, NULL);
+      npth_protect ();
+
+      npth_mutex_lock (&wq->lock);
+      if (item->r_done)
+        *item->r_done = 1;
+      if (!--wq->pending || item->r_done)
+        npth_cond_broadcast (&wq->done_cond);
+      item->next = wq->unused;
+      wq->unused = item;
+    }
+  npth_mutex_unlock (&wq->lock);
+
+  return NULL;
+}
+
+
+/* Create a new work queue with NTHREADS worker threads and store it
+ * at R_WQ.  */
+gpg_error_t
+work_queue_new (work_queue_t *r_wq, unsigned int nthreads)
+{
+  gpg_error_t err;
+  work_queue_t wq;
+  npth_attr_t tattr;
+  int rc;
+
+  *r_wq = NULL;
+
+  if (!nthreads)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (nthreads > MAX_WORKER_THREADS)
+    nthreads = MAX_WORKER_THREADS;
+
+  if (!job_key_created)
+    {
+      rc = npth_key_create (&job_key, NULL);
+      if (rc)
+        return gpg_error_from_errno (rc);
+      job_key_created = 1;
+    }
+
+  wq = xtrycalloc (1, sizeof *wq);
+  if (!wq)
+    return gpg_error_from_syserror ();
+  wq->jobs_tail = &wq->jobs;
+  wq->threads = xtrycalloc (nthreads, sizeof *wq->threads);
+  if (!wq->threads)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (wq);
+      return err;
+    }
+
+  rc = npth_mutex_init (&wq->lock, NULL);
+  if (!rc)
+    rc = npth_cond_init (&wq->job_cond, NULL);
+  if (!rc)
+    rc = npth_cond_init (&wq->done_cond, NULL);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      log_error ("error initializing the work queue: %s\n",
+                 gpg_strerror (err));
+      xfree (wq->threads);
+      xfree (wq);
+      return err;
+    }
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      log_error ("error creating thread attributes: %s\n", gpg_strerror (err));
+      work_queue_release (wq);
+      return err;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (; wq->nthreads < nthreads; wq->nthreads++)
+    {
+      rc = npth_create (&wq->threads[wq->nthreads], &tattr, worker_thread, wq);
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          log_error ("error spawning worker thread: %s\n", gpg_strerror (err));
+          break;
+        }
+    }
+  npth_attr_destroy (&tattr);
+
+  if (!wq->nthreads)
+    {
+      work_queue_release (wq);
+      return err;
+    }
+
+  *r_wq = wq;
+  return 0;
+}
+
+
+/* Wait for all pending jobs, stop the worker threads and release
+ * WQ.  */
+void
+work_queue_release (work_queue_t wq)
+{
+  job_item_t item;
+  unsigned int i;
+
+  if (!wq)
+    return;
+
+  work_queue_wait (wq);
+
+  npth_mutex_lock (&wq->lock);
+  wq->stop = 1;
+  npth_cond_broadcast (&wq->job_cond);
+  npth_mutex_unlock (&wq->lock);
+  for (i=0; i < wq->nthreads; i++)
+    npth_join (wq->threads[i], NULL);
+
+  while ((item = wq->unused))
+    {
+      wq->unused = item->next;
+      xfree (item);
+    }
+  npth_cond_destroy (&wq->done_cond);
+  npth_cond_destroy (&wq->job_cond);
+  npth_mutex_destroy (&wq->lock);
+  xfree (wq->threads);
+  xfree (wq);
+}
+
+
+/* Return the number of worker threads of WQ.  */
+unsigned int
+work_queue_nthreads (work_queue_t wq)
+{
+  return wq? wq->nthreads : 0;
+}
+
+
+/* Queue a job for FNC with OPAQUE.  If R_DONE is not NULL it is set
+ * to true after the job has finished.  The caller must hold the lock
+ * of WQ.  */
+static gpg_error_t
+queue_job (work_queue_t wq, work_queue_job_t fnc, void *opaque, int *r_done)
+{
+  job_item_t item;
+
+  item = wq->unused;
+  if (item)
+    wq->unused = item->next;
+  else
+    {
+      item = xtrymalloc (sizeof *item);
+      if (!item)
+        {
+          return gpg_error_from_syserror ();
+        }
+    }
+  item->next = NULL;
+  item->fnc = fnc;
+  item->opaque = opaque;
+  item->r_done = r_done;
+  *wq->jobs_tail = item;
+  wq->jobs_tail = &item->next;
+  wq->pending++;
+  npth_cond_signal (&wq->job_cond);
+
+  return 0;
+}
+
+
+/* Add a job to WQ which calls FNC with OPAQUE as its argument.  The
+ * jobs are started in the order they have been added.  */
+gpg_error_t
+work_queue_add (work_queue_t wq, work_queue_job_t fnc, void *opaque)
+{
+  gpg_error_t err;
+
+  npth_mutex_lock (&wq->lock);
+  err = queue_job (wq, fnc, opaque, NULL);
+  npth_mutex_unlock (&wq->lock);
+  return err;
+}
+
+
+/* Run FNC with OPAQUE as its argument on a worker thread of WQ and
+ * wait until it has finished.  In contrast to the other functions
+ * this one may be called by several threads concurrently.  */
+gpg_error_t
+work_queue_run (work_queue_t wq, work_queue_job_t fnc, void *opaque)
+{
+  return work_queue_run_poll (wq, fnc, opaque, 0, NULL, NULL);
+}
+
+
+/* Same as work_queue_run but call POLL_FNC with POLL_OPAQUE every
+ * INTERVAL milliseconds while waiting and once more after FNC has
+ * finished.  POLL_FNC is called by the waiting thread without holding
+ * any lock of WQ; this allows to relay data produced by the job.  */
+gpg_error_t
+work_queue_run_poll (work_queue_t wq, work_queue_job_t fnc, void *opaque,
+                     unsigned int interval,
+                     work_queue_job_t poll_fnc, void *poll_opaque)
+{
+  gpg_error_t err;
+  int done = 0;
+  struct timespec abstime;
+
+  npth_mutex_lock (&wq->lock);
+  err = queue_job (wq, fnc, opaque, &done);
+  if (!err)
+    while (!done)
+      {
+        if (!poll_fnc)
+          {
+            npth_cond_wait (&wq->done_cond, &wq->lock);
+            continue;
+          }
+
+        npth_clock_gettime (&abstime);
+        abstime.tv_sec += interval / 1000;
+        abstime.tv_nsec += (long)(interval % 1000) * 1000000;
+        if (abstime.tv_nsec >= 1000000000)
+          {
+            abstime.tv_sec++;
+            abstime.tv_nsec -= 1000000000;
+          }
+        npth_cond_timedwait (&wq->done_cond, &wq->lock, &abstime);
+        if (!done)
+          {
+            npth_mutex_unlock (&wq->lock);
+            poll_fnc (poll_opaque);
+            npth_mutex_lock (&wq->lock);
+          }
+      }
+  npth_mutex_unlock (&wq->lock);
+
+  if (!err && poll_fnc)
+    poll_fnc (poll_opaque);
+  return err;
+}
+
+
+/* Wait until all jobs added to WQ have been completed.  */
+void
+work_queue_wait (work_queue_t wq)
+{
+  npth_mutex_lock (&wq->lock);
+  while (wq->pending)
+    npth_cond_wait (&wq->done_cond, &wq->lock);
+  npth_mutex_unlock (&wq->lock);
+}
+
+
+/* System call clamp functions to be used instead of npth_unprotect
+ * and npth_protect by programs running Libgcrypt or libgpg-error
+ * functions in jobs.  A job does not hold the nPth global lock and
+ * thus must not release or acquire it around a system call.  */
+void
+work_queue_pre_syscall (void)
+{
+  if (!work_queue_in_job ())
+    npth_unprotect ();
+}
+
+void
+work_queue_post_syscall (void)
+{
+  if (!work_queue_in_job ())
+    npth_protect ();
+}
+
+
+/* Return true if the calling thread is a worker thread running a
+ * job.  Such a thread does not hold the nPth global lock and thus
+ * must not access data shared with the nPth threads.  */
+int
+work_queue_in_job (void)
+{
+  return job_key_created && !!npth_getspecific (job_key);
+}
@@ -0,0 +1,94 @@
+/* work-queue.h - A pool of worker threads for CPU bound jobs
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+#ifndef GNUPG_COMMON_WORK_QUEUE_H
+#define GNUPG_COMMON_WORK_QUEUE_H
+
+#include <gpg-error.h>
+
+/* A work queue runs jobs on a fixed number of nPth threads.  The
+ * jobs are run outside of the nPth global lock (i.e. between
+ * npth_unprotect and npth_protect) and thus really in parallel on
+ * several cores.  Consequently a job may only use thread-safe
+ * functions like those from Libgcrypt or the memory allocators and
+ * must not touch any state shared with other threads without proper
+ * locking.  The queue is meant to be used by a single controlling
+ * thread which adds jobs and waits for their completion; only
+ * work_queue_run may be used by several threads at once.  This
+ * module is only available in the nPth version of libcommon.  */
+
+struct work_queue_s;
+typedef struct work_queue_s *work_queue_t;
+
+/* The type of a job function.  */
+typedef void (*work_queue_job_t) (void *opaque);
+
+/* Create a new work queue with NTHREADS worker threads and store it
+ * at R_WQ.  */
+gpg_error_t work_queue_new (work_queue_t *r_wq, unsigned int nthreads);
+
+/* Wait for all pending jobs, stop the worker threads and release
+ * WQ.  */
+void work_queue_release (work_queue_t wq);
+
+/* Return the number of worker threads of WQ.  */
+unsigned int work_queue_nthreads (work_queue_t wq);
+
+/* Add a job to WQ which calls FNC with OPAQUE as its argument.  The
+ * jobs are started in the order they have been added.  */
+gpg_error_t work_queue_add (work_queue_t wq,
+                            work_queue_job_t fnc, void *opaque);
+
+/* Wait until all jobs added to WQ have been completed.  */
+void work_queue_wait (work_queue_t wq);
+
+/* Run FNC with OPAQUE on a worker thread of WQ and wait until it has
+ * finished.  */
+gpg_error_t work_queue_run (work_queue_t wq,
+                            work_queue_job_t fnc, void *opaque);
+
+/* Same as work_queue_run but call POLL_FNC with POLL_OPAQUE every
+ * INTERVAL milliseconds while waiting and after FNC has finished.  */
+gpg_error_t work_queue_run_poll (work_queue_t wq,
+                                 work_queue_job_t fnc, void *opaque,
+                                 unsigned int interval,
+                                 work_queue_job_t poll_fnc,
+                                 void *poll_opaque);
+
+/* Replacements for npth_unprotect and npth_protect to be used as
+ * system call clamp if jobs may call functions using that clamp.  */
+void work_queue_pre_syscall (void);
+void work_queue_post_syscall (void);
+
+/* Return true if called by a job on a worker thread.  */
+int work_queue_in_job (void);
+
+
+#endif /*GNUPG_COMMON_WORK_QUEUE_H*/
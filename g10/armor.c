@@ -40,7 +40,7 @@
 static const byte bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                                "abcdefghijklmnopqrstuvwxyz"
                                "0123456789+/";
-static u32 asctobin[4][256]; /* runtime initialized */
+static u32 asctobin[256]; /* runtime initialized */
 static int is_initialized;
 
 
@@ -175,12 +175,7 @@ initialize(void)
        used to detect invalid characters.  */
     memset (asctobin, 0xff, sizeof(asctobin));
     for(s=bintoasc,i=0; *s; s++,i++ )
-      {
-	asctobin[0][*s] = i << (0 * 6);
-	asctobin[1][*s] = i << (1 * 6);
-	asctobin[2][*s] = i << (2 * 6);
-	asctobin[3][*s] = i << (3 * 6);
-      }
+	asctobin[*s] = i;
 
     is_initialized=1;
 }
@@ -834,106 +829,34 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	}
 
       again:
-	binc = asctobin[0][c];
+	binc = asctobin[c];
 
 	if( binc != 0xffffffffUL )
 	  {
 	    if( idx == 0 && skip_fast == 0
-		&& afx->buffer_pos + (16 - 1) < afx->buffer_len
-		&& n + 12 < size)
+		&& afx->buffer[afx->buffer_pos - 1] == c
+		&& afx->buffer_pos + (4 - 1) <= afx->buffer_len
+		&& n + 3 <= size )
 	      {
-		/* Fast path for radix64 to binary conversion.  */
-		u32 b0,b1,b2,b3;
-
-		/* Speculatively load 15 more input bytes.  */
-		b0 = binc << (3 * 6);
-		b0 |= asctobin[2][afx->buffer[afx->buffer_pos + 0]];
-		b0 |= asctobin[1][afx->buffer[afx->buffer_pos + 1]];
-		b0 |= asctobin[0][afx->buffer[afx->buffer_pos + 2]];
-		b1  = asctobin[3][afx->buffer[afx->buffer_pos + 3]];
-		b1 |= asctobin[2][afx->buffer[afx->buffer_pos + 4]];
-		b1 |= asctobin[1][afx->buffer[afx->buffer_pos + 5]];
-		b1 |= asctobin[0][afx->buffer[afx->buffer_pos + 6]];
-		b2  = asctobin[3][afx->buffer[afx->buffer_pos + 7]];
-		b2 |= asctobin[2][afx->buffer[afx->buffer_pos + 8]];
-		b2 |= asctobin[1][afx->buffer[afx->buffer_pos + 9]];
-		b2 |= asctobin[0][afx->buffer[afx->buffer_pos + 10]];
-		b3  = asctobin[3][afx->buffer[afx->buffer_pos + 11]];
-		b3 |= asctobin[2][afx->buffer[afx->buffer_pos + 12]];
-		b3 |= asctobin[1][afx->buffer[afx->buffer_pos + 13]];
-		b3 |= asctobin[0][afx->buffer[afx->buffer_pos + 14]];
-
-		/* Check if any of the input bytes were invalid. */
-		if( (b0 | b1 | b2 | b3) != 0xffffffffUL )
-		  {
-		    /* All 16 bytes are valid. */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    buf[n + 6] = b2 >> (2 * 8);
-		    buf[n + 7] = b2 >> (1 * 8);
-		    buf[n + 8] = b2 >> (0 * 8);
-		    buf[n + 9] = b3 >> (2 * 8);
-		    buf[n + 10] = b3 >> (1 * 8);
-		    buf[n + 11] = b3 >> (0 * 8);
-		    afx->buffer_pos += 16 - 1;
-		    n += 12;
-		    continue;
-		  }
-		else if( b0 == 0xffffffffUL )
-		  {
-		    /* byte[1..3] have invalid character(s).  Switch to slow
-		       path.  */
-		    skip_fast = 1;
-		  }
-		else if( b1 == 0xffffffffUL )
+		/* Fast path for radix64 to binary conversion: Convert all
+		   complete groups up to the next non-radix64 character
+		   at once.  C is the first character of the group and
+		   still in the buffer.  */
+		size_t avail, used;
+
+		avail = afx->buffer_len - afx->buffer_pos + 1;
+		if( avail / 4 * 3 > size - n )
+		    avail = (size - n) / 3 * 4;
+		n += radix64_decode (buf + n, afx->buffer + afx->buffer_pos - 1,
+				     avail, &used);
+		if( used )
 		  {
-		    /* byte[4..7] have invalid character(s), first 4 bytes are
-		       valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    afx->buffer_pos += 4 - 1;
-		    n += 3;
-		    skip_fast = 1;
-		    continue;
-		  }
-		else if( b2 == 0xffffffffUL )
-		  {
-		    /* byte[8..11] have invalid character(s), first 8 bytes are
-		       valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    afx->buffer_pos += 8 - 1;
-		    n += 6;
-		    skip_fast = 1;
-		    continue;
-		  }
-		else /*if( b3 == 0xffffffffUL )*/
-		  {
-		    /* byte[12..15] have invalid character(s), first 12 bytes
-		       are valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    buf[n + 6] = b2 >> (2 * 8);
-		    buf[n + 7] = b2 >> (1 * 8);
-		    buf[n + 8] = b2 >> (0 * 8);
-		    afx->buffer_pos += 12 - 1;
-		    n += 9;
-		    skip_fast = 1;
+		    afx->buffer_pos += used - 1;
 		    continue;
 		  }
+		/* The group has invalid character(s).  Switch to slow
+		   path.  */
+		skip_fast = 1;
 	      }
 
 	    switch(idx)
@@ -980,10 +903,10 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
             if (afx->buffer_pos + 6 < afx->buffer_len
                 && afx->buffer[afx->buffer_pos + 0] == '3'
                 && afx->buffer[afx->buffer_pos + 1] == 'D'
-                && asctobin[0][afx->buffer[afx->buffer_pos + 2]] != 0xffffffffUL
-                && asctobin[0][afx->buffer[afx->buffer_pos + 3]] != 0xffffffffUL
-                && asctobin[0][afx->buffer[afx->buffer_pos + 4]] != 0xffffffffUL
-                && asctobin[0][afx->buffer[afx->buffer_pos + 5]] != 0xffffffffUL
+                && asctobin[afx->buffer[afx->buffer_pos + 2]] != 0xffffffffUL
+                && asctobin[afx->buffer[afx->buffer_pos + 3]] != 0xffffffffUL
+                && asctobin[afx->buffer[afx->buffer_pos + 4]] != 0xffffffffUL
+                && asctobin[afx->buffer[afx->buffer_pos + 5]] != 0xffffffffUL
                 && afx->buffer[afx->buffer_pos + 6] == '\n')
               {
                 afx->buffer_pos += 2;
@@ -1040,7 +963,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	    u32 mycrc = 0;
 	    idx = 0;
 	    do {
-		if( (binc = asctobin[0][c]) == 0xffffffffUL )
+		if( (binc = asctobin[c]) == 0xffffffffUL )
 		    break;
 		switch(idx) {
 		  case 0: val =  binc << 2; break;
@@ -1125,11 +1048,11 @@ armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
 			     byte *buf, size_t size)
 {
   byte radbuf[sizeof (afx->radbuf)];
-  byte outbuf[64 + sizeof (afx->eol)];
+  byte outbuf[16 * (64 + sizeof (afx->eol))];
   unsigned int eollen = strlen (afx->eol);
-  u32 in, in2;
+  size_t n;
+  u32 in;
   int idx, idx2;
-  int i;
 
   idx = afx->idx;
   idx2 = afx->idx2;
@@ -1168,35 +1091,24 @@ armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
 
   if (size >= (64/4)*3)
     {
-      /* preload eol to outbuf buffer */
-      memcpy (outbuf + 64, afx->eol, sizeof(afx->eol));
-
       do
 	{
 	  /* idx and idx2 == 0 */
 
-	  for (i = 0; i < (64/8); i++)
+	  /* Convert as many full lines as fit into OUTBUF.  */
+	  n = 0;
+	  do
 	    {
-	      in = (u32)buf[0] << (2 * 8);
-	      in |= (u32)buf[1] << (1 * 8);
-	      in |= (u32)buf[2] << (0 * 8);
-	      in2 = (u32)buf[3] << (2 * 8);
-	      in2 |= (u32)buf[4] << (1 * 8);
-	      in2 |= (u32)buf[5] << (0 * 8);
-	      outbuf[i*8+0] = bintoasc[(in >> 18) & 077];
-	      outbuf[i*8+1] = bintoasc[(in >> 12) & 077];
-	      outbuf[i*8+2] = bintoasc[(in >> 6) & 077];
-	      outbuf[i*8+3] = bintoasc[(in >> 0) & 077];
-	      outbuf[i*8+4] = bintoasc[(in2 >> 18) & 077];
-	      outbuf[i*8+5] = bintoasc[(in2 >> 12) & 077];
-	      outbuf[i*8+6] = bintoasc[(in2 >> 6) & 077];
-	      outbuf[i*8+7] = bintoasc[(in2 >> 0) & 077];
-	      buf+=6;
-	      size-=6;
+	      /* pgp doesn't like 72 here */
+	      n += radix64_encode (outbuf + n, buf, (64/4)*3);
+	      memcpy (outbuf + n, afx->eol, eollen);
+	      n += eollen;
+	      buf += (64/4)*3;
+	      size -= (64/4)*3;
 	    }
+	  while (size >= (64/4)*3 && n + 64 + eollen <= sizeof outbuf);
 
-	  /* pgp doesn't like 72 here */
-	  iobuf_write (a, outbuf, 64 + eollen);
+	  iobuf_write (a, outbuf, n);
 	}
       while (size >= (64/4)*3);
 
@@ -0,0 +1,703 @@
+/* bench-filters.c - Throughput benchmark for the IOBUF filter stages
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This program pushes synthetic data through the filters used by gpg
+ * and reports the throughput and the CPU time of each stage.  It is
+ * not run by "make check"; use "make bench" in this directory or run
+ * it directly:
+ *
+ *   $ ./bench-filters --size 256 --with-colons armor aead
+ *
+ * With --with-colons one record per stage and direction is printed:
+ *
+ *   bench:STAGE:DIRECTION:INBYTES:OUTBYTES:REALMS:CPUMS:MIBPERSEC:
+ *
+ * DIRECTION is "write" for the encoding and "read" for the decoding
+ * filter of a stage.  INBYTES is the size of the data fed into the
+ * stage and MIBPERSEC is computed from the plaintext size so that the
+ * numbers of different stages can be compared.  The best of --repeat
+ * runs is reported.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_GETRUSAGE
+# include <sys/time.h>
+# include <sys/resource.h>
+#endif
+#include <npth.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/iobuf.h"
+#include "../common/membuf.h"
+#include "../common/work-queue.h"
+#include "options.h"
+#include "packet.h"
+#include "filter.h"
+#include "main.h"
+
+#define PGM "bench-filters"
+
+/* The size of the pieces written to or read from the stages.  */
+#define IOSIZE (32*1024)
+
+static int verbose;
+static int with_colons;
+static int use_random;
+static unsigned int repeat = 3;
+static size_t datasize = 64 * 1024 * 1024;
+
+/* The synthetic input data.  */
+static byte *plaindata;
+
+
+/* The direction of a stage: Either a filter on an output chain or
+ * on an input chain.  */
+enum bench_dir
+  {
+    DIR_WRITE,
+    DIR_READ
+  };
+
+/* Information passed to the stage functions.  */
+struct bench_parm_s
+{
+  ctrl_t ctrl;
+  DEK *dek;         /* The key for the cipher stages.  */
+  int algo;         /* The algorithm of the stage.  */
+  const byte *in;   /* The input for this run.  */
+  size_t inlen;
+  membuf_t *capture;/* If not NULL store the output here.  */
+  unsigned long long outlen; /* Number of output bytes.  */
+};
+typedef struct bench_parm_s *bench_parm_t;
+
+typedef gpg_error_t (*bench_fnc_t) (bench_parm_t parm);
+
+/* The description of a stage.  */
+struct bench_stage_s
+{
+  const char *name;
+  int algo;
+  bench_fnc_t encode;  /* Writing direction or NULL.  */
+  bench_fnc_t decode;  /* Reading direction.  */
+};
+
+
+
+/* A filter at the end of a writing chain which discards all data,
+ * counts the bytes, and optionally captures them.  */
+static int
+sink_filter (void *opaque, int control,
+             iobuf_t chain, byte *buf, size_t *ret_len)
+{
+  bench_parm_t parm = opaque;
+
+  (void)chain;
+
+  if (control == IOBUFCTRL_FLUSH)
+    {
+      parm->outlen += *ret_len;
+      if (parm->capture)
+        put_membuf (parm->capture, buf, *ret_len);
+    }
+  else if (control == IOBUFCTRL_DESC)
+    mem2str (buf, "sink_filter", *ret_len);
+  return 0;
+}
+
+
+/* The write function of the estream used as output of the decrypt
+ * stages.  */
+static gpgrt_ssize_t
+sink_cookie_write (void *cookie, const void *buffer, size_t size)
+{
+  bench_parm_t parm = cookie;
+
+  (void)buffer;
+  parm->outlen += size;
+  return size;
+}
+
+static es_cookie_io_functions_t sink_cookie_functions =
+  {
+    NULL,
+    sink_cookie_write,
+    NULL,
+    NULL
+  };
+
+
+/* Create an output chain ending in the sink filter.  */
+static iobuf_t
+open_sink (bench_parm_t parm)
+{
+  iobuf_t out;
+
+  out = iobuf_temp ();
+  iobuf_push_filter (out, sink_filter, parm);
+  return out;
+}
+
+
+/* Write the input of PARM to OUT.  */
+static gpg_error_t
+write_input (bench_parm_t parm, iobuf_t out)
+{
+  gpg_error_t err;
+  size_t off, n;
+
+  for (off = 0; off < parm->inlen; off += n)
+    {
+      n = parm->inlen - off;
+      if (n > IOSIZE)
+        n = IOSIZE;
+      err = iobuf_write (out, parm->in + off, n);
+      if (err)
+        return err;
+    }
+  return 0;
+}
+
+
+/* Read all data from INP and count the bytes.  */
+static gpg_error_t
+drain_input (bench_parm_t parm, iobuf_t inp)
+{
+  byte *buffer;
+  int n;
+
+  buffer = xtrymalloc (IOSIZE);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+  while ((n = iobuf_read (inp, buffer, IOSIZE)) != -1)
+    parm->outlen += n;
+  xfree (buffer);
+  return iobuf_error (inp);
+}
+
+
+
+/* Armor.  */
+static gpg_error_t
+bench_armor_encode (bench_parm_t parm)
+{
+  gpg_error_t err;
+  armor_filter_context_t *afx;
+  iobuf_t out;
+
+  out = open_sink (parm);
+  afx = new_armor_context ();
+  push_armor_filter (afx, out);
+  err = write_input (parm, out);
+  iobuf_close (out);
+  release_armor_context (afx);
+  return err;
+}
+
+static gpg_error_t
+bench_armor_decode (bench_parm_t parm)
+{
+  gpg_error_t err;
+  armor_filter_context_t *afx;
+  iobuf_t inp;
+
+  inp = iobuf_temp_with_content ((const char *)parm->in, parm->inlen);
+  afx = new_armor_context ();
+  push_armor_filter (afx, inp);
+  err = drain_input (parm, inp);
+  iobuf_close (inp);
+  release_armor_context (afx);
+  return err;
+}
+
+
+/* Compression.  */
+static gpg_error_t
+bench_compress_encode (bench_parm_t parm)
+{
+  gpg_error_t err;
+  compress_filter_context_t zfx;
+  iobuf_t out;
+
+  memset (&zfx, 0, sizeof zfx);
+  out = open_sink (parm);
+  err = push_compress_filter (out, &zfx, parm->algo);
+  if (!err)
+    err = write_input (parm, out);
+  iobuf_close (out);
+  return err;
+}
+
+static int
+compressed_cb (iobuf_t inp, void *opaque)
+{
+  return drain_input (opaque, inp);
+}
+
+static gpg_error_t
+bench_compress_decode (bench_parm_t parm)
+{
+  gpg_error_t err;
+  struct parse_packet_ctx_s parsectx;
+  PACKET pkt;
+  iobuf_t inp;
+
+  inp = iobuf_temp_with_content ((const char *)parm->in, parm->inlen);
+  init_parse_packet (&parsectx, inp);
+  init_packet (&pkt);
+  err = parse_packet (&parsectx, &pkt);
+  if (!err && pkt.pkttype != PKT_COMPRESSED)
+    err = gpg_error (GPG_ERR_UNEXPECTED);
+  if (!err)
+    err = handle_compressed (parm->ctrl, NULL, pkt.pkt.compressed,
+                             compressed_cb, parm);
+  free_packet (&pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  iobuf_close (inp);
+  return err;
+}
+
+
+/* Encryption.  The plaintext is put into a literal data packet so
+ * that the output can be processed by decrypt_data.  */
+static gpg_error_t
+bench_cipher_encode (bench_parm_t parm)
+{
+  gpg_error_t err;
+  cipher_filter_context_t cfx;
+  PKT_plaintext *pt;
+  PACKET pkt;
+  iobuf_t inp, out;
+
+  memset (&cfx, 0, sizeof cfx);
+  cfx.dek = parm->dek;
+  cfx.dek->use_aead = parm->algo;
+  cfx.dek->use_mdc = !parm->algo;
+
+  inp = iobuf_temp_with_content ((const char *)parm->in, parm->inlen);
+  out = open_sink (parm);
+  iobuf_push_filter (out,
+                     cfx.dek->use_aead? cipher_filter_aead
+                     /**/             : cipher_filter_cfb,
+                     &cfx);
+
+  pt = xmalloc_clear (sizeof *pt);
+  pt->timestamp = make_timestamp ();
+  pt->mode = 'b';
+  pt->new_ctb = 1;
+  pt->buf = inp;
+  init_packet (&pkt);
+  pkt.pkttype = PKT_PLAINTEXT;
+  pkt.pkt.plaintext = pt;
+  err = build_packet (out, &pkt);
+  pt->buf = NULL;
+  free_packet (&pkt, NULL);
+
+  iobuf_close (inp);
+  iobuf_close (out);
+  return err;
+}
+
+static gpg_error_t
+bench_cipher_decode (bench_parm_t parm)
+{
+  gpg_error_t err;
+  struct parse_packet_ctx_s parsectx;
+  PACKET pkt;
+  iobuf_t inp;
+
+  opt.outfp = es_fopencookie (parm, "w", sink_cookie_functions);
+  if (!opt.outfp)
+    return gpg_error_from_syserror ();
+
+  inp = iobuf_temp_with_content ((const char *)parm->in, parm->inlen);
+  init_parse_packet (&parsectx, inp);
+  init_packet (&pkt);
+  err = parse_packet (&parsectx, &pkt);
+  if (!err && pkt.pkttype != PKT_ENCRYPTED_MDC
+      && pkt.pkttype != PKT_ENCRYPTED_AEAD)
+    err = gpg_error (GPG_ERR_UNEXPECTED);
+  if (!err)
+    err = decrypt_data (parm->ctrl, NULL, pkt.pkt.encrypted, parm->dek);
+  free_packet (&pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  iobuf_close (inp);
+
+  es_fclose (opt.outfp);
+  opt.outfp = NULL;
+  return err;
+}
+
+
+/* Hashing as done for signatures.  */
+static gpg_error_t
+bench_md_decode (bench_parm_t parm)
+{
+  gpg_error_t err;
+  md_filter_context_t mfx;
+  iobuf_t inp;
+
+  memset (&mfx, 0, sizeof mfx);
+  err = gcry_md_open (&mfx.md, DIGEST_ALGO_SHA256, 0);
+  if (err)
+    return err;
+  inp = iobuf_temp_with_content ((const char *)parm->in, parm->inlen);
+  iobuf_push_filter (inp, md_filter, &mfx);
+  err = drain_input (parm, inp);
+  iobuf_close (inp);
+  gcry_md_close (mfx.md);
+  return err;
+}
+
+
+/* Canonical text as done for text mode signatures.  */
+static gpg_error_t
+bench_text_decode (bench_parm_t parm)
+{
+  gpg_error_t err;
+  text_filter_context_t tfx;
+  iobuf_t inp;
+
+  memset (&tfx, 0, sizeof tfx);
+  inp = iobuf_temp_with_content ((const char *)parm->in, parm->inlen);
+  iobuf_push_filter (inp, text_filter, &tfx);
+  err = drain_input (parm, inp);
+  iobuf_close (inp);
+  return err;
+}
+
+
+static struct bench_stage_s stages[] =
+  {
+    { "armor",  0, bench_armor_encode, bench_armor_decode },
+    { "zip",    COMPRESS_ALGO_ZIP, bench_compress_encode, bench_compress_decode},
+    { "zlib",   COMPRESS_ALGO_ZLIB, bench_compress_encode,bench_compress_decode},
+#ifdef HAVE_BZIP2
+    { "bzip2",  COMPRESS_ALGO_BZIP2,bench_compress_encode,bench_compress_decode},
+#endif
+    { "cfb",    0, bench_cipher_encode, bench_cipher_decode },
+    { "aead",   AEAD_ALGO_OCB, bench_cipher_encode, bench_cipher_decode },
+    { "md",     0, NULL, bench_md_decode },
+    { "text",   0, NULL, bench_text_decode },
+    { NULL }
+  };
+
+
+
+/* Store the elapsed real and CPU time in seconds.  The CPU time
+ * includes all threads of the process.  */
+static void
+get_times (double *r_real, double *r_cpu)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  *r_real = ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+  *r_real = (double)time (NULL);
+#endif
+#ifdef HAVE_GETRUSAGE
+  {
+    struct rusage ru;
+
+    getrusage (RUSAGE_SELF, &ru);
+    *r_cpu = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+              + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6);
+  }
+#else
+  *r_cpu = (double)clock () / CLOCKS_PER_SEC;
+#endif
+}
+
+
+/* Fill the buffer with DATASIZE bytes of synthetic data.  By default
+ * text lines from a small vocabulary are created so that compression
+ * has something to do; with --random the data is incompressible.  A
+ * fixed seed is used so that results are comparable between runs.  */
+static void
+make_plaindata (void)
+{
+  static const char *words[] =
+    { "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+      "OpenPGP", "packet", "signature", "key", "trust", "armor", "data",
+      "2020-06-01", "12:00:00", "gpg:", "INFO", "WARNING", "0x1F2E3D4C" };
+  u32 seed = 0x2f6b1d35;
+  size_t i, n;
+  const char *w;
+  int col = 0;
+
+  plaindata = xmalloc (datasize);
+  for (i = 0; i < datasize; )
+    {
+      /* xorshift32 */
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      if (use_random)
+        {
+          plaindata[i++] = seed;
+          continue;
+        }
+      if (col > 70)
+        {
+          plaindata[i++] = '\n';
+          col = 0;
+          continue;
+        }
+      w = words[seed % DIM (words)];
+      n = strlen (w);
+      if (n + 1 > datasize - i)
+        n = datasize - i - 1;
+      memcpy (plaindata + i, w, n);
+      i += n;
+      plaindata[i++] = ' ';
+      col += n + 1;
+    }
+}
+
+
+/* Run one stage in direction DIR and print the result.  IN and INLEN
+ * give the input.  If CAPTURE is not NULL the output of the first run
+ * is stored there.  */
+static gpg_error_t
+run_stage (ctrl_t ctrl, DEK *dek, struct bench_stage_s *stage,
+           enum bench_dir dir, const byte *in, size_t inlen,
+           membuf_t *capture)
+{
+  gpg_error_t err = 0;
+  struct bench_parm_s parm;
+  double real0, cpu0, real1, cpu1;
+  double best_real = 0, best_cpu = 0;
+  unsigned int i;
+  const char *dirstr = dir == DIR_WRITE? "write" : "read";
+
+  for (i = 0; i < repeat; i++)
+    {
+      memset (&parm, 0, sizeof parm);
+      parm.ctrl = ctrl;
+      parm.dek = dek;
+      parm.algo = stage->algo;
+      parm.in = in;
+      parm.inlen = inlen;
+      parm.capture = i? NULL : capture;
+
+      get_times (&real0, &cpu0);
+      err = (dir == DIR_WRITE? stage->encode : stage->decode) (&parm);
+      get_times (&real1, &cpu1);
+      if (err)
+        {
+          log_error ("%s %s failed: %s\n",
+                     stage->name, dirstr, gpg_strerror (err));
+          return err;
+        }
+      if (!i || real1 - real0 < best_real)
+        {
+          best_real = real1 - real0;
+          best_cpu = cpu1 - cpu0;
+        }
+    }
+  if (best_real <= 0)
+    best_real = 1e-9;
+
+  if (with_colons)
+    printf ("bench:%s:%s:%zu:%llu:%.0f:%.0f:%.1f:\n",
+            stage->name, dirstr, inlen, parm.outlen,
+            best_real * 1000, best_cpu * 1000,
+            datasize / best_real / (1024*1024));
+  else
+    printf ("%-8s %-7s %10.1f MiB/s  %8.0f ms real  %8.0f ms cpu\n",
+            stage->name, dirstr,
+            datasize / best_real / (1024*1024),
+            best_real * 1000, best_cpu * 1000);
+  fflush (stdout);
+  return 0;
+}
+
+
+/* Run the write and read direction of STAGE.  The input for the read
+ * direction is the output of the write direction.  */
+static gpg_error_t
+bench_stage (ctrl_t ctrl, DEK *dek, struct bench_stage_s *stage)
+{
+  gpg_error_t err;
+  membuf_t mb;
+  void *encoded;
+  size_t encodedlen;
+
+  if (!stage->encode)
+    return run_stage (ctrl, dek, stage, DIR_READ,
+                      plaindata, datasize, NULL);
+
+  init_membuf (&mb, datasize + datasize / 2);
+  err = run_stage (ctrl, dek, stage, DIR_WRITE, plaindata, datasize, &mb);
+  encoded = get_membuf (&mb, &encodedlen);
+  if (!encoded)
+    {
+      if (!err)
+        err = gpg_error_from_syserror ();
+      return err;
+    }
+  if (!err)
+    err = run_stage (ctrl, dek, stage, DIR_READ,
+                     encoded, encodedlen, NULL);
+  xfree (encoded);
+  return err;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  struct bench_stage_s *stage;
+  struct server_control_s ctrlbuf;
+  DEK dekbuf;
+  int i, any, rc = 0;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [options] [STAGES]\n"
+                 "Options:\n"
+                 "  --verbose          print more diagnostics\n"
+                 "  --size N           size of the test data in MiB\n"
+                 "  --repeat N         run each stage N times\n"
+                 "  --random           use random instead of text data\n"
+                 "  --with-colons      machine readable output\n"
+                 "  --worker-threads N as the gpg option\n"
+                 "  --chunk-size N     as the gpg option\n"
+                 "  --compress-level N as the gpg option\n"
+                 "Stages:\n ", stdout);
+          for (stage = stages; stage->name; stage++)
+            printf (" %s", stage->name);
+          putchar ('\n');
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose++;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--random"))
+        {
+          use_random = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--with-colons"))
+        {
+          with_colons = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--size") && argc > 1)
+        {
+          datasize = (size_t)strtoul (argv[1], NULL, 10) * 1024 * 1024;
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--repeat") && argc > 1)
+        {
+          repeat = strtoul (argv[1], NULL, 10);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--worker-threads") && argc > 1)
+        {
+          opt.worker_threads = strtoul (argv[1], NULL, 10);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--chunk-size") && argc > 1)
+        {
+          opt.chunk_size = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--compress-level") && argc > 1)
+        {
+          opt.compress_level = opt.bz2_compress_level = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          fprintf (stderr, PGM ": unknown option '%s'\n", *argv);
+          exit (2);
+        }
+    }
+
+  if (!datasize || !repeat)
+    {
+      fprintf (stderr, PGM ": invalid --size or --repeat\n");
+      exit (2);
+    }
+  if (!opt.chunk_size)
+    opt.chunk_size = 27;
+  else if (opt.chunk_size < 6 || opt.chunk_size > 27)
+    {
+      fprintf (stderr, PGM ": invalid --chunk-size\n");
+      exit (2);
+    }
+  if (!opt.compress_level)
+    opt.compress_level = opt.bz2_compress_level = -1;
+
+  log_set_prefix (PGM, GPGRT_LOG_WITH_PREFIX);
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+  npth_init ();
+  gpgrt_set_syscall_clamp (work_queue_pre_syscall, work_queue_post_syscall);
+
+  opt.verbose = verbose;
+  opt.quiet = !verbose;
+  opt.skip_verify = 1;  /* Do not hash the decrypted literal data.  */
+
+  memset (&ctrlbuf, 0, sizeof ctrlbuf);
+  memset (&dekbuf, 0, sizeof dekbuf);
+  dekbuf.algo = CIPHER_ALGO_AES256;
+  make_session_key (&dekbuf);
+
+  make_plaindata ();
+  if (verbose)
+    log_info ("%zu bytes of %s data, best of %u runs\n",
+              datasize, use_random? "random":"text", repeat);
+
+  for (stage = stages; stage->name && !rc; stage++)
+    {
+      if (argc)
+        {
+          for (any = i = 0; i < argc && !any; i++)
+            any = !strcmp (argv[i], stage->name);
+          if (!any)
+            continue;
+        }
+      rc = bench_stage (&ctrlbuf, &dekbuf, stage);
+    }
+
+  xfree (plaindata);
+  return !!rc;
+}
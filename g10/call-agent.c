@@ -379,6 +379,20 @@ start_agent (ctrl_t ctrl, int flag_for_card)
 }
 
 
+/* Close the connection to the agent.  A new connection is opened on
+ * demand.  This is required before forking processes which would
+ * otherwise share the connection.  */
+void
+agent_disconnect (void)
+{
+  if (agent_ctx)
+    {
+      assuan_release (agent_ctx);
+      agent_ctx = NULL;
+    }
+}
+
+
 /* Return a new malloced string by unescaping the string S.  Escaping
    is percent escaping and '+'/space mapping.  A binary nul will
    silently be replaced by a 0xFF.  Function returns NULL to indicate
@@ -2152,6 +2166,25 @@ keyinfo_status_cb (void *opaque, const char *line)
 }
 
 
+/* An item of the keyinfo cache filled by agent_prefetch_keyinfo.  */
+struct keyinfo_cache_s
+{
+  struct keyinfo_cache_s *next;
+  char hexgrip[2*KEYGRIP_LEN+1];
+  int available;        /* The agent has this secret key.  */
+  int cleartext;        /* The key is stored unprotected.  */
+  char *serialno;       /* Serialno of the card or NULL.  */
+};
+typedef struct keyinfo_cache_s *keyinfo_cache_t;
+
+/* The keyinfo of the keys of the last prefetched keyblock.  */
+static keyinfo_cache_t keyinfo_cache;
+
+/* Whether the agent supports KEYINFO --multi: -1 = unknown, 0 = no,
+ * 1 = yes.  */
+static int keyinfo_multi_support = -1;
+
+
 /* Ask the agent whether a secret key for the given public key is
    available.  Returns 0 if not available.  Bigger value is preferred.  */
 int
@@ -2266,13 +2299,34 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
 
   *r_serialno = NULL;
 
+  if (!hexkeygrip || strlen (hexkeygrip) != 40)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  if (keyinfo_cache)
+    {
+      keyinfo_cache_t ki;
+
+      for (ki = keyinfo_cache; ki; ki = ki->next)
+        if (!ascii_strcasecmp (ki->hexgrip, hexkeygrip))
+          {
+            if (!ki->available)
+              return gpg_error (GPG_ERR_NOT_FOUND);
+            if (ki->serialno)
+              {
+                *r_serialno = xtrystrdup (ki->serialno);
+                if (!*r_serialno)
+                  return gpg_error_from_syserror ();
+              }
+            if (r_cleartext)
+              *r_cleartext = ki->cleartext;
+            return 0;
+          }
+    }
+
   err = start_agent (ctrl, 0);
   if (err)
     return err;
 
-  if (!hexkeygrip || strlen (hexkeygrip) != 40)
-    return gpg_error (GPG_ERR_INV_VALUE);
-
   snprintf (line, DIM(line), "KEYINFO %s", hexkeygrip);
 
   err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
@@ -2295,6 +2349,148 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
 }
 
 
+/* Release all items of the keyinfo cache.  */
+static void
+flush_keyinfo_cache (void)
+{
+  keyinfo_cache_t ki;
+
+  while ((ki = keyinfo_cache))
+    {
+      keyinfo_cache = ki->next;
+      xfree (ki->serialno);
+      xfree (ki);
+    }
+}
+
+
+/* Status callback for agent_prefetch_keyinfo.  */
+static gpg_error_t
+keyinfo_multi_status_cb (void *opaque, const char *line)
+{
+  char *s;
+  const char *fields[9];
+  keyinfo_cache_t ki;
+  char *serialno;
+
+  (void)opaque;
+
+  if ((s = has_leading_keyword (line, "KEYINFO"))
+      && split_fields (s, fields, DIM (fields)) == 9)
+    {
+      /* For the fields see keyinfo_status_cb.  */
+      for (ki = keyinfo_cache; ki; ki = ki->next)
+        if (!ascii_strcasecmp (ki->hexgrip, fields[0]))
+          break;
+      if (!ki || ki->available)
+        return 0;  /* Not asked for or duplicate.  */
+
+      if (fields[1][0] == 'T' && strcmp (fields[2], "-")
+          && !strpbrk (fields[2], ":\n\r"))
+        {
+          serialno = xtrystrdup (fields[2]);
+          if (!serialno)
+            return gpg_error_from_syserror ();
+          ki->serialno = serialno;
+        }
+      ki->cleartext = (fields[5][0] == 'C');
+      ki->available = 1;
+    }
+  return 0;
+}
+
+
+/* Ask the agent in one go for information about all secret keys
+ * matching the keys (primary and sub) of KEYBLOCK and remember that
+ * information so that following calls to agent_get_keyinfo for these
+ * keys are answered without a round trip to the agent.  The
+ * information about a previous KEYBLOCK is discarded; if KEYBLOCK is
+ * NULL the function only does that.  Returns 0 if a secret key is
+ * available for any of the keys in KEYBLOCK.  Agents not supporting
+ * the bulk query fall back to agent_probe_any_secret_key.  */
+gpg_error_t
+agent_prefetch_keyinfo (ctrl_t ctrl, kbnode_t keyblock)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  char *p;
+  kbnode_t kbctx, node;
+  keyinfo_cache_t ki;
+  int nkeys;
+  unsigned char grip[KEYGRIP_LEN];
+
+  flush_keyinfo_cache ();
+  if (!keyblock)
+    return 0;
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+
+  if (keyinfo_multi_support == -1)
+    keyinfo_multi_support =
+      !assuan_transact (agent_ctx, "GETINFO cmd_has_option KEYINFO multi",
+                        NULL, NULL, NULL, NULL, NULL, NULL);
+  if (!keyinfo_multi_support)
+    return agent_probe_any_secret_key (ctrl, keyblock);
+
+  p = stpcpy (line, "KEYINFO --multi");
+  for (kbctx=NULL, nkeys=0; (node = walk_kbnode (keyblock, &kbctx, 0)); )
+    if (node->pkt->pkttype == PKT_PUBLIC_KEY
+        || node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+        || node->pkt->pkttype == PKT_SECRET_KEY
+        || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+      {
+        if (nkeys && ((p - line) + 41) > (ASSUAN_LINELENGTH - 2))
+          {
+            err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                                   keyinfo_multi_status_cb, NULL);
+            if (err)
+              goto leave;
+            p = stpcpy (line, "KEYINFO --multi");
+            nkeys = 0;
+          }
+
+        err = keygrip_from_pk (node->pkt->pkt.public_key, grip);
+        if (err)
+          goto leave;
+        ki = xtrycalloc (1, sizeof *ki);
+        if (!ki)
+          {
+            err = gpg_error_from_syserror ();
+            goto leave;
+          }
+        bin2hex (grip, KEYGRIP_LEN, ki->hexgrip);
+        ki->next = keyinfo_cache;
+        keyinfo_cache = ki;
+        *p++ = ' ';
+        p = stpcpy (p, ki->hexgrip);
+        nkeys++;
+      }
+
+  if (nkeys)
+    {
+      err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                             keyinfo_multi_status_cb, NULL);
+      if (err)
+        goto leave;
+    }
+
+  err = gpg_error (GPG_ERR_NO_SECKEY);
+  for (ki = keyinfo_cache; ki; ki = ki->next)
+    if (ki->available)
+      {
+        err = 0;
+        break;
+      }
+
+ leave:
+  if (err && gpg_err_code (err) != GPG_ERR_NO_SECKEY)
+    flush_keyinfo_cache ();
+  return err;
+}
+
+
 /* Status callback for agent_import_key, agent_export_key and
    agent_genkey.  */
 static gpg_error_t
@@ -94,6 +94,9 @@ struct keypair_info_s
 };
 typedef struct keypair_info_s *keypair_info_t;
 
+/* Close the connection to the agent.  */
+void agent_disconnect (void);
+
 /* Release the card info structure. */
 void agent_release_card_info (struct agent_card_info_s *info);
 
@@ -183,6 +186,9 @@ int agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk);
 gpg_error_t agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock);
 
 
+/* Fetch and remember infos about all secret keys of KEYBLOCK.  */
+gpg_error_t agent_prefetch_keyinfo (ctrl_t ctrl, kbnode_t keyblock);
+
 /* Return infos about the secret key with HEXKEYGRIP.  */
 gpg_error_t agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
                                char **r_serialno, int *r_cleartext);
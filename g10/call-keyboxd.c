@@ -77,6 +77,10 @@ struct keyboxd_local_s
 /* Flag indicating that for example bulk import is enabled.  */
 static unsigned int in_transaction;
 
+/* Counter bumped with each change of the database.  This is used to
+ * invalidate cached lookup results; see keydb_get_change_count.  */
+static unsigned int change_count;
+
 
 
 
@@ -442,6 +446,8 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  change_count++;
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_update_keyblock (ctrl, hd, kb);
@@ -493,6 +499,8 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  change_count++;
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_insert_keyblock (hd, kb);
@@ -523,6 +531,18 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
 }
 
 
+/* Return a counter which is incremented with each change of the key
+ * database (update, insert or delete of a keyblock) by this process.
+ * Callers caching lookup results compare it with the value they saw
+ * before to detect whether their cache is stale.  The counter is
+ * bumped even if the change failed.  */
+unsigned int
+keydb_get_change_count (void)
+{
+  return change_count;
+}
+
+
 /* Delete the currently selected keyblock.  If you haven't done a
  * search yet on this database handle (or called keydb_search_reset),
  * then this function returns an error.
@@ -538,6 +558,8 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  change_count++;
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_delete_keyblock (hd);
@@ -28,6 +28,7 @@
 #include "../common/status.h"
 #include "../common/iobuf.h"
 #include "../common/util.h"
+#include "../common/work-queue.h"
 #include "filter.h"
 #include "packet.h"
 #include "options.h"
@@ -38,6 +39,31 @@
  * be a multiple of the OCB blocksize (16 byte).  */
 #define AEAD_ENC_BUFFER_SIZE (64*1024)
 
+/* The largest chunk size for which we encrypt several chunks in
+ * parallel.  We need to buffer one chunk per thread.  */
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (16*1024*1024)
+
+
+/* A chunk encrypted by a worker thread.  */
+struct aead_chunk_s
+{
+  cipher_filter_context_t *cfx;
+  gcry_cipher_hd_t cipher_hd;  /* The cipher handle for this chunk.  */
+  uint64_t chunkindex;         /* The index of the chunk.            */
+  size_t len;                  /* Number of plaintext bytes in DATA. */
+  byte *data;                  /* Buffer for the chunk and its tag.  */
+  gpg_error_t err;             /* The result of the job.             */
+};
+
+/* The state for parallel encryption.  */
+struct aead_parallel_s
+{
+  work_queue_t wq;
+  unsigned int nchunks;  /* Number of allocated chunks.        */
+  unsigned int nfilled;  /* Number of completely filled chunks. */
+  struct aead_chunk_s chunks[1];
+};
+
 
 /* Wrapper around iobuf_write to make sure that a proper error code is
  * always returned.  */
@@ -55,12 +81,13 @@ my_iobuf_write (iobuf_t a, const void *buffer, size_t buflen)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  If
- * FINAL is set the final AEAD chunk is processed.  This also reset
- * the encryption machinery so that the handle can be used for a new
- * chunk.  */
+/* Set the nonce and the additional data for the chunk CHUNKINDEX
+ * using the cipher handle HD.  If FINAL is set the final AEAD chunk
+ * is processed.  This also reset the encryption machinery so that the
+ * handle can be used for a new chunk.  */
 static gpg_error_t
-set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
+set_nonce_and_ad_hd (cipher_filter_context_t *cfx, gcry_cipher_hd_t hd,
+                     uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char nonce[16];
@@ -83,18 +110,18 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
       BUG ();
     }
 
-  nonce[i++] ^= cfx->chunkindex >> 56;
-  nonce[i++] ^= cfx->chunkindex >> 48;
-  nonce[i++] ^= cfx->chunkindex >> 40;
-  nonce[i++] ^= cfx->chunkindex >> 32;
-  nonce[i++] ^= cfx->chunkindex >> 24;
-  nonce[i++] ^= cfx->chunkindex >> 16;
-  nonce[i++] ^= cfx->chunkindex >>  8;
-  nonce[i++] ^= cfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, 15, "nonce:");
-  err = gcry_cipher_setiv (cfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -103,14 +130,14 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
   ad[2] = cfx->dek->algo;
   ad[3] = cfx->dek->use_aead;
   ad[4] = cfx->chunkbyte;
-  ad[5] = cfx->chunkindex >> 56;
-  ad[6] = cfx->chunkindex >> 48;
-  ad[7] = cfx->chunkindex >> 40;
-  ad[8] = cfx->chunkindex >> 32;
-  ad[9] = cfx->chunkindex >> 24;
-  ad[10]= cfx->chunkindex >> 16;
-  ad[11]= cfx->chunkindex >>  8;
-  ad[12]= cfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = cfx->total >> 56;
@@ -124,7 +151,84 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (cfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* Set the nonce and the additional data for the current chunk.  If
+ * FINAL is set the final AEAD chunk is processed.  */
+static gpg_error_t
+set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
+{
+  return set_nonce_and_ad_hd (cfx, cfx->cipher_hd, cfx->chunkindex, final);
+}
+
+
+/* Release the parallel encryption state of CFX.  */
+static void
+release_parallel (cipher_filter_context_t *cfx)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  unsigned int i;
+
+  if (!par)
+    return;
+
+  work_queue_release (par->wq);
+  for (i=0; i < par->nchunks; i++)
+    {
+      gcry_cipher_close (par->chunks[i].cipher_hd);
+      xfree (par->chunks[i].data);
+    }
+  xfree (par);
+  cfx->parallel = NULL;
+}
+
+
+/* Prepare CFX to encrypt OPT.WORKER_THREADS chunks in parallel.
+ * CIPHERMODE is the Libgcrypt mode for the AEAD algorithm.  */
+static gpg_error_t
+setup_parallel (cipher_filter_context_t *cfx,
+                enum gcry_cipher_modes ciphermode)
+{
+  gpg_error_t err;
+  struct aead_parallel_s *par;
+  unsigned int nchunks = opt.worker_threads;
+  unsigned int i;
+
+  par = xtrycalloc (1, sizeof *par + (nchunks - 1) * sizeof *par->chunks);
+  if (!par)
+    return gpg_error_from_syserror ();
+  cfx->parallel = par;
+  for (i=0; i < nchunks; i++)
+    {
+      struct aead_chunk_s *ck = par->chunks + i;
+
+      ck->cfx = cfx;
+      ck->data = xtrymalloc (cfx->chunksize + 16);
+      if (!ck->data)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      par->nchunks++;
+      err = openpgp_cipher_open (&ck->cipher_hd, cfx->dek->algo, ciphermode,
+                                 GCRY_CIPHER_SECURE);
+      if (!err)
+        err = gcry_cipher_setkey (ck->cipher_hd,
+                                  cfx->dek->key, cfx->dek->keylen);
+      if (err)
+        goto leave;
+    }
+
+  err = work_queue_new (&par->wq, nchunks);
+  if (!err && DBG_FILTER)
+    log_debug ("encrypting up to %u chunks in parallel\n", nchunks);
+
+ leave:
+  if (err)
+    release_parallel (cfx);
+  return err;
 }
 
 
@@ -200,6 +304,13 @@ write_header (cipher_filter_context_t *cfx, iobuf_t a)
   if (err)
     return err;
 
+  if (opt.worker_threads > 1 && cfx->chunksize <= AEAD_MAX_PARALLEL_CHUNKSIZE)
+    {
+      err = setup_parallel (cfx, ciphermode);
+      if (err)
+        goto leave;
+    }
+
   cfx->wrote_header = 1;
 
  leave:
@@ -353,6 +464,136 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
 }
 
 
+/* The job run by the worker threads to encrypt the chunk OPAQUE.  */
+static void
+encrypt_chunk_job (void *opaque)
+{
+  struct aead_chunk_s *ck = opaque;
+  gpg_error_t err;
+
+  err = set_nonce_and_ad_hd (ck->cfx, ck->cipher_hd, ck->chunkindex, 0);
+  if (!err)
+    {
+      gcry_cipher_final (ck->cipher_hd);
+      err = gcry_cipher_encrypt (ck->cipher_hd, ck->data, ck->len, NULL, 0);
+    }
+  if (!err)
+    err = gcry_cipher_gettag (ck->cipher_hd, ck->data + ck->len, 16);
+  ck->err = err;
+}
+
+
+/* Encrypt the first NCHUNKS chunks of the parallel state of CFX
+ * using the worker threads and write them in order to stream A.  */
+static gpg_error_t
+encrypt_chunks (cipher_filter_context_t *cfx, iobuf_t a, unsigned int nchunks)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  struct aead_chunk_s *ck;
+  gpg_error_t err = 0;
+  unsigned int i;
+
+  for (i=0; i < nchunks; i++)
+    {
+      ck = par->chunks + i;
+      ck->chunkindex = cfx->chunkindex++;
+      ck->err = 0;
+      err = work_queue_add (par->wq, encrypt_chunk_job, ck);
+      if (err)
+        break;
+    }
+  work_queue_wait (par->wq);
+  nchunks = i;
+
+  for (i=0; !err && i < nchunks; i++)
+    {
+      ck = par->chunks + i;
+      err = ck->err;
+      if (err)
+        {
+          log_error ("encrypting chunk %ju failed: %s\n",
+                     (uintmax_t)ck->chunkindex, gpg_strerror (err));
+          break;
+        }
+      if (DBG_FILTER)
+        log_debug ("writing chunk %ju: len=%zu\n",
+                   (uintmax_t)ck->chunkindex, ck->len);
+      err = my_iobuf_write (a, ck->data, ck->len + 16);
+      cfx->total += ck->len;
+      ck->len = 0;
+    }
+  par->nfilled = 0;
+
+  return err;
+}
+
+
+/* The flush sub-function of cipher_filter_aead used if chunks are
+ * encrypted in parallel.  */
+static gpg_error_t
+do_flush_parallel (cipher_filter_context_t *cfx, iobuf_t a,
+                   byte *buf, size_t size)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  struct aead_chunk_s *ck;
+  gpg_error_t err;
+  size_t n;
+
+  while (size)
+    {
+      ck = par->chunks + par->nfilled;
+      n = cfx->chunksize - ck->len;
+      if (n > size)
+        n = size;
+      memcpy (ck->data + ck->len, buf, n);
+      ck->len += n;
+      buf  += n;
+      size -= n;
+
+      if (ck->len == cfx->chunksize && ++par->nfilled == par->nchunks)
+        {
+          err = encrypt_chunks (cfx, a, par->nfilled);
+          if (err)
+            return err;
+        }
+    }
+
+  return 0;
+}
+
+
+/* The core of the free sub-function of cipher_filter_aead used if
+ * chunks are encrypted in parallel.  */
+static gpg_error_t
+do_free_parallel (cipher_filter_context_t *cfx, iobuf_t a)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  gpg_error_t err = 0;
+  unsigned int n;
+
+  /* Encrypt the filled chunks and the last, possibly short, chunk.  */
+  n = par->nfilled;
+  if (par->chunks[n].len)
+    n++;
+  if (n)
+    err = encrypt_chunks (cfx, a, n);
+
+  if (!err)
+    {
+      if (DBG_FILTER)
+        log_debug ("creating final chunk\n");
+      err = write_final_chunk (cfx, a);
+    }
+
+  release_parallel (cfx);
+  xfree (cfx->buffer);
+  cfx->buffer = NULL;
+  gcry_cipher_close (cfx->cipher_hd);
+  cfx->cipher_hd = NULL;
+  return err;
+}
+
+
 /* The core of the free sub-function of cipher_filter_aead.   */
 static gpg_error_t
 do_free (cipher_filter_context_t *cfx, iobuf_t a)
@@ -432,12 +673,17 @@ cipher_filter_aead (void *opaque, int control,
     {
       if (!cfx->wrote_header && (rc=write_header (cfx, a)))
         ;
+      else if (cfx->parallel)
+        rc = do_flush_parallel (cfx, a, buf, size);
       else
         rc = do_flush (cfx, a, buf, size);
     }
   else if (control == IOBUFCTRL_FREE)
     {
-      rc = do_free (cfx, a);
+      if (cfx->parallel)
+        rc = do_free_parallel (cfx, a);
+      else
+        rc = do_free (cfx, a);
     }
   else if (control == IOBUFCTRL_DESC)
     {
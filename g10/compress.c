@@ -43,6 +43,7 @@
 #include "filter.h"
 #include "main.h"
 #include "options.h"
+#include "../common/work-queue.h"
 
 
 #ifdef __riscos__
@@ -57,6 +58,62 @@ int compress_filter_bz2( void *opaque, int control,
 			 IOBUF a, byte *buf, size_t *ret_len);
 
 #ifdef HAVE_ZIP
+
+/* The size of the blocks deflated in parallel.  */
+#define PARALLEL_BLOCKSIZE (128*1024)
+
+/* A block deflated by a worker thread.  */
+struct compress_block_s
+{
+  z_stream zs;          /* Raw deflate stream for this block.  */
+  const byte *dict;     /* The preset dictionary or NULL.  */
+  size_t dictlen;
+  byte *in;             /* The input of PARALLEL_BLOCKSIZE bytes.  */
+  size_t inlen;
+  byte *out;            /* The output buffer.  */
+  size_t outsize;
+  size_t outlen;
+  int last;             /* This is the last block of the stream.  */
+  uLong check;          /* The Adler-32 checksum of IN.  */
+  int zrc;              /* The result of deflate.  */
+};
+
+/* The state for parallel deflate.  */
+struct compress_parallel_s
+{
+  work_queue_t wq;
+  int level;
+  unsigned int window;  /* The size of the deflate window.  */
+  uLong check;          /* The Adler-32 checksum of all input.  */
+  int wrote_header;     /* The ZLIB header has been written.  */
+
+  /* The tail of the last block of the previous batch.  */
+  byte dict[32768];
+  size_t dictlen;
+
+  unsigned int nfilled; /* Number of completely filled blocks.  */
+  unsigned int nblocks;
+  struct compress_block_s blocks[1];
+};
+
+
+/* Return the zlib compression level to use.  */
+static int
+get_compress_level (void)
+{
+    int level;
+
+    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
+	level = opt.compress_level;
+    else if( opt.compress_level == -1 )
+	level = Z_DEFAULT_COMPRESSION;
+    else {
+	log_error("invalid compression level; using default level\n");
+	level = Z_DEFAULT_COMPRESSION;
+    }
+    return level;
+}
+
 static void
 init_compress( compress_filter_context_t *zfx, z_stream *zs )
 {
@@ -70,14 +127,7 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
         zlib_initialized = riscos_load_module("ZLib", zlib_path, 1);
 #endif
 
-    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
-	level = opt.compress_level;
-    else if( opt.compress_level == -1 )
-	level = Z_DEFAULT_COMPRESSION;
-    else {
-	log_error("invalid compression level; using default level\n");
-	level = Z_DEFAULT_COMPRESSION;
-    }
+    level = get_compress_level ();
 
     if( (rc = zfx->algo == 1? deflateInit2( zs, level, Z_DEFLATED,
 					    -13, 8, Z_DEFAULT_STRATEGY)
@@ -130,6 +180,254 @@ do_compress( compress_filter_context_t *zfx, z_stream *zs, int flush, IOBUF a )
     return 0;
 }
 
+
+/* Release the parallel deflate state of ZFX.  */
+static void
+release_parallel (compress_filter_context_t *zfx)
+{
+  struct compress_parallel_s *par = zfx->parallel;
+  unsigned int i;
+
+  if (!par)
+    return;
+
+  work_queue_release (par->wq);
+  for (i=0; i < par->nblocks; i++)
+    {
+      deflateEnd (&par->blocks[i].zs);
+      xfree (par->blocks[i].in);
+      xfree (par->blocks[i].out);
+    }
+  xfree (par);
+  zfx->parallel = NULL;
+}
+
+
+/* Prepare ZFX to deflate OPT.WORKER_THREADS blocks in parallel.
+ * Each block is deflated as raw deflate data and primed with the
+ * tail of the previous block; this is the same scheme as used by
+ * pigz.  Returns an error if parallel mode is not possible.  */
+static gpg_error_t
+setup_parallel (compress_filter_context_t *zfx)
+{
+  gpg_error_t err;
+  struct compress_parallel_s *par;
+  unsigned int nblocks = opt.worker_threads;
+  unsigned int i;
+  int zrc;
+
+  par = xtrycalloc (1, sizeof *par + (nblocks - 1) * sizeof *par->blocks);
+  if (!par)
+    return gpg_error_from_syserror ();
+  zfx->parallel = par;
+  par->level = get_compress_level ();
+  /* PGP uses a windowsize of 13 bits for ZIP; see init_compress.  */
+  par->window = zfx->algo == COMPRESS_ALGO_ZIP? 8192 : 32768;
+  par->check = adler32 (0L, Z_NULL, 0);
+
+  for (i=0; i < nblocks; i++)
+    {
+      struct compress_block_s *blk = par->blocks + i;
+
+      zrc = deflateInit2 (&blk->zs, par->level, Z_DEFLATED,
+                          zfx->algo == COMPRESS_ALGO_ZIP? -13 : -15,
+                          8, Z_DEFAULT_STRATEGY);
+      if (zrc != Z_OK)
+        {
+          err = gpg_error (zrc == Z_MEM_ERROR? GPG_ERR_ENOMEM
+                           /**/              : GPG_ERR_INTERNAL);
+          goto leave;
+        }
+      par->nblocks++;
+      /* Allow for the sync flush marker.  */
+      blk->outsize = deflateBound (&blk->zs, PARALLEL_BLOCKSIZE) + 16;
+      blk->in = xtrymalloc (PARALLEL_BLOCKSIZE);
+      blk->out = xtrymalloc (blk->outsize);
+      if (!blk->in || !blk->out)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  err = work_queue_new (&par->wq, nblocks);
+  if (!err && DBG_FILTER)
+    log_debug ("deflating up to %u blocks in parallel\n", nblocks);
+
+ leave:
+  if (err)
+    release_parallel (zfx);
+  return err;
+}
+
+
+/* The job run by the worker threads to deflate the block OPAQUE.  */
+static void
+compress_block_job (void *opaque)
+{
+  struct compress_block_s *blk = opaque;
+  z_stream *zs = &blk->zs;
+  int zrc;
+
+  zrc = deflateReset (zs);
+  if (zrc == Z_OK && blk->dictlen)
+    zrc = deflateSetDictionary (zs, BYTEF_CAST (blk->dict), blk->dictlen);
+  if (zrc == Z_OK)
+    {
+      zs->next_in = BYTEF_CAST (blk->in);
+      zs->avail_in = blk->inlen;
+      zs->next_out = BYTEF_CAST (blk->out);
+      zs->avail_out = blk->outsize;
+      /* A sync flush ends the block on a byte boundary so that the
+       * next block can simply be appended.  */
+      zrc = deflate (zs, blk->last? Z_FINISH : Z_SYNC_FLUSH);
+      if (blk->last && zrc == Z_STREAM_END)
+        zrc = Z_OK;
+      else if (zrc == Z_OK && (zs->avail_in || blk->last))
+        zrc = Z_BUF_ERROR;  /* Output buffer too short.  */
+    }
+  blk->outlen = blk->outsize - zs->avail_out;
+  blk->check = adler32 (0L, Z_NULL, 0);
+  blk->check = adler32 (blk->check, BYTEF_CAST (blk->in), blk->inlen);
+  blk->zrc = zrc;
+}
+
+
+/* Deflate all filled blocks of the parallel state of ZFX and write
+ * them to A.  If LAST is set the currently filled block is included
+ * and the stream is terminated.  */
+static int
+compress_blocks (compress_filter_context_t *zfx, IOBUF a, int last)
+{
+  struct compress_parallel_s *par = zfx->parallel;
+  struct compress_block_s *blk;
+  unsigned int n, i;
+  byte tmp[4];
+  int rc;
+
+  n = par->nfilled + !!last;
+  for (i=0; i < n; i++)
+    {
+      blk = par->blocks + i;
+      if (i)
+        {
+          blk->dict = par->blocks[i-1].in + PARALLEL_BLOCKSIZE - par->window;
+          blk->dictlen = par->window;
+        }
+      else
+        {
+          blk->dict = par->dict;
+          blk->dictlen = par->dictlen;
+        }
+      blk->last = last && i + 1 == n;
+      rc = work_queue_add (par->wq, compress_block_job, blk);
+      if (rc)
+        {
+          work_queue_wait (par->wq);
+          log_error ("deflate: error queueing block: %s\n", gpg_strerror (rc));
+          return rc;
+        }
+    }
+  work_queue_wait (par->wq);
+
+  if (zfx->algo == COMPRESS_ALGO_ZLIB && !par->wrote_header)
+    {
+      int level = par->level == Z_DEFAULT_COMPRESSION? 6 : par->level;
+      unsigned int hdr;
+
+      /* Same as the header written by deflateInit.  */
+      hdr = (0x78 << 8) | ((level < 2? 0 : level < 6? 1 : level == 6? 2 : 3)
+                           << 6);
+      hdr += 31 - (hdr % 31);
+      tmp[0] = hdr >> 8;
+      tmp[1] = hdr;
+      if ((rc = iobuf_write (a, tmp, 2)))
+        return rc;
+      par->wrote_header = 1;
+    }
+
+  for (i=0; i < n; i++)
+    {
+      blk = par->blocks + i;
+      if (blk->zrc != Z_OK)
+        {
+          if (blk->zs.msg)
+            log_fatal ("zlib deflate problem: %s\n", blk->zs.msg);
+          else
+            log_fatal ("zlib deflate problem: rc=%d\n", blk->zrc);
+        }
+      if (DBG_FILTER)
+        log_debug ("deflate block %u: in=%zu out=%zu%s\n",
+                   i, blk->inlen, blk->outlen, blk->last? " (last)":"");
+      if ((rc = iobuf_write (a, blk->out, blk->outlen)))
+        {
+          log_debug ("deflate: iobuf_write failed\n");
+          return rc;
+        }
+      par->check = adler32_combine (par->check, blk->check, blk->inlen);
+    }
+
+  if (last)
+    {
+      if (zfx->algo == COMPRESS_ALGO_ZLIB)
+        {
+          tmp[0] = par->check >> 24;
+          tmp[1] = par->check >> 16;
+          tmp[2] = par->check >>  8;
+          tmp[3] = par->check;
+          if ((rc = iobuf_write (a, tmp, 4)))
+            return rc;
+        }
+    }
+  else
+    {
+      /* Keep the tail of the last block as dictionary for the first
+       * block of the next batch.  */
+      blk = par->blocks + n - 1;
+      memcpy (par->dict, blk->in + PARALLEL_BLOCKSIZE - par->window,
+              par->window);
+      par->dictlen = par->window;
+    }
+
+  for (i=0; i < n; i++)
+    par->blocks[i].inlen = 0;
+  par->nfilled = 0;
+  return 0;
+}
+
+
+/* Put BUF of SIZE bytes into the blocks of the parallel state of ZFX
+ * and deflate them whenever all blocks are filled.  */
+static int
+do_compress_parallel (compress_filter_context_t *zfx, const byte *buf,
+                      size_t size, IOBUF a)
+{
+  struct compress_parallel_s *par = zfx->parallel;
+  struct compress_block_s *blk;
+  size_t n;
+  int rc;
+
+  while (size)
+    {
+      blk = par->blocks + par->nfilled;
+      n = PARALLEL_BLOCKSIZE - blk->inlen;
+      if (n > size)
+        n = size;
+      memcpy (blk->in + blk->inlen, buf, n);
+      blk->inlen += n;
+      buf += n;
+      size -= n;
+      if (blk->inlen == PARALLEL_BLOCKSIZE
+          && ++par->nfilled == par->nblocks)
+        {
+          if ((rc = compress_blocks (zfx, a, 0)))
+            return rc;
+        }
+    }
+  return 0;
+}
+
+
 static void
 init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 {
@@ -258,14 +556,22 @@ compress_filter( void *opaque, int control,
 	    pkt.pkt.compressed = &cd;
 	    if( build_packet( a, &pkt ))
 		log_bug("build_packet(PKT_COMPRESSED) failed\n");
-	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_compress( zfx, zs );
-	    zfx->status = 2;
+	    if (opt.worker_threads > 1 && !setup_parallel (zfx))
+		zfx->status = 3;
+	    else {
+		zs = zfx->opaque = xmalloc_clear( sizeof *zs );
+		init_compress( zfx, zs );
+		zfx->status = 2;
+	    }
 	}
 
-	zs->next_in = BYTEF_CAST (buf);
-	zs->avail_in = size;
-	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	if( zfx->status == 3 )
+	    rc = do_compress_parallel( zfx, buf, size, a );
+	else {
+	    zs->next_in = BYTEF_CAST (buf);
+	    zs->avail_in = size;
+	    rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	}
     }
     else if( control == IOBUFCTRL_FREE ) {
 	if( zfx->status == 1 ) {
@@ -283,6 +589,10 @@ compress_filter( void *opaque, int control,
 	    zfx->opaque = NULL;
 	    xfree(zfx->outbuf); zfx->outbuf = NULL;
 	}
+	else if( zfx->status == 3 ) {
+	    compress_blocks( zfx, a, 1 );
+	    release_parallel( zfx );
+	}
         if (zfx->release)
           zfx->release (zfx);
     }
@@ -31,6 +31,7 @@
 #include "../common/i18n.h"
 #include "../common/status.h"
 #include "../common/compliance.h"
+#include "../common/work-queue.h"
 
 
 static int aead_decode_filter (void *opaque, int control, iobuf_t a,
@@ -96,10 +97,52 @@ struct decode_filter_context_s
   /* Remaining bytes in the packet according to the packet header.
    * Not used if PARTIAL is true.  */
   size_t length;
+
+  /* The state for decrypting several AEAD chunks in parallel or NULL
+   * if the chunks are decrypted one after the other.  */
+  struct aead_parallel_s *parallel;
 };
 typedef struct decode_filter_context_s *decode_filter_ctx_t;
 
 
+/* The largest chunk size for which we decrypt several chunks in
+ * parallel.  We need to buffer one chunk per thread.  */
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (16*1024*1024)
+
+/* A chunk decrypted by a worker thread.  */
+struct aead_chunk_s
+{
+  decode_filter_ctx_t dfx;
+  gcry_cipher_hd_t cipher_hd;  /* The cipher handle for this chunk.   */
+  uint64_t chunkindex;         /* The index of the chunk.             */
+  byte *data;                  /* The chunk followed by its tag.      */
+  size_t len;                  /* Length of the chunk without the tag. */
+  gpg_error_t err;             /* The result of the job.              */
+};
+
+/* The state for parallel decryption.  */
+struct aead_parallel_s
+{
+  work_queue_t wq;
+
+  /* The buffer for the raw data of NCHUNKS chunks with their tags and
+   * 16 bytes lookahead to detect the final tag.  */
+  byte *buffer;
+  size_t bufsize;
+
+  unsigned int nready;  /* Number of decrypted chunks in BUFFER.  */
+  unsigned int cur;     /* The chunk we are currently returning.  */
+  size_t curoff;        /* Offset into that chunk.                */
+  int done;             /* The final tag has been checked.        */
+
+  unsigned int nchunks; /* Number of allocated chunks.  */
+  struct aead_chunk_s chunks[1];
+};
+
+
+static void release_parallel (decode_filter_ctx_t dfx);
+
+
 /* Helper to release the decode context.  */
 static void
 release_dfx_context (decode_filter_ctx_t dfx)
@@ -110,6 +153,7 @@ release_dfx_context (decode_filter_ctx_t dfx)
   log_assert (dfx->refcount);
   if ( !--dfx->refcount )
     {
+      release_parallel (dfx);
       gcry_cipher_close (dfx->cipher_hd);
       dfx->cipher_hd = NULL;
       gcry_md_close (dfx->mdc_hash);
@@ -119,12 +163,13 @@ release_dfx_context (decode_filter_ctx_t dfx)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  This
- * also reset the decryption machinery so that the handle can be
- * used for a new chunk.  If FINAL is set the final AEAD chunk is
- * processed.  */
+/* Set the nonce and the additional data for the chunk CHUNKINDEX
+ * using the cipher handle HD.  This also reset the decryption
+ * machinery so that the handle can be used for a new chunk.  If FINAL
+ * is set the final AEAD chunk is processed.  */
 static gpg_error_t
-aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
+aead_set_nonce_and_ad_hd (decode_filter_ctx_t dfx, gcry_cipher_hd_t hd,
+                          uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char ad[21];
@@ -146,18 +191,18 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     default:
       BUG ();
     }
-  nonce[i++] ^= dfx->chunkindex >> 56;
-  nonce[i++] ^= dfx->chunkindex >> 48;
-  nonce[i++] ^= dfx->chunkindex >> 40;
-  nonce[i++] ^= dfx->chunkindex >> 32;
-  nonce[i++] ^= dfx->chunkindex >> 24;
-  nonce[i++] ^= dfx->chunkindex >> 16;
-  nonce[i++] ^= dfx->chunkindex >>  8;
-  nonce[i++] ^= dfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, i, "nonce:");
-  err = gcry_cipher_setiv (dfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -166,14 +211,14 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
   ad[2] = dfx->cipher_algo;
   ad[3] = dfx->aead_algo;
   ad[4] = dfx->chunkbyte;
-  ad[5] = dfx->chunkindex >> 56;
-  ad[6] = dfx->chunkindex >> 48;
-  ad[7] = dfx->chunkindex >> 40;
-  ad[8] = dfx->chunkindex >> 32;
-  ad[9] = dfx->chunkindex >> 24;
-  ad[10]= dfx->chunkindex >> 16;
-  ad[11]= dfx->chunkindex >>  8;
-  ad[12]= dfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = dfx->total >> 56;
@@ -187,7 +232,17 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (dfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* Set the nonce and the additional data for the current chunk.  If
+ * FINAL is set the final AEAD chunk is processed.  */
+static gpg_error_t
+aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
+{
+  return aead_set_nonce_and_ad_hd (dfx, dfx->cipher_hd, dfx->chunkindex,
+                                   final);
 }
 
 
@@ -213,6 +268,76 @@ aead_checktag (decode_filter_ctx_t dfx, int final, const void *tagbuf)
 }
 
 
+/* Release the parallel decryption state of DFX.  */
+static void
+release_parallel (decode_filter_ctx_t dfx)
+{
+  struct aead_parallel_s *par = dfx->parallel;
+  unsigned int i;
+
+  if (!par)
+    return;
+
+  work_queue_release (par->wq);
+  for (i=0; i < par->nchunks; i++)
+    gcry_cipher_close (par->chunks[i].cipher_hd);
+  xfree (par->buffer);
+  xfree (par);
+  dfx->parallel = NULL;
+}
+
+
+/* Prepare DFX to decrypt OPT.WORKER_THREADS chunks in parallel using
+ * the key from DEK.  CIPHERMODE is the Libgcrypt mode for the AEAD
+ * algorithm.  */
+static gpg_error_t
+setup_parallel (decode_filter_ctx_t dfx, DEK *dek,
+                enum gcry_cipher_modes ciphermode)
+{
+  gpg_error_t err;
+  struct aead_parallel_s *par;
+  unsigned int nchunks = opt.worker_threads;
+  unsigned int i;
+
+  par = xtrycalloc (1, sizeof *par + (nchunks - 1) * sizeof *par->chunks);
+  if (!par)
+    return gpg_error_from_syserror ();
+  dfx->parallel = par;
+  par->bufsize = nchunks * (dfx->chunksize + 16) + 16;
+  par->buffer = xtrymalloc (par->bufsize);
+  if (!par->buffer)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (i=0; i < nchunks; i++)
+    {
+      struct aead_chunk_s *ck = par->chunks + i;
+
+      ck->dfx = dfx;
+      par->nchunks++;
+      err = openpgp_cipher_open (&ck->cipher_hd, dfx->cipher_algo,
+                                 ciphermode, GCRY_CIPHER_SECURE);
+      if (err)
+        goto leave;
+      err = gcry_cipher_setkey (ck->cipher_hd, dek->key, dek->keylen);
+      if (gpg_err_code (err) == GPG_ERR_WEAK_KEY)
+        err = 0;  /* Already reported for the main handle.  */
+      if (err)
+        goto leave;
+    }
+
+  err = work_queue_new (&par->wq, nchunks);
+  if (!err && DBG_FILTER)
+    log_debug ("decrypting up to %u chunks in parallel\n", nchunks);
+
+ leave:
+  if (err)
+    release_parallel (dfx);
+  return err;
+}
+
+
 /****************
  * Decrypt the data, specified by ED with the key DEK.
  */
@@ -374,6 +499,14 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
           goto leave;
         }
 
+      if (opt.worker_threads > 1
+          && dfx->chunksize <= AEAD_MAX_PARALLEL_CHUNKSIZE)
+        {
+          rc = setup_parallel (dfx, dek, ciphermode);
+          if (rc)
+            goto leave;
+        }
+
     }
   else /* CFB encryption.  */
     {
@@ -847,6 +980,195 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
 }
 
 
+/* The job run by the worker threads to decrypt and authenticate the
+ * chunk OPAQUE.  */
+static void
+decrypt_chunk_job (void *opaque)
+{
+  struct aead_chunk_s *ck = opaque;
+  gpg_error_t err;
+
+  err = aead_set_nonce_and_ad_hd (ck->dfx, ck->cipher_hd, ck->chunkindex, 0);
+  if (!err)
+    {
+      gcry_cipher_final (ck->cipher_hd);
+      err = gcry_cipher_decrypt (ck->cipher_hd, ck->data, ck->len, NULL, 0);
+    }
+  if (!err)
+    err = gcry_cipher_checktag (ck->cipher_hd, ck->data + ck->len, 16);
+  ck->err = err;
+}
+
+
+/* Read up to NCHUNKS chunks into the buffer of the parallel state of
+ * DFX and decrypt them using the worker threads.  After the last
+ * chunk has been read the final tag is checked.  */
+static gpg_error_t
+decrypt_chunks (decode_filter_ctx_t dfx, iobuf_t a)
+{
+  struct aead_parallel_s *par = dfx->parallel;
+  const size_t recsize = dfx->chunksize + 16;
+  struct aead_chunk_s *ck;
+  gpg_error_t err = 0;
+  unsigned int nrec, i;
+  size_t len;
+
+  /* Start with the lookahead from the last call.  We need to keep 16
+   * bytes after the chunks because a full chunk may actually be a
+   * shorter last chunk followed by the final tag.  */
+  len = dfx->holdbacklen;
+  dfx->holdbacklen = 0;
+  memcpy (par->buffer, dfx->holdback, len);
+  len = fill_buffer (dfx, a, par->buffer, par->bufsize, len);
+  if (len < 16)
+    return gpg_error (GPG_ERR_TRUNCATED);
+  len -= 16;
+  memcpy (dfx->holdback, par->buffer + len, 16);
+  dfx->holdbacklen = 16;
+  if (!dfx->eof_seen)
+    nrec = par->nchunks;
+  else
+    {
+      /* The holdback buffer now has the final tag.  */
+      nrec = len / recsize;
+      if (len % recsize)
+        {
+          if (len % recsize < 16)
+            return gpg_error (GPG_ERR_TRUNCATED);
+          nrec++;
+        }
+    }
+
+  if (DBG_FILTER)
+    log_debug ("decrypting %u chunks in parallel%s\n",
+               nrec, dfx->eof_seen? " (eof)":"");
+
+  for (i=0; i < nrec; i++)
+    {
+      ck = par->chunks + i;
+      ck->data = par->buffer + i * recsize;
+      ck->len = (len - i * recsize < recsize? len - i * recsize : recsize) - 16;
+      ck->chunkindex = dfx->chunkindex++;
+      ck->err = 0;
+      err = work_queue_add (par->wq, decrypt_chunk_job, ck);
+      if (err)
+        break;
+    }
+  work_queue_wait (par->wq);
+  nrec = i;
+
+  for (i=0; !err && i < nrec; i++)
+    {
+      ck = par->chunks + i;
+      err = ck->err;
+      if (err)
+        log_error ("decrypting chunk %ju failed: %s\n",
+                   (uintmax_t)ck->chunkindex, gpg_strerror (err));
+      dfx->total += ck->len;
+    }
+  if (err)
+    {
+      /* Do not convey any plaintext.  */
+      wipememory (par->buffer, par->bufsize);
+      return err;
+    }
+  par->nready = nrec;
+  par->cur = 0;
+  par->curoff = 0;
+
+  if (dfx->eof_seen)
+    {
+      /* Check the final chunk.  */
+      err = aead_set_nonce_and_ad (dfx, 1);
+      if (err)
+        return err;
+      gcry_cipher_final (dfx->cipher_hd);
+      /* Decrypt an empty string (using HOLDBACK as a dummy).  */
+      err = gcry_cipher_decrypt (dfx->cipher_hd, dfx->holdback, 0, NULL, 0);
+      if (err)
+        {
+          log_error ("gcry_cipher_decrypt failed (final): %s\n",
+                     gpg_strerror (err));
+          return err;
+        }
+      err = aead_checktag (dfx, 1, dfx->holdback);
+      if (err)
+        {
+          wipememory (par->buffer, par->bufsize);
+          par->nready = 0;
+          return err;
+        }
+      par->done = 1;
+    }
+
+  return 0;
+}
+
+
+/* The underflow function of the aead_decode_filter used if chunks are
+ * decrypted in parallel.  Other than aead_underflow this returns data
+ * only after the tag of its chunk has been verified.  */
+static gpg_error_t
+aead_underflow_parallel (decode_filter_ctx_t dfx, iobuf_t a,
+                         byte *buf, size_t *ret_len)
+{
+  struct aead_parallel_s *par = dfx->parallel;
+  const size_t size = *ret_len;
+  struct aead_chunk_s *ck;
+  gpg_error_t err = 0;
+  size_t totallen = 0;
+  size_t n;
+
+  while (totallen < size)
+    {
+      if (par->cur < par->nready)
+        {
+          ck = par->chunks + par->cur;
+          n = ck->len - par->curoff;
+          if (n > size - totallen)
+            n = size - totallen;
+          memcpy (buf + totallen, ck->data + par->curoff, n);
+          totallen += n;
+          par->curoff += n;
+          if (par->curoff == ck->len)
+            {
+              par->cur++;
+              par->curoff = 0;
+            }
+        }
+      else if (par->done)
+        break;
+      else
+        {
+          err = decrypt_chunks (dfx, a);
+          if (err)
+            break;
+        }
+    }
+
+  if (!err && !totallen && par->done)
+    err = gpg_error (GPG_ERR_EOF);
+
+  if (DBG_FILTER)
+    log_debug ("aead_underflow_parallel: returning %zu (%s)\n",
+               totallen, gpg_strerror (err));
+
+  /* In case of an auth error we map the error code to the same as
+   * used by the MDC decryption.  */
+  if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
+    err = gpg_error (GPG_ERR_BAD_SIGNATURE);
+
+  if (err && gpg_err_code (err) != GPG_ERR_EOF)
+    {
+      memset (buf, 0, size);
+      totallen = 0;
+    }
+
+  *ret_len = totallen;
+  return err;
+}
+
+
 /* The IOBUF filter used to decrypt AEAD encrypted data.  */
 static int
 aead_decode_filter (void *opaque, int control, IOBUF a,
@@ -855,7 +1177,15 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
   decode_filter_ctx_t dfx = opaque;
   int rc = 0;
 
-  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
+  if ( control == IOBUFCTRL_UNDERFLOW && dfx->parallel )
+    {
+      log_assert (a);
+
+      rc = aead_underflow_parallel (dfx, a, buf, ret_len);
+      if (gpg_err_code (rc) == GPG_ERR_EOF)
+        rc = -1; /* We need to use the old convention in the filter.  */
+    }
+  else if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
     {
       *ret_len = 0;
       rc = -1;
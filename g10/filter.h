@@ -81,6 +81,7 @@ struct compress_filter_context_s {
     int algo;	 /* compress algo */
     int algo1hack;
     int new_ctb;
+    struct compress_parallel_s *parallel; /* State for parallel deflate.  */
     void (*release)(struct compress_filter_context_s*);
 };
 typedef struct compress_filter_context_s compress_filter_context_t;
@@ -132,6 +133,10 @@ typedef struct
   size_t bufsize;  /* Allocated length.  */
   size_t buflen;   /* Used length.       */
 
+  /* The state for encrypting several AEAD chunks in parallel or NULL
+   * if the chunks are encrypted by the filter itself.  */
+  struct aead_parallel_s *parallel;
+
 } cipher_filter_context_t;
 
 
@@ -37,7 +37,9 @@
 #include "keyserver-internal.h"
 #include "call-agent.h"
 #include "objcache.h"
+#include "keystate-cache.h"
 #include "../common/host2net.h"
+#include "../common/membuf.h"
 #include "../common/mbox-util.h"
 #include "../common/status.h"
 
@@ -48,6 +50,10 @@
 #error We need the cache for key creation
 #endif
 
+/* The number of hash buckets of the lookup cache.  Must be a power
+ * of 2.  */
+#define LOOKUP_CACHE_BUCKETS   1024
+
 /* Flags values returned by the lookup code.  Note that the values are
  * directly used by the KEY_CONSIDERED status line.  */
 #define LOOKUP_NOT_SELECTED        (1<<0)
@@ -119,16 +125,49 @@ typedef struct keyid_list
 } *keyid_list_t;
 
 
+/* The lookup cache holds the results of key lookups by key id,
+ * fingerprint or user id.  Unsuccessful lookups are cached as well so
+ * that repeated requests for a missing key don't hit the database
+ * again.  The entries are kept in a hash table and in a list ordered
+ * by their last use; if the cache is full the least recently used
+ * entry is dropped.  The entire cache is flushed whenever this
+ * process changes the key database.  */
 #if MAX_PK_CACHE_ENTRIES
+
+/* The type of the search term of a cache entry.  */
+enum lookup_cache_types
+  {
+    LOOKUP_CACHE_KEYID,
+    LOOKUP_CACHE_FPR,
+    LOOKUP_CACHE_NAME
+  };
+
 typedef struct pk_cache_entry
 {
-  struct pk_cache_entry *next;
-  u32 keyid[2];
-  PKT_public_key *pk;
+  struct pk_cache_entry *next;      /* Next entry in the bucket.  */
+  struct pk_cache_entry *lru_prev;  /* Next more recently used entry.  */
+  struct pk_cache_entry *lru_next;  /* Next less recently used entry.  */
+  unsigned int hash;
+  unsigned int type:2;    /* One of LOOKUP_CACHE_*.  */
+  unsigned int flags:8;   /* Additional search parameters.  */
+  unsigned int req_usage:8;
+  PKT_public_key *pk;     /* The found key or NULL if not found.  */
+  size_t termlen;
+  byte term[1];           /* The search term.  */
 } *pk_cache_entry_t;
-static pk_cache_entry_t pk_cache;
+
+static pk_cache_entry_t pk_cache[LOOKUP_CACHE_BUCKETS];
+static pk_cache_entry_t pk_cache_mru;   /* Most recently used entry.  */
+static pk_cache_entry_t pk_cache_lru;   /* Least recently used entry.  */
 static int pk_cache_entries;	/* Number of entries in pk cache.  */
 static int pk_cache_disabled;
+static unsigned int pk_cache_change_count; /* See keydb_get_change_count.  */
+static struct {
+  unsigned int hits;
+  unsigned int neg_hits;
+  unsigned int misses;
+  unsigned int flushes;
+} pk_cache_stats;
 #endif
 
 #if MAX_UID_CACHE_ENTRIES < 5
@@ -162,11 +201,222 @@ print_stats ()
 #endif
 
 
+#if MAX_PK_CACHE_ENTRIES
+/* Remove all entries from the lookup cache.  */
+static void
+pk_cache_flush (void)
+{
+  pk_cache_entry_t ce, ce2;
+
+  for (ce = pk_cache_mru; ce; ce = ce2)
+    {
+      ce2 = ce->lru_next;
+      free_public_key (ce->pk);
+      xfree (ce);
+    }
+  memset (pk_cache, 0, sizeof pk_cache);
+  pk_cache_mru = pk_cache_lru = NULL;
+  pk_cache_entries = 0;
+}
+
+
+/* Flush the lookup cache if the key database has been changed since
+ * the last call.  */
+static void
+pk_cache_check_changes (void)
+{
+  unsigned int count = keydb_get_change_count ();
+
+  if (count != pk_cache_change_count)
+    {
+      pk_cache_change_count = count;
+      if (pk_cache_entries)
+        {
+          if (DBG_CACHE)
+            log_debug ("lookup cache: flushed due to keydb changes\n");
+          pk_cache_flush ();
+          pk_cache_stats.flushes++;
+        }
+    }
+}
+
+
+/* Compute the hash value for a search term.  */
+static unsigned int
+pk_cache_hash (int type, const void *term, size_t termlen)
+{
+  const byte *p = term;
+  unsigned int hash = type;
+
+  /* FNV-1a */
+  hash ^= 2166136261U;
+  for (; termlen; termlen--, p++)
+    {
+      hash ^= *p;
+      hash *= 16777619;
+    }
+  return hash;
+}
+
+
+/* Unlink CE from the LRU list.  */
+static void
+pk_cache_lru_unlink (pk_cache_entry_t ce)
+{
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache_mru = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache_lru = ce->lru_prev;
+  ce->lru_prev = ce->lru_next = NULL;
+}
+
+
+/* Put CE at the head of the LRU list.  */
+static void
+pk_cache_lru_push (pk_cache_entry_t ce)
+{
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache_mru;
+  if (pk_cache_mru)
+    pk_cache_mru->lru_prev = ce;
+  pk_cache_mru = ce;
+  if (!pk_cache_lru)
+    pk_cache_lru = ce;
+}
+
+
+/* Remove CE from the cache and release it.  */
+static void
+pk_cache_remove (pk_cache_entry_t ce)
+{
+  pk_cache_entry_t *cep;
+
+  for (cep = &pk_cache[ce->hash % LOOKUP_CACHE_BUCKETS]; *cep;
+       cep = &(*cep)->next)
+    if (*cep == ce)
+      {
+        *cep = ce->next;
+        break;
+      }
+  pk_cache_lru_unlink (ce);
+  free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache_entries--;
+}
+
+
+/* Look up the entry for the search term TERM of length TERMLEN with
+ * the parameters TYPE, FLAGS and REQ_USAGE in the cache.  If
+ * ANY_USAGE is set, a positive entry matches regardless of its
+ * REQ_USAGE.  Returns the entry or NULL if the term is not cached.
+ * Note that the returned entry may be a negative entry, that is one
+ * with PK set to NULL.  */
+static pk_cache_entry_t
+pk_cache_get (int type, unsigned int flags, unsigned int req_usage,
+              const void *term, size_t termlen, int any_usage)
+{
+  pk_cache_entry_t ce;
+  unsigned int hash;
+
+  if (pk_cache_disabled)
+    return NULL;
+  pk_cache_check_changes ();
+  if (!pk_cache_entries)
+    {
+      pk_cache_stats.misses++;
+      return NULL;
+    }
+
+  hash = pk_cache_hash (type, term, termlen);
+  for (ce = pk_cache[hash % LOOKUP_CACHE_BUCKETS]; ce; ce = ce->next)
+    if (ce->hash == hash && ce->type == type && ce->flags == flags
+        && ce->termlen == termlen && !memcmp (ce->term, term, termlen)
+        && (ce->req_usage == req_usage || (any_usage && ce->pk)))
+      {
+        if (ce != pk_cache_mru)
+          {
+            pk_cache_lru_unlink (ce);
+            pk_cache_lru_push (ce);
+          }
+        if (ce->pk)
+          pk_cache_stats.hits++;
+        else
+          pk_cache_stats.neg_hits++;
+        return ce;
+      }
+
+  pk_cache_stats.misses++;
+  return NULL;
+}
+
+
+/* Store the result of a lookup in the cache.  See pk_cache_get for a
+ * description of the parameters.  PK is the found key; it is copied
+ * into the cache.  If PK is NULL a negative entry is created.  An
+ * existing entry for the same term is replaced.  */
+static void
+pk_cache_put (int type, unsigned int flags, unsigned int req_usage,
+              const void *term, size_t termlen, PKT_public_key *pk)
+{
+  pk_cache_entry_t ce, ce2;
+  unsigned int hash;
+
+  if (pk_cache_disabled)
+    return;
+  if (pk && pk->flags.dont_cache)
+    return;
+  pk_cache_check_changes ();
+
+  /* Remove an existing entry for the term.  If we got a key, stale
+   * negative entries for other usages are removed as well.  */
+  hash = pk_cache_hash (type, term, termlen);
+  for (ce = pk_cache[hash % LOOKUP_CACHE_BUCKETS]; ce; ce = ce2)
+    {
+      ce2 = ce->next;
+      if (ce->hash == hash && ce->type == type && ce->flags == flags
+          && (ce->req_usage == req_usage || (pk && !ce->pk))
+          && ce->termlen == termlen && !memcmp (ce->term, term, termlen))
+        pk_cache_remove (ce);
+    }
+
+  while (pk_cache_entries >= MAX_PK_CACHE_ENTRIES && pk_cache_lru)
+    pk_cache_remove (pk_cache_lru);
+
+  ce = xtrymalloc (sizeof *ce + termlen);
+  if (!ce)
+    return;  /* Caching is not essential.  */
+  ce->hash = hash;
+  ce->type = type;
+  ce->flags = flags;
+  ce->req_usage = req_usage;
+  ce->pk = pk? copy_public_key (NULL, pk) : NULL;
+  ce->termlen = termlen;
+  memcpy (ce->term, term, termlen);
+  ce->next = pk_cache[hash % LOOKUP_CACHE_BUCKETS];
+  pk_cache[hash % LOOKUP_CACHE_BUCKETS] = ce;
+  pk_cache_lru_push (ce);
+  pk_cache_entries++;
+}
+
+
+/* Convert KEYID into a byte string usable as a cache term.  */
+static void
+pk_cache_keyid_term (byte *buffer, const u32 *keyid)
+{
+  ulongtobuf (buffer, keyid[0]);
+  ulongtobuf (buffer+4, keyid[1]);
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
+
+
 /* Cache a copy of a public key in the public key cache.  PK is not
  * cached if caching is disabled (via getkey_disable_caches), if
- * PK->FLAGS.DONT_CACHE is set, we don't know how to derive a key id
- * from the public key (e.g., unsupported algorithm), or a key with
- * the key id is already in the cache.
+ * PK->FLAGS.DONT_CACHE is set, or we don't know how to derive a key
+ * id from the public key (e.g., unsupported algorithm).
  *
  * The public key packet is copied into the cache using
  * copy_public_key.  Thus, any secret parts are not copied, for
@@ -178,8 +428,8 @@ void
 cache_public_key (PKT_public_key * pk)
 {
 #if MAX_PK_CACHE_ENTRIES
-  pk_cache_entry_t ce, ce2;
   u32 keyid[2];
+  byte term[8];
 
   if (pk_cache_disabled)
     return;
@@ -199,43 +449,8 @@ cache_public_key (PKT_public_key * pk)
   else
     return; /* Don't know how to get the keyid.  */
 
-  for (ce = pk_cache; ce; ce = ce->next)
-    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-      {
-	if (DBG_CACHE)
-	  log_debug ("cache_public_key: already in cache\n");
-	return;
-      }
-
-  if (pk_cache_entries >= MAX_PK_CACHE_ENTRIES)
-    {
-      int n;
-
-      /* Remove the last 50% of the entries.  */
-      for (ce = pk_cache, n = 0; ce && n < pk_cache_entries/2; n++)
-        ce = ce->next;
-      if (ce && ce != pk_cache && ce->next)
-        {
-          ce2 = ce->next;
-          ce->next = NULL;
-          ce = ce2;
-          for (; ce; ce = ce2)
-            {
-              ce2 = ce->next;
-              free_public_key (ce->pk);
-              xfree (ce);
-              pk_cache_entries--;
-            }
-        }
-      log_assert (pk_cache_entries < MAX_PK_CACHE_ENTRIES);
-    }
-  pk_cache_entries++;
-  ce = xmalloc (sizeof *ce);
-  ce->next = pk_cache;
-  pk_cache = ce;
-  ce->pk = copy_public_key (NULL, pk);
-  ce->keyid[0] = keyid[0];
-  ce->keyid[1] = keyid[1];
+  pk_cache_keyid_term (term, keyid);
+  pk_cache_put (LOOKUP_CACHE_KEYID, 0, pk->req_usage, term, 8, pk);
 #endif
 }
 
@@ -256,31 +471,36 @@ user_id_not_found_utf8 (void)
 
 
 
-/* Disable and drop the public key cache (which is filled by
-   cache_public_key and get_pubkey).  Note: there is currently no way
+/* Disable and drop the lookup cache (which is filled by
+   cache_public_key and the get_pubkey functions).  Note: there is currently no way
    to re-enable this cache.  */
 void
 getkey_disable_caches ()
 {
 #if MAX_PK_CACHE_ENTRIES
-  {
-    pk_cache_entry_t ce, ce2;
-
-    for (ce = pk_cache; ce; ce = ce2)
-      {
-	ce2 = ce->next;
-	free_public_key (ce->pk);
-	xfree (ce);
-      }
-    pk_cache_disabled = 1;
-    pk_cache_entries = 0;
-    pk_cache = NULL;
-  }
+  pk_cache_flush ();
+  pk_cache_disabled = 1;
 #endif
   /* fixme: disable user id cache ? */
 }
 
 
+/* Dump statistics of the lookup cache to the log.  */
+void
+getkey_dump_stats (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  log_info ("lookup cache: entries=%d hits=%u neg_hits=%u misses=%u"
+            " flushes=%u\n",
+            pk_cache_entries,
+            pk_cache_stats.hits,
+            pk_cache_stats.neg_hits,
+            pk_cache_stats.misses,
+            pk_cache_stats.flushes);
+#endif
+}
+
+
 /* Free a list of pubkey_t objects.  */
 void
 pubkeys_free (pubkey_t keys)
@@ -362,22 +582,27 @@ get_pubkey (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
   int rc = 0;
 
 #if MAX_PK_CACHE_ENTRIES
+  byte term[8];
+
+  pk_cache_keyid_term (term, keyid);
   if (pk)
     {
       /* Try to get it from the cache.  We don't do this when pk is
          NULL as it does not guarantee that the user IDs are
          cached. */
       pk_cache_entry_t ce;
-      for (ce = pk_cache; ce; ce = ce->next)
-	{
-	  if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	    /* XXX: We don't check PK->REQ_USAGE here, but if we don't
-	       read from the cache, we do check it!  */
-	    {
-	      copy_public_key (pk, ce->pk);
-	      return 0;
-	    }
-	}
+
+      /* XXX: We don't check PK->REQ_USAGE for found keys here, but if
+         we don't read from the cache, we do check it!  A negative
+         entry is only used for the same REQ_USAGE.  */
+      ce = pk_cache_get (LOOKUP_CACHE_KEYID, 0, pk->req_usage, term, 8, 1);
+      if (ce && ce->pk)
+        {
+          copy_public_key (pk, ce->pk);
+          return 0;
+        }
+      else if (ce)
+        return GPG_ERR_NO_PUBKEY;
     }
 #endif
   /* More init stuff.  */
@@ -434,6 +659,12 @@ get_pubkey (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
   if (!rc)
     goto leave;
 
+#if MAX_PK_CACHE_ENTRIES
+  /* Remember that there is no such key but don't do this for other
+   * errors which might be transient.  */
+  if (gpg_err_code (rc) == GPG_ERR_NO_PUBKEY)
+    pk_cache_put (LOOKUP_CACHE_KEYID, 0, pk->req_usage, term, 8, NULL);
+#endif
   rc = GPG_ERR_NO_PUBKEY;
 
 leave:
@@ -466,20 +697,22 @@ get_pubkey_fast (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
   log_assert (pk);
 #if MAX_PK_CACHE_ENTRIES
   {
-    /* Try to get it from the cache */
+    /* Try to get it from the cache.  A negative entry is only
+     * conclusive if it was stored without a usage restriction.  */
     pk_cache_entry_t ce;
+    byte term[8];
 
-    for (ce = pk_cache; ce; ce = ce->next)
+    pk_cache_keyid_term (term, keyid);
+    ce = pk_cache_get (LOOKUP_CACHE_KEYID, 0, 0, term, 8, 1);
+    if (ce && !ce->pk)
+      return GPG_ERR_NO_PUBKEY;
+    if (ce
+        /* Only consider primary keys.  */
+        && ce->pk->keyid[0] == ce->pk->main_keyid[0]
+        && ce->pk->keyid[1] == ce->pk->main_keyid[1])
       {
-	if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1]
-	    /* Only consider primary keys.  */
-	    && ce->pk->keyid[0] == ce->pk->main_keyid[0]
-	    && ce->pk->keyid[1] == ce->pk->main_keyid[1])
-	  {
-	    if (pk)
-	      copy_public_key (pk, ce->pk);
-	    return 0;
-	  }
+        copy_public_key (pk, ce->pk);
+        return 0;
       }
   }
 #endif
@@ -491,6 +724,16 @@ get_pubkey_fast (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     {
       keydb_release (hd);
+#if MAX_PK_CACHE_ENTRIES
+      {
+        /* There is no key at all with this key id; remember this
+         * without a usage restriction.  */
+        byte term[8];
+
+        pk_cache_keyid_term (term, keyid);
+        pk_cache_put (LOOKUP_CACHE_KEYID, 0, 0, term, 8, NULL);
+      }
+#endif
       return GPG_ERR_NO_PUBKEY;
     }
   rc = keydb_get_keyblock (hd, &keyblock);
@@ -1018,9 +1261,45 @@ get_pubkey_byname (ctrl_t ctrl, enum get_pubkey_modes mode,
        * NAME does not appear to be an email address (in which case we
        * only try the local keyring).  In this case, lookup NAME in
        * the local keyring.  */
-      add_to_strlist (&namelist, name);
-      rc = key_byname (ctrl, retctx, namelist, pk, 0,
-		       include_unusable, ret_keyblock, ret_kdbhd);
+#if MAX_PK_CACHE_ENTRIES
+      /* The lookup cache can only be used if just the key is
+       * requested.  A cached negative result still lets the
+       * auto-key-locate methods run below.  */
+      if (pk && !retctx && !ret_keyblock && !ret_kdbhd)
+        {
+          pk_cache_entry_t ce;
+
+          ce = pk_cache_get (LOOKUP_CACHE_NAME, !!include_unusable,
+                             pk->req_usage, name, strlen (name), 0);
+          if (ce && ce->pk)
+            {
+              copy_public_key (pk, ce->pk);
+              return 0;
+            }
+          else if (ce)
+            rc = GPG_ERR_NO_PUBKEY;
+          else
+            {
+              unsigned int req_usage = pk->req_usage;
+
+              add_to_strlist (&namelist, name);
+              rc = key_byname (ctrl, NULL, namelist, pk, 0,
+                               include_unusable, NULL, NULL);
+              if (!rc)
+                pk_cache_put (LOOKUP_CACHE_NAME, !!include_unusable,
+                              req_usage, name, strlen (name), pk);
+              else if (gpg_err_code (rc) == GPG_ERR_NO_PUBKEY)
+                pk_cache_put (LOOKUP_CACHE_NAME, !!include_unusable,
+                              req_usage, name, strlen (name), NULL);
+            }
+        }
+      else
+#endif
+        {
+          add_to_strlist (&namelist, name);
+          rc = key_byname (ctrl, retctx, namelist, pk, 0,
+                           include_unusable, ret_keyblock, ret_kdbhd);
+        }
     }
 
   /* If the requested name resembles a valid mailbox and automatic
@@ -1713,6 +1992,27 @@ get_pubkey_byfprint (ctrl_t ctrl, PKT_public_key *pk, kbnode_t *r_keyblock,
       struct getkey_ctx_s ctx;
       KBNODE kb = NULL;
       KBNODE found_key = NULL;
+#if MAX_PK_CACHE_ENTRIES
+      unsigned int req_usage = pk? pk->req_usage : 0;
+
+      /* The cache only holds the key and thus can't be used if the
+       * caller wants the keyblock.  */
+      if (!r_keyblock)
+        {
+          pk_cache_entry_t ce;
+
+          ce = pk_cache_get (LOOKUP_CACHE_FPR, 0, req_usage,
+                             fprint, fprint_len, 0);
+          if (ce && !ce->pk)
+            return gpg_error (GPG_ERR_NO_PUBKEY);
+          else if (ce)
+            {
+              if (pk)
+                copy_public_key (pk, ce->pk);
+              return 0;
+            }
+        }
+#endif
 
       memset (&ctx, 0, sizeof ctx);
       ctx.exact = 1;
@@ -1732,6 +2032,14 @@ get_pubkey_byfprint (ctrl_t ctrl, PKT_public_key *pk, kbnode_t *r_keyblock,
       rc = lookup (ctrl, &ctx, 0, &kb, &found_key);
       if (!rc && pk)
 	pk_from_block (pk, kb, found_key);
+#if MAX_PK_CACHE_ENTRIES
+      if (!rc)
+        pk_cache_put (LOOKUP_CACHE_FPR, 0, req_usage, fprint, fprint_len,
+                      (found_key? found_key : kb)->pkt->pkt.public_key);
+      else if (gpg_err_code (rc) == GPG_ERR_NO_PUBKEY)
+        pk_cache_put (LOOKUP_CACHE_FPR, 0, req_usage,
+                      fprint, fprint_len, NULL);
+#endif
       if (!rc && r_keyblock)
 	{
 	  *r_keyblock = kb;
@@ -2494,7 +2802,9 @@ sig_to_revoke_info (PKT_signature * sig, struct revoke_info *rinfo)
  * change that information) and copy its contents into the
  * PKT_public_key.
  *
- * Note that R_REVOKED may be set to 0, 1 or 2.
+ * Note that R_REVOKED may be set to 0, 1 or 2.  R_VOLATILE is set if
+ * the result does not only depend on the keyblock but also on other
+ * keys or the trustdb.
  *
  * This function fills in the following fields in the primary key's
  * keyblock:
@@ -2516,7 +2826,7 @@ sig_to_revoke_info (PKT_signature * sig, struct revoke_info *rinfo)
  */
 static void
 merge_selfsigs_main (ctrl_t ctrl, kbnode_t keyblock, int *r_revoked,
-		     struct revoke_info *rinfo)
+		     struct revoke_info *rinfo, int *r_volatile)
 {
   PKT_public_key *pk = NULL;
   KBNODE k;
@@ -2531,6 +2841,7 @@ merge_selfsigs_main (ctrl_t ctrl, kbnode_t keyblock, int *r_revoked,
   byte sigversion = 0;
 
   *r_revoked = 0;
+  *r_volatile = 0;
   memset (rinfo, 0, sizeof (*rinfo));
 
   /* Section 11.1 of RFC 4880 determines the order of packets within a
@@ -2726,6 +3037,10 @@ merge_selfsigs_main (ctrl_t ctrl, kbnode_t keyblock, int *r_revoked,
    * us?).  Only bother to do this if there is a revocation key in the
    * first place and we're not revoked already.  */
 
+  /* The result depends on the revocation keys.  */
+  if (pk->revkey)
+    *r_volatile = 1;
+
   if (!*r_revoked && pk->revkey)
     for (k = keyblock; k && k->pkt->pkttype != PKT_USER_ID; k = k->next)
       {
@@ -2827,6 +3142,7 @@ merge_selfsigs_main (ctrl_t ctrl, kbnode_t keyblock, int *r_revoked,
    * --allow-non-selfsigned-uid set, then force it valid. */
   if (!pk->flags.valid && opt.allow_non_selfsigned_uid)
     {
+      *r_volatile = 1;
       if (opt.verbose)
 	log_info (_("Invalid key %s made valid by"
 		    " --allow-non-selfsigned-uid\n"), keystr_from_pk (pk));
@@ -2837,6 +3153,7 @@ merge_selfsigs_main (ctrl_t ctrl, kbnode_t keyblock, int *r_revoked,
    * trusted signature. */
   if (!pk->flags.valid)
     {
+      *r_volatile = 1;  /* The result depends on the trustdb.  */
       uidnode = NULL;
 
       for (k = keyblock; k && k->pkt->pkttype != PKT_PUBLIC_SUBKEY;
@@ -3288,6 +3605,310 @@ merge_selfsigs_subkey (ctrl_t ctrl, kbnode_t keyblock, kbnode_t subnode)
     }
 }
 
+/* The version of the data stored in the key state cache.  */
+#define KEYSTATE_VERSION 1
+
+/* Append the 32 bit VALUE to MB.  */
+static void
+put_state_u32 (membuf_t *mb, u32 value)
+{
+  byte buf[4];
+
+  ulongtobuf (buf, value);
+  put_membuf (mb, buf, 4);
+}
+
+
+/* Append the revocation info RINFO to MB.  */
+static void
+put_state_rinfo (membuf_t *mb, const struct revoke_info *rinfo)
+{
+  put_state_u32 (mb, rinfo->date);
+  put_state_u32 (mb, rinfo->keyid[0]);
+  put_state_u32 (mb, rinfo->keyid[1]);
+  put_membuf (mb, &rinfo->algo, 1);
+}
+
+
+/* Store the data computed by merge_selfsigs_main and
+ * merge_selfsigs_subkey for KEYBLOCK in the key state cache under
+ * KEY.  REVOKED and RINFO are the values returned by
+ * merge_selfsigs_main.  See restore_merged_state for the reverse
+ * operation.  */
+static void
+store_merged_state (kbnode_t keyblock, const byte *key,
+                    int revoked, const struct revoke_info *rinfo)
+{
+  membuf_t mb;
+  kbnode_t k;
+  byte buf[4];
+  void *data;
+  size_t len;
+
+  init_membuf (&mb, 256);
+  buf[0] = KEYSTATE_VERSION;
+  buf[1] = revoked;
+  put_membuf (&mb, buf, 2);
+  put_state_rinfo (&mb, rinfo);
+
+  for (k = keyblock; k; k = k->next)
+    {
+      if (k->pkt->pkttype == PKT_PUBLIC_KEY
+          || k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        {
+          PKT_public_key *pk = k->pkt->pkt.public_key;
+
+          buf[0] = (pk->flags.valid
+                    | (pk->flags.revoked << 1)
+                    | (pk->flags.backsig << 3));
+          buf[1] = pk->selfsigversion;
+          buf[2] = pk->pubkey_usage;
+          put_membuf (&mb, buf, 3);
+          put_state_u32 (&mb, pk->expiredate);
+          put_state_rinfo (&mb, &pk->revoked);
+        }
+      else if (k->pkt->pkttype == PKT_USER_ID)
+        {
+          PKT_user_id *uid = k->pkt->pkt.user_id;
+          prefitem_t *pref;
+          unsigned int n;
+
+          buf[0] = (uid->flags.revoked
+                    | (uid->flags.expired << 1)
+                    | (uid->flags.primary << 2)
+                    | (uid->flags.mdc << 4)
+                    | (uid->flags.aead << 5)
+                    | (uid->flags.ks_modify << 6));
+          buf[1] = uid->selfsigversion;
+          buf[2] = uid->help_key_usage >> 8;
+          buf[3] = uid->help_key_usage;
+          put_membuf (&mb, buf, 4);
+          put_state_u32 (&mb, uid->created);
+          put_state_u32 (&mb, uid->expiredate);
+          put_state_u32 (&mb, uid->help_key_expire);
+          for (n = 0, pref = uid->prefs; pref && pref->type; pref++)
+            n++;
+          if (n > 255)
+            {
+              /* The count does not fit into the record; do not cache
+               * such a rare keyblock.  */
+              xfree (get_membuf (&mb, NULL));
+              return;
+            }
+          buf[0] = n;
+          put_membuf (&mb, buf, 1);
+          for (pref = uid->prefs; pref && pref->type; pref++)
+            {
+              buf[0] = pref->type;
+              buf[1] = pref->value;
+              put_membuf (&mb, buf, 2);
+            }
+        }
+      else if (k->pkt->pkttype == PKT_SIGNATURE)
+        {
+          buf[0] = k->pkt->pkt.signature->flags.chosen_selfsig;
+          put_membuf (&mb, buf, 1);
+        }
+    }
+
+  data = get_membuf (&mb, &len);
+  if (data)
+    keystate_cache_put (key, data, len);
+  xfree (data);
+}
+
+
+/* A cursor into the data of the key state cache.  */
+struct state_reader_s
+{
+  const byte *p;
+  size_t n;
+  int err;
+};
+
+
+static unsigned int
+get_state_byte (struct state_reader_s *r)
+{
+  if (!r->n)
+    {
+      r->err = 1;
+      return 0;
+    }
+  r->n--;
+  return *r->p++;
+}
+
+
+static u32
+get_state_u32 (struct state_reader_s *r)
+{
+  u32 value;
+
+  if (r->n < 4)
+    {
+      r->err = 1;
+      r->n = 0;
+      return 0;
+    }
+  value = buf32_to_u32 (r->p);
+  r->p += 4;
+  r->n -= 4;
+  return value;
+}
+
+
+static void
+get_state_rinfo (struct state_reader_s *r, struct revoke_info *rinfo)
+{
+  rinfo->date = get_state_u32 (r);
+  rinfo->keyid[0] = get_state_u32 (r);
+  rinfo->keyid[1] = get_state_u32 (r);
+  rinfo->algo = get_state_byte (r);
+}
+
+
+/* Parse the cached DATA of length LENGTH for KEYBLOCK.  If APPLY is
+ * false the data is only checked; otherwise it is stored in KEYBLOCK
+ * and the values for merge_selfsigs_main's R_REVOKED and RINFO are
+ * stored at R_REVOKED and RINFO.  Returns false if the data does not
+ * match KEYBLOCK.  */
+static int
+apply_merged_state (kbnode_t keyblock, const byte *data, size_t length,
+                    int apply, int *r_revoked, struct revoke_info *rinfo)
+{
+  struct state_reader_s r;
+  struct revoke_info tmprinfo;
+  u32 curtime = make_timestamp ();
+  u32 kid[2];
+  kbnode_t k;
+  unsigned int flags, version, usage, n, i;
+
+  r.p = data;
+  r.n = length;
+  r.err = 0;
+  if (get_state_byte (&r) != KEYSTATE_VERSION)
+    return 0;
+  *r_revoked = get_state_byte (&r);
+  get_state_rinfo (&r, rinfo);
+
+  keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+  for (k = keyblock; k && !r.err; k = k->next)
+    {
+      if (k->pkt->pkttype == PKT_PUBLIC_KEY
+          || k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        {
+          PKT_public_key *pk = k->pkt->pkt.public_key;
+          u32 expiredate;
+
+          flags = get_state_byte (&r);
+          version = get_state_byte (&r);
+          usage = get_state_byte (&r);
+          expiredate = get_state_u32 (&r);
+          get_state_rinfo (&r, &tmprinfo);
+          if (!apply)
+            continue;
+
+          if (k == keyblock)
+            {
+              xfree (pk->revkey);
+              pk->revkey = NULL;
+              pk->numrevkeys = 0;
+              pk->flags.maybe_revoked = 0;
+            }
+          else
+            pk->flags.exact = 0;
+          pk->main_keyid[0] = kid[0];
+          pk->main_keyid[1] = kid[1];
+          pk->flags.valid = !!(flags & 1);
+          pk->flags.revoked = (flags >> 1) & 3;
+          pk->flags.backsig = (flags >> 3) & 3;
+          pk->selfsigversion = version;
+          pk->pubkey_usage = usage;
+          pk->expiredate = expiredate;
+          pk->has_expired = expiredate >= curtime ? 0 : expiredate;
+          pk->revoked = tmprinfo;
+        }
+      else if (k->pkt->pkttype == PKT_USER_ID)
+        {
+          PKT_user_id *uid = k->pkt->pkt.user_id;
+          u32 created, expiredate, help_key_expire;
+
+          flags = get_state_byte (&r);
+          version = get_state_byte (&r);
+          usage = get_state_byte (&r) << 8;
+          usage |= get_state_byte (&r);
+          created = get_state_u32 (&r);
+          expiredate = get_state_u32 (&r);
+          help_key_expire = get_state_u32 (&r);
+          n = get_state_byte (&r);
+          if (r.n < 2 * n)
+            return 0;
+          if (apply)
+            {
+              uid->flags.revoked = !!(flags & 1);
+              uid->flags.expired = !!(flags & 2);
+              uid->flags.primary = (flags >> 2) & 3;
+              uid->flags.mdc = !!(flags & 16);
+              uid->flags.aead = !!(flags & 32);
+              uid->flags.ks_modify = !!(flags & 64);
+              uid->selfsigversion = version;
+              uid->help_key_usage = usage;
+              uid->created = created;
+              uid->expiredate = expiredate;
+              uid->help_key_expire = help_key_expire;
+              xfree (uid->prefs);
+              uid->prefs = NULL;
+              if (n)
+                {
+                  uid->prefs = xmalloc (sizeof (*uid->prefs) * (n + 1));
+                  for (i = 0; i < n; i++)
+                    {
+                      uid->prefs[i].type = r.p[2*i];
+                      uid->prefs[i].value = r.p[2*i+1];
+                    }
+                  uid->prefs[n].type = PREFTYPE_NONE;
+                  uid->prefs[n].value = 0;
+                }
+            }
+          r.p += 2 * n;
+          r.n -= 2 * n;
+        }
+      else if (k->pkt->pkttype == PKT_SIGNATURE)
+        {
+          flags = get_state_byte (&r);
+          if (apply)
+            k->pkt->pkt.signature->flags.chosen_selfsig = !!flags;
+        }
+    }
+
+  return !r.err && !r.n;
+}
+
+
+/* Try to set the data computed by merge_selfsigs_main and
+ * merge_selfsigs_subkey for KEYBLOCK from the key state cache entry
+ * for KEY.  Returns true on success.  */
+static int
+restore_merged_state (kbnode_t keyblock, const byte *key,
+                      int *r_revoked, struct revoke_info *rinfo)
+{
+  const byte *data;
+  size_t length;
+
+  data = keystate_cache_lookup (key, &length);
+  if (!data)
+    return 0;
+  if (!apply_merged_state (keyblock, data, length, 0, r_revoked, rinfo))
+    {
+      if (DBG_CACHE)
+        log_debug ("keystate-cache: entry does not match keyblock\n");
+      return 0;
+    }
+  apply_merged_state (keyblock, data, length, 1, r_revoked, rinfo);
+  return 1;
+}
+
 
 /* Merge information from the self-signatures with the public key,
  * subkeys and user ids to make using them more easy.
@@ -3304,6 +3925,8 @@ merge_selfsigs (ctrl_t ctrl, kbnode_t keyblock)
   prefitem_t *prefs;
   unsigned int mdc_feature;
   unsigned int aead_feature;
+  byte cachekey[KEYSTATE_CACHE_KEYLEN];
+  int use_cache, is_volatile;
 
   if (keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
     {
@@ -3319,15 +3942,28 @@ merge_selfsigs (ctrl_t ctrl, kbnode_t keyblock)
       BUG ();
     }
 
-  merge_selfsigs_main (ctrl, keyblock, &revoked, &rinfo);
-
-  /* Now merge in the data from each of the subkeys.  */
-  for (k = keyblock; k; k = k->next)
+  /* Only a keyblock which has not yet been merged is used with the
+   * key state cache because merge_selfsigs_main and
+   * merge_selfsigs_subkey don't reset all fields.  */
+  main_pk = keyblock->pkt->pkt.public_key;
+  use_cache = (!main_pk->main_keyid[0] && !main_pk->main_keyid[1]
+               && keystate_cache_make_key (keyblock, cachekey));
+  if (!use_cache
+      || !restore_merged_state (keyblock, cachekey, &revoked, &rinfo))
     {
-      if (k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
-	{
-	  merge_selfsigs_subkey (ctrl, keyblock, k);
-	}
+      merge_selfsigs_main (ctrl, keyblock, &revoked, &rinfo, &is_volatile);
+
+      /* Now merge in the data from each of the subkeys.  */
+      for (k = keyblock; k; k = k->next)
+        {
+          if (k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+            {
+              merge_selfsigs_subkey (ctrl, keyblock, k);
+            }
+        }
+
+      if (use_cache && !is_volatile)
+        store_merged_state (keyblock, cachekey, revoked, &rinfo);
     }
 
   main_pk = keyblock->pkt->pkt.public_key;
@@ -36,6 +36,8 @@
 #  include <winsock2.h>
 # endif
 # include <windows.h>
+#else
+# include <sys/wait.h>
 #endif
 #include <npth.h>
 
@@ -60,12 +62,16 @@
 #include "../common/gc-opt-flags.h"
 #include "../common/asshelp.h"
 #include "call-dirmngr.h"
+#include "call-agent.h"
 #include "tofu.h"
 #include "objcache.h"
+#include "sig-cache.h"
+#include "keystate-cache.h"
 #include "../common/init.h"
 #include "../common/mbox-util.h"
 #include "../common/shareddefs.h"
 #include "../common/compliance.h"
+#include "../common/work-queue.h"
 
 #if defined(HAVE_DOSISH_SYSTEM) || defined(__CYGWIN__)
 #define MY_O_BINARY  O_BINARY
@@ -108,7 +114,10 @@ enum cmd_and_opt_values
     oBatch	  = 500,
     oMaxOutput,
     oInputSizeHint,
+    oInputMmapThreshold,
     oChunkSize,
+    oWorkerThreads,
+    oMultifileWorkers,
     oSigNotation,
     oCertNotation,
     oShowNotation,
@@ -148,6 +157,7 @@ enum cmd_and_opt_values
     aFastImport,
     aVerify,
     aVerifyFiles,
+    aVerifyBatch,
     aListSigs,
     aSendKeys,
     aRecvKeys,
@@ -460,6 +470,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_c (aDecryptFiles, "decrypt-files", "@"),
   ARGPARSE_c (aVerify, "verify"   , N_("verify a signature")),
   ARGPARSE_c (aVerifyFiles, "verify-files" , "@" ),
+  ARGPARSE_c (aVerifyBatch, "verify-batch" , "@" ),
   ARGPARSE_c (aListKeys, "list-keys", N_("list keys")),
   ARGPARSE_c (aListKeys, "list-public-keys", "@" ),
   ARGPARSE_c (aListSigs, "list-signatures", N_("list keys and signatures")),
@@ -702,6 +713,7 @@ static gpgrt_opt_t opts[] = {
 
   ARGPARSE_s_n (oMultifile, "multifile", "@"),
   ARGPARSE_s_s (oInputSizeHint, "input-size-hint", "@"),
+  ARGPARSE_s_u (oInputMmapThreshold, "input-mmap-threshold", "@"),
   ARGPARSE_s_n (oUtf8Strings,      "utf8-strings", "@"),
   ARGPARSE_s_n (oNoUtf8Strings, "no-utf8-strings", "@"),
   ARGPARSE_p_u (oSetFilesize, "set-filesize", "@"),
@@ -749,6 +761,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oMangleDosFilenames,      "mangle-dos-filenames", "@"),
   ARGPARSE_s_n (oNoMangleDosFilenames, "no-mangle-dos-filenames", "@"),
   ARGPARSE_s_i (oChunkSize, "chunk-size", "@"),
+  ARGPARSE_s_u (oWorkerThreads, "worker-threads", "@"),
+  ARGPARSE_s_u (oMultifileWorkers, "multifile-workers", "@"),
   ARGPARSE_s_n (oNoSymkeyCache, "no-symkey-cache", "@"),
   ARGPARSE_s_n (oSkipVerify, "skip-verify", "@"),
   ARGPARSE_s_n (oListOnly, "list-only", "@"),
@@ -2279,6 +2293,153 @@ gpg_deinit_default_ctrl (ctrl_t ctrl)
 }
 
 
+/* Distribute the files of a --multifile command over up to
+ * --multifile-workers child processes.  On entry *R_ARGC and *R_ARGV
+ * give the files; if there are none the names are read from stdin.
+ * Returns false if the caller shall process the files given by the
+ * updated *R_ARGC and *R_ARGV; this is the case in a child process,
+ * if no workers are used, and for the files of workers which could
+ * not be started.  Otherwise all files have been processed by the
+ * children and true is returned.  If the names have been read from
+ * stdin, *R_NAMES is set to an allocated array which the caller must
+ * xfree after processing the files; else it is set to NULL.
+ *
+ * The workers are forked after nPth has been initialized.  This is
+ * fine because no work queue threads exist at this point and the
+ * child continues with the only thread holding the nPth lock.  */
+static int
+run_multifile_workers (ctrl_t ctrl, int *r_argc, char ***r_argv,
+                       char ***r_names)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)ctrl;
+  (void)r_argc;
+  (void)r_argv;
+  *r_names = NULL;
+  return 0;
+#else /*!HAVE_W32_SYSTEM*/
+  strlist_t list = NULL;
+  strlist_t sl;
+  char **files;
+  char *p;
+  size_t len;
+  pid_t *pids;
+  pid_t pid;
+  int nfiles, nworkers, nstarted, i, n, status;
+
+  *r_names = NULL;
+  if (opt.multifile_workers < 2 || opt.outfile)
+    return 0;  /* Let the command handle --output.  */
+
+  if (*r_argc)
+    {
+      nfiles = *r_argc;
+      files = *r_argv;
+    }
+  else
+    {
+      char line[2048];
+      unsigned int lno = 0;
+
+      /* Read all names now because the workers share stdin.  */
+      while (fgets (line, DIM(line), stdin))
+        {
+          lno++;
+          if (!*line || line[strlen(line)-1] != '\n')
+            {
+              log_error ("input line %u too long or missing LF\n", lno);
+              break;
+            }
+          line[strlen(line)-1] = '\0';
+          append_to_strlist (&list, line);
+        }
+
+      /* Put the array and the names into one buffer so that the
+       * caller needs to release only that one.  */
+      nfiles = strlist_length (list);
+      len = (nfiles + 1) * sizeof *files;
+      for (sl = list; sl; sl = sl->next)
+        len += strlen (sl->d) + 1;
+      files = xmalloc (len);
+      p = (char *)(files + nfiles + 1);
+      for (sl = list, i = 0; sl; sl = sl->next)
+        {
+          files[i++] = p;
+          p = stpcpy (p, sl->d) + 1;
+        }
+      files[i] = NULL;
+      free_strlist (list);
+      *r_names = files;
+    }
+
+  nworkers = opt.multifile_workers < nfiles? opt.multifile_workers : nfiles;
+  if (nworkers < 2)
+    {
+      *r_argc = nfiles;
+      *r_argv = files;
+      return 0;
+    }
+
+  /* The children must not share any connections or open files with
+   * us.  They are all opened again on demand.  */
+  gpg_deinit_default_ctrl (ctrl);
+  ctrl->cached_getkey_kdb = NULL;
+  agent_disconnect ();
+  es_fflush (NULL);
+  fflush (NULL);
+
+  pids = xcalloc (nworkers, sizeof *pids);
+  for (nstarted = 0; nstarted < nworkers; nstarted++)
+    {
+      pids[nstarted] = fork ();
+      if (pids[nstarted] == (pid_t)(-1))
+        {
+          log_error ("error forking worker process: %s\n", strerror (errno));
+          break;
+        }
+      if (!pids[nstarted])
+        {
+          /* The child processes every NWORKERS-th file.  */
+          for (n=0, i=nstarted; i < nfiles; i += nworkers)
+            files[n++] = files[i];
+          xfree (pids);
+          *r_argc = n;
+          *r_argv = files;
+          return 0;
+        }
+    }
+
+  for (i=0; i < nstarted; i++)
+    {
+      while ((pid = waitpid (pids[i], &status, 0)) == (pid_t)(-1)
+             && errno == EINTR)
+        ;
+      if (pid == (pid_t)(-1))
+        log_error ("waiting for worker process %lu failed: %s\n",
+                   (unsigned long)pids[i], strerror (errno));
+      else if (!WIFEXITED (status) || WEXITSTATUS (status))
+        log_error ("worker process %lu failed\n", (unsigned long)pids[i]);
+    }
+  xfree (pids);
+
+  if (nstarted < nworkers)
+    {
+      /* Process the files of the missing workers ourself.  */
+      for (n=0, i=0; i < nfiles; i++)
+        if (i % nworkers >= nstarted)
+          files[n++] = files[i];
+      *r_argc = n;
+      *r_argv = files;
+      return 0;
+    }
+
+  xfree (*r_names);
+  *r_names = NULL;
+  return 1;
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -2684,6 +2845,7 @@ main (int argc, char **argv)
 
 	  case aVerifyFiles: multifile=1; /* fall through */
 	  case aVerify: set_cmd( &cmd, aVerify); break;
+	  case aVerifyBatch: set_cmd( &cmd, aVerifyBatch); break;
 
           case aServer:
             set_cmd (&cmd, pargs.r_opt);
@@ -2703,10 +2865,22 @@ main (int argc, char **argv)
             opt.input_size_hint = string_to_u64 (pargs.r.ret_str);
             break;
 
+          case oInputMmapThreshold:
+            iobuf_set_mmap_threshold (pargs.r.ret_ulong);
+            break;
+
           case oChunkSize:
             opt.chunk_size = pargs.r.ret_int;
             break;
 
+          case oWorkerThreads:
+            opt.worker_threads = pargs.r.ret_ulong;
+            break;
+
+          case oMultifileWorkers:
+            opt.multifile_workers = pargs.r.ret_ulong;
+            break;
+
 	  case oQuiet: opt.quiet = 1; break;
 	  case oNoTTY: tty_no_terminal(1); break;
 	  case oDryRun: opt.dry_run = 1; break;
@@ -3721,7 +3895,9 @@ main (int argc, char **argv)
     /* Init threading which is used by some helper functions.  */
     npth_init ();
     assuan_set_system_hooks (ASSUAN_SYSTEM_NPTH);
-    gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+    /* Jobs of the work queues do not hold the nPth lock; thus we use
+     * the work queue's variants of npth_unprotect and npth_protect.  */
+    gpgrt_set_syscall_clamp (work_queue_pre_syscall, work_queue_post_syscall);
 
     if (logfile)
       {
@@ -4274,7 +4450,13 @@ main (int argc, char **argv)
 
       case aEncr: /* encrypt the given file */
 	if(multifile)
-	  encrypt_crypt_files (ctrl, argc, argv, remusr);
+          {
+            char **names;
+
+            if (!run_multifile_workers (ctrl, &argc, &argv, &names))
+              encrypt_crypt_files (ctrl, argc, argv, remusr);
+            xfree (names);
+          }
 	else
 	  {
 	    if( argc > 1 )
@@ -4421,9 +4603,25 @@ main (int argc, char **argv)
           write_status_failure ("verify", rc);
 	break;
 
+      case aVerifyBatch:
+        if (argc > 1)
+          wrong_args ("--verify-batch [manifest]");
+        if ((rc = verify_batch (ctrl, fname)))
+          {
+            write_status_failure ("verify", rc);
+            log_error ("verify batch failed: %s\n", gpg_strerror (rc));
+          }
+        break;
+
       case aDecrypt:
         if (multifile)
-	  decrypt_messages (ctrl, argc, argv);
+          {
+            char **names;
+
+            if (!run_multifile_workers (ctrl, &argc, &argv, &names))
+              decrypt_messages (ctrl, argc, argv);
+            xfree (names);
+          }
 	else
 	  {
 	    if( argc > 1 )
@@ -5274,14 +5472,19 @@ g10_exit( int rc )
     write_status_failure ("gpg-exit", gpg_error (GPG_ERR_GENERAL));
 
   gcry_control (GCRYCTL_UPDATE_RANDOM_SEED_FILE);
+  sig_cache_flush ();
+  keystate_cache_flush ();
   if (DBG_CLOCK)
     log_clock ("stop");
 
   if ( (opt.debug & DBG_MEMSTAT_VALUE) )
     {
       keydb_dump_stats ();
+      getkey_dump_stats ();
       sig_check_dump_stats ();
       objcache_dump_stats ();
+      sig_cache_dump_stats ();
+      keystate_cache_dump_stats ();
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
@@ -701,6 +701,14 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
   return gpg_error (GPG_ERR_NO_SECKEY);
 }
 
+gpg_error_t
+agent_prefetch_keyinfo (ctrl_t ctrl, kbnode_t keyblock)
+{
+  (void)ctrl;
+  (void)keyblock;
+  return gpg_error (GPG_ERR_NO_SECKEY);
+}
+
 gpg_error_t
 agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
                    char **r_serialno, int *r_cleartext)
@@ -42,6 +42,7 @@
 #include "../common/mbox-util.h"
 #include "key-check.h"
 #include "key-clean.h"
+#include "../common/work-queue.h"
 
 
 struct import_stats_s
@@ -79,6 +80,25 @@ struct import_stats_s
 #define NODE_TRANSFER_SECKEY 16
 
 
+/* The number of keyblocks read ahead while their self-signatures
+ * are verified by the worker threads.  */
+#define IMPORT_READAHEAD 64
+
+/* The state of the read ahead used with --worker-threads.  */
+struct import_readahead_s
+{
+  work_queue_t wq;
+  int rc;             /* The error which ended the read ahead.  */
+  int v3keys;         /* The V3 key count of that last read_block.  */
+  unsigned int nblocks;  /* The number of buffered keyblocks.  */
+  unsigned int pos;      /* The index of the next keyblock to return.  */
+  struct {
+    kbnode_t keyblock;
+    int v3keys;
+  } blocks[IMPORT_READAHEAD];
+};
+
+
 /* An object and a global instance to store selectors created from
  * --import-filter keep-uid=EXPR.
  * --import-filter drop-sig=EXPR.
@@ -623,6 +643,77 @@ import_keys_es_stream (ctrl_t ctrl, estream_t fp,
 }
 
 
+/* Read the next keyblock like read_block.  If RA is not NULL up to
+ * IMPORT_READAHEAD keyblocks are read at once and the self-signatures
+ * of all of them are verified by the worker threads of RA before the
+ * first one is returned.  The keyblocks are still imported one after
+ * the other by the caller so that the keydb is only updated by the
+ * main thread.  */
+static int
+read_block_ahead (struct import_readahead_s *ra, IOBUF a, unsigned int options,
+                  PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
+{
+  gpg_error_t err;
+  keysig_job_t jobs = NULL;
+  kbnode_t keyblock;
+  int v3keys;
+
+  if (!ra)
+    return read_block (a, options, pending_pkt, ret_root, r_v3keys);
+
+  if (ra->pos == ra->nblocks && !ra->rc)
+    {
+      ra->pos = ra->nblocks = 0;
+      while (ra->nblocks < IMPORT_READAHEAD)
+        {
+          ra->rc = read_block (a, options, pending_pkt, &keyblock, &v3keys);
+          if (ra->rc)
+            {
+              ra->v3keys = v3keys;
+              break;
+            }
+          ra->blocks[ra->nblocks].keyblock = keyblock;
+          ra->blocks[ra->nblocks].v3keys = v3keys;
+          ra->nblocks++;
+          err = queue_self_sig_checks (ra->wq, keyblock, &jobs);
+          if (err)
+            log_info ("checking self-signatures in parallel failed: %s\n",
+                      gpg_strerror (err));
+        }
+      work_queue_wait (ra->wq);
+      finish_key_sig_checks (jobs);
+      if (DBG_CLOCK)
+        log_clock ("%u keyblocks read ahead", ra->nblocks);
+    }
+
+  if (ra->pos == ra->nblocks)
+    {
+      *ret_root = NULL;
+      *r_v3keys = ra->v3keys;
+      return ra->rc;
+    }
+
+  *ret_root = ra->blocks[ra->pos].keyblock;
+  *r_v3keys = ra->blocks[ra->pos].v3keys;
+  ra->blocks[ra->pos].keyblock = NULL;
+  ra->pos++;
+  return 0;
+}
+
+
+/* Release the keyblocks still held by RA and RA itself.  */
+static void
+release_readahead (struct import_readahead_s *ra)
+{
+  if (!ra)
+    return;
+  for (; ra->pos < ra->nblocks; ra->pos++)
+    release_kbnode (ra->blocks[ra->pos].keyblock);
+  work_queue_release (ra->wq);
+  xfree (ra);
+}
+
+
 static int
 import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
 	unsigned char **fpr,size_t *fpr_len, unsigned int options,
@@ -634,11 +725,22 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
                                 grasp the return semantics of
                                 read_block. */
   kbnode_t secattic = NULL;  /* Kludge for PGP desktop percularity */
+  struct import_readahead_s *ra = NULL;
   int rc = 0;
   int v3keys;
 
   getkey_disable_caches ();
 
+  if (opt.worker_threads > 1 && !opt.no_sig_cache)
+    {
+      ra = xtrycalloc (1, sizeof *ra);
+      if (!ra || work_queue_new (&ra->wq, opt.worker_threads))
+        {
+          xfree (ra);
+          ra = NULL;
+        }
+    }
+
   if (!opt.no_armor) /* Armored reading is not disabled.  */
     {
       armor_filter_context_t *afx;
@@ -649,7 +751,8 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
       release_armor_context (afx);
     }
 
-  while (!(rc = read_block (inp, options, &pending_pkt, &keyblock, &v3keys)))
+  while (!(rc = read_block_ahead (ra, inp, options,
+                                  &pending_pkt, &keyblock, &v3keys)))
     {
       stats->v3keys += v3keys;
       if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
@@ -748,6 +851,7 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
     log_error (_("error reading '%s': %s\n"), fname, gpg_strerror (rc));
 
   release_kbnode (secattic);
+  release_readahead (ra);
 
   /* When read_block loop was stopped by error, we have PENDING_PKT left.  */
   if (pending_pkt)
@@ -2158,7 +2262,7 @@ import_one_real (ctrl_t ctrl,
 
           clear_ownertrusts (ctrl, pk);
           if (non_self)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
         }
 
       /* Release the handle and thus unlock the keyring asap.  */
@@ -2251,7 +2355,7 @@ import_one_real (ctrl_t ctrl,
             log_error (_("error writing keyring '%s': %s\n"),
                        keydb_get_resource_name (hd), gpg_strerror (err));
           else if (non_self)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
 
           /* Release the handle and thus unlock the keyring asap.  */
           keydb_release (hd);
@@ -3529,7 +3633,7 @@ import_revoke_cert (ctrl_t ctrl, kbnode_t node, unsigned int options,
       if (get_ownertrust (ctrl, pk) == TRUST_ULTIMATE)
         clear_ownertrusts (ctrl, pk);
 
-      revalidation_mark (ctrl);
+      revalidation_mark_key (ctrl, pk);
     }
   stats->n_revoc++;
 
@@ -197,6 +197,10 @@ gpg_error_t keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb);
 /* Delete the currently selected keyblock.  */
 gpg_error_t keydb_delete_keyblock (KEYDB_HANDLE hd);
 
+/* Return a counter which is bumped with each change of the database
+ * by this process.  */
+unsigned int keydb_get_change_count (void);
+
 /* Clears the current search result and resets the handle's position.  */
 gpg_error_t keydb_search_reset (KEYDB_HANDLE hd);
 
@@ -328,6 +332,9 @@ void cache_public_key( PKT_public_key *pk );
 /* Disable and drop the public key cache.  */
 void getkey_disable_caches(void);
 
+/* Dump statistics of the lookup cache to the log.  */
+void getkey_dump_stats (void);
+
 /* Return the public key used for signature SIG and store it at PK.  */
 gpg_error_t get_pubkey_for_sig (ctrl_t ctrl,
                                 PKT_public_key *pk, PKT_signature *sig,
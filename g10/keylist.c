@@ -48,6 +48,11 @@
 #include "../common/pkscreening.h"
 
 
+/* The maximum number of user IDs for which the validity is looked up
+ * in one batch by the colon listing.  */
+#define MAX_LISTED_UIDS 64
+
+
 static void list_all (ctrl_t, int, int);
 static void list_one (ctrl_t ctrl,
                       strlist_t names, int secret, int mark_secret);
@@ -553,7 +558,7 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
 	}
 
       if (secret || mark_secret)
-        any_secret = !agent_probe_any_secret_key (NULL, keyblock);
+        any_secret = !agent_prefetch_keyinfo (NULL, keyblock);
       else
         any_secret = 0;
 
@@ -596,6 +601,8 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
     print_signature_stats (&listctx);
 
  leave:
+  if (secret || mark_secret)
+    agent_prefetch_keyinfo (NULL, NULL);
   keylist_context_release (&listctx);
   release_kbnode (keyblock);
   keydb_release (hd);
@@ -643,9 +650,12 @@ list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
        * MARK_SECRET set (ie. option --with-secret) we have to test
        * for a secret key, though.  */
       if (secret)
-        any_secret = 1;
+        {
+          agent_prefetch_keyinfo (NULL, keyblock);
+          any_secret = 1;
+        }
       else if (mark_secret)
-        any_secret = !agent_probe_any_secret_key (NULL, keyblock);
+        any_secret = !agent_prefetch_keyinfo (NULL, keyblock);
       else
         any_secret = 0;
 
@@ -668,6 +678,8 @@ list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
     }
   while (!getkey_next (ctrl, ctx, NULL, &keyblock));
   getkey_end (ctrl, ctx);
+  if (secret || mark_secret)
+    agent_prefetch_keyinfo (NULL, NULL);
 
   if (opt.check_sigs && !opt.with_colons)
     print_signature_stats (&listctx);
@@ -1444,16 +1456,14 @@ print_revokers (estream_t fp, PKT_public_key * pk)
     BUG ();
   else
     {
-      int i, j;
+      int i;
+      char hexfpr[2*MAX_FINGERPRINT_LEN+1];
 
       for (i = 0; i < pk->numrevkeys; i++)
 	{
-	  byte *p;
-
 	  es_fprintf (fp, "rvk:::%d::::::", pk->revkey[i].algid);
-	  p = pk->revkey[i].fpr;
-	  for (j = 0; j < pk->revkey[i].fprlen; j++, p++)
-	    es_fprintf (fp, "%02X", *p);
+	  bin2hex (pk->revkey[i].fpr, pk->revkey[i].fprlen, hexfpr);
+	  es_fputs (hexfpr, fp);
 	  es_fprintf (fp, ":%02x%s:\n",
                       pk->revkey[i].class,
                       (pk->revkey[i].class & 0x40) ? "s" : "");
@@ -1517,6 +1527,10 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
   unsigned int keylength;
   char *curve = NULL;
   const char *curvename = NULL;
+  char hexbuf[2*MAX_FINGERPRINT_LEN+1];
+  int letters[MAX_LISTED_UIDS+1];
+  int have_letters = 0;
+  int uidno = 0;
 
   /* Get the keyid from the keyblock.  */
   node = find_kbnode (keyblock, PKT_PUBLIC_KEY);
@@ -1543,6 +1557,18 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
       && agent_get_keyinfo (NULL, hexgrip, &serialno, NULL))
     stubkey = 1;  /* Key not found.  */
 
+  /* Get the validity of the key and all user IDs at once so that
+   * the trustdb does not need to be consulted for each user ID.  */
+  if (!opt.no_expensive_trust_checks)
+    {
+      kbnode_t n;
+
+      for (i=0, n=keyblock; (n = find_next_kbnode (n, PKT_USER_ID));)
+        i++;
+      if (i <= MAX_LISTED_UIDS)
+        have_letters = get_validity_info_list (ctrl, keyblock, letters, i);
+    }
+
   keyid_from_pk (pk, keyid);
   if (!pk->flags.valid)
     trustletter_print = 'i';
@@ -1554,7 +1580,10 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
     trustletter_print = 0;
   else
     {
-      trustletter = get_validity_info (ctrl, keyblock, pk, NULL);
+      if (have_letters)
+        trustletter = letters[0];
+      else
+        trustletter = get_validity_info (ctrl, keyblock, pk, NULL);
       if (trustletter == 'u')
         ulti_hack = 1;
       trustletter_print = trustletter;
@@ -1633,6 +1662,7 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	  PKT_user_id *uid = node->pkt->pkt.user_id;
           int uid_validity;
 
+          uidno++;
 	  if (attrib_fp && uid->attrib_data != NULL)
 	    dump_attribs (uid, pk);
 
@@ -1644,6 +1674,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	    uid_validity = 0;
 	  else if (ulti_hack)
             uid_validity = 'u';
+          else if (have_letters)
+            uid_validity = letters[uidno];
           else
             uid_validity = get_validity_info (ctrl, keyblock, pk, uid);
 
@@ -1656,11 +1688,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	  es_fprintf (es_stdout, "%s:", colon_strtime (uid->expiredate));
 
 	  namehash_from_uid (uid);
-
-	  for (i = 0; i < 20; i++)
-	    es_fprintf (es_stdout, "%02X", uid->namehash[i]);
-
-	  es_fprintf (es_stdout, "::");
+	  es_fputs (bin2hex (uid->namehash, 20, hexbuf), es_stdout);
+	  es_fputs ("::", es_stdout);
 
 	  if (uid->attrib_data)
 	    es_fprintf (es_stdout, "%u %lu", uid->numattribs, uid->attrib_len);
@@ -1890,10 +1919,7 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
           es_fputs ("::", es_stdout);
 
 	  if (opt.no_sig_cache && opt.check_sigs && fprokay)
-	    {
-	      for (i = 0; i < fplen; i++)
-		es_fprintf (es_stdout, "%02X", fparray[i]);
-	    }
+	    es_fputs (bin2hex (fparray, fplen, hexbuf), es_stdout);
           else if ((issuer_fpr = issuer_fpr_string (sig)))
             es_fputs (issuer_fpr, es_stdout);
 
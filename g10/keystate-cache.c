@@ -0,0 +1,563 @@
+/* keystate-cache.c - Persistent cache of merged self-signature data
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The key state cache remembers the information which merge_selfsigs
+ * derives from the self-signatures of a keyblock: validity, usage,
+ * expiration and revocation of the keys, the primary user id and the
+ * preferences.  Computing this requires to check all self-signatures
+ * each time a keyblock is loaded; with this cache the result of the
+ * last computation is reused as long as the keyblock is unchanged.
+ *
+ * The key into the cache is a SHA-256 hash over the content of the
+ * keyblock (fingerprints, user ids and all signature packets) and
+ * the options which affect the signature checks; thus any change to
+ * the keyblock yields a new key and stale entries are never used.
+ * The cached data itself is opaque to this module; it is created and
+ * interpreted by getkey.c.  Keyblocks whose state depends on the
+ * current time or on other keys are not cached at all.
+ *
+ * The file "keystate.dat" in the home directory has a 32 byte header
+ * followed by records consisting of the key, a 2 byte length and the
+ * data.  New records are appended on exit using a single write so
+ * that several processes can update the file concurrently.  If the
+ * file grows too large it is truncated and filled again.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/host2net.h"
+#include "packet.h"
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "../common/i18n.h"
+#include "keystate-cache.h"
+
+#define KEYSTATE_CACHE_FNAME "keystate.dat"
+#define KEYSTATE_CACHE_MAGIC "GnuPG-KeyState1\n"
+#define KEYSTATE_CACHE_MAGICLEN 32
+
+/* The amount of data we are willing to load.  If the file holds more
+ * data it is truncated with the next update.  */
+#define KEYSTATE_CACHE_MAX_SIZE (32 * 1024 * 1024)
+
+
+/* The cached records.  The first NLOADED records have been read from
+ * the file, the others are to be appended.  */
+struct record_s
+{
+  byte key[KEYSTATE_CACHE_KEYLEN];
+  size_t off;            /* Offset of the data in CACHE_DATA.  */
+  unsigned int length;   /* Length of the data.  */
+};
+static struct record_s *cache_records;
+static unsigned int cache_nrecords;
+static unsigned int cache_nloaded;
+static unsigned int cache_allocated;
+
+/* The data of all records.  */
+static byte *cache_data;
+static size_t cache_datalen;
+static size_t cache_dataalloc;
+
+/* An open addressing hash table with indices into CACHE_RECORDS plus
+ * one; 0 marks an empty slot.  TABLE_SIZE is a power of 2.  */
+static unsigned int *cache_table;
+static unsigned int table_size;
+
+/* Flags describing the state of the cache.  */
+static int cache_loaded;   /* The file has been read.  */
+static int cache_disabled; /* Loading failed; don't use the cache.  */
+static int cache_truncate; /* Rewrite instead of appending.  */
+
+/* Statistics.  */
+static unsigned int stat_lookups;
+static unsigned int stat_hits;
+
+
+
+/* Return the slot in the hash table for KEY.  The slot is either
+ * empty or holds KEY.  */
+static unsigned int
+find_slot (const byte *key)
+{
+  unsigned int i, idx;
+
+  /* The key is a hash value and thus we can use it directly.  */
+  i = buf32_to_uint (key) & (table_size - 1);
+  for (;;)
+    {
+      idx = cache_table[i];
+      if (!idx || !memcmp (cache_records[idx - 1].key,
+                           key, KEYSTATE_CACHE_KEYLEN))
+        return i;
+      i = (i + 1) & (table_size - 1);
+    }
+}
+
+
+/* Add a record with KEY and DATA of LENGTH to the cache without
+ * checking whether it already exists.  Returns false on error.  */
+static int
+add_record (const byte *key, const void *data, size_t length)
+{
+  unsigned int i;
+
+  if (cache_nrecords == cache_allocated)
+    {
+      unsigned int n = cache_allocated? cache_allocated * 2 : 256;
+      struct record_s *p;
+
+      p = xtryrealloc (cache_records, (size_t)n * sizeof *p);
+      if (!p)
+        return 0;
+      cache_records = p;
+      cache_allocated = n;
+    }
+
+  if (cache_datalen + length > cache_dataalloc)
+    {
+      size_t n = cache_dataalloc? cache_dataalloc * 2 : 65536;
+      byte *p;
+
+      while (n < cache_datalen + length)
+        n *= 2;
+      p = xtryrealloc (cache_data, n);
+      if (!p)
+        return 0;
+      cache_data = p;
+      cache_dataalloc = n;
+    }
+
+  /* Keep the load factor of the hash table below 1/2.  */
+  if ((cache_nrecords + 1) * 2 > table_size)
+    {
+      unsigned int n = table_size? table_size * 2 : 512;
+      unsigned int *newtbl;
+      unsigned int *oldtbl = cache_table;
+      unsigned int oldsize = table_size;
+
+      newtbl = xtrycalloc (n, sizeof *newtbl);
+      if (!newtbl)
+        return 0;
+      cache_table = newtbl;
+      table_size = n;
+      for (i=0; i < oldsize; i++)
+        if (oldtbl[i])
+          cache_table[find_slot (cache_records[oldtbl[i] - 1].key)]
+            = oldtbl[i];
+      xfree (oldtbl);
+    }
+
+  memcpy (cache_records[cache_nrecords].key, key, KEYSTATE_CACHE_KEYLEN);
+  cache_records[cache_nrecords].off = cache_datalen;
+  cache_records[cache_nrecords].length = length;
+  memcpy (cache_data + cache_datalen, data, length);
+  cache_datalen += length;
+  cache_nrecords++;
+  cache_table[find_slot (key)] = cache_nrecords;
+  return 1;
+}
+
+
+/* Forget all records.  */
+static void
+clear_records (void)
+{
+  xfree (cache_table);
+  cache_table = NULL;
+  table_size = 0;
+  cache_nrecords = 0;
+  cache_datalen = 0;
+}
+
+
+/* Read the cache file.  */
+static void
+load_cache (void)
+{
+  char *fname;
+  estream_t fp;
+  byte magic[KEYSTATE_CACHE_MAGICLEN];
+  byte key[KEYSTATE_CACHE_KEYLEN];
+  byte lenbuf[2];
+  byte *buffer = NULL;
+  size_t n, length;
+
+  cache_loaded = 1;
+  fname = make_filename (gnupg_homedir (), KEYSTATE_CACHE_FNAME, NULL);
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        {
+          log_info (_("can't open '%s': %s\n"), fname, strerror (errno));
+          cache_disabled = 1;
+        }
+      xfree (fname);
+      return;
+    }
+
+  if (es_read (fp, magic, sizeof magic, &n) || n != sizeof magic
+      || memcmp (magic, KEYSTATE_CACHE_MAGIC, strlen (KEYSTATE_CACHE_MAGIC)))
+    {
+      log_info ("ignoring invalid key state cache '%s'\n", fname);
+      cache_truncate = 1;
+    }
+  else if (!(buffer = xtrymalloc (KEYSTATE_CACHE_MAXDATA)))
+    {
+      log_error ("error reading key state cache: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      cache_disabled = 1;
+    }
+  else
+    {
+      while (!es_read (fp, key, sizeof key, &n) && n == sizeof key)
+        {
+          if (es_read (fp, lenbuf, 2, &n) || n != 2)
+            {
+              cache_truncate = 1;  /* Partly written record.  */
+              break;
+            }
+          length = buf16_to_uint (lenbuf);
+          if (es_read (fp, buffer, length, &n) || n != length)
+            {
+              cache_truncate = 1;
+              break;
+            }
+          if (cache_datalen + length > KEYSTATE_CACHE_MAX_SIZE)
+            {
+              if (opt.verbose)
+                log_info ("key state cache '%s' is full - clearing\n",
+                          fname);
+              cache_truncate = 1;
+              break;
+            }
+          if (cache_table && cache_table[find_slot (key)])
+            continue;  /* Written by two processes.  */
+          if (!add_record (key, buffer, length))
+            {
+              log_error ("error reading key state cache: %s\n",
+                         gpg_strerror (gpg_error_from_syserror ()));
+              cache_disabled = 1;
+              break;
+            }
+        }
+    }
+  xfree (buffer);
+  es_fclose (fp);
+  xfree (fname);
+
+  if (cache_truncate)
+    clear_records ();
+  cache_nloaded = cache_nrecords;
+  if (DBG_CACHE)
+    log_debug ("keystate-cache: %u records loaded\n", cache_nloaded);
+}
+
+
+/* Hash the MPI A into MD.  */
+static void
+hash_mpi (gcry_md_hd_t md, gcry_mpi_t a)
+{
+  byte buf[2];
+  unsigned int nbits;
+  const void *p;
+  unsigned char *tmp;
+  size_t n;
+
+  if (!a)
+    return;
+  if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+    {
+      p = gcry_mpi_get_opaque (a, &nbits);
+      buf[0] = nbits >> 8;
+      buf[1] = nbits;
+      gcry_md_write (md, buf, 2);
+      if (p)
+        gcry_md_write (md, p, (nbits+7)/8);
+    }
+  else if (!gcry_mpi_aprint (GCRYMPI_FMT_PGP, &tmp, &n, a))
+    {
+      gcry_md_write (md, tmp, n);
+      gcry_free (tmp);
+    }
+}
+
+
+/* Hash the 32 bit value V into MD.  */
+static void
+hash_u32 (gcry_md_hd_t md, u32 v)
+{
+  byte buf[4];
+
+  ulongtobuf (buf, v);
+  gcry_md_write (md, buf, 4);
+}
+
+
+/* Hash the buffer P of length N prefixed by its length into MD.  */
+static void
+hash_buffer (gcry_md_hd_t md, const void *p, size_t n)
+{
+  hash_u32 (md, n);
+  if (n)
+    gcry_md_write (md, p, n);
+}
+
+
+/* Hash the signature SIG into MD.  */
+static void
+hash_signature (gcry_md_hd_t md, PKT_signature *sig)
+{
+  byte buf[6];
+  int i, nsig;
+
+  buf[0] = sig->version;
+  buf[1] = sig->sig_class;
+  buf[2] = sig->pubkey_algo;
+  buf[3] = sig->digest_algo;
+  buf[4] = sig->digest_start[0];
+  buf[5] = sig->digest_start[1];
+  gcry_md_write (md, buf, 6);
+  hash_u32 (md, sig->timestamp);
+  hash_u32 (md, sig->keyid[0]);
+  hash_u32 (md, sig->keyid[1]);
+  if (sig->hashed)
+    hash_buffer (md, sig->hashed->data, sig->hashed->len);
+  else
+    hash_u32 (md, 0);
+  if (sig->unhashed)
+    hash_buffer (md, sig->unhashed->data, sig->unhashed->len);
+  else
+    hash_u32 (md, 0);
+  nsig = pubkey_get_nsig (sig->pubkey_algo);
+  for (i=0; i < nsig; i++)
+    hash_mpi (md, sig->data[i]);
+}
+
+
+/* Compute the key for the merged self-signature data of KEYBLOCK and
+ * store it at KEY which must have a size of KEYSTATE_CACHE_KEYLEN
+ * bytes.  Returns false if the cache shall not be used for
+ * KEYBLOCK.  */
+int
+keystate_cache_make_key (kbnode_t keyblock, byte *key)
+{
+  gcry_md_hd_t md;
+  PKT_public_key *pk;
+  PKT_signature *sig;
+  PKT_user_id *uid;
+  struct weakhash *weak;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 curtime = make_timestamp ();
+  u32 kid[2];
+  byte buf[8];
+  kbnode_t node;
+
+  if (opt.no_sig_cache || cache_disabled || opt.allow_non_selfsigned_uid
+      || keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return 0;
+  keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    return 0;
+
+  /* The options which affect the result of the signature checks.  */
+  gcry_md_write (md, KEYSTATE_CACHE_MAGIC, strlen (KEYSTATE_CACHE_MAGIC));
+  hash_buffer (md, PACKAGE_VERSION, strlen (PACKAGE_VERSION));
+  buf[0] = opt.compliance;
+  buf[1] = !!opt.flags.allow_weak_digest_algos;
+  buf[2] = !!opt.flags.allow_weak_key_signatures;
+  buf[3] = !!opt.ignore_time_conflict;
+  gcry_md_write (md, buf, 4);
+  for (weak = opt.weak_digests; weak; weak = weak->next)
+    hash_u32 (md, weak->algo);
+
+  for (node = keyblock; node; node = node->next)
+    {
+      buf[0] = node->pkt->pkttype;
+      switch (node->pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+        case PKT_PUBLIC_SUBKEY:
+          pk = node->pkt->pkt.public_key;
+          /* A key created in the future may become valid later.  */
+          if (pk->timestamp > curtime)
+            goto nocache;
+          gcry_md_write (md, buf, 1);
+          fingerprint_from_pk (pk, fpr, &fprlen);
+          hash_buffer (md, fpr, fprlen);
+          hash_u32 (md, pk->max_expiredate);
+          break;
+
+        case PKT_USER_ID:
+        case PKT_ATTRIBUTE:
+          uid = node->pkt->pkt.user_id;
+          gcry_md_write (md, buf, 1);
+          hash_buffer (md, uid->name, uid->len);
+          hash_buffer (md, uid->attrib_data, uid->attrib_len);
+          break;
+
+        case PKT_SIGNATURE:
+          sig = node->pkt->pkt.signature;
+          /* The selection of self-signatures depends on the time if
+           * they expire or are created in the future.  */
+          if (sig->keyid[0] == kid[0] && sig->keyid[1] == kid[1]
+              && (sig->expiredate || sig->timestamp > curtime))
+            goto nocache;
+          gcry_md_write (md, buf, 1);
+          hash_signature (md, sig);
+          break;
+
+        default:
+          break;
+        }
+    }
+
+  memcpy (key, gcry_md_read (md, GCRY_MD_SHA256), KEYSTATE_CACHE_KEYLEN);
+  gcry_md_close (md);
+  return 1;
+
+ nocache:
+  gcry_md_close (md);
+  return 0;
+}
+
+
+/* Return the cached data for KEY and store its length at R_LENGTH.
+ * Returns NULL if KEY is not in the cache.  The returned data is only
+ * valid until the next call to keystate_cache_put.  */
+const byte *
+keystate_cache_lookup (const byte *key, size_t *r_length)
+{
+  unsigned int idx;
+
+  if (!cache_loaded)
+    load_cache ();
+  if (cache_disabled)
+    return NULL;
+
+  stat_lookups++;
+  if (!cache_table || !(idx = cache_table[find_slot (key)]))
+    return NULL;
+  stat_hits++;
+  *r_length = cache_records[idx - 1].length;
+  return cache_data + cache_records[idx - 1].off;
+}
+
+
+/* Store DATA of LENGTH for KEY in the cache.  */
+void
+keystate_cache_put (const byte *key, const void *data, size_t length)
+{
+  if (!cache_loaded)
+    load_cache ();
+  if (cache_disabled || length > KEYSTATE_CACHE_MAXDATA)
+    return;
+
+  if (cache_table && cache_table[find_slot (key)])
+    return;
+  if (cache_datalen + length > KEYSTATE_CACHE_MAX_SIZE)
+    return;
+  if (!add_record (key, data, length))
+    cache_disabled = 1;
+}
+
+
+/* Write the new records to the cache file.  This is called on
+ * exit.  */
+void
+keystate_cache_flush (void)
+{
+  char *fname;
+  estream_t fp;
+  byte *buffer, *p;
+  size_t length, off;
+  unsigned int i;
+
+  if (!cache_loaded || cache_disabled || opt.dry_run
+      || cache_nrecords == cache_nloaded)
+    return;
+
+  fname = make_filename (gnupg_homedir (), KEYSTATE_CACHE_FNAME, NULL);
+  fp = es_fopen (fname, cache_truncate? "wb" : "ab");
+  if (!fp)
+    {
+      log_info (_("can't create '%s': %s\n"), fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  /* Build the entire data in memory and write it unbuffered so that
+   * it is appended with a single system call.  */
+  length = 0;
+  for (i = cache_nloaded; i < cache_nrecords; i++)
+    length += KEYSTATE_CACHE_KEYLEN + 2 + cache_records[i].length;
+  es_fseek (fp, 0, SEEK_END);
+  off = (cache_truncate || !es_ftello (fp))? KEYSTATE_CACHE_MAGICLEN : 0;
+  buffer = xtrycalloc (1, off + length);
+  if (!buffer)
+    {
+      log_error ("error writing key state cache: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      es_fclose (fp);
+      xfree (fname);
+      return;
+    }
+  if (off)
+    memcpy (buffer, KEYSTATE_CACHE_MAGIC, strlen (KEYSTATE_CACHE_MAGIC));
+  p = buffer + off;
+  for (i = cache_nloaded; i < cache_nrecords; i++)
+    {
+      memcpy (p, cache_records[i].key, KEYSTATE_CACHE_KEYLEN);
+      p += KEYSTATE_CACHE_KEYLEN;
+      *p++ = cache_records[i].length >> 8;
+      *p++ = cache_records[i].length;
+      memcpy (p, cache_data + cache_records[i].off, cache_records[i].length);
+      p += cache_records[i].length;
+    }
+  es_setvbuf (fp, NULL, _IONBF, 0);
+  if (es_fwrite (buffer, off + length, 1, fp) != 1 || es_fclose (fp))
+    log_error ("error writing '%s': %s\n", fname, strerror (errno));
+  else if (DBG_CACHE)
+    log_debug ("keystate-cache: %u records added\n",
+               cache_nrecords - cache_nloaded);
+  cache_nloaded = cache_nrecords;
+  cache_truncate = 0;
+  xfree (buffer);
+  xfree (fname);
+}
+
+
+void
+keystate_cache_dump_stats (void)
+{
+  if (cache_loaded)
+    log_info ("keystate-cache: records=%u new=%u lookups=%u hits=%u%s\n",
+              cache_nrecords, cache_nrecords - cache_nloaded,
+              stat_lookups, stat_hits, cache_disabled? " (disabled)":"");
+}
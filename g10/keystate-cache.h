@@ -0,0 +1,36 @@
+/* keystate-cache.h - Persistent cache of merged self-signature data
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_KEYSTATE_CACHE_H
+#define GNUPG_G10_KEYSTATE_CACHE_H
+
+/* The length of a key into the key state cache.  */
+#define KEYSTATE_CACHE_KEYLEN 32
+
+/* The maximum length of a cached state.  */
+#define KEYSTATE_CACHE_MAXDATA 65535
+
+int  keystate_cache_make_key (kbnode_t keyblock, byte *key);
+const byte *keystate_cache_lookup (const byte *key, size_t *r_length);
+void keystate_cache_put (const byte *key, const void *data, size_t length);
+void keystate_cache_flush (void);
+void keystate_cache_dump_stats (void);
+
+#endif /*GNUPG_G10_KEYSTATE_CACHE_H*/
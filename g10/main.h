@@ -298,6 +298,16 @@ gpg_error_t check_signature_over_key_or_uid (ctrl_t ctrl,
                                              int *is_selfsig,
                                              PKT_public_key *ret_pk);
 
+/* Verify key signatures using worker threads.  */
+struct work_queue_s;
+typedef struct keysig_job_s *keysig_job_t;
+gpg_error_t queue_self_sig_checks (struct work_queue_s *wq, kbnode_t keyblock,
+                                   keysig_job_t *r_jobs);
+gpg_error_t queue_cert_sig_check (struct work_queue_s *wq, kbnode_t keyblock,
+                                  kbnode_t node, PKT_public_key *signer,
+                                  keysig_job_t *r_jobs);
+void finish_key_sig_checks (keysig_job_t jobs);
+
 
 /*-- delkey.c --*/
 gpg_error_t delete_keys (ctrl_t ctrl,
@@ -490,6 +500,7 @@ void print_key_line (ctrl_t ctrl, estream_t fp, PKT_public_key *pk, int secret);
 void print_file_status( int status, const char *name, int what );
 int verify_signatures (ctrl_t ctrl, int nfiles, char **files );
 int verify_files (ctrl_t ctrl, int nfiles, char **files );
+int verify_batch (ctrl_t ctrl, const char *manifest);
 int gpg_verify (ctrl_t ctrl, int sig_fd, int data_fd, estream_t out_fp);
 
 /*-- decrypt.c --*/
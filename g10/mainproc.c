@@ -78,6 +78,10 @@ struct mainproc_context
     /* Flag to indicated that either one of the next previous fields
        is used.  This is only needed for better readability. */
     int used;
+    /* If not NULL a hash context with the data already hashed in
+       binary mode.  This is used instead of hashing the data again
+       if it has all the required algorithms enabled.  */
+    gcry_md_hd_t md;
   } signed_data;
 
   DEK *dek;
@@ -1410,6 +1414,19 @@ proc_packets (ctrl_t ctrl, void *anchor, iobuf_t a )
 int
 proc_signature_packets (ctrl_t ctrl, void *anchor, iobuf_t a,
 			strlist_t signedfiles, const char *sigfilename )
+{
+  return proc_signature_packets_with_md (ctrl, anchor, a, signedfiles,
+                                         sigfilename, NULL);
+}
+
+
+/* Same as proc_signature_packets but if MD is not NULL it is used
+ * instead of hashing the files given by SIGNEDFILES in binary mode.
+ * MD is not modified.  */
+int
+proc_signature_packets_with_md (ctrl_t ctrl, void *anchor, iobuf_t a,
+                                strlist_t signedfiles,
+                                const char *sigfilename, gcry_md_hd_t md)
 {
   CTX c = xmalloc_clear (sizeof *c);
   int rc;
@@ -1421,6 +1438,7 @@ proc_signature_packets (ctrl_t ctrl, void *anchor, iobuf_t a,
   c->signed_data.data_fd = -1;
   c->signed_data.data_names = signedfiles;
   c->signed_data.used = !!signedfiles;
+  c->signed_data.md = signedfiles? md : NULL;
 
   c->sigfilename = sigfilename;
   rc = do_proc_packets (c, a);
@@ -2573,6 +2591,110 @@ check_sig_and_print (CTX c, kbnode_t node)
 }
 
 
+/* Return true if the prehashed data in C can be used to check the
+ * detached signature at NODE and if MULTIPLE is set also the
+ * following signatures.  */
+static int
+prehashed_md_usable (CTX c, kbnode_t node, int multiple)
+{
+  PKT_signature *sig;
+
+  for (; node; node = find_next_kbnode (node, PKT_SIGNATURE))
+    {
+      sig = node->pkt->pkt.signature;
+      if (sig->sig_class != 0x00)
+        return 0;  /* Only binary mode has been hashed.  */
+      if (!openpgp_md_test_algo (sig->digest_algo)
+          && !gcry_md_is_enabled (c->signed_data.md,
+                                  map_md_openpgp_to_gcry (sig->digest_algo)))
+        return 0;
+      if (!multiple)
+        break;
+    }
+  return 1;
+}
+
+
+/* Hash the signed data for the detached signature at NODE into new
+ * digest contexts in C->MFX.  If MULTIPLE is set the hash algorithms
+ * of the following signatures are enabled as well.  */
+static gpg_error_t
+hash_detached_data (CTX c, kbnode_t node, int multiple)
+{
+  PKT_signature *sig = node->pkt->pkt.signature;
+  kbnode_t n1;
+  gpg_error_t rc;
+
+  rc = gcry_md_open (&c->mfx.md, sig->digest_algo, 0);
+  if (rc)
+    return rc;
+
+  if (multiple)
+    {
+      /* If we have and want to handle multiple signatures we
+       * need to enable all hash algorithms for the context.  */
+      for (n1 = node; (n1 = find_next_kbnode (n1, PKT_SIGNATURE)); )
+        if (!openpgp_md_test_algo (n1->pkt->pkt.signature->digest_algo))
+          gcry_md_enable (c->mfx.md,
+                          map_md_openpgp_to_gcry
+                          (n1->pkt->pkt.signature->digest_algo));
+    }
+
+  if (RFC2440 || RFC4880)
+    ; /* Strict RFC mode.  */
+  else if (sig->digest_algo == DIGEST_ALGO_SHA1
+           && sig->pubkey_algo == PUBKEY_ALGO_DSA
+           && sig->sig_class == 0x01)
+    {
+      /* Enable a workaround for a pgp5 bug when the detached
+       * signature has been created in textmode.  Note that we
+       * do not implement this for multiple signatures with
+       * different hash algorithms. */
+      rc = gcry_md_open (&c->mfx.md2, sig->digest_algo, 0);
+      if (rc)
+        return rc;
+    }
+
+  /* Here we used to have another hack to work around a pgp
+   * 2 bug: It worked by not using the textmode for detached
+   * signatures; this would let the first signature check
+   * (on md) fail but the second one (on md2), which adds an
+   * extra CR would then have produced the "correct" hash.
+   * This is very, very ugly hack but it may haved help in
+   * some cases (and break others).
+   *	 c->mfx.md2? 0 :(sig->sig_class == 0x01)
+   */
+
+  if (DBG_HASHING)
+    {
+      gcry_md_debug (c->mfx.md, "verify");
+      if (c->mfx.md2)
+        gcry_md_debug (c->mfx.md2, "verify2");
+    }
+
+  if (c->sigs_only)
+    {
+      if (c->signed_data.used && c->signed_data.data_fd != -1)
+        rc = hash_datafile_by_fd (c->mfx.md, c->mfx.md2,
+                                  c->signed_data.data_fd,
+                                  (sig->sig_class == 0x01));
+      else
+        rc = hash_datafiles (c->mfx.md, c->mfx.md2,
+                             c->signed_data.data_names,
+                             c->sigfilename,
+                             (sig->sig_class == 0x01));
+    }
+  else
+    {
+      rc = ask_for_detached_datafile (c->mfx.md, c->mfx.md2,
+                                      iobuf_get_real_fname(c->iobuf),
+                                      (sig->sig_class == 0x01));
+    }
+
+  return rc;
+}
+
+
 /*
  * Process the tree which starts at node
  */
@@ -2727,73 +2849,12 @@ proc_tree (CTX c, kbnode_t node)
         {
           /* Detached signature */
           free_md_filter_context (&c->mfx);
-          rc = gcry_md_open (&c->mfx.md, sig->digest_algo, 0);
-          if (rc)
-            goto detached_hash_err;
-
-          if (multiple_ok)
-            {
-              /* If we have and want to handle multiple signatures we
-               * need to enable all hash algorithms for the context.  */
-              for (n1 = node; (n1 = find_next_kbnode (n1, PKT_SIGNATURE)); )
-                if (!openpgp_md_test_algo (n1->pkt->pkt.signature->digest_algo))
-                  gcry_md_enable (c->mfx.md,
-                                  map_md_openpgp_to_gcry
-                                  (n1->pkt->pkt.signature->digest_algo));
-            }
-
-          if (RFC2440 || RFC4880)
-            ; /* Strict RFC mode.  */
-          else if (sig->digest_algo == DIGEST_ALGO_SHA1
-                   && sig->pubkey_algo == PUBKEY_ALGO_DSA
-                   && sig->sig_class == 0x01)
-            {
-              /* Enable a workaround for a pgp5 bug when the detached
-               * signature has been created in textmode.  Note that we
-               * do not implement this for multiple signatures with
-               * different hash algorithms. */
-              rc = gcry_md_open (&c->mfx.md2, sig->digest_algo, 0);
-              if (rc)
-                goto detached_hash_err;
-	    }
-
-          /* Here we used to have another hack to work around a pgp
-           * 2 bug: It worked by not using the textmode for detached
-           * signatures; this would let the first signature check
-           * (on md) fail but the second one (on md2), which adds an
-           * extra CR would then have produced the "correct" hash.
-           * This is very, very ugly hack but it may haved help in
-           * some cases (and break others).
-           *	 c->mfx.md2? 0 :(sig->sig_class == 0x01)
-           */
-
-          if (DBG_HASHING)
-            {
-              gcry_md_debug (c->mfx.md, "verify");
-              if (c->mfx.md2)
-                gcry_md_debug (c->mfx.md2, "verify2");
-            }
-
-          if (c->sigs_only)
-            {
-              if (c->signed_data.used && c->signed_data.data_fd != -1)
-                rc = hash_datafile_by_fd (c->mfx.md, c->mfx.md2,
-                                          c->signed_data.data_fd,
-                                          (sig->sig_class == 0x01));
-              else
-                rc = hash_datafiles (c->mfx.md, c->mfx.md2,
-                                     c->signed_data.data_names,
-                                     c->sigfilename,
-                                     (sig->sig_class == 0x01));
-	    }
+          if (c->signed_data.md && !DBG_HASHING
+              && prehashed_md_usable (c, node, multiple_ok))
+            rc = gcry_md_copy (&c->mfx.md, c->signed_data.md);
           else
-            {
-              rc = ask_for_detached_datafile (c->mfx.md, c->mfx.md2,
-                                              iobuf_get_real_fname(c->iobuf),
-                                              (sig->sig_class == 0x01));
-	    }
+            rc = hash_detached_data (c, node, multiple_ok);
 
-        detached_hash_err:
           if (rc)
             {
               log_error ("can't hash datafile: %s\n", gpg_strerror (rc));
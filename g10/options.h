@@ -57,6 +57,13 @@ struct
   /* The AEAD chunk size expressed as a power of 2.  */
   int chunk_size;
 
+  /* If > 1 the number of threads used to process CPU bound bulk
+   * operations in parallel.  */
+  unsigned int worker_threads;
+
+  /* If > 1 the number of processes used for --multifile.  */
+  unsigned int multifile_workers;
+
   int dry_run;
   int autostart;
   int list_only;
@@ -641,6 +641,9 @@ void reset_literals_seen(void);
 int proc_packets (ctrl_t ctrl, void *ctx, iobuf_t a );
 int proc_signature_packets (ctrl_t ctrl, void *ctx, iobuf_t a,
 			    strlist_t signedfiles, const char *sigfile );
+int proc_signature_packets_with_md (ctrl_t ctrl, void *ctx, iobuf_t a,
+                                    strlist_t signedfiles,
+                                    const char *sigfile, gcry_md_hd_t md);
 int proc_signature_packets_by_fd (ctrl_t ctrl,
                                   void *anchor, IOBUF a, int signed_data_fd );
 int proc_encryption_packets (ctrl_t ctrl, void *ctx, iobuf_t a);
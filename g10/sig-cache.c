@@ -0,0 +1,399 @@
+/* sig-cache.c - Persistent cache of verified key signatures
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The signature cache remembers key signatures which have been
+ * verified successfully.  The ring trust packets of a keyring file
+ * do the same but they are not available with the keybox or keyboxd
+ * and thus each key listing or trustdb check verifies all signatures
+ * again.  This cache is independent of the keydb backend.
+ *
+ * The key into the cache is a SHA-256 hash over the fingerprint of
+ * the signing key, the algorithms, the final digest of the signed
+ * data and the signature values; thus a hit means that exactly this
+ * signature by exactly this key over exactly this data has been
+ * verified before.  Only good signatures are stored.
+ *
+ * The file "sigcache.dat" in the home directory has a 32 byte header
+ * followed by the keys of the cached signatures.  New keys are
+ * appended on exit using a single write so that several processes
+ * can update the file concurrently.  If the file grows too large it
+ * is truncated and filled again.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/host2net.h"
+#include "packet.h"
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "../common/i18n.h"
+#include "sig-cache.h"
+
+#define SIG_CACHE_FNAME "sigcache.dat"
+/* The header has the size of a key so that the records stay aligned
+ * even if two processes create the file at the same time.  */
+#define SIG_CACHE_MAGIC "GnuPG-SigCache1\n"
+#define SIG_CACHE_MAGICLEN SIG_CACHE_KEYLEN
+
+/* The number of keys we are willing to load.  If the file holds more
+ * keys it is truncated with the next update.  */
+#define SIG_CACHE_MAX_KEYS (1024 * 1024)
+
+
+/* The keys of the cached signatures.  The first NLOADED keys have
+ * been read from the file, the others are to be appended.  */
+static byte *cache_keys;
+static unsigned int cache_nkeys;
+static unsigned int cache_nloaded;
+static unsigned int cache_allocated;
+
+/* An open addressing hash table with indices into CACHE_KEYS plus
+ * one; 0 marks an empty slot.  TABLE_SIZE is a power of 2.  */
+static unsigned int *cache_table;
+static unsigned int table_size;
+
+/* Flags describing the state of the cache.  */
+static int cache_loaded;   /* The file has been read.  */
+static int cache_disabled; /* Loading failed; don't use the cache.  */
+static int cache_truncate; /* Rewrite instead of appending.  */
+
+/* Statistics.  */
+static unsigned int stat_lookups;
+static unsigned int stat_hits;
+
+
+
+/* Return the slot in the hash table for KEY.  The slot is either
+ * empty or holds KEY.  */
+static unsigned int
+find_slot (const byte *key)
+{
+  unsigned int i, idx;
+
+  /* The key is a hash value and thus we can use it directly.  */
+  i = buf32_to_uint (key) & (table_size - 1);
+  for (;;)
+    {
+      idx = cache_table[i];
+      if (!idx || !memcmp (cache_keys + (idx - 1) * SIG_CACHE_KEYLEN,
+                           key, SIG_CACHE_KEYLEN))
+        return i;
+      i = (i + 1) & (table_size - 1);
+    }
+}
+
+
+/* Add KEY to the cache without checking whether it already exists.
+ * Returns false on error.  */
+static int
+add_key (const byte *key)
+{
+  unsigned int i;
+
+  if (cache_nkeys == cache_allocated)
+    {
+      unsigned int n = cache_allocated? cache_allocated * 2 : 1024;
+      byte *p;
+
+      p = xtryrealloc (cache_keys, (size_t)n * SIG_CACHE_KEYLEN);
+      if (!p)
+        return 0;
+      cache_keys = p;
+      cache_allocated = n;
+    }
+
+  /* Keep the load factor of the hash table below 1/2.  */
+  if ((cache_nkeys + 1) * 2 > table_size)
+    {
+      unsigned int n = table_size? table_size * 2 : 2048;
+      unsigned int *newtbl;
+      unsigned int *oldtbl = cache_table;
+      unsigned int oldsize = table_size;
+
+      newtbl = xtrycalloc (n, sizeof *newtbl);
+      if (!newtbl)
+        return 0;
+      cache_table = newtbl;
+      table_size = n;
+      for (i=0; i < oldsize; i++)
+        if (oldtbl[i])
+          cache_table[find_slot (cache_keys
+                                 + (oldtbl[i] - 1) * SIG_CACHE_KEYLEN)]
+            = oldtbl[i];
+      xfree (oldtbl);
+    }
+
+  memcpy (cache_keys + (size_t)cache_nkeys * SIG_CACHE_KEYLEN,
+          key, SIG_CACHE_KEYLEN);
+  cache_nkeys++;
+  cache_table[find_slot (key)] = cache_nkeys;
+  return 1;
+}
+
+
+/* Read the cache file.  */
+static void
+load_cache (void)
+{
+  char *fname;
+  estream_t fp;
+  byte magic[SIG_CACHE_MAGICLEN];
+  byte key[SIG_CACHE_KEYLEN];
+  size_t n;
+  int partial = 0;
+
+  cache_loaded = 1;
+  fname = make_filename (gnupg_homedir (), SIG_CACHE_FNAME, NULL);
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        {
+          log_info (_("can't open '%s': %s\n"), fname, strerror (errno));
+          cache_disabled = 1;
+        }
+      xfree (fname);
+      return;
+    }
+
+  if (es_read (fp, magic, sizeof magic, &n) || n != sizeof magic
+      || memcmp (magic, SIG_CACHE_MAGIC, strlen (SIG_CACHE_MAGIC)))
+    {
+      log_info ("ignoring invalid signature cache '%s'\n", fname);
+      cache_truncate = 1;
+    }
+  else
+    {
+      while (!es_read (fp, key, sizeof key, &n) && n == sizeof key)
+        {
+          if (cache_nkeys >= SIG_CACHE_MAX_KEYS)
+            {
+              if (opt.verbose)
+                log_info ("signature cache '%s' is full - clearing\n",
+                          fname);
+              cache_truncate = 1;
+              break;
+            }
+          if (cache_table && cache_table[find_slot (key)])
+            continue;  /* Written by two processes.  */
+          if (!add_key (key))
+            {
+              log_error ("error reading signature cache: %s\n",
+                         gpg_strerror (gpg_error_from_syserror ()));
+              cache_disabled = 1;
+              break;
+            }
+        }
+      if (n && n < sizeof key)
+        {
+          /* Appending to a truncated record would misalign all new
+           * records; thus keep the keys but rewrite the file.  */
+          log_info ("signature cache '%s' is truncated\n", fname);
+          partial = 1;
+        }
+    }
+  es_fclose (fp);
+  xfree (fname);
+
+  if (cache_truncate)
+    {
+      xfree (cache_table);
+      cache_table = NULL;
+      table_size = 0;
+      cache_nkeys = 0;
+    }
+  cache_nloaded = partial? 0 : cache_nkeys;
+  if (partial)
+    cache_truncate = 1;
+  if (DBG_CACHE)
+    log_debug ("sig-cache: %u signatures loaded\n", cache_nkeys);
+}
+
+
+/* Hash the MPI A into MD.  */
+static void
+hash_mpi (gcry_md_hd_t md, gcry_mpi_t a)
+{
+  byte buf[2];
+  unsigned int nbits;
+  const void *p;
+  unsigned char *tmp;
+  size_t n;
+
+  if (!a)
+    return;
+  if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+    {
+      p = gcry_mpi_get_opaque (a, &nbits);
+      buf[0] = nbits >> 8;
+      buf[1] = nbits;
+      gcry_md_write (md, buf, 2);
+      if (p)
+        gcry_md_write (md, p, (nbits+7)/8);
+    }
+  else if (!gcry_mpi_aprint (GCRYMPI_FMT_PGP, &tmp, &n, a))
+    {
+      gcry_md_write (md, tmp, n);
+      gcry_free (tmp);
+    }
+}
+
+
+/* Compute the key for the signature SIG made by PK over the data in
+ * the finalized hash context DIGEST and store it at KEY which must
+ * have a size of SIG_CACHE_KEYLEN bytes.  Returns false if the cache
+ * shall not be used.  */
+int
+sig_cache_make_key (PKT_public_key *pk, PKT_signature *sig,
+                    gcry_md_hd_t digest, byte *key)
+{
+  gcry_md_hd_t md;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  const byte *dp;
+  byte buf[2];
+  int i, nsig;
+
+  if (opt.no_sig_cache || cache_disabled)
+    return 0;
+  dp = gcry_md_read (digest, sig->digest_algo);
+  if (!dp)
+    return 0;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    return 0;
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  gcry_md_write (md, fpr, fprlen);
+  buf[0] = sig->pubkey_algo;
+  buf[1] = sig->digest_algo;
+  gcry_md_write (md, buf, 2);
+  gcry_md_write (md, dp, gcry_md_get_algo_dlen (sig->digest_algo));
+  nsig = pubkey_get_nsig (sig->pubkey_algo);
+  for (i=0; i < nsig; i++)
+    hash_mpi (md, sig->data[i]);
+  memcpy (key, gcry_md_read (md, GCRY_MD_SHA256), SIG_CACHE_KEYLEN);
+  gcry_md_close (md);
+  return 1;
+}
+
+
+/* Return true if the signature described by KEY has already been
+ * verified.  */
+int
+sig_cache_lookup (const byte *key)
+{
+  if (!cache_loaded)
+    load_cache ();
+  if (cache_disabled)
+    return 0;
+
+  stat_lookups++;
+  if (!cache_table || !cache_table[find_slot (key)])
+    return 0;
+  stat_hits++;
+  return 1;
+}
+
+
+/* Store KEY of a good signature in the cache.  */
+void
+sig_cache_put (const byte *key)
+{
+  if (!cache_loaded)
+    load_cache ();
+  if (cache_disabled)
+    return;
+
+  if (cache_table && cache_table[find_slot (key)])
+    return;
+  if (cache_nkeys >= SIG_CACHE_MAX_KEYS)
+    return;
+  if (!add_key (key))
+    cache_disabled = 1;
+}
+
+
+/* Write the new keys to the cache file.  This is called on exit.  */
+void
+sig_cache_flush (void)
+{
+  char *fname;
+  estream_t fp;
+  byte *buffer;
+  size_t length, off;
+
+  if (!cache_loaded || cache_disabled || opt.dry_run
+      || (cache_nkeys == cache_nloaded && !cache_truncate))
+    return;
+
+  fname = make_filename (gnupg_homedir (), SIG_CACHE_FNAME, NULL);
+  fp = es_fopen (fname, cache_truncate? "wb" : "ab");
+  if (!fp)
+    {
+      log_info (_("can't create '%s': %s\n"), fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  /* Build the entire data in memory and write it unbuffered so that
+   * it is appended with a single system call.  */
+  length = (size_t)(cache_nkeys - cache_nloaded) * SIG_CACHE_KEYLEN;
+  es_fseek (fp, 0, SEEK_END);
+  off = (cache_truncate || !es_ftello (fp))? SIG_CACHE_MAGICLEN : 0;
+  buffer = xtrycalloc (1, off + length);
+  if (!buffer)
+    {
+      log_error ("error writing signature cache: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      es_fclose (fp);
+      xfree (fname);
+      return;
+    }
+  if (off)
+    memcpy (buffer, SIG_CACHE_MAGIC, strlen (SIG_CACHE_MAGIC));
+  memcpy (buffer + off,
+          cache_keys + (size_t)cache_nloaded * SIG_CACHE_KEYLEN, length);
+  es_setvbuf (fp, NULL, _IONBF, 0);
+  if (es_fwrite (buffer, off + length, 1, fp) != 1 || es_fclose (fp))
+    log_error ("error writing '%s': %s\n", fname, strerror (errno));
+  else if (DBG_CACHE)
+    log_debug ("sig-cache: %u signatures added\n",
+               cache_nkeys - cache_nloaded);
+  cache_nloaded = cache_nkeys;
+  cache_truncate = 0;
+  xfree (buffer);
+  xfree (fname);
+}
+
+
+void
+sig_cache_dump_stats (void)
+{
+  if (cache_loaded)
+    log_info ("sig-cache: keys=%u new=%u lookups=%u hits=%u%s\n",
+              cache_nkeys, cache_nkeys - cache_nloaded,
+              stat_lookups, stat_hits, cache_disabled? " (disabled)":"");
+}
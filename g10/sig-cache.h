@@ -0,0 +1,34 @@
+/* sig-cache.h - Persistent cache of verified key signatures
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_SIG_CACHE_H
+#define GNUPG_G10_SIG_CACHE_H
+
+/* The length of a key into the signature cache.  */
+#define SIG_CACHE_KEYLEN 32
+
+int  sig_cache_make_key (PKT_public_key *pk, PKT_signature *sig,
+                         gcry_md_hd_t digest, byte *key);
+int  sig_cache_lookup (const byte *key);
+void sig_cache_put (const byte *key);
+void sig_cache_flush (void);
+void sig_cache_dump_stats (void);
+
+#endif /*GNUPG_G10_SIG_CACHE_H*/
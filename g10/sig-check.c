@@ -34,6 +34,8 @@
 #include "options.h"
 #include "pkglue.h"
 #include "../common/compliance.h"
+#include "../common/work-queue.h"
+#include "sig-cache.h"
 
 static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 				gcry_md_hd_t digest,
@@ -44,7 +46,7 @@ static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 static int check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
                                        gcry_md_hd_t digest,
                                        const void *extrahash,
-                                       size_t extrahashlen);
+                                       size_t extrahashlen, int use_cache);
 
 
 /* Statistics for signature verification.  */
@@ -468,7 +470,7 @@ check_signature_end (PKT_public_key *pk, PKT_signature *sig,
     return rc;
 
   if ((rc = check_signature_end_simple (pk, sig, digest,
-                                        extrahash, extrahashlen)))
+                                        extrahash, extrahashlen, 0)))
     return rc;
 
   if (!rc && ret_pk)
@@ -480,13 +482,17 @@ check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 
 /* This function is similar to check_signature_end, but it only checks
  * whether the signature was generated by PK.  It does not check
- * expiration, revocation, etc.  */
+ * expiration, revocation, etc.  If USE_CACHE is set the persistent
+ * signature cache is consulted and updated; this must only be done
+ * by the main thread.  */
 static int
 check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
                             gcry_md_hd_t digest,
-                            const void *extrahash, size_t extrahashlen)
+                            const void *extrahash, size_t extrahashlen,
+                            int use_cache)
 {
   gcry_mpi_t result = NULL;
+  byte cachekey[SIG_CACHE_KEYLEN];
   int rc = 0;
 
   if (!opt.flags.allow_weak_digest_algos)
@@ -608,6 +614,12 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
     }
     gcry_md_final( digest );
 
+    /* Check whether we already verified this signature.  */
+    if (use_cache)
+      use_cache = sig_cache_make_key (pk, sig, digest, cachekey);
+    if (use_cache && sig_cache_lookup (cachekey))
+      goto leave;
+
     /* Convert the digest to an MPI.  */
     result = encode_md_value (pk, digest, sig->digest_algo );
     if (!result)
@@ -620,7 +632,10 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
     if (DBG_CLOCK && sig->sig_class <= 0x01)
       log_clock ("leave pk_verify");
     gcry_mpi_release (result);
+    if (!rc && use_cache)
+      sig_cache_put (cachekey);
 
+ leave:
   if (!rc && sig->flags.unknown_critical)
     {
       log_info(_("assuming bad signature from key %s"
@@ -1016,21 +1031,21 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
     {
       log_assert (packet->pkttype == PKT_PUBLIC_KEY);
       hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
+      rc = check_signature_end_simple (signer, sig, md, NULL, 0, 1);
     }
   else if (IS_BACK_SIG (sig))
     {
       log_assert (packet->pkttype == PKT_PUBLIC_KEY);
       hash_public_key (md, packet->pkt.public_key);
       hash_public_key (md, signer);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
+      rc = check_signature_end_simple (signer, sig, md, NULL, 0, 1);
     }
   else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
     {
       log_assert (packet->pkttype == PKT_PUBLIC_SUBKEY);
       hash_public_key (md, pripk);
       hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
+      rc = check_signature_end_simple (signer, sig, md, NULL, 0, 1);
     }
   else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
     {
@@ -1049,7 +1064,7 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
         {
           hash_public_key (md, pripk);
           hash_uid_packet (packet->pkt.user_id, md, sig);
-          rc = check_signature_end_simple (signer, sig, md, NULL, 0);
+          rc = check_signature_end_simple (signer, sig, md, NULL, 0, 1);
         }
     }
   else
@@ -1272,3 +1287,196 @@ check_key_signature2 (ctrl_t ctrl,
 
   return rc;
 }
+
+
+/* A key signature whose verification has been delegated to a worker
+ * thread.  */
+struct keysig_job_s
+{
+  struct keysig_job_s *next;
+  PKT_public_key *pripk;  /* The primary key of the keyblock.  */
+  PKT_public_key *signer; /* The signer; PRIPK for a self-signature.  */
+  PKT_signature *sig;     /* The signature to verify.  */
+  PACKET *packet;         /* The key, subkey or user id it covers.  */
+  gpg_error_t result;
+};
+
+
+/* The job run by the worker threads to verify the key signature
+ * OPAQUE.  This is a stripped down check_signature_over_key_or_uid
+ * which only hashes and verifies; everything which may log or look
+ * up keys has been done by add_keysig_job.  */
+static void
+keysig_job (void *opaque)
+{
+  struct keysig_job_s *job = opaque;
+  PKT_signature *sig = job->sig;
+  gcry_md_hd_t md;
+
+  if (gcry_md_open (&md, sig->digest_algo, 0))
+    {
+      job->result = gpg_error (GPG_ERR_DIGEST_ALGO);
+      return;
+    }
+
+  if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+    {
+      hash_public_key (md, job->pripk);
+      hash_public_key (md, job->packet->pkt.public_key);
+    }
+  else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+    {
+      hash_public_key (md, job->pripk);
+      hash_uid_packet (job->packet->pkt.user_id, md, sig);
+    }
+  else
+    hash_public_key (md, job->pripk);
+
+  job->result = check_signature_end_simple (job->signer, sig, md,
+                                            NULL, 0, 0);
+  gcry_md_close (md);
+}
+
+
+/* Queue a job to verify the signature SIG by SIGNER over PACKET of
+ * the keyblock with the primary key PRIPK.  Signatures which would
+ * not be verified by check_signature_end_simple without printing a
+ * diagnostic are not queued but left to the regular code.  */
+static gpg_error_t
+add_keysig_job (struct work_queue_s *wq, PKT_public_key *pripk,
+                PKT_public_key *signer, PKT_signature *sig, PACKET *packet,
+                keysig_job_t *r_jobs)
+{
+  gpg_error_t err;
+  struct keysig_job_s *job;
+
+  if (!packet || sig->flags.checked || sig->flags.unknown_critical)
+    return 0;
+  if (openpgp_pk_test_algo (sig->pubkey_algo)
+      || openpgp_md_test_algo (sig->digest_algo))
+    return 0;
+  if (!opt.flags.allow_weak_digest_algos
+      && is_weak_digest (sig->digest_algo))
+    return 0;
+  if (!signer->flags.primary && !(signer->pubkey_usage & PUBKEY_USAGE_CERT))
+    return 0;
+
+  job = xtrycalloc (1, sizeof *job);
+  if (!job)
+    return gpg_error_from_syserror ();
+  job->pripk = pripk;
+  job->signer = signer;
+  job->sig = sig;
+  job->packet = packet;
+  err = work_queue_add (wq, keysig_job, job);
+  if (err)
+    {
+      xfree (job);
+      return err;
+    }
+  job->next = *r_jobs;
+  *r_jobs = job;
+  return 0;
+}
+
+
+/* Queue the verification of the self-signatures of KEYBLOCK on the
+ * work queue WQ and prepend the jobs to the list at R_JOBS.  The
+ * caller must call work_queue_wait and then finish_key_sig_checks
+ * before KEYBLOCK is released; this stores the good results in the
+ * signature cache flags so that the following check_key_signature
+ * calls don't need to verify them again.  */
+gpg_error_t
+queue_self_sig_checks (struct work_queue_s *wq, kbnode_t keyblock,
+                       keysig_job_t *r_jobs)
+{
+  gpg_error_t err;
+  PKT_public_key *pripk;
+  PACKET *uidpkt = NULL;
+  PACKET *subpkt = NULL;
+  PKT_signature *sig;
+  PACKET *packet;
+  kbnode_t n;
+
+  if (opt.no_sig_cache || keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return 0;
+  pripk = keyblock->pkt->pkt.public_key;
+  pk_keyid (pripk);  /* Make sure the keyid is cached.  */
+
+  for (n = keyblock->next; n; n = n->next)
+    {
+      if (n->pkt->pkttype == PKT_USER_ID)
+        uidpkt = n->pkt;
+      else if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        subpkt = n->pkt;
+      if (n->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+
+      sig = n->pkt->pkt.signature;
+      if (keyid_cmp (pripk->keyid, sig->keyid))
+        continue;
+
+      if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+        packet = keyblock->pkt;
+      else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+        packet = subpkt;
+      else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+        packet = uidpkt;
+      else
+        packet = NULL;
+      err = add_keysig_job (wq, pripk, pripk, sig, packet, r_jobs);
+      if (err)
+        return err;
+    }
+
+  return 0;
+}
+
+
+/* Queue the verification of the user id certification at NODE of
+ * KEYBLOCK which has been issued by SIGNER on the work queue WQ and
+ * prepend the job to the list at R_JOBS.  SIGNER must not be
+ * released before finish_key_sig_checks has been called.  See
+ * queue_self_sig_checks for details.  */
+gpg_error_t
+queue_cert_sig_check (struct work_queue_s *wq, kbnode_t keyblock,
+                      kbnode_t node, PKT_public_key *signer,
+                      keysig_job_t *r_jobs)
+{
+  PKT_signature *sig = node->pkt->pkt.signature;
+  kbnode_t unode;
+
+  if (opt.no_sig_cache || keyblock->pkt->pkttype != PKT_PUBLIC_KEY
+      || !(IS_UID_SIG (sig) || IS_UID_REV (sig)))
+    return 0;
+  /* check_signature_over_key_or_uid rejects SHA-1 certifications
+   * with a note.  */
+  if (sig->digest_algo == DIGEST_ALGO_SHA1
+      && !opt.flags.allow_weak_key_signatures)
+    return 0;
+
+  unode = find_prev_kbnode (keyblock, node, PKT_USER_ID);
+  return add_keysig_job (wq, keyblock->pkt->pkt.public_key, signer, sig,
+                         unode? unode->pkt : NULL, r_jobs);
+}
+
+
+/* Store the results of the completed JOBS in the signature packets
+ * and release the jobs.  Only good signatures are cached: The jobs
+ * are queued before the import fixups and thus a misplaced subkey
+ * binding signature, which fix_pks_corruption may move to the right
+ * subkey later, has been checked against the wrong packet.  A bad
+ * result is thus left to the regular check.  */
+void
+finish_key_sig_checks (keysig_job_t jobs)
+{
+  struct keysig_job_s *job;
+
+  while ((job = jobs))
+    {
+      jobs = job->next;
+      if (!job->result)
+        cache_sig_result (job->sig, 0);
+      xfree (job);
+    }
+}
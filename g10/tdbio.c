@@ -27,6 +27,12 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+#endif
 
 #include "gpg.h"
 #include "../common/status.h"
@@ -57,18 +63,18 @@
 #endif
 
 /*
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * Records are read directly from a read-only shared memory mapping of
+ * the trustdb if the system supports this; otherwise lseek and read
+ * are used.  Written records are kept in a write-back cache which is
+ * hashed by the record number.  The cache is flushed in the order of
+ * the record numbers so that runs of adjacent records are written
+ * with a single system call.  Because the mapping is shared, the
+ * pages of the mapping reflect those writes.
  */
 typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct
 {
-  CACHE_CTRL next;
-  struct {
-    unsigned used:1;
-    unsigned dirty:1;
-  } flags;
+  CACHE_CTRL next;   /* Next entry in the hash bucket or unused list.  */
   ulong recno;
   char data[TRUST_RECORD_LEN];
 };
@@ -76,15 +82,33 @@ struct cache_ctrl_struct
 /* Size of the cache.  The SOFT value is the general one.  While in a
    transaction this may not be sufficient and thus we may increase it
    then up to the HARD limit.  */
-#define MAX_CACHE_ENTRIES_SOFT	200
-#define MAX_CACHE_ENTRIES_HARD	10000
+#define MAX_CACHE_ENTRIES_SOFT	1000
+#define MAX_CACHE_ENTRIES_HARD	100000
+
+/* The number of buckets of the cache hash table; must be a power of
+ * 2.  */
+#define CACHE_TABLE_SIZE 1024
+
+/* The maximum number of adjacent records written at once.  */
+#define MAX_WRITE_RUN 64
 
 
-/* The cache is controlled by these variables.  */
-static CACHE_CTRL cache_list;
+/* The cache is controlled by these variables.  All entries in the
+ * hash table are dirty.  */
+static CACHE_CTRL cache_tbl[CACHE_TABLE_SIZE];
+static CACHE_CTRL cache_unused;
 static int cache_entries;
 static int cache_is_dirty;
 
+#ifdef HAVE_MMAP
+/* The memory mapping of the trustdb and its length.  This covers
+ * only complete records.  */
+static const byte *db_map;
+static size_t db_map_len;
+/* Set if mapping the trustdb failed; we then use read.  */
+static int db_map_failed;
+#endif /*HAVE_MMAP*/
+
 
 /* An object to pass information to cmp_krec_fpr. */
 struct cmp_krec_fpr_struct
@@ -115,7 +139,7 @@ static unsigned int is_locked;
 static int  db_fd = -1;
 
 /* A flag indicating that a transaction is active.  */
-/* static int in_transaction;   Not yet used. */
+static int in_transaction;
 
 
 
@@ -198,225 +222,238 @@ get_record_from_cache (ulong recno)
 {
   CACHE_CTRL r;
 
-  for (r = cache_list; r; r = r->next)
+  for (r = cache_tbl[recno & (CACHE_TABLE_SIZE - 1)]; r; r = r->next)
+    if (r->recno == recno)
+      return r->data;
+  return NULL;
+}
+
+
+/*
+ * Return a pointer to the record RECNO in the memory mapping of the
+ * trustdb.  If the record is not yet covered by the mapping, the
+ * trustdb is mapped again to include records appended in the
+ * meantime.  Returns NULL if the record does not exist or the
+ * trustdb can't be mapped; the caller shall then use read.
+ */
+static const byte *
+get_record_from_map (ulong recno)
+{
+#ifdef HAVE_MMAP
+  struct stat st;
+  size_t len;
+  void *p;
+
+  if ((recno + 1) * TRUST_RECORD_LEN <= db_map_len)
+    return db_map + recno * TRUST_RECORD_LEN;
+  if (db_map_failed)
+    return NULL;
+
+  if (fstat (db_fd, &st))
+    return NULL;
+  len = (size_t)(st.st_size / TRUST_RECORD_LEN) * TRUST_RECORD_LEN;
+  if ((recno + 1) * TRUST_RECORD_LEN > len)
+    return NULL;  /* Beyond the end of the file.  */
+
+  if (db_map)
+    munmap ((void *)db_map, db_map_len);
+  db_map = NULL;
+  db_map_len = 0;
+  p = mmap (NULL, len, PROT_READ, MAP_SHARED, db_fd, 0);
+  if (p == MAP_FAILED)
     {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
+      if (DBG_TRUST)
+        log_debug ("trustdb: mmap failed: %s\n", strerror (errno));
+      db_map_failed = 1;
+      return NULL;
     }
+  db_map = p;
+  db_map_len = len;
+  return db_map + recno * TRUST_RECORD_LEN;
+#else /*!HAVE_MMAP*/
+  (void)recno;
   return NULL;
+#endif /*!HAVE_MMAP*/
+}
+
+
+/* Helper for write_cache to sort the entries by record number.  */
+static int
+cmp_cache_recno (const void *a, const void *b)
+{
+  ulong ra = (*(const CACHE_CTRL *)a)->recno;
+  ulong rb = (*(const CACHE_CTRL *)b)->recno;
+
+  return ra < rb? -1 : ra > rb;
 }
 
 
 /*
- * Write a cached item back to the trustdb file.
+ * Write NRECS adjacent records from BUF starting at record RECNO back
+ * to the trustdb file.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-write_cache_item (CACHE_CTRL r)
+write_records (ulong recno, const char *buf, int nrecs)
 {
   gpg_error_t err;
   int n;
 
-  if (lseek (db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+  if (lseek (db_fd, recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: lseek failed: %s\n"),
-                 r->recno, strerror (errno));
+                 recno, strerror (errno));
       return err;
     }
-  n = write (db_fd, r->data, TRUST_RECORD_LEN);
-  if (n != TRUST_RECORD_LEN)
+  n = write (db_fd, buf, nrecs * TRUST_RECORD_LEN);
+  if (n != nrecs * TRUST_RECORD_LEN)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
-                 r->recno, n, strerror (errno) );
+                 recno, n, strerror (errno) );
       return err;
     }
-  r->flags.dirty = 0;
   return 0;
 }
 
 
 /*
- * Put data into the cache.  This function may flush
- * some cache entries if the cache is filled up.
+ * Drop all entries from the cache without writing them.
+ */
+static void
+discard_cache (void)
+{
+  CACHE_CTRL r;
+  int i;
+
+  for (i=0; i < CACHE_TABLE_SIZE; i++)
+    while ((r = cache_tbl[i]))
+      {
+        cache_tbl[i] = r->next;
+        r->next = cache_unused;
+        cache_unused = r;
+      }
+  cache_entries = 0;
+  cache_is_dirty = 0;
+}
+
+
+/*
+ * Write all cached records back to the trustdb file and empty the
+ * cache.  The caller must hold the write lock.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-put_record_into_cache (ulong recno, const char *data)
+write_cache (void)
 {
-  CACHE_CTRL r, unused;
-  int dirty_count = 0;
-  int clean_count = 0;
+  CACHE_CTRL *items, r;
+  char *buf;
+  int i, n, nitems;
+  int rc = 0;
 
-  /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
-    {
-      if (!r->flags.used)
-        {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
-        {
-          if (!r->flags.dirty)
-            {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          return 0;
-	}
-      if (r->flags.used)
-        {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
-    }
+  if (!cache_entries)
+    return 0;
 
-  /* Not in the cache: add a new entry. */
-  if (unused)
+  items = xtrymalloc (cache_entries * sizeof *items);
+  buf = xtrymalloc (MAX_WRITE_RUN * TRUST_RECORD_LEN);
+  if (!items || !buf)
     {
-      /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      rc = gpg_error_from_syserror ();
+      xfree (items);
+      xfree (buf);
+      return rc;
     }
 
-  /* See whether we reached the limit. */
-  if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
-    {
-      /* No: Put into cache.  */
-      r = xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      r->next = cache_list;
-      cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
+  nitems = 0;
+  for (i=0; i < CACHE_TABLE_SIZE; i++)
+    for (r = cache_tbl[i]; r; r = r->next)
+      items[nitems++] = r;
+  log_assert (nitems == cache_entries);
+  qsort (items, nitems, sizeof *items, cmp_cache_recno);
 
-  /* Cache is full: discard some clean entries.  */
-  if (clean_count)
+  for (i=0; !rc && i < nitems; i += n)
     {
-      int n;
+      for (n=0; i + n < nitems && n < MAX_WRITE_RUN
+             && items[i+n]->recno == items[i]->recno + n; n++)
+        memcpy (buf + n * TRUST_RECORD_LEN, items[i+n]->data,
+                TRUST_RECORD_LEN);
+      rc = write_records (items[i]->recno, buf, n);
+    }
 
-      /* We discard a third of the clean entries.  */
-      n = clean_count / 3;
-      if (!n)
-        n = 1;
+  if (!rc)
+    discard_cache ();
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && !r->flags.dirty)
-            {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
+  xfree (buf);
+  xfree (items);
+  return rc;
+}
 
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
 
-  /* No clean entries: We have to flush some dirty entries.  */
-#if 0 /* Transactions are not yet used.  */
-  if (in_transaction)
-    {
-      /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
-      if (cache_entries < MAX_CACHE_ENTRIES_HARD)
-        {
-          if (opt.debug && !(cache_entries % 100))
-            log_debug ("increasing tdbio cache size\n");
-          r = xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
-          r->next = cache_list;
-          cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
-          return 0;
-	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
-    }
-#endif
+/*
+ * Put data into the cache.  This function flushes the cache if it
+ * is filled up.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+put_record_into_cache (ulong recno, const char *data)
+{
+  CACHE_CTRL r;
+  const byte *cur;
+  int rc;
 
-  if (dirty_count)
-    {
-      int n;
+  /* See whether we already cached this one.  */
+  for (r = cache_tbl[recno & (CACHE_TABLE_SIZE - 1)]; r; r = r->next)
+    if (r->recno == recno)
+      {
+        memcpy (r->data, data, TRUST_RECORD_LEN);
+        return 0;
+      }
 
-      /* Discard some dirty entries. */
-      n = dirty_count / 5;
-      if (!n)
-        n = 1;
+  /* Do not dirty the cache with unchanged records.  */
+  cur = get_record_from_map (recno);
+  if (cur && !memcmp (cur, data, TRUST_RECORD_LEN))
+    return 0;
 
-      take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
+  if (cache_entries >= MAX_CACHE_ENTRIES_SOFT)
+    {
+      if (in_transaction)
         {
-          if (r->flags.used && r->flags.dirty)
+          /* We can't flush while in a transaction.  Thus we increase
+           * the cache size instead.  */
+          if (cache_entries >= MAX_CACHE_ENTRIES_HARD)
             {
-              int rc;
-
-              rc = write_cache_item (r);
-              if (rc)
-                return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
-      release_write_lock ();
-
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+              log_info (_("trustdb transaction too large\n"));
+              return gpg_error (GPG_ERR_RESOURCE_LIMIT);
+            }
+          if (opt.debug && !(cache_entries % 1000))
+            log_debug ("increasing tdbio cache size\n");
+        }
+      else
+        {
+          take_write_lock ();
+          rc = write_cache ();
+          release_write_lock ();
+          if (rc)
+            return rc;
+        }
     }
 
-  /* We should never reach this.  */
-  BUG();
+  r = cache_unused;
+  if (r)
+    cache_unused = r->next;
+  else
+    r = xmalloc (sizeof *r);
+  r->recno = recno;
+  memcpy (r->data, data, TRUST_RECORD_LEN);
+  r->next = cache_tbl[recno & (CACHE_TABLE_SIZE - 1)];
+  cache_tbl[recno & (CACHE_TABLE_SIZE - 1)] = r;
+  cache_is_dirty = 1;
+  cache_entries++;
+  return 0;
 }
 
 
@@ -429,53 +466,43 @@ tdbio_is_dirty()
 
 
 /*
- * Flush the cache.  This cannot be used while in a transaction.
+ * Flush the cache.  While in a transaction this does nothing; the
+ * cache is then flushed by tdbio_end_transaction.
  */
 int
 tdbio_sync()
 {
-    CACHE_CTRL r;
-    int did_lock = 0;
-
-    if( db_fd == -1 )
-	open_db();
-#if 0 /* Transactions are not yet used.  */
-    if( in_transaction )
-	log_bug("tdbio: syncing while in transaction\n");
-#endif
+  int rc;
+  int did_lock = 0;
 
-    if( !cache_is_dirty )
-	return 0;
+  if (db_fd == -1)
+    open_db ();
+  if (in_transaction)
+    return 0;
 
-    if (!take_write_lock ())
-        did_lock = 1;
+  if (!cache_is_dirty)
+    return 0;
 
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
-    }
-    cache_is_dirty = 0;
-    if (did_lock)
-        release_write_lock ();
+  if (!take_write_lock ())
+    did_lock = 1;
 
-    return 0;
+  rc = write_cache ();
+
+  if (did_lock)
+    release_write_lock ();
+
+  return rc;
 }
 
 
-#if 0  /* Not yet used.  */
 /*
  * Simple transactions system:
  * Everything between begin_transaction and end/cancel_transaction
  * is not immediately written but at the time of end_transaction.
- *
- * NOTE: The transaction code is disabled in the 1.2 branch, as it is
- * not yet used.
+ * The write lock is held for the entire transaction.
  */
 int
-tdbio_begin_transaction ()  /* Not yet used.  */
+tdbio_begin_transaction (void)
 {
   int rc;
 
@@ -485,56 +512,43 @@ tdbio_begin_transaction ()  /* Not yet used.  */
   rc = tdbio_sync();
   if (rc)
     return rc;
+  take_write_lock ();
   in_transaction = 1;
   return 0;
 }
 
 int
-tdbio_end_transaction ()  /* Not yet used.  */
+tdbio_end_transaction (void)
 {
   int rc;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
-  take_write_lock ();
   gnupg_block_all_signals ();
   in_transaction = 0;
-  rc = tdbio_sync();
+  rc = write_cache ();
   gnupg_unblock_all_signals();
   release_write_lock ();
   return rc;
 }
 
 int
-tdbio_cancel_transaction () /* Not yet used.  */
+tdbio_cancel_transaction (void)
 {
-  CACHE_CTRL r;
-
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
 
-  /* Remove all dirty marked entries, so that the original ones are
-   * read back the next time.  */
-  if (cache_is_dirty)
-    {
-      for (r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              r->flags.used = 0;
-              cache_entries--;
-	    }
-	}
-      cache_is_dirty = 0;
-    }
+  /* Remove all dirty entries, so that the original ones are read
+   * back the next time.  */
+  discard_cache ();
 
   in_transaction = 0;
+  release_write_lock ();
   return 0;
 }
-#endif  /* Not yet used.  */
 
 
-
+
 /********************************************************
  **************** cached I/O functions ******************
  ********************************************************/
@@ -989,6 +1003,62 @@ tdbio_write_nextcheck (ctrl_t ctrl, ulong stamp)
 
 
 
+/*
+ * Return true if only the keys marked with TRUST_RECFLAG_CHANGED need
+ * to be revalidated.  In this case the nextcheck value from before
+ * the keys were marked is stored at R_SAVEDCHECK.  On a read problem
+ * the process is terminated.
+ */
+int
+tdbio_read_revalidate (ulong *r_savedcheck)
+{
+  TRUSTREC vr;
+  int rc;
+
+  rc = tdbio_read_record (0, &vr, RECTYPE_VER);
+  if (rc)
+    log_fatal (_("%s: error reading version record: %s\n"),
+               db_name, gpg_strerror (rc));
+  *r_savedcheck = vr.r.ver.savedcheck;
+  return !!vr.r.ver.revalidate;
+}
+
+
+/*
+ * Set the flag telling that only marked keys need to be revalidated
+ * to REVALIDATE and store SAVEDCHECK along with it.  On a read or
+ * write problem the process is terminated.
+ *
+ * Return: True if the version record actually changed.
+ */
+int
+tdbio_write_revalidate (ctrl_t ctrl, int revalidate, ulong savedcheck)
+{
+  TRUSTREC vr;
+  int rc;
+
+  rc = tdbio_read_record (0, &vr, RECTYPE_VER);
+  if (rc)
+    log_fatal (_("%s: error reading version record: %s\n"),
+               db_name, gpg_strerror (rc));
+
+  if (!revalidate)
+    savedcheck = 0;
+  if (vr.r.ver.revalidate == !!revalidate
+      && vr.r.ver.savedcheck == savedcheck)
+    return 0;
+
+  vr.r.ver.revalidate = !!revalidate;
+  vr.r.ver.savedcheck = savedcheck;
+  rc = tdbio_write_record (ctrl, &vr);
+  if (rc)
+    log_fatal (_("%s: error writing version record: %s\n"),
+               db_name, gpg_strerror (rc));
+  return 1;
+}
+
+
+
 /*
  * Return the record number of the trusthash table or create one if it
  * does not yet exist.  On a read or write problem the process is
@@ -1451,7 +1521,8 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
 
     case RECTYPE_VER:
       es_fprintf (fp,
-         "version, td=%lu, f=%lu, m/c/d=%d/%d/%d tm=%d mcl=%d nc=%lu (%s)\n",
+         "version, td=%lu, f=%lu, m/c/d=%d/%d/%d tm=%d mcl=%d nc=%lu (%s)"
+                  " rv=%lu\n",
                   rec->r.ver.trusthashtbl,
                   rec->r.ver.firstfree,
                   rec->r.ver.marginals,
@@ -1460,7 +1531,8 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
                   rec->r.ver.trust_model,
                   rec->r.ver.min_cert_level,
                   rec->r.ver.nextcheck,
-                  strtimestamp(rec->r.ver.nextcheck)
+                  strtimestamp(rec->r.ver.nextcheck),
+                  rec->r.ver.revalidate
                   );
       break;
 
@@ -1486,8 +1558,9 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
       es_fprintf (fp, "trust ");
       for (i=0; i < 20; i++)
         es_fprintf (fp, "%02X", rec->r.trust.fingerprint[i]);
-      es_fprintf (fp, ", ot=%d, d=%d, vl=%lu\n", rec->r.trust.ownertrust,
-                  rec->r.trust.depth, rec->r.trust.validlist);
+      es_fprintf (fp, ", ot=%d, d=%d, vl=%lu, f=%d\n",
+                  rec->r.trust.ownertrust, rec->r.trust.depth,
+                  rec->r.trust.validlist, rec->r.trust.flags);
       break;
 
     case RECTYPE_VALID:
@@ -1524,6 +1597,8 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
     open_db ();
 
   buf = get_record_from_cache( recnum );
+  if (!buf)
+    buf = get_record_from_map (recnum);
   if (!buf)
     {
       if (lseek (db_fd, recnum * TRUST_RECORD_LEN, SEEK_SET) == -1)
@@ -1582,7 +1657,9 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
           p += 4;
           rec->r.ver.nextcheck = buf32_to_ulong(p);
           p += 4;
+          rec->r.ver.revalidate = buf32_to_ulong(p);
           p += 4;
+          rec->r.ver.savedcheck = buf32_to_ulong(p);
           p += 4;
           rec->r.ver.firstfree = buf32_to_ulong(p);
           p += 4;
@@ -1631,7 +1708,7 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
       rec->r.trust.ownertrust = *p++;
       rec->r.trust.depth = *p++;
       rec->r.trust.min_ownertrust = *p++;
-      p++;
+      rec->r.trust.flags = *p++;
       rec->r.trust.validlist = buf32_to_ulong(p);
       break;
 
@@ -1695,8 +1772,8 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
       p += 2;
       ulongtobuf(p, rec->r.ver.created); p += 4;
       ulongtobuf(p, rec->r.ver.nextcheck); p += 4;
-      p += 4;
-      p += 4;
+      ulongtobuf(p, rec->r.ver.revalidate); p += 4;
+      ulongtobuf(p, rec->r.ver.savedcheck); p += 4;
       ulongtobuf(p, rec->r.ver.firstfree ); p += 4;
       p += 4;
       ulongtobuf(p, rec->r.ver.trusthashtbl ); p += 4;
@@ -1726,7 +1803,7 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
       *p++ = rec->r.trust.ownertrust;
       *p++ = rec->r.trust.depth;
       *p++ = rec->r.trust.min_ownertrust;
-      p++;
+      *p++ = rec->r.trust.flags;
       ulongtobuf( p, rec->r.trust.validlist); p += 4;
       break;
 
@@ -40,6 +40,9 @@
 #define RECTYPE_VALID 13
 #define RECTYPE_FREE 254
 
+/* Flags of the trust record.  */
+#define TRUST_RECFLAG_CHANGED 1  /* The key needs to be revalidated.  */
+
 
 struct trust_record {
     int  rectype;
@@ -57,8 +60,8 @@ struct trust_record {
 	    byte  min_cert_level;
 	    ulong created;   /* timestamp of trustdb creation  */
 	    ulong nextcheck; /* timestamp of next scheduled check */
-	    ulong reserved;
-	    ulong reserved2;
+	    ulong revalidate; /* only the marked keys need a check */
+	    ulong savedcheck; /* nextcheck before the keys were marked */
 	    ulong firstfree;
 	    ulong reserved3;
             ulong trusthashtbl;
@@ -79,6 +82,7 @@ struct trust_record {
         byte depth;
         ulong validlist;
 	byte min_ownertrust;
+        byte flags;         /* TRUST_RECFLAG_*  */
       } trust;
       struct {
         byte namehash[20];
@@ -103,6 +107,8 @@ int tdbio_db_matches_options(void);
 byte tdbio_read_model(void);
 ulong tdbio_read_nextcheck (void);
 int tdbio_write_nextcheck (ctrl_t ctrl, ulong stamp);
+int tdbio_read_revalidate (ulong *r_savedcheck);
+int tdbio_write_revalidate (ctrl_t ctrl, int revalidate, ulong savedcheck);
 int tdbio_is_dirty(void);
 int tdbio_sync(void);
 int tdbio_begin_transaction(void);
@@ -286,7 +286,8 @@ get_override_session_key (DEK *dek, const char *string)
   return GPG_ERR_GENERAL;
 }
 
-/* Stub: */
+/* Stub: (not used if decrypt-data.c is linked) */
+#ifndef WITH_DECRYPT_DATA
 int
 decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
 {
@@ -296,6 +297,7 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
   (void)dek;
   return GPG_ERR_GENERAL;
 }
+#endif /*!WITH_DECRYPT_DATA*/
 
 
 /* Stub:
@@ -458,6 +460,14 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
   return gpg_error (GPG_ERR_NO_SECKEY);
 }
 
+gpg_error_t
+agent_prefetch_keyinfo (ctrl_t ctrl, kbnode_t keyblock)
+{
+  (void)ctrl;
+  (void)keyblock;
+  return gpg_error (GPG_ERR_NO_SECKEY);
+}
+
 gpg_error_t
 agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
                    char **r_serialno, int *r_cleartext)
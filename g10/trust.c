@@ -304,6 +304,17 @@ revalidation_mark (ctrl_t ctrl)
 }
 
 
+void
+revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+#ifndef NO_TRUST_MODELS
+  tdb_revalidation_mark_key (ctrl, pk);
+#else
+  (void)pk;
+#endif
+}
+
+
 void
 check_trustdb_stale (ctrl_t ctrl)
 {
@@ -424,6 +435,61 @@ get_validity_info (ctrl_t ctrl, kbnode_t kb, PKT_public_key *pk,
 }
 
 
+/* Store the validity letters of the primary key of KEYBLOCK and of
+ * its NUIDS user IDs at LETTERS, which must have space for NUIDS+1
+ * items.  LETTERS[0] receives the letter for the key and the other
+ * items those for the user IDs in keyblock order; the values are the
+ * same as returned by get_validity_info.  Unlike calling
+ * get_validity_info for each item, the trustdb is consulted only
+ * once.  Returns false if that is not possible with the current
+ * trust model.  */
+int
+get_validity_info_list (ctrl_t ctrl, kbnode_t keyblock,
+                        int *letters, int nuids)
+{
+#ifdef NO_TRUST_MODELS
+  (void)ctrl;
+  (void)keyblock;
+  (void)letters;
+  (void)nuids;
+  return 0;
+#else
+  PKT_public_key *pk = keyblock->pkt->pkt.public_key;
+  /* The validities are computed in place of the letters.  */
+  unsigned int *validities = (unsigned int *)letters;
+  unsigned int validity;
+  kbnode_t node;
+  int i;
+
+  for (node = keyblock, i = 0;
+       i < nuids && (node = find_next_kbnode (node, PKT_USER_ID)); i++)
+    namehash_from_uid (node->pkt->pkt.user_id);
+  if (i != nuids)
+    return 0;
+
+  if (!tdb_get_validity_list (ctrl, keyblock, validities, nuids))
+    return 0;
+
+  for (i=0; i <= nuids; i++)
+    {
+      /* Set the flags direct from the key as done by get_validity.  */
+      validity = validities[i];
+      if (pk->flags.revoked)
+        validity |= TRUST_FLAG_REVOKED;
+      if (pk->has_expired)
+        validity = ((validity & (~TRUST_MASK | TRUST_FLAG_PENDING_CHECK))
+                    | TRUST_EXPIRED);
+
+      if ((validity & TRUST_FLAG_REVOKED))
+        letters[i] = 'r';
+      else
+        letters[i] = trust_letter (validity);
+    }
+  return 1;
+#endif
+}
+
+
 const char *
 get_validity_string (ctrl_t ctrl, PKT_public_key *pk, PKT_user_id *uid)
 {
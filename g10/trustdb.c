@@ -38,6 +38,7 @@
 #include "trustdb.h"
 #include "tofu.h"
 #include "key-clean.h"
+#include "../common/work-queue.h"
 
 static u32
 keyid_from_fpr20 (ctrl_t ctrl, const byte *fpr, u32 *keyid)
@@ -95,6 +96,34 @@ struct key_array
   KBNODE keyblock;
 };
 
+/* The number of keyblocks whose signatures are verified at once if
+ * --worker-threads is used.  */
+#define VALIDATE_BATCH_SIZE 256
+
+/* A signer of a certification looked up for the worker threads.  FPR
+ * is the issuer fingerprint of the signatures; FPRLEN is 0 for items
+ * looked up by keyid.  PK is NULL if the key is not available.  */
+struct signer_item
+{
+  struct signer_item *next;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  byte fprlen;
+  PKT_public_key *pk;
+};
+
+/* The number of buckets of a signer table.  Must be a power of 2.  */
+#define SIGNER_TABLE_SIZE 1024
+
+/* The signers looked up by check_sigs_parallel hashed by the last
+ * bytes of the issuer fingerprint.  Signers of signatures without an
+ * issuer fingerprint are not cached but kept in the NOFPR list only
+ * to release them later.  */
+struct signer_table_s
+{
+  struct signer_item *bucket[SIGNER_TABLE_SIZE];
+  struct signer_item *nofpr;
+};
+
 
 /* Control information for the trust DB.  */
 static struct
@@ -112,6 +141,7 @@ static struct key_item *utk_list;      /* all ultimately trusted keys */
 static int pending_check_trustdb;
 
 static int validate_keys (ctrl_t ctrl, int interactive);
+static int read_trust_record (ctrl_t ctrl, PKT_public_key *pk, TRUSTREC *rec);
 
 
 /**********************************************
@@ -438,6 +468,34 @@ do_sync(void)
       }
 }
 
+/*
+ * Begin a trustdb transaction and die on error
+ */
+static void
+begin_transaction (void)
+{
+  int rc = tdbio_begin_transaction ();
+  if (rc)
+    {
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc));
+      g10_exit (2);
+    }
+}
+
+/*
+ * Commit a trustdb transaction and die on error
+ */
+static void
+end_transaction (void)
+{
+  int rc = tdbio_end_transaction ();
+  if (rc)
+    {
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc));
+      g10_exit (2);
+    }
+}
+
 const char *
 trust_model_string (int model)
 {
@@ -641,6 +699,63 @@ tdb_revalidation_mark (ctrl_t ctrl)
   pending_check_trustdb = 1;
 }
 
+/* Schedule a revalidation because the keyblock of PK has changed;
+ * for example new certifications have been imported.  Unless a
+ * complete revalidation has already been scheduled only the keys
+ * marked this way are revalidated by the next check.  The nextcheck
+ * value 2 (like the 1 used by tdb_revalidation_mark in 1970) tells
+ * that only marked keys need to be checked; older versions of gpg see
+ * it as an expired check and overwrite it with a 1 whenever they
+ * change something.  */
+void
+tdb_revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+  TRUSTREC rec;
+  gpg_error_t err;
+  ulong scheduled;
+
+  init_trustdb (ctrl, 0);
+  if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
+    return;
+
+  scheduled = tdbio_read_nextcheck ();
+  if (scheduled == 1
+      || (scheduled != 2 && scheduled && scheduled <= make_timestamp ()))
+    {
+      /* A complete check is already due.  */
+      tdb_revalidation_mark (ctrl);
+      return;
+    }
+
+  begin_transaction ();
+  if (scheduled != 2)
+    tdbio_write_revalidate (ctrl, 1, scheduled);
+
+  err = read_trust_record (ctrl, pk, &rec);
+  if (err && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    {
+      tdbio_invalid ();
+      return;
+    }
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      memset (&rec, 0, sizeof rec);
+      rec.recnum = tdbio_new_recnum (ctrl);
+      rec.rectype = RECTYPE_TRUST;
+      fpr20_from_pk (pk, rec.r.trust.fingerprint);
+    }
+  if (!(rec.r.trust.flags & TRUST_RECFLAG_CHANGED))
+    {
+      rec.r.trust.flags |= TRUST_RECFLAG_CHANGED;
+      write_record (ctrl, &rec);
+    }
+
+  tdbio_write_nextcheck (ctrl, 2);
+  end_transaction ();
+  pending_check_trustdb = 1;
+}
+
+
 int
 trustdb_pending_check(void)
 {
@@ -1073,6 +1188,34 @@ tdb_check_trustdb_stale (ctrl_t ctrl)
     }
 }
 
+
+/* Combine the TOFU and the Web-of-Trust validity and add the flags
+ * common to all validity values.  */
+static unsigned int
+finish_validity (unsigned int tofu_validity, unsigned int validity)
+{
+#ifdef USE_TOFU
+  validity = tofu_wot_trust_combine (tofu_validity, validity);
+#else /*!USE_TOFU*/
+  (void)tofu_validity;
+
+  validity &= TRUST_MASK;
+
+  if (validity == TRUST_NEVER)
+    /* TRUST_NEVER trumps everything else.  */
+    validity |= TRUST_NEVER;
+  if (validity == TRUST_EXPIRED)
+    /* TRUST_EXPIRED trumps everything but TRUST_NEVER.  */
+    validity |= TRUST_EXPIRED;
+#endif /*!USE_TOFU*/
+
+  if (opt.trust_model != TM_TOFU
+      && pending_check_trustdb)
+    validity |= TRUST_FLAG_PENDING_CHECK;
+
+  return validity;
+}
+
 /*
  * Return the validity information for KB/PK (at least one of them
  * must be non-NULL).  This is the core of get_validity.  If SIG is
@@ -1091,8 +1234,8 @@ tdb_get_validity_core (ctrl_t ctrl,
   TRUSTREC trec, vrec;
   gpg_error_t err = 0;
   ulong recno;
-#ifdef USE_TOFU
   unsigned int tofu_validity = TRUST_UNKNOWN;
+#ifdef USE_TOFU
   int free_kb = 0;
 #endif
   unsigned int validity = TRUST_UNKNOWN;
@@ -1305,24 +1448,85 @@ tdb_get_validity_core (ctrl_t ctrl,
     }
 
  leave:
-#ifdef USE_TOFU
-  validity = tofu_wot_trust_combine (tofu_validity, validity);
-#else /*!USE_TOFU*/
-  validity &= TRUST_MASK;
+  return finish_validity (tofu_validity, validity);
+}
 
-  if (validity == TRUST_NEVER)
-    /* TRUST_NEVER trumps everything else.  */
-    validity |= TRUST_NEVER;
-  if (validity == TRUST_EXPIRED)
-    /* TRUST_EXPIRED trumps everything but TRUST_NEVER.  */
-    validity |= TRUST_EXPIRED;
-#endif /*!USE_TOFU*/
 
-  if (opt.trust_model != TM_TOFU
-      && pending_check_trustdb)
-    validity |= TRUST_FLAG_PENDING_CHECK;
+/* Compute the validity of the primary key of the keyblock KB and of
+ * all its user IDs using a single lookup of the trust record.  On
+ * return VALIDITIES[0] has the validity of the key and VALIDITIES[1]
+ * to VALIDITIES[NUIDS] those of the user IDs in the order they
+ * appear in KB.  The values are identical to those returned by
+ * tdb_get_validity_core.  Returns false if this shortcut is not
+ * possible with the current trust model; the caller then needs to
+ * use tdb_get_validity_core for each item.  */
+int
+tdb_get_validity_list (ctrl_t ctrl, kbnode_t kb,
+                       unsigned int *validities, int nuids)
+{
+  TRUSTREC trec, vrec;
+  gpg_error_t err;
+  PKT_public_key *pk = kb->pkt->pkt.public_key;
+  kbnode_t node;
+  ulong recno;
+  int i;
 
-  return validity;
+  if (opt.trust_model != TM_CLASSIC && opt.trust_model != TM_PGP)
+    return 0;
+
+  init_trustdb (ctrl, 0);
+  check_trustdb_stale (ctrl);
+
+  err = read_trust_record (ctrl, pk, &trec);
+  if (err && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    {
+      tdbio_invalid ();
+      for (i=0; i <= nuids; i++)
+        validities[i] = 0;
+      return 1;
+    }
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      /* No record found.  */
+      for (i=0; i <= nuids; i++)
+        validities[i] = finish_validity (TRUST_UNKNOWN, TRUST_UNKNOWN);
+      return 1;
+    }
+
+  /* Mark the user IDs as not yet seen so that, like in
+   * tdb_get_validity_core, the first matching valid record wins.  */
+  validities[0] = 0;
+  for (i=1; i <= nuids; i++)
+    validities[i] = (unsigned int)-1;
+
+  for (recno = trec.r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+
+      if (validities[0] < (vrec.r.valid.validity & TRUST_MASK))
+        validities[0] = (vrec.r.valid.validity & TRUST_MASK);
+
+      for (node = kb, i = 1; i <= nuids
+             && (node = find_next_kbnode (node, PKT_USER_ID)); i++)
+        if (validities[i] == (unsigned int)-1
+            && !memcmp (vrec.r.valid.namehash,
+                        node->pkt->pkt.user_id->namehash, 20))
+          validities[i] = (vrec.r.valid.validity & TRUST_MASK);
+    }
+
+  for (i=0; i <= nuids; i++)
+    {
+      if (validities[i] == (unsigned int)-1)
+        validities[i] = 0;  /* User ID not signed.  */
+      if ((trec.r.trust.ownertrust & TRUST_FLAG_DISABLED))
+        validities[i] |= TRUST_FLAG_DISABLED;
+      validities[i] = finish_validity (TRUST_UNKNOWN, validities[i]);
+    }
+
+  pk->flags.disabled = !!(trec.r.trust.ownertrust & TRUST_FLAG_DISABLED);
+  pk->flags.disabled_valid = 1;
+
+  return 1;
 }
 
 
@@ -1509,13 +1713,14 @@ dump_key_array (int depth, struct key_array *keys)
 }
 
 
+/* Write the validity of the user ids of KEYBLOCK to the trustdb.
+ * The caller must sync the trustdb after the last keyblock.  */
 static void
 store_validation_status (ctrl_t ctrl, int depth,
                          kbnode_t keyblock, KeyHashTable stored)
 {
   KBNODE node;
   int status;
-  int any = 0;
 
   for (node=keyblock; node; node = node->next)
     {
@@ -1537,14 +1742,9 @@ store_validation_status (ctrl_t ctrl, int depth,
 			       uid, depth, status);
 
 	      mark_keyblock_seen(stored,keyblock);
-
-              any = 1;
             }
         }
     }
-
-  if (any)
-    do_sync ();
 }
 
 
@@ -1832,26 +2032,254 @@ search_skipfnc (void *opaque, u32 *kid, int dummy_uid_no)
 }
 
 
+/* Return the public key which issued SIG.  If SIG carries an issuer
+ * fingerprint the key is taken from or added to the table TBL.
+ * Otherwise the key is looked up by its keyid, which uses the public
+ * key cache of getkey.c, and the result is only put on the list of
+ * keys to release.  Returns NULL if the key is not available.  The
+ * keys are owned by TBL.  */
+static PKT_public_key *
+get_signer (ctrl_t ctrl, struct signer_table_s *tbl, PKT_signature *sig)
+{
+  struct signer_item *item, **bucket;
+  const byte *fpr;
+  size_t fprlen;
+
+  fpr = issuer_fpr_raw (sig, &fprlen);
+  if (fpr && fprlen >= 2 && fprlen <= MAX_FINGERPRINT_LEN)
+    {
+      bucket = tbl->bucket + (((fpr[fprlen-2] << 8) | fpr[fprlen-1])
+                              & (SIGNER_TABLE_SIZE - 1));
+      for (item = *bucket; item; item = item->next)
+        if (item->fprlen == fprlen && !memcmp (item->fpr, fpr, fprlen))
+          return item->pk;
+    }
+  else
+    {
+      fprlen = 0;
+      bucket = &tbl->nofpr;
+    }
+
+  item = xmalloc_clear (sizeof *item);
+  if (fprlen)
+    memcpy (item->fpr, fpr, fprlen);
+  item->fprlen = fprlen;
+  item->pk = xmalloc_clear (sizeof *item->pk);
+  item->pk->req_usage = PUBKEY_USAGE_CERT;
+  if (get_pubkey_for_sig (ctrl, item->pk, sig, NULL))
+    {
+      free_public_key (item->pk);
+      item->pk = NULL;
+    }
+  item->next = *bucket;
+  *bucket = item;
+  return item->pk;
+}
+
+
+/* Release the signer list ITEM.  */
+static void
+release_signer_items (struct signer_item *item)
+{
+  struct signer_item *next;
+
+  for (; item; item = next)
+    {
+      next = item->next;
+      if (item->pk)
+        free_public_key (item->pk);
+      xfree (item);
+    }
+}
+
+
+/* Verify the signatures of the NKEYS keyblocks in KEYS using the
+ * worker threads of WQ.  This covers the self-signatures and the
+ * certifications by keys in KLIST, i.e. those which will be checked
+ * by validate_one_keyblock.  The results are stored in the signature
+ * cache flags and the keyblocks are then prepared for
+ * validate_one_keyblock.  */
+static void
+check_sigs_parallel (ctrl_t ctrl, work_queue_t wq, kbnode_t *keys,
+                     unsigned int nkeys, struct key_item *klist)
+{
+  gpg_error_t err = 0;
+  keysig_job_t jobs = NULL;
+  struct signer_table_s *signers;
+  PKT_public_key *pk, *signer;
+  PKT_signature *sig;
+  kbnode_t node, uidnode;
+  unsigned int i;
+
+  signers = xmalloc_clear (sizeof *signers);
+  for (i=0; i < nkeys && !err; i++)
+    err = queue_self_sig_checks (wq, keys[i], &jobs);
+  work_queue_wait (wq);
+  finish_key_sig_checks (jobs);
+  jobs = NULL;
+
+  for (i=0; i < nkeys; i++)
+    {
+      merge_keys_and_selfsig (ctrl, keys[i]);
+      clear_kbnode_flags (keys[i]);
+    }
+
+  /* Now that we know which user ids are valid we can look at the
+   * certifications.  The filter is the same as in
+   * mark_usable_uid_certs.  */
+  for (i=0; i < nkeys && !err; i++)
+    {
+      pk = keys[i]->pkt->pkt.public_key;
+      if (pk->has_expired || pk->flags.revoked)
+        continue;
+
+      uidnode = NULL;
+      for (node=keys[i]; node && !err; node = node->next)
+        {
+          if (node->pkt->pkttype == PKT_USER_ID)
+            {
+              if (node->pkt->pkt.user_id->flags.revoked
+                  || node->pkt->pkt.user_id->flags.expired)
+                uidnode = NULL;
+              else
+                uidnode = node;
+              continue;
+            }
+          if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+            break;
+          if (!uidnode || node->pkt->pkttype != PKT_SIGNATURE)
+            continue;
+
+          sig = node->pkt->pkt.signature;
+          if (sig->flags.checked || !keyid_cmp (pk_keyid (pk), sig->keyid))
+            continue;
+          if (!IS_UID_SIG (sig) && !IS_UID_REV (sig))
+            continue;
+          if (sig->sig_class >= 0x11 && sig->sig_class <= 0x13
+              && sig->sig_class - 0x10 < opt.min_cert_level)
+            continue;
+          if (!is_in_klist (klist, sig))
+            continue;
+
+          signer = get_signer (ctrl, signers, sig);
+          if (signer)
+            err = queue_cert_sig_check (wq, keys[i], node, signer, &jobs);
+        }
+    }
+  work_queue_wait (wq);
+  finish_key_sig_checks (jobs);
+
+  for (i=0; i < SIGNER_TABLE_SIZE; i++)
+    release_signer_items (signers->bucket[i]);
+  release_signer_items (signers->nofpr);
+  xfree (signers);
+
+  if (err)
+    log_info ("checking signatures in parallel failed: %s\n",
+              gpg_strerror (err));
+}
+
+
+/* Process the candidate KEYBLOCK for validate_key_list.  The
+ * keyblock must have been prepared with merge_keys_and_selfsig and
+ * clear_kbnode_flags.  Returns true if KEYBLOCK shall be stored in
+ * the key array.  */
+static int
+validate_candidate (ctrl_t ctrl, kbnode_t keyblock, KeyHashTable full_trust,
+                    struct key_item *klist, u32 curtime, u32 *next_expire)
+{
+  PKT_public_key *pk = keyblock->pkt->pkt.public_key;
+  KBNODE node;
+
+  if (pk->has_expired || pk->flags.revoked)
+    {
+      /* it does not make sense to look further at those keys */
+      mark_keyblock_seen (full_trust, keyblock);
+      return 0;
+    }
+
+  if (!validate_one_keyblock (ctrl, keyblock, klist, curtime, next_expire))
+    return 0;
+
+  if (pk->expiredate && pk->expiredate >= curtime
+      && pk->expiredate < *next_expire)
+    *next_expire = pk->expiredate;
+
+  /* Optimization - if all uids are fully trusted, then we
+     never need to consider this key as a candidate again. */
+
+  for (node=keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
+      break;
+
+  if(node==NULL)
+    mark_keyblock_seen (full_trust, keyblock);
+
+  return 1;
+}
+
+
+/* Verify the signatures of the NBATCH keyblocks in BATCH in parallel
+ * and run validate_candidate on each of them.  The keyblocks to keep
+ * are appended to KEYS which is returned; the others are released.
+ * This is a helper for validate_key_list.  */
+static struct key_array *
+validate_batch (ctrl_t ctrl, work_queue_t wq,
+                kbnode_t *batch, unsigned int nbatch,
+                struct key_array *keys, size_t *nkeys, size_t *maxkeys,
+                KeyHashTable full_trust, struct key_item *klist,
+                u32 curtime, u32 *next_expire)
+{
+  unsigned int i;
+
+  check_sigs_parallel (ctrl, wq, batch, nbatch, klist);
+  for (i=0; i < nbatch; i++)
+    {
+      if (validate_candidate (ctrl, batch[i], full_trust, klist,
+                              curtime, next_expire))
+        {
+          if (*nkeys == *maxkeys)
+            {
+              *maxkeys += 1000;
+              keys = xrealloc (keys, (*maxkeys+1) * sizeof *keys);
+            }
+          keys[(*nkeys)++].keyblock = batch[i];
+        }
+      else
+        release_kbnode (batch[i]);
+      batch[i] = NULL;
+    }
+  return keys;
+}
+
+
 /*
  * Scan all keys and return a key_array of all suitable keys from
  * klist.  The caller has to pass keydb handle so that we don't use
  * to create our own.  Returns either a key_array or NULL in case of
  * an error.  No results found are indicated by an empty array.
- * Caller hast to release the returned array.
+ * Caller hast to release the returned array.  If WQ is not NULL the
+ * signatures are verified in batches by its worker threads.
  */
 static struct key_array *
 validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
-                   struct key_item *klist, u32 curtime, u32 *next_expire)
+                   struct key_item *klist, u32 curtime, u32 *next_expire,
+                   work_queue_t wq)
 {
   KBNODE keyblock = NULL;
   struct key_array *keys = NULL;
   size_t nkeys, maxkeys;
+  kbnode_t *batch = NULL;
+  unsigned int nbatch = 0;
+  unsigned int i;
   int rc;
   KEYDB_SEARCH_DESC desc;
 
   maxkeys = 1000;
   keys = xmalloc ((maxkeys+1) * sizeof *keys);
   nkeys = 0;
+  if (wq)
+    batch = xmalloc (VALIDATE_BATCH_SIZE * sizeof *batch);
 
   rc = keydb_search_reset (hd);
   if (rc)
@@ -1869,6 +2297,7 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     {
       keys[nkeys].keyblock = NULL;
+      xfree (batch);
       return keys;
     }
   if (rc)
@@ -1880,8 +2309,6 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   desc.mode = KEYDB_SEARCH_MODE_NEXT; /* change mode */
   do
     {
-      PKT_public_key *pk;
-
       rc = keydb_get_keyblock (hd, &keyblock);
       if (rc)
         {
@@ -1898,40 +2325,34 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
           continue;
         }
 
+      if (wq)
+        {
+          /* Collect a batch and verify the signatures of all its
+           * keyblocks at once.  The batch is then processed in the
+           * same order as without worker threads.  */
+          batch[nbatch++] = keyblock;
+          keyblock = NULL;
+          if (nbatch == VALIDATE_BATCH_SIZE)
+            {
+              keys = validate_batch (ctrl, wq, batch, nbatch, keys,
+                                     &nkeys, &maxkeys, full_trust, klist,
+                                     curtime, next_expire);
+              nbatch = 0;
+            }
+          continue;
+        }
+
       /* prepare the keyblock for further processing */
       merge_keys_and_selfsig (ctrl, keyblock);
       clear_kbnode_flags (keyblock);
-      pk = keyblock->pkt->pkt.public_key;
-      if (pk->has_expired || pk->flags.revoked)
-        {
-          /* it does not make sense to look further at those keys */
-          mark_keyblock_seen (full_trust, keyblock);
-        }
-      else if (validate_one_keyblock (ctrl, keyblock, klist,
-                                      curtime, next_expire))
+      if (validate_candidate (ctrl, keyblock, full_trust, klist,
+                              curtime, next_expire))
         {
-	  KBNODE node;
-
-          if (pk->expiredate && pk->expiredate >= curtime
-              && pk->expiredate < *next_expire)
-            *next_expire = pk->expiredate;
-
           if (nkeys == maxkeys) {
             maxkeys += 1000;
             keys = xrealloc (keys, (maxkeys+1) * sizeof *keys);
           }
           keys[nkeys++].keyblock = keyblock;
-
-	  /* Optimization - if all uids are fully trusted, then we
-	     never need to consider this key as a candidate again. */
-
-	  for (node=keyblock; node; node = node->next)
-	    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
-	      break;
-
-	  if(node==NULL)
-	    mark_keyblock_seen (full_trust, keyblock);
-
           keyblock = NULL;
         }
 
@@ -1940,6 +2361,14 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
     }
   while (!(rc = keydb_search (hd, &desc, 1, NULL)));
 
+  if (nbatch && (!rc || gpg_err_code (rc) == GPG_ERR_NOT_FOUND))
+    {
+      keys = validate_batch (ctrl, wq, batch, nbatch, keys,
+                             &nkeys, &maxkeys, full_trust, klist,
+                             curtime, next_expire);
+      nbatch = 0;
+    }
+
   if (rc && gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
     {
       log_error ("keydb_search_next failed: %s\n", gpg_strerror (rc));
@@ -1947,9 +2376,13 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
     }
 
   keys[nkeys].keyblock = NULL;
+  xfree (batch);
   return keys;
 
  die:
+  for (i=0; i < nbatch; i++)
+    release_kbnode (batch[i]);
+  xfree (batch);
   keys[nkeys].keyblock = NULL;
   release_key_array (keys);
   return NULL;
@@ -1968,9 +2401,10 @@ reset_trust_records (ctrl_t ctrl)
       if(rec.rectype==RECTYPE_TRUST)
 	{
 	  count++;
-	  if(rec.r.trust.min_ownertrust)
+	  if(rec.r.trust.min_ownertrust || rec.r.trust.flags)
 	    {
 	      rec.r.trust.min_ownertrust=0;
+	      rec.r.trust.flags=0;
 	      write_record (ctrl, &rec);
 	    }
 
@@ -1999,6 +2433,263 @@ reset_trust_records (ctrl_t ctrl)
     }
 }
 
+/* Build the list of keys which certified user ids of KEYBLOCK and
+ * are used by validate_keys as signers, i.e. the part of the key
+ * lists validate_keys would use for KEYBLOCK.  The largest depth
+ * at which one of them is used is stored at R_DEPTH.  Returns -1 if
+ * this can't be determined without a complete validation.  */
+static int
+changed_key_signers (ctrl_t ctrl, kbnode_t keyblock,
+                     struct key_item **r_klist, int *r_depth)
+{
+  PKT_public_key *pk = keyblock->pkt->pkt.public_key;
+  struct key_item *klist = NULL;
+  struct key_item *k;
+  PKT_public_key *spk = NULL;
+  PKT_signature *sig;
+  TRUSTREC srec, vrec;
+  kbnode_t node, n, skb;
+  ulong recno;
+  int depth, fully;
+  int rc = 0;
+
+  *r_klist = NULL;
+  *r_depth = 0;
+  for (node = keyblock; node && !rc; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (!keyid_cmp (pk_keyid (pk), sig->keyid))
+        continue;
+      if (!IS_UID_SIG (sig) && !IS_UID_REV (sig))
+        continue;
+      if (sig->trust_depth && opt.trust_model == TM_PGP)
+        {
+          rc = -1;  /* Trust signatures make KEYBLOCK an introducer.  */
+          break;
+        }
+      for (k = klist; k; k = k->next)
+        if (k->kid[0] == sig->keyid[0] && k->kid[1] == sig->keyid[1])
+          break;
+      if (k)
+        continue;
+
+      if (tdb_keyid_is_utk (sig->keyid))
+        {
+          k = new_key_item ();
+          k->kid[0] = sig->keyid[0];
+          k->kid[1] = sig->keyid[1];
+          k->ownertrust = TRUST_ULTIMATE;
+          k->next = klist;
+          klist = k;
+          continue;
+        }
+
+      /* Only keys which have been fully valid at a depth allowing
+       * them to certify are used.  */
+      if (spk)
+        free_public_key (spk);
+      spk = xmalloc_clear (sizeof *spk);
+      if (get_pubkey (ctrl, spk, sig->keyid)
+          || spk->has_expired || spk->flags.revoked
+          || read_trust_record (ctrl, spk, &srec))
+        continue;
+      fully = 0;
+      for (recno = srec.r.trust.validlist; recno; recno = vrec.r.valid.next)
+        {
+          read_record (recno, &vrec, RECTYPE_VALID);
+          if ((vrec.r.valid.validity & TRUST_MASK) == TRUST_FULLY)
+            fully = 1;
+        }
+      if (!fully)
+        continue;
+
+      /* The stored depth is the last one at which the signer has
+       * been updated and thus may be larger than the one at which
+       * it is used.  The trust value, depth and regexp of a trust
+       * signature on the signer are not stored in the trustdb.  */
+      if (srec.r.trust.depth + 1 >= opt.max_cert_depth
+          || srec.r.trust.min_ownertrust)
+        rc = -1;
+      else if (opt.trust_model == TM_PGP)
+        {
+          skb = get_pubkeyblock (ctrl, sig->keyid);
+          for (n = skb; n; n = n->next)
+            if (n->pkt->pkttype == PKT_SIGNATURE
+                && n->pkt->pkt.signature->trust_depth)
+              rc = -1;
+          release_kbnode (skb);
+        }
+      if (rc)
+        break;
+
+      depth = srec.r.trust.depth + 1;
+      if (depth > *r_depth)
+        *r_depth = depth;
+      k = new_key_item ();
+      k->kid[0] = sig->keyid[0];
+      k->kid[1] = sig->keyid[1];
+      k->ownertrust = srec.r.trust.ownertrust & TRUST_MASK;
+      k->min_ownertrust = srec.r.trust.min_ownertrust;
+      k->next = klist;
+      klist = k;
+    }
+
+  if (spk)
+    free_public_key (spk);
+  if (rc)
+    release_key_items (klist);
+  else
+    *r_klist = klist;
+  return rc;
+}
+
+
+/* The maximum number of changed keys for validate_changed_keys.  */
+#define MAX_CHANGED_KEYS 64
+
+/* Revalidate only the keys marked by tdb_revalidation_mark_key.  A
+ * changed key which does not act as an introducer affects only its
+ * own validity which is recomputed here from the stored validity of
+ * its signers.  Returns 0 on success or -1 if a complete validation
+ * is required; in the latter case the trustdb is not changed.  */
+static int
+validate_changed_keys (ctrl_t ctrl)
+{
+  TRUSTREC rec, vrec;
+  ulong recnum, recno, savedcheck;
+  ulong changed[MAX_CHANGED_KEYS];
+  kbnode_t keyblocks[MAX_CHANGED_KEYS];
+  int nchanged = 0;
+  struct key_item *klist;
+  KeyHashTable stored = NULL;
+  PKT_public_key *pk;
+  kbnode_t node;
+  u32 kid[2], start_time, next_expire;
+  byte fpr[20];
+  int i, depth, was_fully, is_fully;
+  int in_transaction = 0;
+  int rc = 0;
+
+  if (!(opt.trust_model == TM_PGP || opt.trust_model == TM_CLASSIC)
+      || !utk_list || !tdbio_db_matches_options ()
+      || tdbio_read_nextcheck () != 2 || !tdbio_read_revalidate (&savedcheck))
+    return -1;
+
+  /* Collect the changed keys.  Keys with an ownertrust are
+   * introducers and thus affect other keys.  */
+  for (recnum=1; !rc && !tdbio_read_record (recnum, &rec, 0); recnum++)
+    {
+      if (rec.rectype != RECTYPE_TRUST
+          || !(rec.r.trust.flags & TRUST_RECFLAG_CHANGED))
+        continue;
+      if (nchanged == MAX_CHANGED_KEYS
+          || (rec.r.trust.ownertrust & TRUST_MASK) >= TRUST_MARGINAL
+          || rec.r.trust.min_ownertrust)
+        {
+          rc = -1;
+          break;
+        }
+      /* The keyid is the tail of the fingerprint stored in the trust
+       * record for v4 as well as v5 keys.  */
+      kid[0] = buf32_to_u32 (rec.r.trust.fingerprint + 12);
+      kid[1] = buf32_to_u32 (rec.r.trust.fingerprint + 16);
+      keyblocks[nchanged] = get_pubkeyblock (ctrl, kid);
+      if (!keyblocks[nchanged])
+        {
+          rc = -1;  /* Probably deleted.  */
+          break;
+        }
+      changed[nchanged++] = recnum;
+      fpr20_from_pk (keyblocks[nchanged-1]->pkt->pkt.public_key, fpr);
+      if (memcmp (fpr, rec.r.trust.fingerprint, 20)
+          || tdb_keyid_is_utk (kid))
+        rc = -1;
+    }
+  if (rc)
+    goto leave;
+
+  /* Either all changed keys are revalidated or the trustdb is left
+   * as it is for the complete validation.  */
+  begin_transaction ();
+  in_transaction = 1;
+
+  start_time = make_timestamp ();
+  next_expire = savedcheck? savedcheck : 0xffffffff;
+  stored = new_key_hash_table ();
+  for (i=0; i < nchanged && !rc; i++)
+    {
+      clear_kbnode_flags (keyblocks[i]);
+      pk = keyblocks[i]->pkt->pkt.public_key;
+      if (changed_key_signers (ctrl, keyblocks[i], &klist, &depth))
+        {
+          rc = -1;
+          break;
+        }
+
+      /* Clear the validity like reset_trust_records does.  */
+      read_record (changed[i], &rec, RECTYPE_TRUST);
+      was_fully = 0;
+      for (recno = rec.r.trust.validlist; recno; recno = vrec.r.valid.next)
+        {
+          read_record (recno, &vrec, RECTYPE_VALID);
+          if ((vrec.r.valid.validity & TRUST_MASK) == TRUST_FULLY)
+            was_fully = 1;
+          vrec.r.valid.validity &= ~TRUST_MASK;
+          vrec.r.valid.marginal_count = vrec.r.valid.full_count = 0;
+          write_record (ctrl, &vrec);
+        }
+      rec.r.trust.flags &= ~TRUST_RECFLAG_CHANGED;
+      write_record (ctrl, &rec);
+
+      is_fully = 0;
+      if (klist && !pk->has_expired && !pk->flags.revoked
+          && validate_one_keyblock (ctrl, keyblocks[i], klist,
+                                    start_time, &next_expire))
+        {
+          if (pk->expiredate && pk->expiredate >= start_time
+              && pk->expiredate < next_expire)
+            next_expire = pk->expiredate;
+          store_validation_status (ctrl, depth, keyblocks[i], stored);
+          for (node = keyblocks[i]; node; node = node->next)
+            if (node->pkt->pkttype == PKT_USER_ID && (node->flag & 4))
+              is_fully = 1;
+        }
+      release_key_items (klist);
+
+      /* A key which became fully valid or lost this state may be
+       * used as a signer for other keys.  */
+      if ((was_fully || is_fully)
+          && (was_fully != is_fully || rec.r.trust.depth != depth)
+          && depth + 1 < opt.max_cert_depth)
+        rc = -1;
+    }
+  if (rc)
+    goto leave;
+
+  if (next_expire == 0xffffffff || next_expire < start_time)
+    tdbio_write_nextcheck (ctrl, 0);
+  else
+    tdbio_write_nextcheck (ctrl, next_expire);
+  tdbio_write_revalidate (ctrl, 0, 0);
+  end_transaction ();
+  in_transaction = 0;
+  pending_check_trustdb = 0;
+  if (!opt.quiet)
+    log_info (ngettext ("%d changed key revalidated\n",
+                        "%d changed keys revalidated\n", nchanged), nchanged);
+
+ leave:
+  for (i=0; i < nchanged; i++)
+    release_kbnode (keyblocks[i]);
+  release_key_hash_table (stored);
+  if (in_transaction)
+    tdbio_cancel_transaction ();
+  return rc;
+}
+
+
 /*
  * Run the key validation procedure.
  *
@@ -2038,6 +2729,12 @@ validate_keys (ctrl_t ctrl, int interactive)
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable stored,used,full_trust;
   u32 start_time, next_expire;
+  work_queue_t wq = NULL;
+
+  /* A check without user interaction may be limited to the keys
+   * which have changed since the last check.  */
+  if (!interactive && !validate_changed_keys (ctrl))
+    return 0;
 
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectural re-thinking, as it is agonizingly slow.
@@ -2058,6 +2755,12 @@ validate_keys (ctrl_t ctrl, int interactive)
 
   reset_trust_records (ctrl);
 
+  /* With worker threads the signatures are verified in parallel.
+   * This relies on the signature cache flags.  */
+  if (opt.worker_threads > 1 && !opt.no_sig_cache
+      && work_queue_new (&wq, opt.worker_threads))
+    wq = NULL;
+
   /* Fixme: Instead of always building a UTK list, we could just build it
    * here when needed */
   if (!utk_list)
@@ -2176,7 +2879,7 @@ validate_keys (ctrl_t ctrl, int interactive)
 
       /* Find all keys which are signed by a key in kdlist */
       keys = validate_key_list (ctrl, kdb, full_trust, klist,
-				start_time, &next_expire);
+				start_time, &next_expire, wq);
       if (!keys)
         {
           log_error ("validate_key_list failed\n");
@@ -2193,6 +2896,7 @@ validate_keys (ctrl_t ctrl, int interactive)
 
       for (kar=keys; kar->keyblock; kar++)
         store_validation_status (ctrl, depth, kar->keyblock, stored);
+      do_sync ();
 
       if (!opt.quiet)
         log_info (_("depth: %d  valid: %3d  signed: %3d"
@@ -2252,6 +2956,7 @@ validate_keys (ctrl_t ctrl, int interactive)
     }
 
  leave:
+  work_queue_release (wq);
   keydb_release (kdb);
   release_key_array (keys);
   if (klist != utk_list)
@@ -2273,6 +2978,7 @@ validate_keys (ctrl_t ctrl, int interactive)
                       strtimestamp (next_expire));
         }
 
+      tdbio_write_revalidate (ctrl, 0, 0);
       rc2 = tdbio_update_version_record (ctrl);
       if (rc2)
 	{
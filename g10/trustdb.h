@@ -62,6 +62,7 @@ void update_ownertrust (ctrl_t ctrl,
 int clear_ownertrusts (ctrl_t ctrl, PKT_public_key *pk);
 
 void revalidation_mark (ctrl_t ctrl);
+void revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk);
 void check_trustdb_stale (ctrl_t ctrl);
 void check_or_update_trustdb (ctrl_t ctrl);
 
@@ -70,6 +71,8 @@ unsigned int get_validity (ctrl_t ctrl, kbnode_t kb, PKT_public_key *pk,
 			   PKT_signature *sig, int may_ask);
 int get_validity_info (ctrl_t ctrl, kbnode_t kb, PKT_public_key *pk,
                        PKT_user_id *uid);
+int get_validity_info_list (ctrl_t ctrl, kbnode_t keyblock,
+                            int *letters, int nuids);
 const char *get_validity_string (ctrl_t ctrl,
                                  PKT_public_key *pk, PKT_user_id *uid);
 
@@ -91,6 +94,7 @@ gpg_error_t init_trustdb (ctrl_t ctrl, int no_create);
 int have_trustdb (ctrl_t ctrl);
 void tdb_check_trustdb_stale (ctrl_t ctrl);
 void tdb_revalidation_mark (ctrl_t ctrl);
+void tdb_revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk);
 int trustdb_pending_check(void);
 void tdb_check_or_update (ctrl_t ctrl);
 
@@ -100,6 +104,8 @@ unsigned int tdb_get_validity_core (ctrl_t ctrl, kbnode_t kb,
                                     PKT_public_key *pk, PKT_user_id *uid,
                                     PKT_public_key *main_pk,
 				    PKT_signature *sig, int may_ask);
+int tdb_get_validity_list (ctrl_t ctrl, kbnode_t kb,
+                           unsigned int *validities, int nuids);
 
 void list_trust_path( const char *username );
 int enum_cert_paths( void **context, ulong *lid,
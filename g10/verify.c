@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "gpg.h"
 #include "options.h"
@@ -35,6 +37,26 @@
 #include "filter.h"
 #include "../common/ttyio.h"
 #include "../common/i18n.h"
+#include "../common/work-queue.h"
+
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__CYGWIN__)
+#define MY_O_BINARY  O_BINARY
+#else
+#define MY_O_BINARY  0
+#endif
+
+/* The number of manifest entries processed at once by verify_batch.  */
+#define VERIFY_BATCH_SIZE 64
+
+/* An entry of the manifest processed by verify_batch.  */
+struct batch_entry_s
+{
+  char *sigfile;     /* The detached signature.  */
+  char *datafile;    /* The signed data.  */
+  int fd;            /* The opened data file while hashing or -1.  */
+  gcry_md_hd_t md;   /* The hashed data or NULL.  */
+  gpg_error_t err;   /* The error from hashing the data.  */
+};
 
 
 /****************
@@ -228,6 +250,319 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
 
 
 
+/* Read the signature packets from SIGFILE and return a hash context
+ * at R_MD with all digest algorithms of the signatures enabled.  A
+ * hash context is only returned for detached signatures in binary
+ * mode; in all other cases NULL is stored at R_MD and the entry is
+ * processed the usual way.  */
+static void
+prepare_batch_hash (const char *sigfile, gcry_md_hd_t *r_md)
+{
+  iobuf_t fp;
+  armor_filter_context_t *afx = NULL;
+  struct parse_packet_ctx_s parsectx;
+  PACKET *pkt;
+  gcry_md_hd_t md = NULL;
+  int rc;
+
+  *r_md = NULL;
+
+  fp = iobuf_open (sigfile);
+  if (fp)
+    iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+  if (!fp || is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      return;  /* The error is reported later.  */
+    }
+  if (!opt.no_armor && use_armor_filter (fp))
+    {
+      afx = new_armor_context ();
+      push_armor_filter (afx, fp);
+    }
+
+  pkt = xmalloc (sizeof *pkt);
+  init_packet (pkt);
+  init_parse_packet (&parsectx, fp);
+  while ((rc = parse_packet (&parsectx, pkt)) != -1)
+    {
+      if (rc || pkt->pkttype != PKT_SIGNATURE
+          || pkt->pkt.signature->sig_class != 0x00)
+        {
+          gcry_md_close (md);
+          md = NULL;
+          break;
+        }
+      if (openpgp_md_test_algo (pkt->pkt.signature->digest_algo))
+        ;
+      else if (!md && gcry_md_open (&md, 0, 0))
+        break;
+      else
+        gcry_md_enable (md, map_md_openpgp_to_gcry
+                        (pkt->pkt.signature->digest_algo));
+      free_packet (pkt, &parsectx);
+      init_packet (pkt);
+    }
+  free_packet (pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  xfree (pkt);
+  iobuf_close (fp);
+  release_armor_context (afx);
+
+  *r_md = md;
+}
+
+
+/* The job to hash the data file of a batch entry.  This runs in a
+ * worker thread.  */
+static void
+batch_hash_job (void *opaque)
+{
+  struct batch_entry_s *entry = opaque;
+  char *buffer;
+  ssize_t n;
+
+  buffer = xtrymalloc (65536);
+  if (!buffer)
+    {
+      entry->err = gpg_error_from_syserror ();
+      return;
+    }
+  do
+    {
+      n = read (entry->fd, buffer, 65536);
+      if (n > 0)
+        gcry_md_write (entry->md, buffer, n);
+    }
+  while (n > 0 || (n < 0 && errno == EINTR));
+  if (n < 0)
+    entry->err = gpg_error_from_syserror ();
+  xfree (buffer);
+}
+
+
+/* Verify the detached signature of the batch ENTRY.  */
+static int
+verify_batch_entry (ctrl_t ctrl, struct batch_entry_s *entry)
+{
+  IOBUF fp;
+  armor_filter_context_t *afx = NULL;
+  progress_filter_context_t *pfx = new_progress_context ();
+  strlist_t sl = NULL;
+  int rc;
+
+  print_file_status (STATUS_FILE_START, entry->sigfile, 1);
+  fp = iobuf_open (entry->sigfile);
+  if (fp)
+    iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+  if (fp && is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      fp = NULL;
+      gpg_err_set_errno (EPERM);
+    }
+  if (!fp)
+    {
+      rc = gpg_error_from_syserror ();
+      log_error (_("can't open '%s': %s\n"),
+                 entry->sigfile, gpg_strerror (rc));
+      print_file_status (STATUS_FILE_ERROR, entry->sigfile, 1);
+      goto leave;
+    }
+  handle_progress (pfx, fp, entry->sigfile);
+
+  if (!opt.no_armor && use_armor_filter (fp))
+    {
+      afx = new_armor_context ();
+      push_armor_filter (afx, fp);
+    }
+
+  /* If hashing failed the data is hashed again by the regular code
+   * which also reports the error.  */
+  add_to_strlist (&sl, entry->datafile);
+  rc = proc_signature_packets_with_md (ctrl, NULL, fp, sl, entry->sigfile,
+                                       entry->err? NULL : entry->md);
+  free_strlist (sl);
+  iobuf_close (fp);
+  write_status (STATUS_FILE_DONE);
+
+  reset_literals_seen ();
+
+ leave:
+  release_armor_context (afx);
+  release_progress_context (pfx);
+  return rc;
+}
+
+
+/* Verify the NENTRIES entries of a batch.  If WQ is not NULL the
+ * data files are hashed in parallel first.  */
+static int
+verify_batch_entries (ctrl_t ctrl, work_queue_t wq,
+                      struct batch_entry_s *entries, int nentries)
+{
+  struct batch_entry_s *entry;
+  int i, rc;
+  int first_rc = 0;
+
+  for (i=0; wq && i < nentries; i++)
+    {
+      entry = entries + i;
+      prepare_batch_hash (entry->sigfile, &entry->md);
+      if (!entry->md)
+        continue;
+      entry->fd = gnupg_open (entry->datafile, O_RDONLY | MY_O_BINARY, 0);
+      if (entry->fd != -1 && is_secured_file (entry->fd))
+        {
+          close (entry->fd);
+          entry->fd = -1;
+        }
+      if (entry->fd == -1 || work_queue_add (wq, batch_hash_job, entry))
+        {
+          /* Let the regular code handle the error.  */
+          gcry_md_close (entry->md);
+          entry->md = NULL;
+        }
+    }
+  if (wq)
+    work_queue_wait (wq);
+
+  for (i=0; i < nentries; i++)
+    {
+      entry = entries + i;
+      if (entry->fd != -1)
+        close (entry->fd);
+      entry->fd = -1;
+      rc = verify_batch_entry (ctrl, entry);
+      if (!first_rc)
+        first_rc = rc;
+      gcry_md_close (entry->md);
+      entry->md = NULL;
+      xfree (entry->sigfile);
+      entry->sigfile = NULL;
+      xfree (entry->datafile);
+      entry->datafile = NULL;
+    }
+
+  return first_rc;
+}
+
+
+/****************
+ * Verify the detached signatures listed in the manifest MANIFEST or
+ * read the manifest from stdin.  Each line of the manifest gives the
+ * name of a signature file and the name of the signed data file
+ * separated by white space.  Spaces and percent signs in the names
+ * need to be percent escaped.  Empty lines and lines starting with a
+ * hash mark are ignored.  If more than one worker thread has been
+ * requested the data files are hashed in parallel.
+ */
+int
+verify_batch (ctrl_t ctrl, const char *manifest)
+{
+  estream_t fp;
+  work_queue_t wq = NULL;
+  struct batch_entry_s *entries;
+  char *line = NULL;
+  size_t linesize = 0;
+  size_t maxlen;
+  ssize_t len;
+  unsigned int lno = 0;
+  char *p, *sigfile, *datafile;
+  int i, nentries, rc;
+  int first_rc = 0;
+
+  if (!manifest || !strcmp (manifest, "-"))
+    fp = es_stdin;
+  else
+    fp = es_fopen (manifest, "r");
+  if (!fp)
+    {
+      rc = gpg_error_from_syserror ();
+      log_error (_("can't open '%s': %s\n"), manifest, gpg_strerror (rc));
+      return rc;
+    }
+
+  entries = xcalloc (VERIFY_BATCH_SIZE, sizeof *entries);
+  for (i=0; i < VERIFY_BATCH_SIZE; i++)
+    entries[i].fd = -1;
+
+  if (opt.worker_threads > 1)
+    work_queue_new (&wq, opt.worker_threads);
+
+  nentries = 0;
+  maxlen = 4096;
+  while ((len = es_read_line (fp, &line, &linesize, &maxlen)) > 0)
+    {
+      lno++;
+      if (!maxlen)
+        {
+          log_error (_("input line %u too long or missing LF\n"), lno);
+          rc = gpg_error (GPG_ERR_TOO_LARGE);
+          goto leave;
+        }
+      maxlen = 4096;
+      trim_spaces (line);
+      if (!*line || *line == '#')
+        continue;
+
+      sigfile = line;
+      for (p = line; *p && !spacep (p); p++)
+        ;
+      if (*p)
+        *p++ = 0;
+      datafile = p;
+      while (spacep (datafile))
+        datafile++;
+      for (p = datafile; *p && !spacep (p); p++)
+        ;
+      if (!*datafile || *p)
+        {
+          log_error ("manifest line %u: %s\n", lno,
+                     gpg_strerror (gpg_error (GPG_ERR_SYNTAX)));
+          if (!first_rc)
+            first_rc = gpg_error (GPG_ERR_SYNTAX);
+          continue;
+        }
+      percent_unescape_inplace (sigfile, 0);
+      percent_unescape_inplace (datafile, 0);
+
+      entries[nentries].sigfile = xstrdup (sigfile);
+      entries[nentries].datafile = xstrdup (datafile);
+      entries[nentries].err = 0;
+      if (++nentries == VERIFY_BATCH_SIZE)
+        {
+          rc = verify_batch_entries (ctrl, wq, entries, nentries);
+          if (!first_rc)
+            first_rc = rc;
+          nentries = 0;
+        }
+    }
+  if (len < 0)
+    {
+      rc = gpg_error_from_syserror ();
+      log_error (_("error reading '%s': %s\n"),
+                 manifest? manifest : "[stdin]", gpg_strerror (rc));
+      goto leave;
+    }
+  rc = first_rc;
+
+ leave:
+  if (nentries)
+    {
+      i = verify_batch_entries (ctrl, wq, entries, nentries);
+      if (!rc)
+        rc = i;
+    }
+  work_queue_release (wq);
+  xfree (entries);
+  xfree (line);
+  if (fp != es_stdin)
+    es_fclose (fp);
+  return rc;
+}
+
+
 
 /* Perform a verify operation.  To verify detached signatures, DATA_FD
    shall be the descriptor of the signed data; for regular signatures
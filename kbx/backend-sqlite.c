@@ -67,6 +67,13 @@ struct be_sqlite_local_s
   /* The statement object of the current select command.  */
   sqlite3_stmt *select_stmt;
 
+  /* The connection used for SELECT_STMT; this is either DATABASE_HD
+   * or READER_HD.  */
+  sqlite3 *db;
+
+  /* A read-only connection owned by this object or NULL.  */
+  sqlite3 *reader_hd;
+
   /* The column numbers for UIDNO and SUBKEY or 0.  */
   int select_col_uidno;
   int select_col_subkey;
@@ -104,6 +111,49 @@ static npth_mutex_t database_mutex = NPTH_MUTEX_INITIALIZER;
 static sqlite3 *database_hd;
 /* A lockfile used make sure only we are accessing the database.  */
 static dotlock_t database_lock;
+/* The name of the database file.  */
+static char *database_fname;
+
+/* Searches outside of a transaction use read-only connections of
+ * their own which are stepped without holding the nPth lock.  With
+ * the database in WAL mode they run in parallel to each other and to
+ * updates done via DATABASE_HD.  READERS_OKAY is set if this can be
+ * done.  Idle connections are kept for reuse; the list is only
+ * accessed while holding the nPth lock.  */
+#define MAX_IDLE_READERS 16
+static int readers_okay;
+static sqlite3 *idle_readers[MAX_IDLE_READERS];
+static unsigned int n_idle_readers;
+
+/* Statements used to store keys are kept prepared for reuse; they
+ * are identified by the address of their SQL string.  */
+static struct
+{
+  const char *sqlstr;
+  sqlite3_stmt *stmt;
+} stmt_cache[12];
+
+/* The number of keys stored in one transaction during a bulk store.  */
+#define BULK_BATCH_SIZE 1000
+
+/* The state of a bulk store.  */
+static struct
+{
+  unsigned int active:1;         /* A bulk store is in progress.  */
+  unsigned int defer_indices:1;  /* The indices have been dropped.  */
+  unsigned int pending;          /* Keys stored in this transaction.  */
+} bulk;
+
+/* The indices which are not required for storing keys and thus may
+ * be dropped during a bulk store.  They are re-created by the
+ * statements in TABLE_DEFINITIONS.  */
+static const char *deferred_indices[] =
+  {
+   "DROP INDEX IF EXISTS fingerprintidx2",
+   "DROP INDEX IF EXISTS userididx1",
+   "DROP INDEX IF EXISTS userididx3",
+   "DROP INDEX IF EXISTS issueridx1"
+  };
 
 /* The version of our current database schema.  */
 #define DATABASE_VERSION 1
@@ -201,8 +251,38 @@ static struct
   };
 
 
+/* A trigram index on the user ids and mail addresses used for
+ * substring searches.  This requires the FTS5 module of SQLite with
+ * the trigram tokenizer (3.34).  The index refers to the rows of the
+ * userid table by their rowid and is kept up to date by triggers.  */
+static const char uid_fts_table[] =
+  "CREATE VIRTUAL TABLE IF NOT EXISTS useridfts"
+  " USING fts5(uid, addrspec, content='userid', tokenize='trigram')";
+static const char *uid_fts_triggers[] =
+  {
+   "CREATE TRIGGER IF NOT EXISTS useridfts_ai AFTER INSERT ON userid BEGIN"
+   " INSERT INTO useridfts(rowid, uid, addrspec)"
+   "  VALUES (new.rowid, new.uid, new.addrspec);"
+   " END",
+   "CREATE TRIGGER IF NOT EXISTS useridfts_ad AFTER DELETE ON userid BEGIN"
+   " INSERT INTO useridfts(useridfts, rowid, uid, addrspec)"
+   "  VALUES ('delete', old.rowid, old.uid, old.addrspec);"
+   " END",
+   "CREATE TRIGGER IF NOT EXISTS useridfts_au AFTER UPDATE ON userid BEGIN"
+   " INSERT INTO useridfts(useridfts, rowid, uid, addrspec)"
+   "  VALUES ('delete', old.rowid, old.uid, old.addrspec);"
+   " INSERT INTO useridfts(rowid, uid, addrspec)"
+   "  VALUES (new.rowid, new.uid, new.addrspec);"
+   " END"
+  };
+
+/* Set if the useridfts table can be used.  */
+static int have_uid_fts;
+
+
 /*-- prototypes --*/
 static gpg_error_t get_config_value (const char *name, char **r_value);
+static gpg_error_t run_sql_statement (const char *sqlstr);
 static gpg_error_t set_config_value (const char *name, const char *value);
 
 
@@ -331,12 +411,13 @@ run_sql_reset (sqlite3_stmt *stmt)
 }
 
 
-/* Run an SQL prepare for SQLSTR and return a statement at R_STMT.  If
- * EXTRA or EXTRA2 are not NULL these parts are appended to the SQL
- * statement.  */
+/* Run an SQL prepare for SQLSTR on the connection DB and return a
+ * statement at R_STMT.  If EXTRA or EXTRA2 are not NULL these parts
+ * are appended to the SQL statement.  */
 static gpg_error_t
-run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
-                 sqlite3_stmt **r_stmt)
+run_sql_prepare_db (sqlite3 *db, const char *sqlstr,
+                    const char *extra, const char *extra2,
+                    sqlite3_stmt **r_stmt)
 {
   gpg_error_t err;
   int res;
@@ -350,7 +431,7 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
       sqlstr = buffer;
     }
 
-  res = sqlite3_prepare_v2 (database_hd, sqlstr, -1, r_stmt, NULL);
+  res = sqlite3_prepare_v2 (db, sqlstr, -1, r_stmt, NULL);
   if (res)
     err = diag_prepare_err (res, sqlstr);
   else
@@ -360,6 +441,29 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
 }
 
 
+/* Run an SQL prepare for SQLSTR on the main connection and return a
+ * statement at R_STMT.  See run_sql_prepare_db for EXTRA and
+ * EXTRA2.  */
+static gpg_error_t
+run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
+                 sqlite3_stmt **r_stmt)
+{
+  return run_sql_prepare_db (database_hd, sqlstr, extra, extra2, r_stmt);
+}
+
+
+/* Run an SQL prepare for SQLSTR on the connection of CTX and store it
+ * as the select statement of CTX.  See run_sql_prepare_db for EXTRA
+ * and EXTRA2.  */
+static gpg_error_t
+ctx_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
+                 be_sqlite_local_t ctx)
+{
+  return run_sql_prepare_db (ctx->db, sqlstr, extra, extra2,
+                             &ctx->select_stmt);
+}
+
+
 /* Helper to bind a BLOB parameter to a statement.  */
 static gpg_error_t
 run_sql_bind_blob (sqlite3_stmt *stmt, int no,
@@ -481,7 +585,16 @@ run_sql_step_for_select (sqlite3_stmt *stmt)
   gpg_error_t err;
   int res;
 
-  res = sqlite3_step (stmt);
+  if (sqlite3_db_handle (stmt) != database_hd)
+    {
+      /* A statement on a read-only connection; let other threads
+       * run meanwhile.  */
+      npth_unprotect ();
+      res = sqlite3_step (stmt);
+      npth_protect ();
+    }
+  else
+    res = sqlite3_step (stmt);
   if (res == SQLITE_DONE || res == SQLITE_ROW)
     err = gpg_error (gpg_err_code_from_sqlite (res));
   else
@@ -537,6 +650,201 @@ run_sql_statement (const char *sqlstr)
 }
 
 
+/* Return a prepared statement for SQLSTR at R_STMT.  The statement is
+ * taken from the cache if possible; SQLSTR must thus be a constant
+ * string.  The statement must be released with release_cached_stmt.  */
+static gpg_error_t
+run_sql_prepare_cached (const char *sqlstr, sqlite3_stmt **r_stmt)
+{
+  gpg_error_t err;
+  int idx;
+
+  for (idx=0; idx < DIM (stmt_cache) && stmt_cache[idx].sqlstr; idx++)
+    if (stmt_cache[idx].sqlstr == sqlstr)
+      {
+        *r_stmt = stmt_cache[idx].stmt;
+        return 0;
+      }
+
+  err = run_sql_prepare (sqlstr, NULL, NULL, r_stmt);
+  if (!err && idx < DIM (stmt_cache))
+    {
+      stmt_cache[idx].sqlstr = sqlstr;
+      stmt_cache[idx].stmt = *r_stmt;
+    }
+  return err;
+}
+
+
+/* Finalize all statements in the statement cache.  */
+static void
+finalize_cached_stmts (void)
+{
+  int idx;
+
+  for (idx=0; idx < DIM (stmt_cache) && stmt_cache[idx].sqlstr; idx++)
+    {
+      sqlite3_finalize (stmt_cache[idx].stmt);
+      stmt_cache[idx].stmt = NULL;
+      stmt_cache[idx].sqlstr = NULL;
+    }
+}
+
+
+/* Release STMT as returned by run_sql_prepare_cached.  */
+static void
+release_cached_stmt (sqlite3_stmt *stmt)
+{
+  int idx;
+
+  for (idx=0; idx < DIM (stmt_cache) && stmt_cache[idx].sqlstr; idx++)
+    if (stmt_cache[idx].stmt == stmt)
+      {
+        sqlite3_reset (stmt);
+        sqlite3_clear_bindings (stmt);
+        return;
+      }
+  sqlite3_finalize (stmt);
+}
+
+
+/* Same as run_sql_statement_bind_ubid but SQLSTR must be a constant
+ * string and its statement is kept prepared for reuse.  */
+static gpg_error_t
+run_cached_statement_bind_ubid (const char *sqlstr,
+                                const unsigned char *ubid)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+
+  err = run_sql_prepare_cached (sqlstr, &stmt);
+  if (err)
+    return err;
+  err = run_sql_bind_blob (stmt, 1, ubid, UBID_LEN);
+  if (!err)
+    err = run_sql_step (stmt);
+  release_cached_stmt (stmt);
+  return err;
+}
+
+
+/* Helper for create_or_open_database to check the result of
+ * "PRAGMA journal_mode".  */
+static int
+journal_mode_cb (void *opaque, int ncols, char **values, char **names)
+{
+  (void)names;
+
+  if (ncols && values[0] && !ascii_strcasecmp (values[0], "wal"))
+    *(int *)opaque = 1;
+  return 0;
+}
+
+
+/* Return a read-only connection to the database at R_DB.  */
+static gpg_error_t
+open_reader (sqlite3 **r_db)
+{
+  int res;
+
+  if (n_idle_readers)
+    {
+      *r_db = idle_readers[--n_idle_readers];
+      return 0;
+    }
+
+  res = sqlite3_open_v2 (database_fname, r_db,
+                         (SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX), NULL);
+  if (res)
+    {
+      log_error ("error opening '%s': %s\n",
+                 database_fname, sqlite3_errstr (res));
+      sqlite3_close (*r_db);
+      *r_db = NULL;
+      return gpg_error (gpg_err_code_from_sqlite (res));
+    }
+  sqlite3_extended_result_codes (*r_db, 1);
+  /* Only a checkpoint or a recovery may block a reader.  */
+  sqlite3_busy_timeout (*r_db, 5000);
+  return 0;
+}
+
+
+/* Release the read-only connection DB or keep it for reuse.  */
+static void
+close_reader (sqlite3 *db)
+{
+  if (!db)
+    return;
+  if (n_idle_readers < MAX_IDLE_READERS)
+    idle_readers[n_idle_readers++] = db;
+  else
+    sqlite3_close (db);
+}
+
+
+/* Stop maintaining the trigram index on the user ids and mark it as
+ * outdated.  */
+static void
+drop_uid_fts (void)
+{
+  have_uid_fts = 0;
+  sqlite3_exec (database_hd,
+                "DROP TRIGGER IF EXISTS useridfts_ai;"
+                "DROP TRIGGER IF EXISTS useridfts_ad;"
+                "DROP TRIGGER IF EXISTS useridfts_au",
+                NULL, NULL, NULL);
+  set_config_value ("uidfts", "0");
+}
+
+
+/* Create the trigram index on the user ids if supported by SQLite.
+ * The config value "uidfts" tells whether the index is up to date;
+ * if it is not, the index is rebuilt from the userid table.  */
+static void
+setup_uid_fts (void)
+{
+  gpg_error_t err;
+  int res, idx;
+  char *value;
+
+  res = sqlite3_exec (database_hd, uid_fts_table, NULL, NULL, NULL);
+  if (res)
+    {
+      if (opt.verbose)
+        log_info ("no trigram index on user ids: %s\n",
+                  sqlite3_errmsg (database_hd));
+      /* Make sure that updates of the userid table do not fail due
+       * to triggers created by an SQLite with FTS5 support and tell
+       * such a version to rebuild the index.  */
+      drop_uid_fts ();
+      return;
+    }
+
+  for (err = 0, idx=0; !err && idx < DIM (uid_fts_triggers); idx++)
+    err = run_sql_statement (uid_fts_triggers[idx]);
+  if (err)
+    return;
+
+  err = get_config_value ("uidfts", &value);
+  if (err || strcmp (value, "1"))
+    {
+      if (!opt.quiet)
+        log_info ("building the trigram index on user ids\n");
+      err = run_sql_statement ("INSERT INTO useridfts(useridfts)"
+                               " VALUES ('rebuild')");
+      if (!err)
+        err = set_config_value ("uidfts", "1");
+    }
+  xfree (value);
+  if (err)
+    log_error ("error building the trigram index on user ids: %s\n",
+               gpg_strerror (err));
+  else
+    have_uid_fts = 1;
+}
+
+
 /* Create and initialize a new SQL database file if it does not
  * exists; else open it and check that all required objects are
  * available.  */
@@ -600,6 +908,28 @@ create_or_open_database (const char *filename)
   /* Enable extended error codes.  */
   sqlite3_extended_result_codes (database_hd, 1);
 
+  /* Switch to write-ahead logging so that searches can be run in
+   * parallel on read-only connections.  This setting is stored in
+   * the database.  */
+  if (sqlite3_threadsafe ())
+    {
+      database_fname = xtrystrdup (filename);
+      if (!database_fname)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      res = sqlite3_exec (database_hd, "PRAGMA journal_mode=WAL",
+                          journal_mode_cb, &readers_okay, NULL);
+      if (res || !readers_okay)
+        {
+          readers_okay = 0;
+          if (opt.verbose)
+            log_info ("not using WAL mode: %s\n",
+                      sqlite3_errmsg (database_hd));
+        }
+    }
+
   /* Create the tables if needed.  */
   for (idx=0; idx < DIM(table_definitions); idx++)
     {
@@ -644,6 +974,8 @@ create_or_open_database (const char *filename)
         }
     }
 
+  setup_uid_fts ();
+
   if (!opt.quiet)
     log_info (_("database '%s' created\n"), filename);
 
@@ -715,6 +1047,10 @@ be_sqlite_release_resource (ctrl_t ctrl, backend_handle_t hd)
     return;
   hd->db_type = DB_TYPE_NONE;
 
+  /* The cached statements must be finalized before the database
+   * could be closed.  */
+  finalize_cached_stmts ();
+
   xfree (hd);
 }
 
@@ -738,6 +1074,7 @@ be_sqlite_release_local (be_sqlite_local_t ctx)
 {
   if (ctx->select_stmt)
     sqlite3_finalize (ctx->select_stmt);
+  close_reader (ctx->reader_hd);
   xfree (ctx);
 }
 
@@ -778,6 +1115,126 @@ be_sqlite_commit (void)
 }
 
 
+/* Commit the current batch of a bulk store.  The next store starts a
+ * new transaction.  */
+static gpg_error_t
+commit_bulk_batch (void)
+{
+  gpg_error_t err;
+
+  err = run_sql_statement ("commit");
+  if (!err)
+    {
+      opt.active_transaction = 0;
+      bulk.pending = 0;
+    }
+  return err;
+}
+
+
+/* Re-create the indices dropped for a bulk store.  */
+static gpg_error_t
+recreate_deferred_indices (void)
+{
+  gpg_error_t err = 0;
+  gpg_error_t err2;
+  int idx;
+
+  if (!opt.quiet)
+    log_info ("re-creating the database indices\n");
+  for (idx=0; idx < DIM (table_definitions); idx++)
+    if (!strncmp (table_definitions[idx].sql, "CREATE INDEX", 12))
+      {
+        err2 = run_sql_statement (table_definitions[idx].sql);
+        if (!err)
+          err = err2;
+      }
+  setup_uid_fts ();
+  return err;
+}
+
+
+/* Start a bulk store.  The caller has already set OPT.IN_TRANSACTION
+ * so that all keys stored until be_sqlite_bulk_end are stored in a
+ * global transaction; however, that transaction is committed after
+ * each batch of BULK_BATCH_SIZE keys.  If DEFER_INDICES is set the
+ * indices which are not required for storing keys are dropped and
+ * re-created by be_sqlite_bulk_end.  */
+gpg_error_t
+be_sqlite_bulk_begin (int defer_indices)
+{
+  gpg_error_t err = 0;
+  int idx;
+
+  if (!database_hd)
+    return gpg_error (GPG_ERR_NOT_INITIALIZED);
+
+  acquire_mutex ();
+  if (bulk.active)
+    {
+      err = gpg_error (GPG_ERR_CONFLICT);
+      goto leave;
+    }
+  bulk.pending = 0;
+  bulk.defer_indices = 0;
+
+  if (defer_indices)
+    {
+      drop_uid_fts ();
+      for (idx=0; !err && idx < DIM (deferred_indices); idx++)
+        err = run_sql_statement (deferred_indices[idx]);
+      if (err)
+        {
+          /* Do not leave the database without its indices.  */
+          recreate_deferred_indices ();
+          goto leave;
+        }
+      bulk.defer_indices = 1;
+    }
+  bulk.active = 1;
+
+ leave:
+  release_mutex ();
+  return err;
+}
+
+
+/* Finish a bulk store by committing the last batch.  This also ends
+ * the global transaction and re-creates the indices dropped by
+ * be_sqlite_bulk_begin.  */
+gpg_error_t
+be_sqlite_bulk_end (void)
+{
+  gpg_error_t err = 0;
+
+  if (!database_hd)
+    return gpg_error (GPG_ERR_NOT_INITIALIZED);
+
+  acquire_mutex ();
+  if (opt.active_transaction)
+    {
+      err = run_sql_statement ("commit");
+      if (err && run_sql_statement ("rollback"))
+        log_error ("Warning: database rollback failed - should not happen!\n");
+    }
+  opt.in_transaction = 0;
+  opt.active_transaction = 0;
+
+  if (bulk.defer_indices)
+    {
+      gpg_error_t err2 = recreate_deferred_indices ();
+      if (!err)
+        err = err2;
+    }
+  bulk.active = 0;
+  bulk.defer_indices = 0;
+  bulk.pending = 0;
+
+  release_mutex ();
+  return err;
+}
+
+
 /* Return a value from the config table.  NAME most not have quotes
  * etc.  If no error is returned the caller must xfree the value
  * stored at R_VALUE.  On error NULL is stored there.  */
@@ -915,34 +1372,42 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_EXACT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.uid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1, desc[descidx].u.name);
       break;
     case KEYDB_SEARCH_MODE_MAIL:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1, desc[descidx].u.name);
       break;
 
     case KEYDB_SEARCH_MODE_MAILSUB:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+      if (!ctx->select_stmt && have_uid_fts)
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                               " p.keyblob, u.uidno"
+                               " FROM pubkey as p, userid as u"
+                               " WHERE p.ubid = u.ubid AND u.rowid IN"
+                               " (SELECT rowid FROM useridfts"
+                               "  WHERE addrspec LIKE ?1)",
+                               extra, " ORDER BY p.ubid", ctx);
+      else if (!ctx->select_stmt)
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
@@ -950,12 +1415,20 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_SUBSTR:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+      if (!ctx->select_stmt && have_uid_fts)
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                               " p.keyblob, u.uidno"
+                               " FROM pubkey as p, userid as u"
+                               " WHERE p.ubid = u.ubid AND u.rowid IN"
+                               " (SELECT rowid FROM useridfts"
+                               "  WHERE uid LIKE ?1)",
+                               extra, " ORDER BY p.ubid", ctx);
+      else if (!ctx->select_stmt)
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
@@ -968,12 +1441,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_ISSUER:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob"
                                " FROM pubkey as p, issuer as i"
                                " WHERE p.ubid = i.ubid"
                                " AND i.dn = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -989,13 +1462,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       else
         {
           if (!ctx->select_stmt)
-            err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
+            err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
                                    " p.revoked, p.keyblob"
                                    " FROM pubkey as p, issuer as i"
                                    " WHERE p.ubid = i.ubid"
                                    " AND i.sn = $1 AND i.dn = $2",
                                    extra, " ORDER BY p.ubid",
-                                   &ctx->select_stmt);
+                                   ctx);
           if (!err)
             err = run_sql_bind_ntext (ctx->select_stmt, 1,
                                       desc[descidx].sn, desc[descidx].snlen);
@@ -1015,12 +1488,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SUBJECT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid"
                                " AND u.uid = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -1029,12 +1502,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SHORT_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
                                " p.revoked, p.keyblob, f.subkey"
                                " FROM pubkey as p, fingerprint as f"
                                " WHERE p.ubid = f.ubid AND"
                                " substr(f.kid,5) = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf)+4,
@@ -1044,11 +1517,11 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_LONG_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
                                " p.revoked, p.keyblob, f.subkey"
                                " FROM pubkey as p, fingerprint as f"
                                " WHERE p.ubid = f.ubid AND f.kid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf),
@@ -1058,11 +1531,11 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_FPR:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
                                " p.revoked, p.keyblob, f.subkey"
                                " FROM pubkey as p, fingerprint as f"
                                " WHERE p.ubid = f.ubid AND f.fpr = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.fpr, desc[descidx].fprlen);
@@ -1071,11 +1544,11 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_KEYGRIP:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = ctx_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, f.subkey"
                                " FROM pubkey as p, fingerprint as f"
                                " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+                               extra, " ORDER BY p.ubid", ctx);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.grip, KEYGRIP_LEN);
@@ -1083,10 +1556,10 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_UBID:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked, keyblob"
+        err = ctx_sql_prepare ("SELECT ubid, type, ephemeral, revoked, keyblob"
                                " FROM pubkey as p"
                                " WHERE ubid = ?1",
-                               extra, NULL, &ctx->select_stmt);
+                               extra, NULL, ctx);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.ubid, UBID_LEN);
@@ -1104,10 +1577,10 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
           else
             extra = " ORDER by ubid";
 
-          err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked,"
+          err = ctx_sql_prepare ("SELECT ubid, type, ephemeral, revoked,"
                                  " keyblob"
                                  " FROM pubkey as p",
-                                 extra, NULL, &ctx->select_stmt);
+                                 extra, NULL, ctx);
         }
       break;
 
@@ -1136,12 +1609,12 @@ be_sqlite_search (ctrl_t ctrl,
   gpg_error_t err;
   db_request_part_t part;
   be_sqlite_local_t ctx;
+  sqlite3 *db;
+  int locked = 0;
 
   log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
   log_assert (request);
 
-  acquire_mutex ();
-
   /* Find the specific request part or allocate it.  */
   err = be_find_request_part (backend_hd, request, &part);
   if (err)
@@ -1150,7 +1623,10 @@ be_sqlite_search (ctrl_t ctrl,
 
   if (!desc)
     {
-      /* Reset */
+      /* Reset.  Resetting the statement also ends the read
+       * transaction of a read-only connection.  */
+      if (ctx->select_stmt && ctx->db != database_hd)
+        sqlite3_reset (ctx->select_stmt);
       ctx->select_done = 0;
       ctx->select_eof = 0;
       ctx->descidx = 0;
@@ -1166,6 +1642,33 @@ be_sqlite_search (ctrl_t ctrl,
       goto leave;
     }
 
+  /* A new select needs to see the changes of a transaction and thus
+   * uses the main connection in this case; otherwise it uses the
+   * read-only connection of this request.  A select already started
+   * is continued on its connection.  */
+  if (!ctx->select_done)
+    {
+      if (opt.in_transaction || opt.active_transaction || !readers_okay)
+        db = database_hd;
+      else if (!ctx->reader_hd && open_reader (&ctx->reader_hd))
+        db = database_hd;
+      else
+        db = ctx->reader_hd;
+      if (db != ctx->db && ctx->select_stmt)
+        {
+          sqlite3_finalize (ctx->select_stmt);
+          ctx->select_stmt = NULL;
+        }
+      ctx->db = db;
+    }
+
+  if (ctx->db == database_hd
+      || (!opt.active_transaction && opt.in_transaction))
+    {
+      acquire_mutex ();
+      locked = 1;
+    }
+
   /* Start a global transaction if needed.  */
   if (!opt.active_transaction && opt.in_transaction)
     {
@@ -1203,7 +1706,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 0);
       if (!ubid || n < 0)
         {
-          if (!ubid && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!ubid && sqlite3_errcode (ctx->db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1236,7 +1739,7 @@ be_sqlite_search (ctrl_t ctrl,
       ctx->lastubid_valid = 1;
 
       n = sqlite3_column_int (ctx->select_stmt, 1);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1247,7 +1750,7 @@ be_sqlite_search (ctrl_t ctrl,
       pubkey_type = n;
 
       n = sqlite3_column_int (ctx->select_stmt, 2);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1258,7 +1761,7 @@ be_sqlite_search (ctrl_t ctrl,
       is_ephemeral = !!n;
 
       n = sqlite3_column_int (ctx->select_stmt, 3);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1272,7 +1775,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 4);
       if (!keyblob || n < 0)
         {
-          if (!keyblob && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!keyblob && sqlite3_errcode (ctx->db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1286,7 +1789,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_uidno)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_uidno);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (ctx->db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1305,7 +1808,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_subkey)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_subkey);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (ctx->db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1342,7 +1845,8 @@ be_sqlite_search (ctrl_t ctrl,
     }
 
  leave:
-  release_mutex ();
+  if (locked)
+    release_mutex ();
   return err;
 }
 
@@ -1366,7 +1870,7 @@ store_into_pubkey (enum kbxd_store_modes mode,
   else /* Auto */
     sqlstr = ("INSERT OR REPLACE INTO pubkey(ubid,type,keyblob)"
               " VALUES(?1,?2,?3)");
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+  err = run_sql_prepare_cached (sqlstr, &stmt);
   if (err)
     goto leave;
   err = run_sql_bind_blob (stmt, 1, ubid, UBID_LEN);
@@ -1383,7 +1887,7 @@ store_into_pubkey (enum kbxd_store_modes mode,
 
  leave:
   if (stmt)
-    sqlite3_finalize (stmt);
+    release_cached_stmt (stmt);
   return err;
 }
 
@@ -1402,7 +1906,7 @@ store_into_fingerprint (const unsigned char *ubid, int subkey,
 
   sqlstr = ("INSERT OR REPLACE INTO fingerprint(fpr,kid,keygrip,subkey,ubid)"
             " VALUES(?1,?2,?3,?4,?5)");
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+  err = run_sql_prepare_cached (sqlstr, &stmt);
   if (err)
     goto leave;
   err = run_sql_bind_blob (stmt, 1, fpr, fprlen);
@@ -1425,7 +1929,7 @@ store_into_fingerprint (const unsigned char *ubid, int subkey,
 
  leave:
   if (stmt)
-    sqlite3_finalize (stmt);
+    release_cached_stmt (stmt);
   return err;
 }
 
@@ -1444,7 +1948,7 @@ store_into_userid (const unsigned char *ubid, enum pubkey_types pktype,
 
   sqlstr = ("INSERT OR REPLACE INTO userid(uid,addrspec,type,ubid,uidno)"
             " VALUES(?1,?2,?3,?4,?5)");
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+  err = run_sql_prepare_cached (sqlstr, &stmt);
   if (err)
     goto leave;
 
@@ -1476,7 +1980,7 @@ store_into_userid (const unsigned char *ubid, enum pubkey_types pktype,
 
  leave:
   if (stmt)
-    sqlite3_finalize (stmt);
+    release_cached_stmt (stmt);
   xfree (addrspec);
   return err;
 }
@@ -1495,7 +1999,7 @@ store_into_issuer (const unsigned char *ubid,
 
   sqlstr = ("INSERT OR REPLACE INTO issuer(sn,dn,ubid)"
             " VALUES(?1,?2,?3)");
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+  err = run_sql_prepare_cached (sqlstr, &stmt);
   if (err)
     goto leave;
 
@@ -1513,7 +2017,7 @@ store_into_issuer (const unsigned char *ubid,
 
  leave:
   if (stmt)
-    sqlite3_finalize (stmt);
+    release_cached_stmt (stmt);
   xfree (addrspec);
   return err;
 }
@@ -1534,6 +2038,7 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
   /* be_sqlite_local_t ctx; */
   int got_mutex = 0;
   int in_transaction = 0;
+  int savepoint = 0;
   int info_valid = 0;
   struct _keybox_openpgp_info info;
   ksba_cert_t cert = NULL;
@@ -1597,23 +2102,33 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
     }
   in_transaction = 1;
 
+  /* Within a global transaction use a savepoint so that a failed
+   * store does not leave partial data behind.  */
+  if (opt.active_transaction)
+    {
+      err = run_sql_statement ("savepoint store");
+      if (err)
+        goto leave;
+      savepoint = 1;
+    }
+
   err = store_into_pubkey (mode, pktype, ubid, blob, bloblen);
   if (err)
     goto leave;
 
   /* Delete all related rows so that we can freshly add possibly added
    * or changed user ids and subkeys.  */
-  err = run_sql_statement_bind_ubid
+  err = run_cached_statement_bind_ubid
     ("DELETE FROM fingerprint WHERE ubid = ?1", ubid);
   if (err)
     goto leave;
-  err = run_sql_statement_bind_ubid
+  err = run_cached_statement_bind_ubid
     ("DELETE FROM userid WHERE ubid = ?1", ubid);
   if (err)
     goto leave;
   if (cert)
     {
-      err = run_sql_statement_bind_ubid
+      err = run_cached_statement_bind_ubid
         ("DELETE FROM issuer WHERE ubid = ?1", ubid);
       if (err)
         goto leave;
@@ -1737,10 +2252,23 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
     }
 
  leave:
+  if (savepoint && !err)
+    err = run_sql_statement ("release store");
+  else if (savepoint)
+    {
+      if (run_sql_statement ("rollback to store")
+          || run_sql_statement ("release store"))
+        log_error ("Warning: database rollback failed - should not happen!\n");
+    }
   if (in_transaction && !err)
     {
       if (opt.active_transaction)
-        ; /* We are in a global transaction.  */
+        {
+          /* We are in a global transaction.  For a bulk store it is
+           * committed after a batch of keys.  */
+          if (bulk.active && ++bulk.pending >= BULK_BATCH_SIZE)
+            err = commit_bulk_batch ();
+        }
       else
         err = run_sql_statement ("commit");
     }
@@ -28,6 +28,8 @@
 #include <assuan.h>
 #include "../common/i18n.h"
 #include "../common/userids.h"
+#include "../common/asshelp.h"
+#include "../common/host2net.h"
 #include "backend.h"
 #include "frontend.h"
 
@@ -161,6 +163,16 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
 }
 
 
+/* Release the database.  This is called at shutdown.  */
+void
+kbxd_release_database (void)
+{
+  be_generic_release_backend (NULL, the_database.backend_handle);
+  the_database.backend_handle = NULL;
+  the_database.db_type = DB_TYPE_NONE;
+}
+
+
 /* Release all per session objects.  */
 void
 kbxd_release_session_info (ctrl_t ctrl)
@@ -498,3 +510,99 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
     log_clock ("%s: leave", __func__);
   return err;
 }
+
+
+
+/* Start a bulk store; the keys are then stored using kbxd_store and
+ * the bulk store is finished with kbxd_bulk_end.  The caller must
+ * have set OPT.IN_TRANSACTION.  For the SQLite backend the keys are
+ * committed in batches and if DEFER_INDICES is set the indices are
+ * only updated at the end.  */
+gpg_error_t
+kbxd_bulk_begin (ctrl_t ctrl, int defer_indices)
+{
+  gpg_error_t err;
+
+  take_read_write_lock (ctrl);
+
+  if (!the_database.db_type)
+    {
+      log_error ("%s: error: no database configured\n", __func__);
+      err = gpg_error (GPG_ERR_NOT_INITIALIZED);
+    }
+  else if (the_database.db_type == DB_TYPE_SQLITE)
+    err = be_sqlite_bulk_begin (defer_indices);
+  else
+    err = 0;  /* Nothing to prepare.  */
+
+  release_lock (ctrl);
+  return err;
+}
+
+
+/* Store the keys in BUFFER of LENGTH during a bulk store.  Each key
+ * is prefixed by its length as a 4 byte big endian integer.  The
+ * number of the first key is taken from R_COUNT and the number of
+ * the next key is stored there.  A key which can't be stored is
+ * reported by an ERROR status line and counted at R_NFAILED.  If the
+ * length prefixes do not match LENGTH, GPG_ERR_INV_LENGTH is
+ * returned; the keys before the bad prefix have been stored.  */
+gpg_error_t
+kbxd_bulk_store_blobs (ctrl_t ctrl, const unsigned char *buffer,
+                       size_t length, enum kbxd_store_modes mode,
+                       unsigned int *r_count, unsigned int *r_nfailed)
+{
+  gpg_error_t err = 0;
+  gpg_error_t err2;
+  size_t off, n;
+
+  for (off = 0; off < length; off += n, ++*r_count)
+    {
+      if (length - off < 4
+          || (n = buf32_to_size_t (buffer + off)) > length - off - 4)
+        {
+          err = gpg_error (GPG_ERR_INV_LENGTH);
+          break;
+        }
+      off += 4;
+      if (!n)
+        err2 = gpg_error (GPG_ERR_MISSING_VALUE);
+      else
+        err2 = kbxd_store (ctrl, buffer + off, n, mode);
+      if (err2)
+        {
+          ++*r_nfailed;
+          if (opt.verbose)
+            log_info ("bulk store of key %u failed: %s\n",
+                      *r_count, gpg_strerror (err2));
+          err = status_printf (ctrl, "ERROR", "bulkstore %u %u",
+                               err2, *r_count);
+          if (err)
+            break;
+        }
+    }
+
+  return err;
+}
+
+
+/* Finish a bulk store started by kbxd_bulk_begin.  This also ends
+ * the transaction.  */
+gpg_error_t
+kbxd_bulk_end (ctrl_t ctrl)
+{
+  gpg_error_t err;
+
+  take_read_write_lock (ctrl);
+
+  if (the_database.db_type == DB_TYPE_SQLITE)
+    err = be_sqlite_bulk_end ();
+  else
+    {
+      opt.in_transaction = 0;
+      err = 0;
+    }
+
+  release_lock (ctrl);
+  return err;
+}
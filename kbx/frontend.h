@@ -27,6 +27,7 @@ gpg_error_t kbxd_set_database (ctrl_t ctrl,
                                const char *filename_arg, int readonly);
 
 void kbxd_release_session_info (ctrl_t ctrl);
+void kbxd_release_database (void);
 
 gpg_error_t kbxd_rollback (void);
 gpg_error_t kbxd_commit (void);
@@ -36,6 +37,12 @@ gpg_error_t kbxd_search (ctrl_t ctrl,
 gpg_error_t kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
                         enum kbxd_store_modes mode);
 gpg_error_t kbxd_delete (ctrl_t ctrl, const unsigned char *ubid);
+gpg_error_t kbxd_bulk_begin (ctrl_t ctrl, int defer_indices);
+gpg_error_t kbxd_bulk_store_blobs (ctrl_t ctrl, const unsigned char *buffer,
+                                   size_t length, enum kbxd_store_modes mode,
+                                   unsigned int *r_count,
+                                   unsigned int *r_nfailed);
+gpg_error_t kbxd_bulk_end (ctrl_t ctrl);
 
 
 #endif /*KBX_FRONTEND_H*/
@@ -45,6 +45,10 @@
 #define set_error(e,t) (ctx ? assuan_set_error (ctx, gpg_error (e), (t)) \
                         /**/: gpg_error (e))
 
+/* The maximum length of the data returned by one inquiry of the
+ * BULKSTORE command.  */
+#define MAX_BULKSTORE_INQUIRE (16 * 1024 * 1024)
+
 
 
 /* Control structure per connection. */
@@ -540,6 +544,108 @@ cmd_store (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_bulkstore[] =
+  "BULKSTORE [--update|--insert] [--defer-indices]\n"
+  "\n"
+  "Insert or update many keys.  The keys are requested using\n"
+  "  INQUIRE BLOBS\n"
+  "which is repeated until an empty response is received.  Each\n"
+  "response consists of one or more keys each prefixed by its length\n"
+  "as a 4 byte big endian integer.  The options --update and --insert\n"
+  "have the same meaning as with STORE.  A key which can't be stored\n"
+  "is reported by the status line\n"
+  "  ERROR bulkstore <errorcode> <index>\n"
+  "with INDEX being the number of the key starting at 0.  After each\n"
+  "response the number of keys processed so far is reported by\n"
+  "  PROGRESS bulkstore ? <count> 0\n"
+  "The keys are stored in large transactions; thus when this command\n"
+  "fails the keys stored so far may or may not be in the database.\n"
+  "With option --defer-indices the database indices are re-created\n"
+  "only at the end which is faster for large imports.  This command\n"
+  "may not be used while a transaction is active.";
+static gpg_error_t
+cmd_bulkstore (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  int opt_update, opt_insert, opt_defer;
+  enum kbxd_store_modes mode;
+  gpg_error_t err, err2;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  unsigned int count = 0;
+  unsigned int nfailed = 0;
+  char okay[50];
+
+  opt_update = has_option (line, "--update");
+  opt_insert = has_option (line, "--insert");
+  opt_defer = has_option (line, "--defer-indices");
+  line = skip_options (line);
+  if (*line)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "no args expected");
+      goto leave;
+    }
+  if (opt_update && !opt_insert)
+    mode = KBXD_STORE_UPDATE;
+  else if (!opt_update && opt_insert)
+    mode = KBXD_STORE_INSERT;
+  else
+    mode = KBXD_STORE_AUTO;
+
+  if (opt.in_transaction)
+    {
+      err = set_error (GPG_ERR_CONFLICT, "already in a transaction");
+      goto leave;
+    }
+  opt.in_transaction = 1;
+  opt.transaction_pid = assuan_get_pid (ctx);
+  err = kbxd_bulk_begin (ctrl, opt_defer);
+  if (err)
+    {
+      opt.in_transaction = 0;
+      goto leave;
+    }
+
+  for (;;)
+    {
+      xfree (value);
+      value = NULL;
+      err = assuan_inquire (ctx, "BLOBS", &value, &valuelen,
+                            MAX_BULKSTORE_INQUIRE);
+      if (err)
+        {
+          log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+          break;
+        }
+      if (!valuelen)
+        break;  /* End of keys.  */
+
+      err = kbxd_bulk_store_blobs (ctrl, value, valuelen, mode,
+                                   &count, &nfailed);
+      if (gpg_err_code (err) == GPG_ERR_INV_LENGTH)
+        err = set_error (GPG_ERR_INV_LENGTH, "invalid key length");
+      if (err)
+        break;
+      err = status_printf (ctrl, "PROGRESS", "bulkstore ? %u 0", count);
+      if (err)
+        break;
+    }
+
+  err2 = kbxd_bulk_end (ctrl);
+  if (!err)
+    err = err2;
+  if (!err)
+    {
+      snprintf (okay, sizeof okay, "%u keys, %u failed", count, nfailed);
+      err = assuan_set_okay_line (ctx, okay);
+    }
+
+ leave:
+  xfree (value);
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_delete[] =
   "DELETE <ubid> \n"
   "\n"
@@ -770,6 +876,7 @@ register_commands (assuan_context_t ctx)
     { "SEARCH",     cmd_search,     hlp_search },
     { "NEXT",       cmd_next,       hlp_next   },
     { "STORE",      cmd_store,      hlp_store  },
+    { "BULKSTORE",  cmd_bulkstore,  hlp_bulkstore },
     { "DELETE",     cmd_delete,     hlp_delete  },
     { "TRANSACTION",cmd_transaction,hlp_transaction },
     { "GETINFO",    cmd_getinfo,    hlp_getinfo },
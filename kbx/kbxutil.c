@@ -56,6 +56,7 @@ enum cmd_and_opt_values {
   aImportOpenPGP,
   aFindDups,
   aCut,
+  aBuildIndex,
 
   oDebug,
   oDebugAll,
@@ -78,6 +79,7 @@ static gpgrt_opt_t opts[] = {
   { aImportOpenPGP, "import-openpgp", 0, "import OpenPGP keyblocks"},
   { aFindDups,    "find-dups",   0, "find duplicates" },
   { aCut,         "cut",         0, "export records" },
+  { aBuildIndex,  "build-index", 0, "create or rebuild the index" },
 
   { 301, NULL, 0, N_("@\nOptions:\n ") },
 
@@ -515,6 +517,7 @@ main (int argc, char **argv)
         case aImportOpenPGP:
         case aFindDups:
         case aCut:
+        case aBuildIndex:
           cmd = pargs.r_opt;
           break;
 
@@ -577,6 +580,20 @@ main (int argc, char **argv)
             _keybox_dump_cut_records (*argv, from, to, stdout);
         }
     }
+  else if (cmd == aBuildIndex)
+    {
+      gpg_error_t err;
+
+      if (!argc)
+        log_error ("usage: kbxutil --build-index KEYBOXFILES\n");
+      for (; argc; argc--, argv++)
+        {
+          err = _keybox_index_build (*argv);
+          if (err)
+            log_error ("error building the index for '%s': %s\n",
+                       *argv, gpg_strerror (err));
+        }
+    }
   else if (cmd == aImportOpenPGP)
     {
       if (!argc)
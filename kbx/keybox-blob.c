@@ -227,6 +227,7 @@ struct keyboxblob {
   byte *blob;
   size_t bloblen;
   off_t fileoffset;
+  int is_view;    /* BLOB is owned by the caller; see _keybox_set_blob_view.  */
 
   /* stuff used only by keybox_create_blob */
   unsigned char *serialbuf;
@@ -1078,11 +1079,47 @@ _keybox_release_blob (KEYBOXBLOB blob)
     xfree (blob->uids[i].name);
   xfree (blob->uids );
   xfree (blob->sigs );
-  xfree (blob->blob );
+  if (!blob->is_view)
+    xfree (blob->blob );
   xfree (blob );
 }
 
 
+/* Point BLOB to the IMAGELEN bytes at IMAGE which are owned by the
+ * caller and stored at offset OFF of the keybox file.  This is used
+ * to inspect the blobs of a mapped keybox without copying them.  BLOB
+ * must have been created by _keybox_new_blob without an image.  */
+void
+_keybox_set_blob_view (KEYBOXBLOB blob,
+                       const unsigned char *image, size_t imagelen, off_t off)
+{
+  log_assert (!blob->blob || blob->is_view);
+  blob->blob = (unsigned char *)image;
+  blob->bloblen = imagelen;
+  blob->fileoffset = off;
+  blob->is_view = 1;
+}
+
+
+/* Store a new blob with a copy of the image of BLOB at R_BLOB.  */
+int
+_keybox_copy_blob (KEYBOXBLOB *r_blob, KEYBOXBLOB blob)
+{
+  unsigned char *image;
+  int rc;
+
+  *r_blob = NULL;
+  image = xtrymalloc (blob->bloblen? blob->bloblen : 1);
+  if (!image)
+    return gpg_error_from_syserror ();
+  memcpy (image, blob->blob, blob->bloblen);
+  rc = _keybox_new_blob (r_blob, image, blob->bloblen, blob->fileoffset);
+  if (rc)
+    xfree (image);
+  return rc;
+}
+
+
 
 const unsigned char *
 _keybox_get_blob_image ( KEYBOXBLOB blob, size_t *n )
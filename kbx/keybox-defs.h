@@ -87,6 +87,10 @@ struct keybox_handle {
   int for_openpgp;        /* Used by gpg.  */
   struct keybox_found_s found;
   struct keybox_found_s saved_found;
+  struct {
+    const unsigned char *image;  /* The mapped file or NULL.  */
+    size_t length;               /* The length of the mapping.  */
+  } map;
   struct {
     char *name;
     char *pattern;
@@ -131,6 +135,33 @@ struct _keybox_openpgp_info
 typedef struct _keybox_openpgp_info *keybox_openpgp_info_t;
 
 
+/* The identity of a keybox file as recorded in its index.  */
+struct _keybox_index_stamp
+{
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t ino;
+};
+
+/* The state of the index as recorded before a keybox update.  */
+struct _keybox_index_state
+{
+  int exists;   /* An index file exists.  */
+  int current;  /* The index matches the keybox.  */
+  struct _keybox_index_stamp stamp;  /* The keybox before the update.  */
+};
+typedef struct _keybox_index_state *keybox_index_state_t;
+
+/* The modes for _keybox_index_update.  */
+enum
+  {
+    KEYBOX_INDEX_TOUCH,
+    KEYBOX_INDEX_INSERT,
+    KEYBOX_INDEX_UPDATE,
+    KEYBOX_INDEX_REBUILD
+  };
+
+
 /* Don't know whether this is needed: */
 /*  static struct { */
 /*    int dry_run; */
@@ -141,6 +172,8 @@ typedef struct _keybox_openpgp_info *keybox_openpgp_info_t;
 
 /*-- keybox-init.c --*/
 void _keybox_close_file (KEYBOX_HANDLE hd);
+gpg_error_t _keybox_map_file (KEYBOX_HANDLE hd);
+void _keybox_unmap_file (KEYBOX_HANDLE hd);
 
 
 /*-- keybox-blob.c --*/
@@ -160,6 +193,9 @@ int  _keybox_new_blob (KEYBOXBLOB *r_blob,
                        unsigned char *image, size_t imagelen,
                        off_t off);
 void _keybox_release_blob (KEYBOXBLOB blob);
+void _keybox_set_blob_view (KEYBOXBLOB blob, const unsigned char *image,
+                            size_t imagelen, off_t off);
+int _keybox_copy_blob (KEYBOXBLOB *r_blob, KEYBOXBLOB blob);
 const unsigned char *_keybox_get_blob_image (KEYBOXBLOB blob, size_t *n);
 off_t _keybox_get_blob_fileoffset (KEYBOXBLOB blob);
 void _keybox_update_header_blob (KEYBOXBLOB blob, int for_openpgp);
@@ -173,6 +209,9 @@ void _keybox_destroy_openpgp_info (keybox_openpgp_info_t info);
 
 /*-- keybox-file.c --*/
 int _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted);
+int _keybox_read_mapped_blob (KEYBOXBLOB blob, const unsigned char *buffer,
+                              size_t length, size_t *r_off,
+                              int *skipped_deleted);
 int _keybox_write_blob (KEYBOXBLOB blob, estream_t fp, FILE *outfp);
 
 /*-- keybox-search.c --*/
@@ -195,6 +234,19 @@ blob_get_type (KEYBOXBLOB blob)
 }
 
 
+/*-- keybox-index.c --*/
+gpg_error_t _keybox_index_build (const char *fname);
+void _keybox_index_prepare (const char *fname, keybox_index_state_t state);
+void _keybox_index_update (const char *fname, keybox_index_state_t state,
+                           int mode, off_t off, size_t oldlen,
+                           KEYBOXBLOB blob);
+gpg_error_t _keybox_index_lookup (KEYBOX_HANDLE hd,
+                                  KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                                  off_t startoff,
+                                  off_t **r_offsets, size_t *r_noffsets,
+                                  off_t *r_resume);
+
+
 /*-- keybox-dump.c --*/
 int _keybox_dump_blob (KEYBOXBLOB blob, FILE *fp);
 int _keybox_dump_file (const char *filename, int stats_only, FILE *outfp);
@@ -25,6 +25,7 @@
 #include <time.h>
 
 #include "keybox-defs.h"
+#include "../common/host2net.h"
 
 
 #define IMAGELEN_LIMIT (5*1024*1024)
@@ -116,7 +117,12 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted)
   image[0] = c1; image[1] = c2; image[2] = c3; image[3] = c4; image[4] = type;
   if (es_fread (image+5, imagelen-5, 1, fp) != 1)
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
+      gpg_error_t tmperr;
+
+      if (es_ferror (fp))
+        tmperr = gpg_error_from_syserror ();
+      else
+        tmperr = gpg_error (GPG_ERR_TOO_SHORT);  /* Truncated blob.  */
       xfree (image);
       return tmperr;
     }
@@ -128,6 +134,53 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted)
 }
 
 
+/* Same as _keybox_read_blob but take the blob from the image of the
+   keybox file BUFFER of LENGTH bytes at offset *R_OFF.  BLOB is set
+   to view the image of the blob (see _keybox_set_blob_view) and
+   *R_OFF is advanced to the next blob.  A corrupt blob at the end of
+   the image yields the same result as with _keybox_read_blob.  */
+int
+_keybox_read_mapped_blob (KEYBOXBLOB blob, const unsigned char *buffer,
+                          size_t length, size_t *r_off, int *skipped_deleted)
+{
+  size_t off, imagelen;
+  int type;
+
+  if (skipped_deleted)
+    *skipped_deleted = 0;
+ again:
+  off = *r_off;
+  if (off >= length)
+    return -1; /* eof */
+  if (length - off < 5)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  imagelen = buf32_to_size_t (buffer + off);
+  type = buffer[off+4];
+  if (imagelen < 5)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  /* Like the seek in _keybox_read_blob, skipping a blob which extends
+   * beyond the end leads to EOF.  */
+  *r_off = imagelen > length - off? length : off + imagelen;
+  if (!type)
+    {
+      /* Special treatment for empty blobs. */
+      if (skipped_deleted)
+        *skipped_deleted = 1;
+      goto again;
+    }
+
+  if (imagelen > IMAGELEN_LIMIT) /* Sanity check. */
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  if (imagelen > length - off)
+    return gpg_error (GPG_ERR_TOO_SHORT);  /* Truncated blob.  */
+
+  _keybox_set_blob_view (blob, buffer + off, imagelen, off);
+  return 0;
+}
+
+
 /* Write the block to the current file position */
 int
 _keybox_write_blob (KEYBOXBLOB blob, estream_t fp, FILE *outfp)
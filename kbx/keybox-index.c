@@ -0,0 +1,1166 @@
+/* keybox-index.c - Sidecar index for keybox files
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The index of a keybox is stored in a file next to the keybox with
+ * the suffix ".idx" appended.  It maps 8 byte values derived from the
+ * fingerprints, keygrips and UBIDs of the blobs to the offsets of
+ * these blobs in the keybox.  The index is optional: it is only
+ * maintained by the update functions if it already exists; use
+ * "kbxutil --build-index" to create it.  For searches by user id the
+ * index also holds a signature of the user ids of each blob: this is
+ * a 256 bit Bloom filter over the trigrams of the ASCII lowercased
+ * user id strings; a blob can only match a substring search if all
+ * bits of the trigrams of the search string are set.  The layout is
+ * (all integers in network byte order):
+ *
+ *   - b4   Magic "KBXi"
+ *   - byte Version of the index (1)
+ *   - byte Flags
+ *          bit 0 = The keygrips of all blobs are indexed.
+ *          bit 1 = The user id signatures are valid.
+ *   - u16  RFU
+ *   - u64  Size of the keybox file
+ *   - u64  Modification time of the keybox file
+ *   - u64  Inode number of the keybox file
+ *   - u32  [NENTRIES] Number of entries
+ *   - u32  [NSIGS] Number of user id signatures
+ *   - NENTRIES times, sorted in ascending order:
+ *     - b8   The key value
+ *     - byte The type of the key value (INDEX_TYPE_*)
+ *     - b7   The offset of the blob in the keybox file
+ *   - NSIGS times, sorted by offset:
+ *     - u64  The offset of the blob in the keybox file
+ *     - b32  The Bloom filter over the user ids of the blob
+ *
+ * An index is only used if the size, modification time and inode
+ * number in its header match the keybox file; a keybox modified by a
+ * version without index support thus merely disables the index until
+ * it is rebuilt.  Because different fingerprints may share the same
+ * key value, the blobs found via the index are always matched against
+ * the search description the same way as during a full scan.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "keybox-defs.h"
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+
+
+#define INDEX_MAGIC    "KBXi"
+#define INDEX_VERSION  1
+#define INDEX_HDRLEN   40
+#define INDEX_ENTRYLEN 16
+#define INDEX_KEYLEN   9    /* Length of the key value and its type.  */
+#define INDEX_BLOOMLEN 32
+#define INDEX_SIGLEN   (8 + INDEX_BLOOMLEN)
+
+/* The maximum number of user id signature matches returned by one
+ * lookup.  */
+#define MAX_SIG_CANDIDATES 256
+
+/* The header flags.  */
+#define INDEX_FLAG_GRIPS 1
+#define INDEX_FLAG_UIDS  2
+
+/* The types of the key values.  */
+#define INDEX_TYPE_KID   1  /* Keyid part of a stored fingerprint.  */
+#define INDEX_TYPE_GRIP  2  /* Leftmost 8 bytes of a keygrip.  */
+#define INDEX_TYPE_UBID  3  /* Leftmost 8 bytes of the UBID.  */
+
+#define get16(a) buf16_to_ulong ((a))
+
+
+/* A list of index entries.  */
+struct entry_list_s
+{
+  unsigned char *d;      /* NENTRIES * INDEX_ENTRYLEN bytes.  */
+  size_t nentries;
+  size_t allocated;      /* Allocated number of entries.  */
+  unsigned int flags;    /* The header flags (INDEX_FLAG_*).  */
+  unsigned char *s;      /* NSIGS * INDEX_SIGLEN bytes.  */
+  size_t nsigs;
+  size_t sallocated;     /* Allocated number of signatures.  */
+};
+typedef struct entry_list_s *entry_list_t;
+
+
+/* A list of blob offsets.  */
+struct offset_list_s
+{
+  off_t *d;
+  size_t n;
+  size_t allocated;
+};
+
+
+
+static inline uint64_t
+get64 (const unsigned char *p)
+{
+  return (((uint64_t)buf32_to_u32 (p)) << 32) | buf32_to_u32 (p+4);
+}
+
+static inline void
+put64 (unsigned char *p, uint64_t val)
+{
+  int i;
+
+  for (i=7; i >= 0; i--, val >>= 8)
+    p[i] = val;
+}
+
+
+/* Return the offset stored in the index entry at P.  */
+static inline off_t
+entry_get_off (const unsigned char *p)
+{
+  uint64_t val = 0;
+  int i;
+
+  for (i=INDEX_KEYLEN; i < INDEX_ENTRYLEN; i++)
+    val = (val << 8) | p[i];
+  return (off_t)val;
+}
+
+static inline void
+entry_put_off (unsigned char *p, off_t off)
+{
+  uint64_t val = off;
+  int i;
+
+  for (i=INDEX_ENTRYLEN-1; i >= INDEX_KEYLEN; i--, val >>= 8)
+    p[i] = val;
+}
+
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  return memcmp (a, b, INDEX_ENTRYLEN);
+}
+
+static int
+compare_offsets (const void *a, const void *b)
+{
+  off_t x = *(const off_t*)a;
+  off_t y = *(const off_t*)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Return a malloced string with the name of the index for the keybox
+ * FNAME.  If TMP is set the name of the temporary file used to create
+ * the index is returned.  */
+static char *
+index_fname (const char *fname, int tmp)
+{
+  return strconcat (fname, tmp? ".idx.tmp" : ".idx", NULL);
+}
+
+
+static void
+stamp_from_stat (struct _keybox_index_stamp *stamp, struct stat *st)
+{
+  stamp->size  = st->st_size;
+  stamp->mtime = st->st_mtime;
+  stamp->ino   = st->st_ino;
+}
+
+
+/* Parse the header at BUFFER and check that it matches STAMP.
+ * Returns the number of entries and the flags at R_NENTRIES and
+ * R_FLAGS.  */
+static gpg_error_t
+parse_header (const unsigned char *buffer,
+              const struct _keybox_index_stamp *stamp,
+              size_t *r_nentries, size_t *r_nsigs, unsigned int *r_flags)
+{
+  if (memcmp (buffer, INDEX_MAGIC, 4))
+    return gpg_error (GPG_ERR_INV_OBJ);
+  if (buffer[4] != INDEX_VERSION)
+    return gpg_error (GPG_ERR_UNKNOWN_VERSION);
+  if (get64 (buffer+8) != stamp->size
+      || get64 (buffer+16) != stamp->mtime
+      || get64 (buffer+24) != stamp->ino)
+    return gpg_error (GPG_ERR_INV_STATE);  /* Index is stale.  */
+
+  *r_flags = buffer[5];
+  *r_nentries = buf32_to_size_t (buffer+32);
+  *r_nsigs = (*r_flags & INDEX_FLAG_UIDS)? buf32_to_size_t (buffer+36) : 0;
+  return 0;
+}
+
+
+static void
+build_header (unsigned char *buffer, const struct _keybox_index_stamp *stamp,
+              size_t nentries, size_t nsigs, unsigned int flags)
+{
+  memset (buffer, 0, INDEX_HDRLEN);
+  memcpy (buffer, INDEX_MAGIC, 4);
+  buffer[4] = INDEX_VERSION;
+  buffer[5] = flags;
+  put64 (buffer+8, stamp->size);
+  put64 (buffer+16, stamp->mtime);
+  put64 (buffer+24, stamp->ino);
+  buffer[32] = nentries >> 24;
+  buffer[33] = nentries >> 16;
+  buffer[34] = nentries >>  8;
+  buffer[35] = nentries;
+  buffer[36] = nsigs >> 24;
+  buffer[37] = nsigs >> 16;
+  buffer[38] = nsigs >>  8;
+  buffer[39] = nsigs;
+}
+
+
+/* Read the entry with index IDX from the index file FP into BUFFER.  */
+static gpg_error_t
+read_entry (estream_t fp, size_t idx, unsigned char *buffer)
+{
+  if (es_fseeko (fp, INDEX_HDRLEN + (off_t)idx * INDEX_ENTRYLEN, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (es_fread (buffer, INDEX_ENTRYLEN, 1, fp) != 1)
+    return es_ferror (fp)? gpg_error_from_syserror ()
+      /**/               : gpg_error (GPG_ERR_TOO_SHORT);
+  return 0;
+}
+
+
+/* Set the bits for the trigrams of the string S with length LEN in
+ * the Bloom filter BLOOM.  Return the number of trigrams.  */
+static size_t
+bloom_add_trigrams (unsigned char *bloom, const unsigned char *s, size_t len)
+{
+  size_t n;
+  uint32_t h;
+
+  for (n=0; len >= 3; s++, len--, n++)
+    {
+      h = (((uint32_t)ascii_tolower (s[0]) << 16)
+           | ((uint32_t)ascii_tolower (s[1]) << 8)
+           | ascii_tolower (s[2]));
+      h *= 2654435761u;
+      bloom[h >> 27] |= 1 << ((h >> 24) & 7);
+      bloom[(h >> 19) & 31] |= 1 << ((h >> 16) & 7);
+    }
+  return n;
+}
+
+
+/* Compute the user id signature of the blob in BUFFER of LENGTH into
+ * BLOOM.  If the user ids can't be parsed all bits are set so that
+ * the blob is always looked at.  */
+static void
+compute_uid_bloom (unsigned char *bloom,
+                   const unsigned char *buffer, size_t length)
+{
+  size_t nkeys, keyinfolen, nserial, nuids, uidinfolen, pos, idx, off, len;
+
+  memset (bloom, 0, INDEX_BLOOMLEN);
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18);
+  pos = 20 + keyinfolen*nkeys;
+  if (pos+2 > length)
+    goto invalid;
+  nserial = get16 (buffer+pos);
+  pos += 2 + nserial;
+  if (pos+4 > length)
+    goto invalid;
+  nuids = get16 (buffer + pos);  pos += 2;
+  uidinfolen = get16 (buffer + pos);  pos += 2;
+  if (uidinfolen < 12 || pos + uidinfolen*nuids > length)
+    goto invalid;
+
+  for (idx=0; idx < nuids; idx++, pos += uidinfolen)
+    {
+      off = buf32_to_size_t (buffer+pos);
+      len = buf32_to_size_t (buffer+pos+4);
+      if ((uint64_t)off+(uint64_t)len > (uint64_t)length)
+        goto invalid;
+      bloom_add_trigrams (bloom, buffer + off, len);
+    }
+  return;
+
+ invalid:
+  memset (bloom, 0xff, INDEX_BLOOMLEN);
+}
+
+
+/* Append the user id signature of the blob in BUFFER of LENGTH at
+ * OFF to LIST.  */
+static gpg_error_t
+add_sig (entry_list_t list, const unsigned char *buffer, size_t length,
+         off_t off)
+{
+  unsigned char *p;
+
+  if (list->nsigs == list->sallocated)
+    {
+      size_t newsize = list->sallocated? 2 * list->sallocated : 64;
+
+      p = xtryrealloc (list->s, newsize * INDEX_SIGLEN);
+      if (!p)
+        return gpg_error_from_syserror ();
+      list->s = p;
+      list->sallocated = newsize;
+    }
+  p = list->s + list->nsigs * INDEX_SIGLEN;
+  put64 (p, off);
+  compute_uid_bloom (p + 8, buffer, length);
+  list->nsigs++;
+  return 0;
+}
+
+
+
+/* Append an entry with the key value KEY of TYPE for the blob at OFF
+ * to LIST.  */
+static gpg_error_t
+add_entry (entry_list_t list, const unsigned char *key, int type, off_t off)
+{
+  unsigned char *p;
+
+  if (list->nentries == list->allocated)
+    {
+      size_t newsize = list->allocated? 2 * list->allocated : 64;
+
+      p = xtryrealloc (list->d, newsize * INDEX_ENTRYLEN);
+      if (!p)
+        return gpg_error_from_syserror ();
+      list->d = p;
+      list->allocated = newsize;
+    }
+  p = list->d + list->nentries * INDEX_ENTRYLEN;
+  memcpy (p, key, 8);
+  p[8] = type;
+  entry_put_off (p, off);
+  list->nentries++;
+  return 0;
+}
+
+
+/* Append the entries for BLOB which is stored at offset OFF of the
+ * keybox to LIST.  Clears INDEX_FLAG_GRIPS in LIST if the keygrips
+ * of the blob are not known.  The key values are derived the same
+ * way as the search functions compare them; invalid blobs which are
+ * never found by a search do not get any entries.  */
+static gpg_error_t
+add_blob_entries (entry_list_t list, KEYBOXBLOB blob, off_t off)
+{
+  gpg_error_t err;
+  const unsigned char *buffer;
+  size_t length, nkeys, keyinfolen, pos, cert_off, cert_len;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *k;
+  int idx, fpr32;
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (length < 40)
+    return 0;
+  if (buffer[4] != KEYBOX_BLOBTYPE_PGP && buffer[4] != KEYBOX_BLOBTYPE_X509)
+    return 0;
+  fpr32 = buffer[5] == 2;
+
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18);
+  if (!nkeys || keyinfolen < (fpr32?56:28))
+    return 0;
+  pos = 20;
+  if (pos + (uint64_t)keyinfolen*nkeys > (uint64_t)length)
+    return 0;
+
+  err = add_entry (list, buffer + pos, INDEX_TYPE_UBID, off);
+  for (idx=0; !err && idx < nkeys; idx++)
+    err = add_entry (list, buffer + pos + idx*keyinfolen + (fpr32? 0 : 12),
+                     INDEX_TYPE_KID, off);
+  if (!err)
+    err = add_sig (list, buffer, length, off);
+  if (err)
+    return err;
+
+  /* The keygrips are not stored in the blob; for OpenPGP we can get
+   * them by parsing the keyblock.  */
+  if (buffer[4] != KEYBOX_BLOBTYPE_PGP)
+    {
+      list->flags &= ~INDEX_FLAG_GRIPS;
+      return 0;
+    }
+  cert_off = buf32_to_size_t (buffer+8);
+  cert_len = buf32_to_size_t (buffer+12);
+  if ((uint64_t)cert_off+(uint64_t)cert_len > (uint64_t)length
+      || _keybox_parse_openpgp (buffer + cert_off, cert_len, NULL, &info))
+    return 0; /* A search by keygrip won't find it either.  */
+
+  err = add_entry (list, info.primary.grip, INDEX_TYPE_GRIP, off);
+  if (!err && info.nsubkeys)
+    {
+      for (k = &info.subkeys; k && !err; k = k->next)
+        err = add_entry (list, k->grip, INDEX_TYPE_GRIP, off);
+    }
+  _keybox_destroy_openpgp_info (&info);
+  return err;
+}
+
+
+/* Write LIST as the index for the keybox FNAME identified by STAMP.
+ * The user id signatures are only written if INDEX_FLAG_UIDS is set
+ * in LIST.  */
+static gpg_error_t
+write_index (const char *fname, const struct _keybox_index_stamp *stamp,
+             entry_list_t list)
+{
+  gpg_error_t err;
+  char *idxfname, *tmpfname;
+  unsigned char header[INDEX_HDRLEN];
+  estream_t fp;
+  size_t nsigs;
+
+  nsigs = (list->flags & INDEX_FLAG_UIDS)? list->nsigs : 0;
+  if (list->nentries > 0xffffffff || nsigs > 0xffffffff)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  idxfname = index_fname (fname, 0);
+  tmpfname = index_fname (fname, 1);
+  if (!idxfname || !tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  build_header (header, stamp, list->nentries, nsigs, list->flags);
+  if (es_fwrite (header, INDEX_HDRLEN, 1, fp) != 1
+      || (list->nentries
+          && es_fwrite (list->d, INDEX_ENTRYLEN, list->nentries, fp)
+          != list->nentries)
+      || (nsigs && es_fwrite (list->s, INDEX_SIGLEN, nsigs, fp) != nsigs))
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  err = gnupg_rename_file (tmpfname, idxfname, NULL);
+  if (err)
+    gnupg_remove (tmpfname);
+
+ leave:
+  xfree (tmpfname);
+  xfree (idxfname);
+  return err;
+}
+
+
+
+/* Create or rebuild the index for the keybox FNAME.  */
+gpg_error_t
+_keybox_index_build (const char *fname)
+{
+  gpg_error_t err;
+  estream_t fp;
+  struct stat st;
+  struct _keybox_index_stamp stamp;
+  struct entry_list_s list = { NULL, 0, 0,
+                               INDEX_FLAG_GRIPS | INDEX_FLAG_UIDS };
+  KEYBOXBLOB blob;
+  off_t off;
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  if (fstat (es_fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  stamp_from_stat (&stamp, &st);
+
+  for (;;)
+    {
+      err = _keybox_read_blob (&blob, fp, NULL);
+      if (gpg_err_code (err) == GPG_ERR_TOO_LARGE
+          && gpg_err_source (err) == GPG_ERR_SOURCE_KEYBOX)
+        continue; /* Skipped by the search functions as well.  */
+      if (err == -1)
+        {
+          err = 0;
+          break;
+        }
+      if (err)
+        goto leave;
+      off = _keybox_get_blob_fileoffset (blob);
+      err = add_blob_entries (&list, blob, off);
+      _keybox_release_blob (blob);
+      if (err)
+        goto leave;
+    }
+
+  if (list.nentries)
+    qsort (list.d, list.nentries, INDEX_ENTRYLEN, compare_entries);
+  err = write_index (fname, &stamp, &list);
+
+ leave:
+  es_fclose (fp);
+  xfree (list.d);
+  xfree (list.s);
+  return err;
+}
+
+
+/* Record the state of the index of the keybox FNAME at STATE.  This
+ * needs to be called with the keybox locked and before it is
+ * modified; the actual update is then done by _keybox_index_update.  */
+void
+_keybox_index_prepare (const char *fname, keybox_index_state_t state)
+{
+  char *idxfname;
+  estream_t fp;
+  struct stat st;
+  unsigned char header[INDEX_HDRLEN];
+  size_t nentries, nsigs;
+  unsigned int flags;
+
+  memset (state, 0, sizeof *state);
+
+  idxfname = index_fname (fname, 0);
+  if (!idxfname)
+    return;
+  fp = es_fopen (idxfname, "rb");
+  xfree (idxfname);
+  if (!fp)
+    return;  /* No index.  */
+  state->exists = 1;
+
+  if (!gnupg_stat (fname, &st))
+    {
+      stamp_from_stat (&state->stamp, &st);
+      if (es_fread (header, INDEX_HDRLEN, 1, fp) == 1
+          && !parse_header (header, &state->stamp, &nentries, &nsigs,
+                            &flags))
+        state->current = 1;
+    }
+  es_fclose (fp);
+}
+
+
+/* Incrementally update the current index of the keybox FNAME after
+ * the blob at OFF with length OLDLEN has been replaced by BLOB (MODE
+ * is KEYBOX_INDEX_UPDATE) or BLOB has been appended (MODE is
+ * KEYBOX_INDEX_INSERT).  NEWSTAMP identifies the modified keybox.  */
+static gpg_error_t
+update_entries (const char *fname, keybox_index_state_t state, int mode,
+                off_t off, size_t oldlen, KEYBOXBLOB blob,
+                const struct _keybox_index_stamp *newstamp)
+{
+  gpg_error_t err;
+  char *idxfname;
+  estream_t fp = NULL;
+  unsigned char header[INDEX_HDRLEN];
+  struct entry_list_s old = { NULL };
+  struct entry_list_s new = { NULL };
+  struct entry_list_s result = { NULL };
+  unsigned char *src, *dst, *srcend, *p;
+  size_t nentries, nsigs, newlen;
+  off_t o, delta;
+
+  idxfname = index_fname (fname, 0);
+  if (!idxfname)
+    return gpg_error_from_syserror ();
+  fp = es_fopen (idxfname, "rb");
+  xfree (idxfname);
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  if (es_fread (header, INDEX_HDRLEN, 1, fp) != 1)
+    {
+      err = gpg_error (GPG_ERR_TOO_SHORT);
+      goto leave;
+    }
+  err = parse_header (header, &state->stamp, &nentries, &nsigs, &old.flags);
+  if (err)
+    goto leave;
+  old.d = xtrymalloc ((nentries? nentries : 1) * INDEX_ENTRYLEN);
+  old.s = xtrymalloc ((nsigs? nsigs : 1) * INDEX_SIGLEN);
+  if (!old.d || !old.s)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if ((nentries && es_fread (old.d, INDEX_ENTRYLEN, nentries, fp) != nentries)
+      || (nsigs && es_fread (old.s, INDEX_SIGLEN, nsigs, fp) != nsigs))
+    {
+      err = gpg_error (GPG_ERR_TOO_SHORT);
+      goto leave;
+    }
+  old.nentries = old.allocated = nentries;
+  old.nsigs = nsigs;
+
+  /* Collect the entries of the new blob.  */
+  _keybox_get_blob_image (blob, &newlen);
+  if (mode == KEYBOX_INDEX_INSERT)
+    {
+      off = state->stamp.size;
+      oldlen = 0;
+    }
+  delta = (off_t)newlen - (off_t)oldlen;
+  new.flags = INDEX_FLAG_GRIPS | INDEX_FLAG_UIDS;
+  err = add_blob_entries (&new, blob, off);
+  if (err)
+    goto leave;
+  if (new.nentries)
+    qsort (new.d, new.nentries, INDEX_ENTRYLEN, compare_entries);
+
+  /* Drop the entries of the replaced blob, move the entries of the
+   * following blobs and merge the new entries in.  Moving the
+   * offsets does not change the sort order.  */
+  result.flags = (old.flags & new.flags);
+  result.allocated = old.nentries + new.nentries;
+  result.d = xtrymalloc ((result.allocated? result.allocated : 1)
+                         * INDEX_ENTRYLEN);
+  if (!result.d)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (p = old.d, dst = old.d; p < old.d + old.nentries * INDEX_ENTRYLEN;
+       p += INDEX_ENTRYLEN)
+    {
+      o = entry_get_off (p);
+      if (mode == KEYBOX_INDEX_UPDATE && o == off)
+        continue;
+      if (dst != p)
+        memcpy (dst, p, INDEX_ENTRYLEN);
+      if (o > off)
+        entry_put_off (dst, o + delta);
+      dst += INDEX_ENTRYLEN;
+    }
+  srcend = dst;
+  src = old.d;
+  p = new.d;
+  dst = result.d;
+  while (src < srcend || p < new.d + new.nentries * INDEX_ENTRYLEN)
+    {
+      if (p == new.d + new.nentries * INDEX_ENTRYLEN
+          || (src < srcend && compare_entries (src, p) <= 0))
+        {
+          memcpy (dst, src, INDEX_ENTRYLEN);
+          src += INDEX_ENTRYLEN;
+        }
+      else
+        {
+          memcpy (dst, p, INDEX_ENTRYLEN);
+          p += INDEX_ENTRYLEN;
+        }
+      dst += INDEX_ENTRYLEN;
+    }
+  result.nentries = (dst - result.d) / INDEX_ENTRYLEN;
+
+  /* Same for the user id signatures which are sorted by offset; the
+   * signature of the new blob is inserted in place.  */
+  if ((result.flags & INDEX_FLAG_UIDS))
+    {
+      result.s = xtrymalloc ((old.nsigs + 1) * INDEX_SIGLEN);
+      if (!result.s)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      p = new.nsigs? new.s : NULL;
+      dst = result.s;
+      for (src = old.s; src < old.s + old.nsigs * INDEX_SIGLEN;
+           src += INDEX_SIGLEN)
+        {
+          o = get64 (src);
+          if (mode == KEYBOX_INDEX_UPDATE && o == off)
+            continue;
+          if (o > off && p)
+            {
+              memcpy (dst, p, INDEX_SIGLEN);
+              dst += INDEX_SIGLEN;
+              p = NULL;
+            }
+          memcpy (dst, src, INDEX_SIGLEN);
+          if (o > off)
+            put64 (dst, o + delta);
+          dst += INDEX_SIGLEN;
+        }
+      if (p)
+        {
+          memcpy (dst, p, INDEX_SIGLEN);
+          dst += INDEX_SIGLEN;
+        }
+      result.nsigs = (dst - result.s) / INDEX_SIGLEN;
+    }
+
+  es_fclose (fp);
+  fp = NULL;
+  err = write_index (fname, newstamp, &result);
+
+ leave:
+  es_fclose (fp);
+  xfree (old.d);
+  xfree (old.s);
+  xfree (new.d);
+  xfree (new.s);
+  xfree (result.d);
+  xfree (result.s);
+  return err;
+}
+
+
+/* Write NEWSTAMP into the header of the current index of the keybox
+ * FNAME.  This is used after in-place modifications of the keybox
+ * which do not change any offsets.  Entries of deleted blobs may stay
+ * in the index because the search skips deleted blobs anyway.  */
+static gpg_error_t
+touch_index (const char *fname, keybox_index_state_t state,
+             const struct _keybox_index_stamp *newstamp)
+{
+  gpg_error_t err;
+  char *idxfname;
+  estream_t fp;
+  unsigned char header[INDEX_HDRLEN];
+  size_t nentries, nsigs;
+  unsigned int flags;
+
+  idxfname = index_fname (fname, 0);
+  if (!idxfname)
+    return gpg_error_from_syserror ();
+  fp = es_fopen (idxfname, "r+b");
+  xfree (idxfname);
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  if (es_fread (header, INDEX_HDRLEN, 1, fp) != 1)
+    err = gpg_error (GPG_ERR_TOO_SHORT);
+  else
+    err = parse_header (header, &state->stamp, &nentries, &nsigs, &flags);
+  if (!err)
+    {
+      build_header (header, newstamp, nentries, nsigs, flags);
+      if (es_fseeko (fp, 0, SEEK_SET)
+          || es_fwrite (header, INDEX_HDRLEN, 1, fp) != 1)
+        err = gpg_error_from_syserror ();
+    }
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  return err;
+}
+
+
+/* Update the index of the keybox FNAME after a modification.  STATE
+ * is the state as recorded by _keybox_index_prepare before the
+ * modification.  MODE describes the modification:
+ *
+ *  KEYBOX_INDEX_TOUCH   - The keybox has been modified in place.
+ *  KEYBOX_INDEX_INSERT  - BLOB has been appended to the keybox.
+ *  KEYBOX_INDEX_UPDATE  - The blob at OFF of length OLDLEN has been
+ *                         replaced by BLOB.
+ *  KEYBOX_INDEX_REBUILD - Anything else.
+ *
+ * Nothing is done if there is no index.  Errors are not returned
+ * because the index is merely a cache; an index which could not be
+ * updated will not be used.  */
+void
+_keybox_index_update (const char *fname, keybox_index_state_t state,
+                      int mode, off_t off, size_t oldlen, KEYBOXBLOB blob)
+{
+  gpg_error_t err;
+  struct stat st;
+  struct _keybox_index_stamp newstamp;
+
+  if (!state->exists)
+    return;
+
+  if (!state->current || mode == KEYBOX_INDEX_REBUILD)
+    err = gpg_error (GPG_ERR_INV_STATE);
+  else if (gnupg_stat (fname, &st))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      stamp_from_stat (&newstamp, &st);
+      if (mode == KEYBOX_INDEX_TOUCH)
+        err = touch_index (fname, state, &newstamp);
+      else
+        err = update_entries (fname, state, mode, off, oldlen, blob,
+                              &newstamp);
+    }
+
+  if (err)
+    {
+      err = _keybox_index_build (fname);
+      if (err)
+        log_info ("error rebuilding the index for '%s': %s\n",
+                  fname, gpg_strerror (err));
+    }
+}
+
+
+
+/* Append OFF to LIST.  */
+static gpg_error_t
+add_offset (struct offset_list_s *list, off_t off)
+{
+  off_t *tmp;
+
+  if (list->n == list->allocated)
+    {
+      size_t newsize = list->allocated? 2 * list->allocated : 16;
+
+      tmp = xtryrealloc (list->d, newsize * sizeof *list->d);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      list->d = tmp;
+      list->allocated = newsize;
+    }
+  list->d[list->n++] = off;
+  return 0;
+}
+
+
+/* Append the offsets of all entries for KEY of TYPE in the index FP
+ * with NENTRIES entries to LIST.  */
+static gpg_error_t
+lookup_key (estream_t fp, size_t nentries,
+            const unsigned char *key, int type, struct offset_list_s *list)
+{
+  gpg_error_t err;
+  unsigned char want[INDEX_KEYLEN];
+  unsigned char buffer[INDEX_ENTRYLEN];
+  size_t lo, hi, mid;
+
+  memcpy (want, key, 8);
+  want[8] = type;
+
+  /* Find the first matching entry.  */
+  lo = 0;
+  hi = nentries;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      err = read_entry (fp, mid, buffer);
+      if (err)
+        return err;
+      if (memcmp (buffer, want, INDEX_KEYLEN) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  for (; lo < nentries; lo++)
+    {
+      err = read_entry (fp, lo, buffer);
+      if (err)
+        return err;
+      if (memcmp (buffer, want, INDEX_KEYLEN))
+        break;
+      err = add_offset (list, entry_get_off (buffer));
+      if (err)
+        return err;
+    }
+  return 0;
+}
+
+
+/* Compute the Bloom filter pattern for the user id search string
+ * NAME into PATTERN.  Returns false if the string is too short for
+ * the signatures to be useful.  */
+static int
+uid_pattern (unsigned char *pattern, const char *name)
+{
+  size_t len;
+
+  memset (pattern, 0, INDEX_BLOOMLEN);
+  if (*name == '<')
+    name++;
+  len = strlen (name);
+  if (len && name[len-1] == '>')
+    len--;
+  return !!bloom_add_trigrams (pattern, (const unsigned char *)name, len);
+}
+
+
+/* Append the offsets of all blobs at or after STARTOFF whose user id
+ * signatures in the index FP match one of the NPATTERNS PATTERNS to
+ * LIST.  The signatures start at SIGSTART and there are NSIGS of them.
+ * At most MAX_SIG_CANDIDATES offsets are appended; if there are more
+ * candidates the offset where the scan needs to be resumed is stored
+ * at R_RESUME.  */
+static gpg_error_t
+lookup_sigs (estream_t fp, off_t sigstart, size_t nsigs, off_t startoff,
+             unsigned char (*patterns)[INDEX_BLOOMLEN], size_t npatterns,
+             struct offset_list_s *list, off_t *r_resume)
+{
+  gpg_error_t err;
+  unsigned char buffer[INDEX_SIGLEN];
+  size_t lo, hi, mid, n, i, count;
+  off_t off;
+
+  /* Find the first signature at or after STARTOFF.  */
+  lo = 0;
+  hi = nsigs;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (es_fseeko (fp, sigstart + (off_t)mid * INDEX_SIGLEN, SEEK_SET))
+        return gpg_error_from_syserror ();
+      if (es_fread (buffer, 8, 1, fp) != 1)
+        return gpg_error (GPG_ERR_TOO_SHORT);
+      if ((off_t)get64 (buffer) < startoff)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (es_fseeko (fp, sigstart + (off_t)lo * INDEX_SIGLEN, SEEK_SET))
+    return gpg_error_from_syserror ();
+  for (count=0; lo < nsigs; lo++)
+    {
+      if (es_fread (buffer, INDEX_SIGLEN, 1, fp) != 1)
+        return gpg_error (GPG_ERR_TOO_SHORT);
+      off = get64 (buffer);
+      for (n=0; n < npatterns; n++)
+        {
+          for (i=0; i < INDEX_BLOOMLEN; i++)
+            if ((buffer[8+i] & patterns[n][i]) != patterns[n][i])
+              break;
+          if (i == INDEX_BLOOMLEN)
+            break;
+        }
+      if (n == npatterns)
+        continue;
+      if (count++ == MAX_SIG_CANDIDATES)
+        {
+          *r_resume = off;
+          break;
+        }
+      err = add_offset (list, off);
+      if (err)
+        return err;
+    }
+  return 0;
+}
+
+
+/* Use the index to get the offsets of all blobs at or after STARTOFF
+ * which may match one of the NDESC search descriptions DESC in the
+ * keybox opened at HD->FP.  On success a sorted array with the
+ * offsets is stored at R_OFFSETS and its length at R_NOFFSETS; the
+ * caller must release the array.  For searches by user id the number
+ * of returned offsets is limited; if there may be more candidates the
+ * offset to be used as STARTOFF for the next call is stored at
+ * R_RESUME, else 0 is stored there.  GPG_ERR_NOT_SUPPORTED is
+ * returned if the index can't be used for the search, in which case
+ * the caller needs to scan the entire keybox.  */
+gpg_error_t
+_keybox_index_lookup (KEYBOX_HANDLE hd,
+                      KEYBOX_SEARCH_DESC *desc, size_t ndesc, off_t startoff,
+                      off_t **r_offsets, size_t *r_noffsets, off_t *r_resume)
+{
+  gpg_error_t err;
+  char *idxfname;
+  estream_t fp = NULL;
+  struct stat st;
+  struct _keybox_index_stamp stamp;
+  unsigned char header[INDEX_HDRLEN];
+  unsigned char key[8];
+  size_t nentries, nsigs, n, i;
+  unsigned int flags;
+  struct offset_list_s list = { NULL };
+  unsigned char (*patterns)[INDEX_BLOOMLEN] = NULL;
+  size_t npatterns = 0;
+  int need_grips = 0;
+  off_t resume = 0;
+
+  *r_offsets = NULL;
+  *r_noffsets = 0;
+  *r_resume = 0;
+
+  if (!ndesc || !hd->fp)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_LONG_KID:
+        case KEYDB_SEARCH_MODE_UBID:
+          break;
+        case KEYDB_SEARCH_MODE_FPR:
+          if (desc[n].fprlen != 20 && desc[n].fprlen != 32)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          break;
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          need_grips = 1;
+          break;
+        case KEYDB_SEARCH_MODE_EXACT:
+        case KEYDB_SEARCH_MODE_SUBSTR:
+        case KEYDB_SEARCH_MODE_MAIL:
+        case KEYDB_SEARCH_MODE_MAILSUB:
+          if (!patterns)
+            {
+              patterns = xtrycalloc (ndesc, sizeof *patterns);
+              if (!patterns)
+                return gpg_error_from_syserror ();
+            }
+          if (!desc[n].u.name || !uid_pattern (patterns[npatterns++],
+                                               desc[n].u.name))
+            {
+              xfree (patterns);
+              return gpg_error (GPG_ERR_NOT_SUPPORTED);
+            }
+          break;
+        default:
+          xfree (patterns);
+          return gpg_error (GPG_ERR_NOT_SUPPORTED);
+        }
+    }
+
+  idxfname = index_fname (hd->kb->fname, 0);
+  if (!idxfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = es_fopen (idxfname, "rb");
+  xfree (idxfname);
+  if (!fp)
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  if (fstat (es_fileno (hd->fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  stamp_from_stat (&stamp, &st);
+  if (es_fread (header, INDEX_HDRLEN, 1, fp) != 1
+      || parse_header (header, &stamp, &nentries, &nsigs, &flags)
+      || (need_grips && !(flags & INDEX_FLAG_GRIPS))
+      || (npatterns && !(flags & INDEX_FLAG_UIDS)))
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  if (npatterns)
+    {
+      err = lookup_sigs (fp, INDEX_HDRLEN + (off_t)nentries * INDEX_ENTRYLEN,
+                         nsigs, startoff, patterns, npatterns,
+                         &list, &resume);
+      if (err)
+        goto leave;
+    }
+
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          key[0] = desc[n].u.kid[0] >> 24;
+          key[1] = desc[n].u.kid[0] >> 16;
+          key[2] = desc[n].u.kid[0] >>  8;
+          key[3] = desc[n].u.kid[0];
+          key[4] = desc[n].u.kid[1] >> 24;
+          key[5] = desc[n].u.kid[1] >> 16;
+          key[6] = desc[n].u.kid[1] >>  8;
+          key[7] = desc[n].u.kid[1];
+          err = lookup_key (fp, nentries, key, INDEX_TYPE_KID, &list);
+          break;
+        case KEYDB_SEARCH_MODE_FPR:
+          /* Version 2 blobs use the leftmost bytes of the fingerprint
+           * as keyid; version 1 blobs have only 20 byte fingerprints
+           * and use the rightmost bytes.  */
+          err = lookup_key (fp, nentries, desc[n].u.fpr, INDEX_TYPE_KID,
+                            &list);
+          if (!err && desc[n].fprlen == 20)
+            err = lookup_key (fp, nentries, desc[n].u.fpr + 12,
+                              INDEX_TYPE_KID, &list);
+          break;
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          err = lookup_key (fp, nentries, desc[n].u.grip, INDEX_TYPE_GRIP,
+                            &list);
+          break;
+        case KEYDB_SEARCH_MODE_UBID:
+          err = lookup_key (fp, nentries, desc[n].u.ubid, INDEX_TYPE_UBID,
+                            &list);
+          break;
+        case KEYDB_SEARCH_MODE_EXACT:
+        case KEYDB_SEARCH_MODE_SUBSTR:
+        case KEYDB_SEARCH_MODE_MAIL:
+        case KEYDB_SEARCH_MODE_MAILSUB:
+          break;  /* Already done.  */
+        default:
+          err = gpg_error (GPG_ERR_BUG);
+          break;
+        }
+      if (err)
+        goto leave;
+    }
+
+  /* Sort, remove duplicates and restrict to the range covered by
+   * this lookup.  */
+  if (list.n)
+    {
+      qsort (list.d, list.n, sizeof *list.d, compare_offsets);
+      for (i=n=0; i < list.n; i++)
+        {
+          if (list.d[i] < startoff || (resume && list.d[i] >= resume))
+            continue;
+          if (n && list.d[i] == list.d[n-1])
+            continue;
+          list.d[n++] = list.d[i];
+        }
+      list.n = n;
+    }
+
+  *r_offsets = list.d;
+  *r_noffsets = list.n;
+  *r_resume = resume;
+  list.d = NULL;
+
+ leave:
+  es_fclose (fp);
+  xfree (list.d);
+  xfree (patterns);
+  return err;
+}
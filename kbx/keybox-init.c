@@ -23,6 +23,14 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+#endif
 
 #include "keybox-defs.h"
 #include "../common/sysutils.h"
@@ -178,6 +186,7 @@ keybox_release (KEYBOX_HANDLE hd)
     }
   _keybox_release_blob (hd->found.blob);
   _keybox_release_blob (hd->saved_found.blob);
+  _keybox_unmap_file (hd);
   if (hd->fp)
     {
       es_fclose (hd->fp);
@@ -251,6 +260,7 @@ _keybox_close_file (KEYBOX_HANDLE hd)
   for (idx=0; idx < hd->kb->handle_table_size; idx++)
     if ((roverhd = hd->kb->handle_table[idx]))
       {
+        _keybox_unmap_file (roverhd);
         if (roverhd->fp)
           {
             es_fclose (roverhd->fp);
@@ -261,6 +271,62 @@ _keybox_close_file (KEYBOX_HANDLE hd)
 }
 
 
+/* Map the keybox file opened at HD->FP into memory so that a scan
+   can inspect the blobs without reading and copying them.  An
+   existing mapping is kept if the size of the file did not change.
+   Returns GPG_ERR_NOT_SUPPORTED if the file can't be mapped.  */
+gpg_error_t
+_keybox_map_file (KEYBOX_HANDLE hd)
+{
+#ifdef HAVE_MMAP
+  struct stat st;
+  void *map;
+  size_t maplen;
+
+  if (!hd->fp)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (fstat (es_fileno (hd->fp), &st))
+    return gpg_error_from_syserror ();
+  if (!S_ISREG (st.st_mode) || !st.st_size)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  maplen = (size_t)st.st_size;
+  if ((off_t)maplen != st.st_size)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED); /* Too large.  */
+
+  if (hd->map.image && hd->map.length == maplen)
+    return 0;
+  _keybox_unmap_file (hd);
+
+  map = mmap (NULL, maplen, PROT_READ, MAP_PRIVATE, es_fileno (hd->fp), 0);
+  if (map == MAP_FAILED)
+    return gpg_error_from_syserror ();
+#ifdef MADV_SEQUENTIAL
+  madvise (map, maplen, MADV_SEQUENTIAL);
+#endif
+  hd->map.image = map;
+  hd->map.length = maplen;
+  return 0;
+#else /*!HAVE_MMAP*/
+  (void)hd;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif /*!HAVE_MMAP*/
+}
+
+
+/* Release the mapping created by _keybox_map_file.  */
+void
+_keybox_unmap_file (KEYBOX_HANDLE hd)
+{
+  if (!hd->map.image)
+    return;
+#ifdef HAVE_MMAP
+  munmap ((void*)hd->map.image, hd->map.length);
+#endif
+  hd->map.image = NULL;
+  hd->map.length = 0;
+}
+
+
 /*
  * Lock the keybox at handle HD, or unlock if YES is false.  TIMEOUT
  * is the value used for dotlock_take.  In general -1 should be used
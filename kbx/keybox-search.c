@@ -916,6 +916,7 @@ keybox_search_reset (KEYBOX_HANDLE hd)
         {
           /* Ooops.  Seek did not work.  Close so that the search will
            * open the file again.  */
+          _keybox_unmap_file (hd);
           es_fclose (hd->fp);
           hd->fp = NULL;
         }
@@ -943,6 +944,13 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
   struct sn_array_s *sn_array = NULL;
   int pk_no, uid_no;
   off_t lastfoundoff;
+  off_t *idxoffs = NULL;
+  size_t nidxoffs = 0;
+  size_t idxpos = 0;
+  off_t idxresume = 0;
+  int use_index;
+  KEYBOXBLOB viewblob = NULL;
+  size_t mappos = 0;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -1088,6 +1096,28 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         }
     }
 
+  /* For lookups by fingerprint and the like, and for most searches
+   * by user id, the sidecar index, if available, tells us which blobs
+   * to look at.  */
+  {
+    off_t startoff = hd->fp? es_ftello (hd->fp) : 0;
+
+    use_index = !_keybox_index_lookup (hd, desc, ndesc,
+                                       startoff == (off_t)-1? 0 : startoff,
+                                       &idxoffs, &nidxoffs, &idxresume);
+  }
+
+  /* Otherwise we need to scan the keybox which we do on a memory
+   * mapped image of the file if possible.  The file position is then
+   * only updated after the scan.  */
+  if (!use_index && !_keybox_map_file (hd))
+    {
+      off_t curoff = es_ftello (hd->fp);
+
+      if (curoff != (off_t)-1 && curoff <= hd->map.length
+          && !_keybox_new_blob (&viewblob, NULL, 0, 0))
+        mappos = curoff;
+    }
 
   pk_no = uid_no = 0;
   for (;;)
@@ -1095,8 +1125,64 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       unsigned int blobflags;
       int blobtype;
 
-      _keybox_release_blob (blob); blob = NULL;
-      rc = _keybox_read_blob (&blob, hd->fp, NULL);
+      if (!viewblob)
+        _keybox_release_blob (blob);
+      blob = NULL;
+      if (use_index)
+        {
+          /* Skip to the next candidate after the current position.  */
+          off_t curoff = es_ftello (hd->fp);
+
+          if (curoff == (off_t)-1)
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+          while (idxpos < nidxoffs && idxoffs[idxpos] < curoff)
+            idxpos++;
+          if (idxpos == nidxoffs && idxresume)
+            {
+              /* Get the next batch of candidates.  */
+              xfree (idxoffs);
+              idxpos = 0;
+              rc = _keybox_index_lookup (hd, desc, ndesc,
+                                         idxresume > curoff? idxresume:curoff,
+                                         &idxoffs, &nidxoffs, &idxresume);
+              if (rc)
+                {
+                  /* The index went stale, for example because the
+                   * keybox has been modified meanwhile.  As with the
+                   * first lookup continue with a linear scan; the
+                   * blobs before CUROFF have already been looked at
+                   * and the file is positioned at a blob boundary.  */
+                  idxoffs = NULL;
+                  nidxoffs = 0;
+                  use_index = 0;
+                }
+            }
+        }
+      if (use_index)
+        {
+          if (idxpos == nidxoffs)
+            {
+              rc = -1;  /* No more candidates.  */
+              break;
+            }
+          if (es_fseeko (hd->fp, idxoffs[idxpos], SEEK_SET))
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+        }
+      if (viewblob)
+        {
+          rc = _keybox_read_mapped_blob (viewblob, hd->map.image,
+                                         hd->map.length, &mappos, NULL);
+          if (!rc)
+            blob = viewblob;
+        }
+      else
+        rc = _keybox_read_blob (&blob, hd->fp, NULL);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
         {
@@ -1222,6 +1308,22 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         break; /* got it */
     }
 
+  if (viewblob)
+    {
+      /* Set the file position for the next search and replace the
+       * view of the found blob by a copy.  */
+      if (es_fseeko (hd->fp, mappos, SEEK_SET))
+        {
+          if (!rc || rc == -1 || gpg_err_code (rc) == GPG_ERR_EOF)
+            rc = gpg_error_from_syserror ();
+        }
+      else if (!rc)
+        rc = _keybox_copy_blob (&blob, viewblob);
+      if (rc)
+        blob = NULL;
+      _keybox_release_blob (viewblob);
+    }
+
   if (!rc)
     {
       hd->found.blob = blob;
@@ -1241,6 +1343,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 
   if (sn_array)
     release_sn_array (sn_array, ndesc);
+  xfree (idxoffs);
 
   return rc;
 }
@@ -168,12 +168,16 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
   char *tmpfname = NULL;
   char buffer[4096];  /* (Must be at least 32 bytes) */
   int nread, nbytes;
+  struct _keybox_index_state idxstate;
+  size_t oldlen = 0;
 
   /* Open the source file. Because we do a rename, we have to check the
      permissions of the file */
   if ((ec = gnupg_access (fname, W_OK)))
     return gpg_error (ec);
 
+  _keybox_index_prepare (fname, &idxstate);
+
   fp = es_fopen (fname, "rb");
   if (mode == FILECOPY_INSERT && !fp && errno == ENOENT)
     {
@@ -205,6 +209,7 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
 /*            log_debug ("%s: chmod failed: %s\n", fname, strerror(errno) ); */
 /*            return KEYBOX_File_Error; */
 /*          } */
+      _keybox_index_update (fname, &idxstate, KEYBOX_INDEX_REBUILD, 0, 0, NULL);
       return 0; /* Ready. */
     }
 
@@ -296,6 +301,7 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
           es_fclose (newfp);
           return rc;
         }
+      oldlen = es_ftello (fp) - start_offset;
     }
 
   /* Do an insert or update. */
@@ -346,6 +352,12 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
     }
 
   rc = rename_tmp_file (bakfname, tmpfname, fname, secret);
+  if (!rc)
+    _keybox_index_update (fname, &idxstate,
+                          mode == FILECOPY_INSERT? KEYBOX_INDEX_INSERT :
+                          mode == FILECOPY_UPDATE? KEYBOX_INDEX_UPDATE :
+                          /**/                     KEYBOX_INDEX_REBUILD,
+                          start_offset, oldlen, blob);
 
  leave:
   xfree(bakfname);
@@ -509,6 +521,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   size_t flag_pos, flag_size;
   const unsigned char *buffer;
   size_t length;
+  struct _keybox_index_state idxstate;
 
   (void)idx;  /* Not yet used.  */
 
@@ -536,6 +549,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   off += flag_pos;
 
   _keybox_close_file (hd);
+  _keybox_index_prepare (fname, &idxstate);
   fp = es_fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
@@ -571,6 +585,8 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
       if (!ec)
         ec = gpg_err_code_from_syserror ();
     }
+  if (!ec)
+    _keybox_index_update (fname, &idxstate, KEYBOX_INDEX_TOUCH, 0, 0, NULL);
 
   return gpg_error (ec);
 }
@@ -584,6 +600,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   const char *fname;
   estream_t fp;
   int rc;
+  struct _keybox_index_state idxstate;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -601,6 +618,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   off += 4;
 
   _keybox_close_file (hd);
+  _keybox_index_prepare (fname, &idxstate);
   fp = es_fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
@@ -617,6 +635,8 @@ keybox_delete (KEYBOX_HANDLE hd)
       if (!rc)
         rc = gpg_error_from_syserror ();
     }
+  if (!rc)
+    _keybox_index_update (fname, &idxstate, KEYBOX_INDEX_TOUCH, 0, 0, NULL);
 
   return rc;
 }
@@ -638,6 +658,7 @@ keybox_compress (KEYBOX_HANDLE hd)
   u32 cut_time;
   int any_changes = 0;
   int skipped_deleted;
+  struct _keybox_index_state idxstate;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -791,7 +812,13 @@ keybox_compress (KEYBOX_HANDLE hd)
   if (rc || !any_changes)
     gnupg_remove (tmpfname);
   else
-    rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+    {
+      _keybox_index_prepare (fname, &idxstate);
+      rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+      if (!rc)
+        _keybox_index_update (fname, &idxstate, KEYBOX_INDEX_REBUILD,
+                              0, 0, NULL);
+    }
 
   xfree(bakfname);
   xfree(tmpfname);
@@ -360,6 +360,7 @@ cleanup (void)
   if (done)
     return;
   done = 1;
+  kbxd_release_database ();
   if (!inhibit_socket_removal)
     remove_socket (socket_name);
 }
@@ -0,0 +1,350 @@
+/* t-bulkstore.c - Regression tests for the bulk store of keyboxd
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sqlite3.h>
+#include <npth.h>
+
+#define INCLUDED_BY_MAIN_MODULE 1
+#include "keyboxd.h"
+#include "../common/asshelp.h"
+#include "../common/host2net.h"
+#include "frontend.h"
+#include "t-kbx-support.h"
+
+
+#define DATABASE_NAME "./t-bulkstore.db"
+
+/* The number of keys stored; this is more than one batch.  */
+#define NKEYS 1100
+
+static int verbose;
+
+/* The fingerprints of the keys.  */
+static unsigned char fprs[NKEYS][20];
+
+/* The number of keys returned by the last search.  */
+static unsigned int nfound;
+
+/* The number of ERROR status lines and the key index given by the
+ * last one.  */
+static unsigned int nerrors;
+static unsigned int last_error_index;
+
+
+
+/* Return true if the key with the fingerprint FPR is stored.  */
+static int
+have_key (ctrl_t ctrl, const unsigned char *fpr)
+{
+  gpg_error_t err;
+  KEYDB_SEARCH_DESC desc;
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  desc.fprlen = 20;
+  memcpy (desc.u.fpr, fpr, 20);
+  nfound = 0;
+  err = kbxd_search (ctrl, &desc, 1, 1);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND
+      || gpg_err_code (err) == GPG_ERR_EOF)
+    return 0;
+  if (err)
+    {
+      fprintf (stderr, "search failed: %s\n", gpg_strerror (err));
+      fail ();
+    }
+  return nfound == 1;
+}
+
+
+/* Return the number of the deferred indices in the database.  */
+static int
+count_deferred_indices (void)
+{
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
+  int count;
+
+  if (sqlite3_open (DATABASE_NAME, &db))
+    fail ();
+  if (sqlite3_prepare_v2 (db, "SELECT count(*) FROM sqlite_master"
+                          " WHERE type = 'index' AND name IN"
+                          " ('fingerprintidx2', 'userididx1',"
+                          "  'userididx3', 'issueridx1')",
+                          -1, &stmt, NULL))
+    fail ();
+  if (sqlite3_step (stmt) != SQLITE_ROW)
+    fail ();
+  count = sqlite3_column_int (stmt, 0);
+  sqlite3_finalize (stmt);
+  sqlite3_close (db);
+  return count;
+}
+
+
+/* Store all keys with a bulk store and check that they are found.  A
+ * corrupt key in the middle must not affect the others.  */
+static void
+test_bulk_store (ctrl_t ctrl, int defer_indices)
+{
+  gpg_error_t err;
+  unsigned char buffer[KEYBLOCK_BUFSIZE];
+  char uid[50];
+  size_t n;
+  int i;
+
+  opt.in_transaction = 1;
+  err = kbxd_bulk_begin (ctrl, defer_indices);
+  if (err)
+    fail ();
+  if (defer_indices && count_deferred_indices ())
+    fail ();
+  for (i=0; i < NKEYS; i++)
+    {
+      snprintf (uid, sizeof uid, "Key %d <k%d@example.org>", i, i);
+      n = make_keyblock (buffer, i, uid, fprs[i]);
+      if (kbxd_store (ctrl, buffer, n, KBXD_STORE_AUTO))
+        fail ();
+      if (i == NKEYS / 2)
+        {
+          /* A truncated keyblock.  */
+          if (!kbxd_store (ctrl, buffer, 40, KBXD_STORE_AUTO))
+            fail ();
+        }
+    }
+  err = kbxd_bulk_end (ctrl);
+  if (err)
+    fail ();
+  if (opt.in_transaction || opt.active_transaction)
+    fail ();
+
+  if (count_deferred_indices () != 4)
+    fail ();
+  for (i=0; i < NKEYS; i++)
+    if (!have_key (ctrl, fprs[i]))
+      fail ();
+}
+
+
+/* Check that a failed start of a bulk store leaves neither the bulk
+ * mode active nor the database without indices.  */
+static void
+test_failed_begin (ctrl_t ctrl)
+{
+  gpg_error_t err;
+  sqlite3 *db;
+
+  /* Lock the database so that dropping the indices fails.  */
+  if (sqlite3_open (DATABASE_NAME, &db))
+    fail ();
+  if (sqlite3_exec (db, "BEGIN EXCLUSIVE", NULL, NULL, NULL))
+    fail ();
+
+  opt.in_transaction = 1;
+  err = kbxd_bulk_begin (ctrl, 1);
+  if (!err)
+    fail ();
+  opt.in_transaction = 0;
+
+  if (sqlite3_exec (db, "COMMIT", NULL, NULL, NULL))
+    fail ();
+  sqlite3_close (db);
+
+  if (count_deferred_indices () != 4)
+    fail ();
+  if (!have_key (ctrl, fprs[0]))
+    fail ();
+
+  /* A new bulk store can be started.  */
+  opt.in_transaction = 1;
+  err = kbxd_bulk_begin (ctrl, 0);
+  if (err)
+    fail ();
+  err = kbxd_bulk_end (ctrl);
+  if (err)
+    fail ();
+}
+
+
+/* Append the keyblock for IDX with its length prefix to BUFFER at
+ * offset OFF and return the new length.  The fingerprint is stored
+ * at FPR.  */
+static size_t
+append_blob (unsigned char *buffer, size_t off, int idx, unsigned char *fpr)
+{
+  char uid[50];
+  size_t n;
+
+  snprintf (uid, sizeof uid, "Framed %d <f%d@example.org>", idx, idx);
+  n = make_keyblock (buffer + off + 4, idx, uid, fpr);
+  ulongtobuf (buffer + off, n);
+  return off + 4 + n;
+}
+
+
+/* Store the LENGTH bytes at BUFFER using the framing of the
+ * BULKSTORE command and check the error code and the number of keys
+ * processed and failed.  */
+static void
+check_blobs (ctrl_t ctrl, const unsigned char *buffer, size_t length,
+             gpg_err_code_t expected_err, unsigned int expected_count,
+             unsigned int expected_nfailed)
+{
+  gpg_error_t err;
+  unsigned int count = 0;
+  unsigned int nfailed = 0;
+
+  nerrors = 0;
+  err = kbxd_bulk_store_blobs (ctrl, buffer, length, KBXD_STORE_AUTO,
+                               &count, &nfailed);
+  if (gpg_err_code (err) != expected_err)
+    {
+      fprintf (stderr, "bulk store returned: %s\n", gpg_strerror (err));
+      fail ();
+    }
+  if (count != expected_count || nfailed != expected_nfailed
+      || nerrors != expected_nfailed)
+    fail ();
+}
+
+
+/* Check the length prefixed framing of the keys sent with the
+ * BULKSTORE command.  */
+static void
+test_framing (ctrl_t ctrl)
+{
+  unsigned char buffer[3 * (KEYBLOCK_BUFSIZE + 4) + 8];
+  unsigned char fpr[5][20];
+  size_t len;
+
+  opt.in_transaction = 1;
+  if (kbxd_bulk_begin (ctrl, 0))
+    fail ();
+
+  /* An empty and a short record are reported but the keys after
+   * them are still stored.  */
+  len = append_blob (buffer, 0, NKEYS, fpr[0]);
+  memset (buffer + len, 0, 4);
+  len += 4;
+  append_blob (buffer, len, NKEYS + 1, fpr[1]);
+  ulongtobuf (buffer + len, 40);
+  len += 4 + 40;
+  len = append_blob (buffer, len, NKEYS + 2, fpr[2]);
+  check_blobs (ctrl, buffer, len, 0, 4, 2);
+  if (last_error_index != 2)
+    fail ();
+
+  /* An oversized length stops the store.  */
+  len = append_blob (buffer, 0, NKEYS + 3, fpr[3]);
+  ulongtobuf (buffer, (len - 4 + 1));
+  check_blobs (ctrl, buffer, len, GPG_ERR_INV_LENGTH, 0, 0);
+
+  /* Trailing bytes after the last key are not a length prefix.  */
+  len = append_blob (buffer, 0, NKEYS + 4, fpr[4]);
+  memcpy (buffer + len, "\x00\x01", 2);
+  check_blobs (ctrl, buffer, len + 2, GPG_ERR_INV_LENGTH, 1, 0);
+  memcpy (buffer + len, "trash", 5);
+  check_blobs (ctrl, buffer, len + 5, GPG_ERR_INV_LENGTH, 1, 0);
+
+  if (kbxd_bulk_end (ctrl))
+    fail ();
+
+  if (!have_key (ctrl, fpr[0]) || !have_key (ctrl, fpr[2])
+      || !have_key (ctrl, fpr[4]))
+    fail ();
+  if (have_key (ctrl, fpr[1]) || have_key (ctrl, fpr[3]))
+    fail ();
+}
+
+
+int
+main (int argc, char **argv)
+{
+  ctrl_t ctrl;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+  opt.quiet = !verbose;
+  opt.verbose = verbose;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+  npth_init ();
+
+  remove (DATABASE_NAME);
+  remove (DATABASE_NAME "-wal");
+  remove (DATABASE_NAME "-shm");
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+  if (kbxd_set_database (ctrl, DATABASE_NAME, 0))
+    fail ();
+
+  test_bulk_store (ctrl, 1);
+  test_failed_begin (ctrl);
+  /* Store the same keys again, this time as updates.  */
+  test_bulk_store (ctrl, 0);
+  test_framing (ctrl);
+
+  kbxd_release_session_info (ctrl);
+  xfree (ctrl);
+  kbxd_release_database ();
+
+  remove (DATABASE_NAME);
+  remove (DATABASE_NAME "-wal");
+  remove (DATABASE_NAME "-shm");
+  return 0;
+}
+
+
+/* Stub for kbxserver.c which records the ERROR status lines.  */
+gpg_error_t
+status_printf (ctrl_t ctrl, const char *keyword, const char *format, ...)
+{
+  va_list arg_ptr;
+
+  (void)ctrl;
+
+  if (!strcmp (keyword, "ERROR") && !strcmp (format, "bulkstore %u %u"))
+    {
+      va_start (arg_ptr, format);
+      (void)va_arg (arg_ptr, unsigned int);  /* The error code.  */
+      last_error_index = va_arg (arg_ptr, unsigned int);
+      va_end (arg_ptr);
+      nerrors++;
+    }
+  return 0;
+}
+
+
+/* Stub for kbxserver.c which counts the returned keys.  */
+gpg_error_t
+kbxd_write_data_line (ctrl_t ctrl, const void *buffer_arg, size_t size)
+{
+  (void)ctrl;
+  (void)buffer_arg;
+  (void)size;
+  nfound++;
+  return 0;
+}
@@ -0,0 +1,84 @@
+/* t-kbx-support.c - Helper for the keybox regression tests
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gcrypt.h>
+
+#include "../common/openpgpdefs.h"
+#include "t-kbx-support.h"
+
+
+/* Build an OpenPGP keyblock consisting of a v4 RSA key packet with a
+ * made up modulus unique for IDX and a user id packet with UID.
+ * The keyblock is stored at BUFFER which must have space for
+ * KEYBLOCK_BUFSIZE bytes; its length is returned.  The fingerprint
+ * is stored at FPR.  */
+size_t
+make_keyblock (unsigned char *buffer, int idx, const char *uid,
+               unsigned char *fpr)
+{
+  unsigned char *p = buffer;
+  unsigned char *body;
+  unsigned char hdr[3];
+  size_t bodylen, uidlen;
+  gcry_md_hd_t md;
+  int i;
+
+  *p++ = 0xc0 | 6;  /* Public key packet.  */
+  *p++ = 77;
+  body = p;
+  *p++ = 4;
+  *p++ = 0x5f; *p++ = 0x00; *p++ = 0x00; *p++ = 0x00;
+  *p++ = PUBKEY_ALGO_RSA;
+  *p++ = 2; *p++ = 0;  /* 512 bits */
+  *p++ = 0xc0;
+  *p++ = idx >> 8;
+  *p++ = idx;
+  for (i=3; i < 64; i++)
+    *p++ = i;
+  *p++ = 0; *p++ = 17;
+  *p++ = 1; *p++ = 0; *p++ = 1;
+  bodylen = p - body;
+  if (bodylen != 77)
+    fail ();
+
+  uidlen = strlen (uid);
+  if (uidlen > 191)
+    fail ();
+  *p++ = 0xc0 | 13;  /* User id packet.  */
+  *p++ = uidlen;
+  memcpy (p, uid, uidlen);
+  p += uidlen;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    fail ();
+  hdr[0] = 0x99;
+  hdr[1] = bodylen >> 8;
+  hdr[2] = bodylen;
+  gcry_md_write (md, hdr, 3);
+  gcry_md_write (md, body, bodylen);
+  memcpy (fpr, gcry_md_read (md, 0), 20);
+  gcry_md_close (md);
+
+  return p - buffer;
+}
@@ -0,0 +1,45 @@
+/* t-kbx-support.h - Helper for the keybox regression tests
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_KBX_T_KBX_SUPPORT_H
+#define GNUPG_KBX_T_KBX_SUPPORT_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/* Macros to print the result of a test.  */
+#define pass()  do { ; } while(0)
+#define fail()  do { fprintf (stderr, "%s:%d: test failed\n",\
+                              __FILE__,__LINE__);            \
+                     exit (1);                               \
+                   } while(0)
+
+
+/* The size of the buffer required by make_keyblock.  */
+#define KEYBLOCK_BUFSIZE 300
+
+
+/*-- t-kbx-support.c --*/
+size_t make_keyblock (unsigned char *buffer, int idx, const char *uid,
+                      unsigned char *fpr);
+
+
+#endif /*GNUPG_KBX_T_KBX_SUPPORT_H*/
@@ -0,0 +1,286 @@
+/* t-keybox-index.c - Regression tests for the keybox index
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "keybox-defs.h"
+#include "../common/host2net.h"
+#include "t-kbx-support.h"
+
+
+#define KEYBOX_NAME "t-keybox-index.kbx"
+#define INDEX_NAME  KEYBOX_NAME ".idx"
+
+/* The number of keys whose user id signature matches the search
+ * string "xyz beta" without containing it.  This is larger than the
+ * number of candidates returned by one index lookup, so that the
+ * search needs to resume the lookup.  */
+#define NDECOYS 300
+
+static int verbose;
+
+/* The fingerprints of the keys stored by make_keybox.  */
+static unsigned char fprs[NDECOYS+2][20];
+
+
+
+/* Create a new keybox with the decoys, the key "Alice" and the key
+ * "Zed" stored last.  */
+static void
+make_keybox (KEYBOX_HANDLE hd)
+{
+  gpg_error_t err;
+  unsigned char buffer[KEYBLOCK_BUFSIZE];
+  char uid[100];
+  size_t n;
+  int i;
+
+  for (i=0; i < NDECOYS + 2; i++)
+    {
+      if (i == 0)
+        strcpy (uid, "Alice <alice@example.org>");
+      else if (i == NDECOYS + 1)
+        strcpy (uid, "Zed xyz beta <zed@example.org>");
+      else
+        snprintf (uid, sizeof uid, "Decoy %d xyz bz beta <d%d@example.org>",
+                  i, i);
+      n = make_keyblock (buffer, i, uid, fprs[i]);
+      err = keybox_insert_keyblock (hd, buffer, n);
+      if (err)
+        {
+          fprintf (stderr, "insert failed: %s\n", gpg_strerror (err));
+          fail ();
+        }
+    }
+}
+
+
+/* Search for DESC from the start of the keybox and return true if a
+ * key was found whose user id contains EXPECT.  */
+static int
+search_one (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, const char *expect)
+{
+  gpg_error_t err;
+  unsigned long skipped;
+  void *buffer;
+  size_t buflen;
+  int found;
+
+  if (keybox_search_reset (hd))
+    fail ();
+  err = keybox_search (hd, desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, &skipped);
+  if (gpg_err_code (err) == GPG_ERR_EOF || err == -1)
+    return 0;
+  if (err)
+    {
+      fprintf (stderr, "search failed: %s\n", gpg_strerror (err));
+      fail ();
+    }
+  if (keybox_get_data (hd, &buffer, &buflen, NULL, NULL))
+    fail ();
+  found = !!memmem (buffer, buflen, expect, strlen (expect));
+  xfree (buffer);
+  return found;
+}
+
+
+/* Run the searches common to all tests.  */
+static void
+run_searches (KEYBOX_HANDLE hd)
+{
+  KEYBOX_SEARCH_DESC desc;
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  desc.fprlen = 20;
+  memcpy (desc.u.fpr, fprs[NDECOYS+1], 20);
+  if (!search_one (hd, &desc, "Zed"))
+    fail ();
+
+  memcpy (desc.u.fpr, fprs[0], 20);
+  if (!search_one (hd, &desc, "Alice"))
+    fail ();
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_LONG_KID;
+  desc.u.kid[0] = buf32_to_u32 (fprs[42] + 12);
+  desc.u.kid[1] = buf32_to_u32 (fprs[42] + 16);
+  if (!search_one (hd, &desc, "Decoy 42 "))
+    fail ();
+
+  /* This needs to resume the index lookup.  */
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_SUBSTR;
+  desc.u.name = "xyz beta";
+  if (!search_one (hd, &desc, "Zed"))
+    fail ();
+
+  desc.mode = KEYDB_SEARCH_MODE_MAIL;
+  desc.u.name = "d7@example.org";
+  if (!search_one (hd, &desc, "Decoy 7 "))
+    fail ();
+
+  desc.mode = KEYDB_SEARCH_MODE_SUBSTR;
+  desc.u.name = "no such user";
+  if (search_one (hd, &desc, ""))
+    fail ();
+}
+
+
+/* Return true if the index can be used for DESC.  If R_RESUME is not
+ * NULL the resume offset of the lookup is stored there.  */
+static int
+index_usable (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, off_t *r_resume)
+{
+  gpg_error_t err;
+  off_t *offsets;
+  size_t noffsets;
+  off_t resume;
+
+  if (keybox_search_reset (hd))
+    fail ();
+  /* Make sure that the file is open.  */
+  if (!hd->fp && !(hd->fp = es_fopen (KEYBOX_NAME, "rb")))
+    fail ();
+  err = _keybox_index_lookup (hd, desc, 1, 0, &offsets, &noffsets, &resume);
+  xfree (offsets);
+  if (r_resume)
+    *r_resume = resume;
+  return !err;
+}
+
+
+static void
+test_index (void)
+{
+  gpg_error_t err;
+  void *token;
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc;
+  estream_t fp;
+
+  remove (INDEX_NAME);
+  fp = es_fopen (KEYBOX_NAME, "wb");
+  if (!fp)
+    fail ();
+  if (_keybox_write_header_blob (fp, 1))
+    fail ();
+  if (es_fclose (fp))
+    fail ();
+  err = keybox_register_file (KEYBOX_NAME, 0, &token);
+  if (err)
+    fail ();
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail ();
+
+  make_keybox (hd);
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  desc.fprlen = 20;
+  memcpy (desc.u.fpr, fprs[1], 20);
+
+  /* Without an index.  */
+  if (verbose)
+    fprintf (stderr, "searching without an index\n");
+  if (index_usable (hd, &desc, NULL))
+    fail ();
+  run_searches (hd);
+
+  /* With a current index.  */
+  if (verbose)
+    fprintf (stderr, "searching with an index\n");
+  _keybox_close_file (hd);
+  if (_keybox_index_build (KEYBOX_NAME))
+    fail ();
+  if (!index_usable (hd, &desc, NULL))
+    fail ();
+  {
+    /* The decoys don't fit into one batch of candidates.  */
+    KEYBOX_SEARCH_DESC subdesc;
+    off_t resume;
+
+    memset (&subdesc, 0, sizeof subdesc);
+    subdesc.mode = KEYDB_SEARCH_MODE_SUBSTR;
+    subdesc.u.name = "xyz beta";
+    if (!index_usable (hd, &subdesc, &resume) || !resume)
+      fail ();
+  }
+  run_searches (hd);
+
+  /* The index is maintained by an insert.  */
+  if (verbose)
+    fprintf (stderr, "searching with an updated index\n");
+  {
+    unsigned char buffer[KEYBLOCK_BUFSIZE];
+    unsigned char fpr[20];
+    size_t n;
+
+    n = make_keyblock (buffer, NDECOYS + 2, "Bob <bob@example.org>", fpr);
+    if (keybox_insert_keyblock (hd, buffer, n))
+      fail ();
+    if (!index_usable (hd, &desc, NULL))
+      fail ();
+    run_searches (hd);
+    memcpy (desc.u.fpr, fpr, 20);
+    if (!search_one (hd, &desc, "Bob"))
+      fail ();
+    memcpy (desc.u.fpr, fprs[1], 20);
+  }
+
+  /* With a stale index: Append a deleted blob behind the back of the
+   * keybox code.  */
+  if (verbose)
+    fprintf (stderr, "searching with a stale index\n");
+  _keybox_close_file (hd);
+  fp = es_fopen (KEYBOX_NAME, "ab");
+  if (!fp)
+    fail ();
+  es_fwrite ("\x00\x00\x00\x08\x00\x00\x00\x00", 8, 1, fp);
+  if (es_fclose (fp))
+    fail ();
+  if (index_usable (hd, &desc, NULL))
+    fail ();
+  run_searches (hd);
+
+  keybox_release (hd);
+  remove (KEYBOX_NAME);
+  remove (KEYBOX_NAME "~");
+  remove (INDEX_NAME);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  test_index ();
+
+  return 0;
+}
@@ -34,3 +34,40 @@
        (tr:assert-identity source)))
     (append plain-files data-files)))
  (force all-compression-algos))
+
+;; Files with sizes around the 128 KiB blocks deflated by the worker
+;; threads and spanning more than one batch of four blocks.
+(define block-files
+  (map (lambda (size)
+	 (let ((name (string-append "blocks-" (number->string size))))
+	   (call-with-output-file name
+	     (lambda (port)
+	       (let loop ((i 0))
+		 (when (< i size)
+		       (write-char (integer->char
+				    (+ 32 (modulo (* i (modulo i 1021)) 95)))
+				   port)
+		       (loop (+ i 1))))))
+	   name))
+       '(131071 131072 131073 655361)))
+
+(for-each-p'
+ "Checking compression with worker threads"
+ (lambda (variant)
+   (for-each
+    (lambda (source)
+      (tr:do
+       (tr:open source)
+       (tr:gpg "" `(--yes --encrypt --recipient ,usrname2
+			  --compress-algo ,(car variant)
+			  --worker-threads ,(cadr variant)
+			  --compress-level ,(caddr variant)))
+       (tr:gpg "" '(--yes --decrypt))
+       (tr:assert-identity source)))
+    (append block-files '("plain-large" "data-80000"))))
+ (lambda (variant)
+   (string-append (car variant) "/" (cadr variant) "/" (caddr variant)))
+ ;; The algorithm, the number of worker threads, and the level.
+ '(("zip" "0" "1") ("zip" "0" "9") ("zip" "4" "1") ("zip" "4" "9")
+   ("zlib" "0" "1") ("zlib" "0" "9") ("zlib" "4" "1") ("zlib" "4" "9")
+   ("zip" "2" "6") ("zlib" "3" "6")))
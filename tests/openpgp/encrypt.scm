@@ -59,3 +59,43 @@
     (tr:gpg "" '(--yes --decrypt))
     (tr:assert-identity source)))
  plain-files)
+
+;; Files with sizes around the 64 byte chunks used with --chunk-size 6
+;; and around the batches of chunks handed to the worker threads.
+(define aead-files
+  (map (lambda (size)
+	 (let ((name (string-append "aead-" (number->string size))))
+	   (call-with-output-file name
+	     (lambda (port)
+	       (let loop ((i 0))
+		 (when (< i size)
+		       (write-char (integer->char (+ 32 (modulo i 95))) port)
+		       (loop (+ i 1))))))
+	   name))
+       '(0 1 63 64 65 191 192 193 255 256 257 1000)))
+
+(define aead-args '(--rfc4880bis --force-aead --cipher-algo AES256
+		    --compress-algo none --chunk-size 6))
+
+(info "Checking that --force-aead uses the requested chunk size")
+(call-check `(,@GPG --yes --output aead-1000.gpg ,@aead-args
+		    --encrypt --recipient ,usrname2 aead-1000))
+(let ((packets (call-popen `(,@GPG --list-packets aead-1000.gpg) "")))
+  (unless (and (string-contains? packets ":aead encrypted packet:")
+	       (string-contains? packets " cb=0\n"))
+	  (fail "The message is not encrypted using AEAD with 64 byte chunks")))
+
+(for-each-p'
+ "Checking AEAD encryption with worker threads"
+ (lambda (threads)
+   (for-each
+    (lambda (source)
+      (tr:do
+       (tr:open source)
+       (tr:gpg "" `(--yes ,@aead-args --worker-threads ,(car threads)
+			  --encrypt --recipient ,usrname2))
+       (tr:gpg "" `(--yes --worker-threads ,(cadr threads) --decrypt))
+       (tr:assert-identity source)))
+    (append aead-files '("plain-large" "data-80000"))))
+ (lambda (threads) (string-append (car threads) "/" (cadr threads)))
+ '(("0" "0") ("0" "4") ("4" "0") ("4" "4") ("3" "2")))
@@ -59,3 +59,18 @@
 		 (string-split-newlines c))))
       (unless (= 2 (length keys))
 	      (fail "Importing keys with long id collision failed"))))))
+
+(define pks-fpr "3E1CD6CB250B1BC966625A06697697DF5729621E")
+(define pks-subfpr "7B8A4315D93204C50D4FFDEA5A72EBA7A65B5F1D")
+(info "Checking the PKS subkey repair with parallel self-signature checks.")
+;; The binding signature of the first subkey follows the second
+;; subkey.  Checking it in advance against the second subkey fails;
+;; that result must not keep the repair from succeeding.
+(call-check `(,@GPG --worker-threads 2
+		    --import-options repair-pks-subkey-bug --import
+		    ,(in-srcdir "tests" "openpgp" "samplekeys/pks-subkey-bug.asc")))
+(let ((fprs (filter (lambda (x) (eq? 'fpr (:type x)))
+		    (gpg-with-colons `(--list-keys ,pks-fpr)))))
+  (unless (and (= 2 (length fprs))
+	       (string=? pks-subfpr (:fpr (cadr fprs))))
+	  (fail "PKS subkey corruption not repaired")))
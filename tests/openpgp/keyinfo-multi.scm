@@ -0,0 +1,82 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2020 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+(define grip1 "76F7E2B35832976B50A27A282D9B87E44577EB66")
+(define grip2 "A0747D5F9425E6664F4FFBEED20FBCA79FDED2BD")
+(define grip3 "50B2D4FA4122C212611048BC5FC31BD44393626E")
+(define new-grip "0DD40284FF992CD24DC4AAC367037E066FCEE26A")
+(define no-grip "0000000000000000000000000000000000000000")
+
+;; Return the command NAME with the keygrips GRIPS as arguments.
+(define (grip-command name grips)
+  (apply string-append name (map (lambda (grip) (string-append " " grip))
+				 grips)))
+
+;; Send COMMAND to the agent and return the response as list of lines.
+(define (agent-command command)
+  (string-split-newlines
+   (string-rtrim char-whitespace?
+		 (call-popen `(,(tool 'gpg-connect-agent)) command))))
+
+;; Return the keygrips of the KEYINFO status lines of RESPONSE.
+(define (keyinfo-grips response)
+  (map (lambda (line) (caddr (string-split line #\space)))
+       (filter (lambda (line) (string-prefix? line "S KEYINFO "))
+	       response)))
+
+;; Check that KEYINFO --multi for GRIPS returns exactly EXPECTED.
+(define (check-keyinfo-multi grips expected)
+  (let* ((response (agent-command
+		    (grip-command "KEYINFO --multi" grips)))
+	 (found (keyinfo-grips response)))
+    (unless (string=? "OK" (last response))
+	    (fail "KEYINFO --multi failed:" response))
+    (unless (equal? found expected)
+	    (fail "KEYINFO --multi returned" found "instead of" expected))))
+
+;; Check that HAVEKEY for GRIPS succeeds iff AVAILABLE is true.
+(define (check-havekey grips available)
+  (let ((response (agent-command (grip-command "HAVEKEY" grips))))
+    (unless (eq? available (string=? "OK" (last response)))
+	    (fail "Unexpected HAVEKEY result:" response))))
+
+(info "Checking KEYINFO --multi...")
+(check-keyinfo-multi (list grip1 no-grip grip2) (list grip1 grip2))
+(check-keyinfo-multi (list no-grip) '())
+(check-havekey (list no-grip grip3) #t)
+(check-havekey (list no-grip no-grip) #f)
+
+(info "Checking KEYINFO --multi after adding a key...")
+(dearmor (in-srcdir "tests" "openpgp" "privkeys"
+		    (string-append new-grip ".asc"))
+	 (string-append "private-keys-v1.d/" new-grip ".key"))
+(check-keyinfo-multi (list new-grip grip1) (list new-grip grip1))
+
+(info "Checking KEYINFO --multi after removing keys...")
+(unlink (string-append "private-keys-v1.d/" grip1 ".key"))
+(check-keyinfo-multi (list new-grip grip1 grip2) (list new-grip grip2))
+(let ((response (agent-command
+		 (string-append "DELETE_KEY --force " grip2))))
+  (unless (string=? "OK" (last response))
+	  (fail "DELETE_KEY failed:" response)))
+(check-keyinfo-multi (list new-grip grip1 grip2) (list new-grip))
+(check-havekey (list grip1 grip2) #f)
@@ -0,0 +1,79 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2020 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-environment)
+
+(define keystate-file "keystate.dat")
+
+(for-each
+ (lambda (name)
+   (call-check `(,@GPG --import
+		       ,(in-srcdir "tests" "openpgp" "samplekeys" name))))
+ '("whats-new-in-2.1.asc"
+   "E657FB607BB4F21C90BB6651BC067AF28BC90111.asc"
+   "rsa-rsa-sample-1.asc"
+   "authenticate-only.pub.asc"))
+
+;; Return the fingerprints of all primary keys.
+(define (primary-fprs)
+  (let loop ((records (gpg-with-colons '(--list-keys))) (acc '()))
+    (cond
+     ((or (null? records) (null? (cdr records)))
+      (reverse acc))
+     ((and (eq? 'pub (:type (car records)))
+	   (eq? 'fpr (:type (cadr records))))
+      (loop (cddr records) (cons (:fpr (cadr records)) acc)))
+     (else
+      (loop (cdr records) acc)))))
+
+;; Return the key listing and, for each key, the edit menu listing
+;; which also shows the preferences and the primary user id flag.
+(define (listing . extra-args)
+  (cons (call-popen `(,@GPG --with-colons ,@extra-args --list-keys) "")
+	(map (lambda (fpr)
+	       (call-popen `(,@GPG --with-colons ,@extra-args
+				   --command-fd 0 --edit-key ,fpr)
+			   "quit\n"))
+	     (primary-fprs))))
+
+(define (check-listing what expected)
+  (let ((result (listing)))
+    (unless (equal? result expected)
+	    (fail "Listing" what "differs from the freshly merged one:"
+		  result expected))))
+
+;; The reference listing does not use the key state cache.
+(define reference (listing '--no-sig-cache))
+
+(info "Checking the listing while populating the key state cache...")
+(catch '() (unlink keystate-file))
+(check-listing "with an empty cache" reference)
+(unless (file-exists? keystate-file)
+	(fail "The key state cache has not been created"))
+
+(info "Checking the listing restored from the key state cache...")
+(check-listing "from the cache" reference)
+
+(info "Checking that --no-sig-cache ignores a corrupt key state cache...")
+(call-with-output-file keystate-file
+  (lambda (port) (display "not a key state cache" port)))
+(unless (equal? reference (listing '--no-sig-cache))
+	(fail "Listing with --no-sig-cache differs"))
+(check-listing "with a corrupt cache" reference)
@@ -0,0 +1,111 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2020 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+(define my-wd (getcwd))
+(define files (append plain-files data-files))
+(define encrypted-files (map (lambda (name) (string-append name ".gpg"))
+			     files))
+
+(info "Checking encryption using --multifile-workers.")
+(call-check `(,@GPG --encrypt --recipient ,usrname2
+		    --multifile-workers 3 --multifile ,@files))
+(for-each-p
+ "Verifying files:"
+ (lambda (source)
+   (tr:do
+    (tr:open (string-append source ".gpg"))
+    (tr:gpg "" '(--yes --decrypt))
+    (tr:assert-identity source)))
+ files)
+
+;; Decrypt the encrypted files and the files EXTRA, given as arguments
+;; or, if STDIN is true, on stdin, in a new directory using the
+;; options ARGS.  Return the exit status, the decrypted files as list
+;; of file names and whether they match the source, and the
+;; diagnostics.
+(define (decrypt-multifile extra stdin . args)
+  (with-temporary-working-directory
+   (for-each (lambda (name) (file-copy (path-join my-wd name) name))
+	     encrypted-files)
+   (call-with-output-file "garbage.gpg"
+     (lambda (port) (display "This is not an OpenPGP message\n" port)))
+   (let* ((names (append encrypted-files extra))
+	  (result (if stdin
+		      (call-with-io `(,@GPG ,@args --decrypt --multifile)
+				    (apply string-append
+					   (map (lambda (name)
+						  (string-append name "\n"))
+						names)))
+		      (call-with-io `(,@GPG ,@args --decrypt --multifile
+					    ,@names)
+				    ""))))
+     ;; All workers must have finished when the main process returns.
+     (list (:retcode result)
+	   (map (lambda (name)
+		  (list name (and (file-exists? name)
+				  (file=? (path-join my-wd name) name))))
+		files)
+	   (:stderr result)))))
+
+(define serial (decrypt-multifile '() #f))
+(unless (= 0 (car serial))
+	(fail "Decryption using --multifile failed"))
+(unless (equal? (cadr serial) (map (lambda (name) (list name #t)) files))
+	(fail "Files decrypted using --multifile differ:" (cadr serial)))
+
+(for-each-p
+ "Checking decryption using --multifile-workers"
+ (lambda (workers)
+   (for-each
+    (lambda (stdin)
+      (let ((result (decrypt-multifile '() stdin
+				       '--multifile-workers workers)))
+	(unless (= 0 (car result))
+		(fail "Decryption using" workers "workers failed:"
+		      (caddr result)))
+	(unless (equal? (cadr result) (cadr serial))
+		(fail "Files decrypted using" workers "workers differ:"
+		      (cadr result)))))
+    '(#f #t)))
+ ;; More workers than files are limited to the number of files.
+ '("2" "3" "8" "20"))
+
+(info "Checking --multifile-workers with a failing worker.")
+(define failing (decrypt-multifile '("garbage.gpg" "no-such-file.gpg") #f))
+(when (= 0 (car failing))
+      (fail "Decryption of bad files using --multifile did not fail"))
+(for-each
+ (lambda (workers)
+   (let ((result (decrypt-multifile '("garbage.gpg" "no-such-file.gpg") #f
+				    '--multifile-workers workers)))
+     (when (= 0 (car result))
+	   (fail "Decryption of bad files using" workers "workers did not fail"))
+     ;; There are no worker processes on Windows.
+     (when (and (char=? *pathsep* #\:)
+		(not (string-contains? (caddr result) "worker process")))
+	   (fail "The failing worker has not been reported:" (caddr result)))
+     ;; The files of the failing and of the other workers are still
+     ;; processed.
+     (unless (equal? (cadr result) (cadr failing))
+	     (fail "Files decrypted using" workers "workers differ:"
+		   (cadr result)))))
+ '("2" "3"))
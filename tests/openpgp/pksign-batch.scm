@@ -0,0 +1,188 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2020 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+;; An unprotected RSA key and a DSA key protected by a passphrase.
+(define rsa-grip "13FDB8809B17C5547779F9D205C45F47CE0217CE")
+(define protected-grip "50B2D4FA4122C212611048BC5FC31BD44393626E")
+
+;; The digests as lists of the Libgcrypt algorithm number and the
+;; bytes of the digest.
+(define (make-digest algo len seed)
+  (cons algo (let loop ((i 0) (acc '()))
+	       (if (= i len)
+		   (reverse acc)
+		   (loop (+ i 1) (cons (modulo (+ seed (* 7 i)) 256) acc))))))
+(define digests (list (make-digest 8 32 1)	; SHA256
+		      (make-digest 2 20 2)	; SHA1
+		      (make-digest 10 64 3)	; SHA512
+		      (make-digest 8 32 4)))
+
+;; Return the bytes of FILENAME.
+(define (read-bytes filename)
+  (call-with-binary-input-file filename
+    (lambda (port)
+      (let loop ((acc '()))
+	(let ((c (read-char port)))
+	  (if (eof-object? c)
+	      (reverse acc)
+	      (loop (cons (char->integer c) acc))))))))
+
+;; Write the list of BYTES to FILENAME.
+(define (write-bytes filename bytes)
+  (catch '() (unlink filename))
+  (call-with-binary-output-file filename
+    (lambda (port)
+      (for-each (lambda (byte) (write-char (integer->char byte) port))
+		bytes))))
+
+;; Return DIGEST as a record of the DIGESTS inquiry.
+(define (digest-record digest)
+  (cons (car digest) (cons (length (cdr digest)) (cdr digest))))
+
+(define (bytes->hex bytes)
+  (apply string-append
+	 (map (lambda (byte)
+		(string-append (if (< byte 16) "0" "")
+			       (number->string byte 16)))
+	      bytes)))
+
+;; Send the script SCRIPT to the agent and return the final OK or ERR
+;; line of each command.
+(define (agent-script script)
+  (filter (lambda (line) (or (string=? line "OK")
+			     (string-prefix? line "OK ")
+			     (string-prefix? line "ERR ")))
+	  (string-split-newlines
+	   (string-rtrim char-whitespace?
+			 (call-popen `(,(tool 'gpg-connect-agent)) script)))))
+
+;; Split the output of PKSIGN --batch into the signatures.
+(define (split-batch bytes)
+  (let loop ((bytes bytes) (acc '()))
+    (cond
+     ((null? bytes)
+      (reverse acc))
+     ((< (length bytes) 4)
+      (fail "Truncated length in PKSIGN --batch output"))
+     (else
+      (let ((len (+ (* 16777216 (car bytes)) (* 65536 (cadr bytes))
+		    (* 256 (caddr bytes)) (cadddr bytes))))
+	(let take ((bytes (cddddr bytes)) (n len) (sig '()))
+	  (cond
+	   ((= n 0)
+	    (loop bytes (cons (reverse sig) acc)))
+	   ((null? bytes)
+	    (fail "Truncated signature in PKSIGN --batch output"))
+	   (else
+	    (take (cdr bytes) (- n 1) (cons (car bytes) sig))))))))))
+
+(define (check-ok what result)
+  (unless (string-prefix? result "OK")
+	  (fail what "failed:" result)))
+
+(define (check-error what result error)
+  (unless (and (string-prefix? result "ERR ")
+	       (string-contains? result error))
+	  (fail what "did not fail with" error ":" result)))
+
+(info "Checking PKSIGN --batch...")
+(write-bytes "digests" (apply append (map digest-record digests)))
+(let ((response
+       (agent-script
+	(string-append
+	 "/definqfile DIGESTS digests\n"
+	 "/datafile batch.sig\n"
+	 "SIGKEY " rsa-grip "\n"
+	 "PKSIGN --batch\n"
+	 "/datafile\n"
+	 ;; The digest of the batch may not be used by a plain PKSIGN.
+	 "PKSIGN\n"
+	 "/bye\n"))))
+  (unless (= (length response) 2)
+	  (fail "Unexpected response:" response))
+  (check-ok "PKSIGN --batch" (car response))
+  (check-error "PKSIGN without SETHASH" (cadr response) ""))
+
+;; PKCS#1 v1.5 signatures are deterministic; thus the signatures of
+;; the batch verify iff they match those made one at a time, and they
+;; must be in the order of the digests.
+(let ((signatures (split-batch (read-bytes "batch.sig"))))
+  (unless (= (length signatures) (length digests))
+	  (fail "PKSIGN --batch returned" (length signatures)
+		"signatures for" (length digests) "digests"))
+  (for-each
+   (lambda (digest signature)
+     (check-ok "PKSIGN"
+	       (last (agent-script
+		      (string-append
+		       "/datafile single.sig\n"
+		       "SIGKEY " rsa-grip "\n"
+		       "SETHASH " (number->string (car digest)) " "
+		       (bytes->hex (cdr digest)) "\n"
+		       "PKSIGN\n"
+		       "/datafile\n"
+		       "/bye\n"))))
+     (unless (equal? signature (read-bytes "single.sig"))
+	     (fail "Signature of PKSIGN --batch for" (bytes->hex (cdr digest))
+		   "differs from the one of PKSIGN")))
+   digests signatures))
+
+(info "Checking PKSIGN --batch with an empty list...")
+(write-bytes "digests" '())
+(check-error "PKSIGN --batch with an empty list"
+	     (last (agent-script
+		    (string-append
+		     "/definqfile DIGESTS digests\n"
+		     "SIGKEY " rsa-grip "\n"
+		     "PKSIGN --batch\n"
+		     "/bye\n")))
+	     "No data")
+
+;; Forget the passphrase of the protected key so that signing with it
+;; requires the pinentry, which is not available.
+(define (protected-script)
+  (string-append
+   "CLEAR_PASSPHRASE --mode=normal " protected-grip "\n"
+   "OPTION pinentry-mode=error\n"
+   "/definqfile DIGESTS digests\n"
+   "SIGKEY " protected-grip "\n"
+   "PKSIGN --batch\n"
+   "/bye\n"))
+
+(info "Checking PKSIGN --batch with a malformed record...")
+(write-bytes "digests" (digest-record (make-digest 2 20 5)))
+(check-error "PKSIGN --batch with a protected key"
+	     (last (agent-script (protected-script))) "No pinentry")
+(for-each
+ (lambda (bytes)
+   (write-bytes "digests" bytes)
+   (check-error "PKSIGN --batch with a malformed record"
+		(last (agent-script (protected-script))) "Invalid length"))
+ (list
+  ;; A digest length not matching any algorithm.
+  (digest-record (make-digest 8 33 6))
+  ;; A valid record followed by a truncated one.
+  (append (digest-record (make-digest 8 32 7))
+	  (digest-record (make-digest 8 32 8))
+	  '(8))
+  ;; A record claiming more bytes than available.
+  '(8 32 1 2 3 4)))
@@ -0,0 +1,163 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2020 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+(define sigcache-file "sigcache.dat")
+
+;; Return the bytes of FILENAME.
+(define (read-bytes filename)
+  (call-with-binary-input-file filename
+    (lambda (port)
+      (let loop ((acc '()))
+	(let ((c (read-char port)))
+	  (if (eof-object? c)
+	      (reverse acc)
+	      (loop (cons (char->integer c) acc))))))))
+
+;; Write the list of BYTES to FILENAME.
+(define (write-bytes filename bytes)
+  (catch '() (unlink filename))
+  (call-with-binary-output-file filename
+    (lambda (port)
+      (for-each (lambda (byte) (write-char (integer->char byte) port))
+		bytes))))
+
+(define (list-head lst n)
+  (if (= n 0)
+      '()
+      (cons (car lst) (list-head (cdr lst) (- n 1)))))
+
+;; Return the number of keys in the cache file.
+(define (cached-keys)
+  (let ((length (length (read-bytes sigcache-file))))
+    (unless (= 0 (modulo length 32))
+	    (fail "The size of the signature cache is" length))
+    (- (quotient length 32) 1)))
+
+;; Return the value of the field NAME of the statistics line FIELDS.
+(define (stats-field name fields)
+  (let ((prefix (string-append name "=")))
+    (string->number
+     (substring (car (filter (lambda (field) (string-prefix? field prefix))
+			     fields))
+		(string-length prefix)))))
+
+;; Check all key signatures.  Return the listing, the diagnostics, and
+;; the statistics of the signature cache as list of the number of
+;; keys, lookups and hits or #f if the cache has not been used.
+(define (check-sigs . args)
+  ;; The key state cache would skip the checks of the self-signatures
+  ;; when the keyblocks are merged.
+  (catch '() (unlink "keystate.dat"))
+  (let* ((result (call-with-io `(,@GPG --with-colons --debug memstat ,@args
+				       --check-sigs) ""))
+	 (stats (filter (lambda (line) (string-contains? line " sig-cache: "))
+			(string-split-newlines (:stderr result)))))
+    (unless (= 0 (:retcode result))
+	    (fail "--check-sigs failed:" (:stderr result)))
+    (list (:stdout result)
+	  (:stderr result)
+	  (and (not (null? stats))
+	       (let ((fields (string-split (car stats) #\space)))
+		 (map (lambda (name) (stats-field name fields))
+		      '("keys" "lookups" "hits")))))))
+
+;; The listing with each signature verified.
+(define reference (car (check-sigs '--no-sig-cache)))
+
+;; Check the signatures and compare the listing with the reference.
+;; Return the diagnostics and the statistics.
+(define (check-listing what . args)
+  (let ((result (apply check-sigs args)))
+    (unless (string=? (car result) reference)
+	    (fail "Listing" what "differs from the reference"))
+    (cdr result)))
+
+(info "Checking that --no-sig-cache does not create the signature cache...")
+(catch '() (unlink sigcache-file))
+(when (file-exists? sigcache-file)
+      (fail "Could not remove the signature cache"))
+(check-listing "with --no-sig-cache" '--no-sig-cache)
+(when (file-exists? sigcache-file)
+      (fail "The signature cache has been created with --no-sig-cache"))
+
+(info "Checking the signatures while populating the signature cache...")
+(define nkeys
+  (let ((stats (cadr (check-listing "with an empty cache"))))
+    (unless (and stats (< 0 (car stats)))
+	    (fail "No signature has been cached:" stats))
+    (unless (= (car stats) (cached-keys))
+	    (fail "The signature cache has" (cached-keys) "keys instead of"
+		  (car stats)))
+    (car stats)))
+(define valid-cache (read-bytes sigcache-file))
+
+;; Check that the signatures are found in the cache by a new process
+;; and that no further keys are added.
+(define (check-hits what)
+  (let ((stats (cadr (check-listing what))))
+    (unless (and stats (< 0 (caddr stats)))
+	    (fail "No signature has been found in the cache" what ":" stats))
+    (unless (= nkeys (car stats) (cached-keys))
+	    (fail "The signature cache has" (cached-keys) "keys instead of"
+		  nkeys))))
+
+(info "Checking the signatures found in the signature cache...")
+(check-hits "after a restart")
+
+(info "Checking that --no-sig-cache ignores the signature cache...")
+(write-bytes sigcache-file (map char->integer
+				(string->list "not a signature cache")))
+(let ((result (check-listing "with --no-sig-cache" '--no-sig-cache)))
+  (when (cadr result)
+	(fail "The signature cache has been used with --no-sig-cache")))
+(unless (equal? (read-bytes sigcache-file)
+		(map char->integer (string->list "not a signature cache")))
+	(fail "The signature cache has been changed with --no-sig-cache"))
+
+(info "Checking a corrupt signature cache...")
+(unless (string-contains? (car (check-listing "with a corrupt cache"))
+			  "ignoring invalid signature cache")
+	(fail "The corrupt signature cache has not been detected"))
+(check-hits "after replacing a corrupt cache")
+
+(info "Checking a signature cache with a truncated header...")
+(write-bytes sigcache-file (list-head valid-cache 10))
+(unless (string-contains? (car (check-listing "with a truncated header"))
+			  "ignoring invalid signature cache")
+	(fail "The truncated header has not been detected"))
+(check-hits "after replacing a truncated cache")
+
+(info "Checking a signature cache with a truncated record...")
+(write-bytes sigcache-file (list-head valid-cache (+ 32 (* 32 2) 5)))
+(unless (string-contains? (car (check-listing "with a truncated record"))
+			  "is truncated")
+	(fail "The truncated record has not been detected"))
+(check-hits "after rewriting a truncated cache")
+
+(info "Checking a signature cache with unknown keys...")
+;; The bytes of the first two keys in reverse order.
+(write-bytes sigcache-file
+	     (append (list-head valid-cache 32)
+		     (reverse (list-head (list-tail valid-cache 32) 64))))
+(check-listing "with unknown keys")
+(set! nkeys (+ nkeys 2))
+(check-hits "with unknown keys")
@@ -0,0 +1,83 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2020 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "trust-pgp" "common.scm"))
+
+(display "Checking incremental trustdb updates after imports...\n")
+
+(initscenario "scenario1")
+
+;; Export the key KEYFPR to the file NAME.  Any remaining arguments
+;; are passed to GPG.
+(define (export-key keyfpr name . args)
+  (call-check `(,@GPG --yes --output ,name ,@args --export ,keyfpr)))
+
+;; Replace the keys of Bobby and Carol by versions without the
+;; certifications by other keys.
+(export-key BOBBY "bobby-full.gpg")
+(export-key CAROL "carol-full.gpg")
+(export-key BOBBY "bobby-min.gpg" '--export-options "export-minimal")
+(export-key CAROL "carol-min.gpg" '--export-options "export-minimal")
+(call-check `(,@GPG --yes --delete-keys ,BOBBY ,CAROL))
+(call-check `(,@GPG --import "bobby-min.gpg" "carol-min.gpg"))
+(updatetrustdb)
+
+;; Return the validity of all keys and user ids.
+(define (validities . args)
+  (map (lambda (record) (list (:type record) (cadr record)))
+       (filter (lambda (record) (member (:type record) '(pub uid)))
+	       (gpg-with-colons `(,@args --list-keys)))))
+
+;; Check that the current validities match those computed from
+;; scratch using a new trustdb with the same ownertrust values.
+(define (check-against-full-validation)
+  (let ((scratch "trustdb-scratch.gpg")
+	(ownertrust (call-popen `(,@GPG --export-ownertrust) "")))
+    (catch '() (unlink scratch))
+    (call-popen `(,@GPG --trustdb-name ,scratch --import-ownertrust)
+		ownertrust)
+    (call-check `(,@GPG --trustdb-name ,scratch --check-trustdb --yes))
+    (let ((expected (validities '--trustdb-name scratch))
+	  (result (validities)))
+      (unless (equal? result expected)
+	      (fail "Validities" result "differ from" expected)))
+    (unlink scratch)))
+
+;; Import the keys in FILE and run --check-trustdb.  Return its
+;; diagnostic output.
+(define (import-and-check file)
+  (call-check `(,@GPG --import ,file))
+  (:stderr (call-with-io `(,@GPG --check-trustdb --yes) "")))
+
+(check-against-full-validation)
+
+;; The certification of Carol's key by Bobby's key does not make it
+;; valid; thus only Carol's key needs to be revalidated.
+(unless (string-contains? (import-and-check "carol-full.gpg")
+			  "changed key revalidated")
+	(fail "Carol's key has not been revalidated incrementally"))
+(check-against-full-validation)
+
+;; The certification of Bobby's key by Alice's key makes it fully
+;; valid, which changes the validity of the keys signed by Bobby.
+(import-and-check "bobby-full.gpg")
+(check-against-full-validation)
+(checktrust BOBBY "f")
+(checktrust CAROL "q")
+(checktrust DAVID "q")
@@ -0,0 +1,111 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2020 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+(define sources (append plain-files data-files))
+
+;; Create a detached signature for each source, a text mode one for
+;; the first source, and one for a copy of a source with a file name
+;; which needs to be escaped.
+(for-each
+ (lambda (source)
+   (call-popen `(,@GPG --yes --passphrase-fd "0" -sb
+		       --output ,(string-append source ".sig") ,source)
+	       usrpass1))
+ sources)
+(call-popen `(,@GPG --yes --passphrase-fd "0" --textmode -sb
+		    --output ,(string-append (car sources) ".tsig")
+		    ,(car sources))
+	    usrpass1)
+(file-copy (car data-files) "data file%1")
+(call-popen `(,@GPG --yes --passphrase-fd "0" -sb
+		    --output "sig file.sig" "data file%1")
+	    usrpass1)
+
+;; The manifest and the expected result for each entry in order.
+(define manifest
+  (string-append
+   "# A comment and an empty line\n"
+   "\n"
+   (apply string-append
+	  (map (lambda (source)
+		 (string-append source ".sig " source "\n"))
+	       sources))
+   "  " (car sources) ".tsig\t" (car sources) "  \n"
+   "sig%20file.sig data%20file%251\n"
+   "malformed-line-with-one-field\n"
+   (car sources) ".sig " (cadr sources) "\n"
+   "no-such-file.sig " (car sources) "\n"))
+(define expected
+  (append (map (lambda (source) 'GOODSIG) sources)
+	  '(GOODSIG GOODSIG BADSIG FILE_ERROR)))
+
+;; Return the status keywords of the status output STATUS, grouped
+;; by FILE_START and FILE_DONE.  Like --verify-files, an entry whose
+;; signature file cannot be opened ends with FILE_ERROR instead.
+(define (status-groups status)
+  (let loop ((lines (string-split-newlines status)) (group #f) (acc '()))
+    (if (null? lines)
+	(begin
+	  (if group
+	      (fail "Missing FILE_DONE"))
+	  (reverse acc))
+	(let ((keyword (cadr (string-split (car lines) #\space))))
+	  (cond
+	   ((string=? keyword "FILE_START")
+	    (if group
+		(fail "Nested FILE_START"))
+	    (loop (cdr lines) '() acc))
+	   ((or (string=? keyword "FILE_DONE")
+		(string=? keyword "FILE_ERROR"))
+	    (unless group
+		    (fail keyword "without FILE_START"))
+	    (loop (cdr lines) #f
+		  (cons (reverse (cons (string->symbol keyword) group))
+			acc)))
+	   (group
+	    (loop (cdr lines) (cons (string->symbol keyword) group) acc))
+	   (else
+	    (loop (cdr lines) group acc)))))))
+
+;; Return the result of an entry given its status keywords.
+(define (group-result group)
+  (cond
+   ((member 'GOODSIG group) 'GOODSIG)
+   ((member 'BADSIG group) 'BADSIG)
+   ((member 'FILE_ERROR group) 'FILE_ERROR)
+   (else group)))
+
+(define (check-verify-batch . args)
+  (let* ((result (call-with-io `(,@GPG --status-fd=1 ,@args
+				       --verify-batch) manifest))
+	 (results (map group-result (status-groups (:stdout result)))))
+    ;; The malformed line and the bad signature make the command fail.
+    (if (= 0 (:retcode result))
+	(fail "--verify-batch did not fail"))
+    (unless (equal? results expected)
+	    (fail "Unexpected results" results "instead of" expected))))
+
+(info "Checking --verify-batch...")
+(check-verify-batch '--worker-threads "0")
+
+(info "Checking --verify-batch with hashing in parallel...")
+(check-verify-batch '--worker-threads "4")
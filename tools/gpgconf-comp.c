@@ -337,6 +337,7 @@ static known_option_t known_options_gpg_agent[] =
    { "max-cache-ttl", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "max-cache-ttl-ssh", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "ignore-cache-for-signing", GC_OPT_FLAG_RUNTIME, GC_LEVEL_BASIC },
+   { "cache-unprotected-keys", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "allow-emacs-pinentry", GC_OPT_FLAG_RUNTIME, GC_LEVEL_ADVANCED },
    { "grab", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "no-allow-external-cache", GC_OPT_FLAG_RUNTIME, GC_LEVEL_BASIC },